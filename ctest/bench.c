@@ -0,0 +1,672 @@
+/* Micro-benchmarks of the hot paths of SEP on synthetic images.
+ *
+ * Each benchmark is swept over one parameter at a time (image size, source
+ * density, dtype, filter kernel size, deblending thresholds, aperture
+ * radius, subpixel sampling, threads of the batch aperture functions), the
+ * others being held at their defaults.
+ * Results are printed as tab-separated lines:
+ *
+ *   name  params  units  best_us  median_us  [base_us  ratio]
+ *
+ * where times are per unit of work (one call, or one aperture) over several
+ * timed batches. Given the output of an earlier run as a baseline, the
+ * median of each benchmark is also compared with the baseline's, and their
+ * geometric mean ratio printed at the end.
+ *
+ * Usage: bench [-q] [-t SECONDS] [-b BASELINE] [-o OUTPUT] [FILTER]
+ *
+ *   -q        quick run: skip the largest images, shorter timings
+ *   -t        minimum timed duration of each benchmark [0.5]
+ *   -b        compare with this earlier output
+ *   -o        also write the results (without comparison) to this file
+ *   FILTER    only run benchmarks whose name contains this string
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sep.h"
+
+#define NBATCH     5     /* timed batches of each benchmark */
+#define NAPER      1000  /* apertures per aperture benchmark */
+#define BACKLEVEL  100.0 /* flat background of the synthetic images */
+#define NOISE      5.0   /* and its noise */
+#define ALLOC_ERROR 1     /* status of memory allocation errors, as in SEP */
+
+/* defaults of the swept parameters */
+#define DEF_SIZE     1024
+#define DEF_DENSITY  5     /* sources per 100x100 pixels */
+#define DEF_KERNEL   3
+#define DEF_NTHRESH  32
+#define DEF_RADIUS   5.0
+#define DEF_SUBPIX   5
+
+typedef struct
+{
+  /* image */
+  void *im;
+  int dtype;
+  int w, h;
+
+  /* extraction */
+  float *conv;
+  int convw, convh;
+  int nthresh;
+
+  /* apertures */
+  int kind;
+  int n;
+  double *x, *y, *rs;
+  double r;
+  int subpix;
+  int nthreads;
+  double *sum, *sumerr, *area;
+  int *niter;
+  short *flag;
+} benchcase;
+
+typedef int (*benchfunc)(benchcase *);
+
+/* aperture kinds */
+enum {APER_CIRCLE, APER_ELLIPSE, APER_CIRCANN, APER_ELLIPANN,
+      APER_CIRCLE_BATCH, APER_FLUXRAD, APER_WINPOS, APER_WINPOS_BATCH};
+
+static const char *aper_names[] = {"sum_circle", "sum_ellipse",
+				   "sum_circann", "sum_ellipann",
+				   "sum_circle_batch", "flux_radius",
+				   "windowed", "windowed_batch"};
+
+typedef struct
+{
+  int dtype;
+  const char *name;
+  size_t size;
+} dtypeinfo;
+
+static const dtypeinfo dtypes[] = {{SEP_TFLOAT, "float", sizeof(float)},
+				   {SEP_TDOUBLE, "double", sizeof(double)},
+				   {SEP_TINT, "int", sizeof(int)},
+				   {SEP_TSHORT, "int16", sizeof(short)},
+				   {SEP_TUSHORT, "uint16",
+				    sizeof(unsigned short)},
+				   {SEP_TBYTE, "uint8", sizeof(unsigned char)}};
+#define NDTYPES (int)(sizeof(dtypes)/sizeof(dtypes[0]))
+
+/* run options */
+static double mintime = 0.5;
+static int quick = 0;
+static const char *filter = NULL;
+static FILE *outfile = NULL;
+
+/* baseline results */
+static int nbase = 0;
+static char **basekeys = NULL;
+static double *basetimes = NULL;
+static double logratios = 0.0;
+static int nratios = 0;
+
+double now(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/*--------------------------- synthetic images ------------------------------*/
+
+/* portable random numbers, so that all platforms time the same images */
+static unsigned long long rngstate;
+
+double urand(void)
+{
+  rngstate = rngstate*6364136223846793005ULL + 1442695040888963407ULL;
+  return (rngstate >> 11) * (1.0/9007199254740992.0);
+}
+
+double nrand(void)
+{
+  double u1, u2;
+  do u1 = urand(); while (u1 <= 0.0);
+  u2 = urand();
+  return sqrt(-2.0*log(u1)) * cos(6.283185307179586*u2);
+}
+
+/* flat background with noise and gaussian sources, with values clipped to
+ * 0-255 so that they fit all dtypes */
+float *make_image(int w, int h, int density)
+{
+  float *im;
+  double x0, y0, peak, sig, dx, dy, v;
+  int i, n, x, y, xmin, xmax, ymin, ymax;
+
+  if (!(im = (float *)malloc((size_t)w*h*sizeof(float))))
+    return NULL;
+  rngstate = 12345;
+  for (i=0; i<w*h; i++)
+    im[i] = BACKLEVEL + NOISE*nrand();
+
+  n = (int)((double)density*w*h/1e4);
+  for (i=0; i<n; i++)
+    {
+      x0 = w*urand();
+      y0 = h*urand();
+      peak = 10.0 + 140.0*urand();
+      sig = 1.0 + 2.0*urand();
+      xmin = (int)(x0 - 4*sig);
+      xmax = (int)(x0 + 4*sig);
+      ymin = (int)(y0 - 4*sig);
+      ymax = (int)(y0 + 4*sig);
+      for (y=(ymin<0?0:ymin); y<=ymax && y<h; y++)
+	for (x=(xmin<0?0:xmin); x<=xmax && x<w; x++)
+	  {
+	    dx = x - x0;
+	    dy = y - y0;
+	    im[(size_t)y*w+x] += peak*exp(-(dx*dx + dy*dy)/(2*sig*sig));
+	  }
+    }
+
+  for (i=0; i<w*h; i++)
+    {
+      v = im[i];
+      im[i] = v < 0.0? 0.0: (v > 255.0? 255.0: v);
+    }
+  return im;
+}
+
+/* copy of a float image in another dtype */
+void *convert_image(float *im, int npix, const dtypeinfo *dt)
+{
+  void *out;
+  int i;
+
+  if (!(out = malloc((size_t)npix*dt->size)))
+    return NULL;
+  for (i=0; i<npix; i++)
+    switch (dt->dtype)
+      {
+      case SEP_TFLOAT:
+	((float *)out)[i] = im[i];
+	break;
+      case SEP_TDOUBLE:
+	((double *)out)[i] = im[i];
+	break;
+      case SEP_TINT:
+	((int *)out)[i] = (int)(im[i] + 0.5);
+	break;
+      case SEP_TSHORT:
+	((short *)out)[i] = (short)(im[i] + 0.5);
+	break;
+      case SEP_TUSHORT:
+	((unsigned short *)out)[i] = (unsigned short)(im[i] + 0.5);
+	break;
+      default:
+	((unsigned char *)out)[i] = (unsigned char)(im[i] + 0.5);
+      }
+  return out;
+}
+
+/* gaussian kernel of size k x k, or NULL for k = 0 */
+float *make_kernel(int k)
+{
+  float *conv;
+  double sig, dx, dy;
+  int i, j;
+
+  if (k == 0)
+    return NULL;
+  if (!(conv = (float *)malloc(k*k*sizeof(float))))
+    return NULL;
+  sig = k/4.0;
+  for (j=0; j<k; j++)
+    for (i=0; i<k; i++)
+      {
+	dx = i - (k-1)/2.0;
+	dy = j - (k-1)/2.0;
+	conv[j*k+i] = exp(-(dx*dx + dy*dy)/(2*sig*sig));
+      }
+  return conv;
+}
+
+/*------------------------------- benchmarks --------------------------------*/
+
+int bench_makeback(benchcase *bc)
+{
+  sepbackmap *bkmap;
+  int status;
+
+  status = sep_makeback(bc->im, NULL, bc->dtype, 0, bc->w, bc->h, 64, 64,
+			0.0, 3, 3, 0.0, &bkmap);
+  if (status == 0)
+    sep_freeback(bkmap);
+  return status;
+}
+
+/* thresholds are absolute, just above the flat background */
+int bench_extract(benchcase *bc)
+{
+  sepobj *objects;
+  int status, nobj;
+
+  status = sep_extract(bc->im, NULL, bc->dtype, 0, bc->w, bc->h,
+		       BACKLEVEL + 1.5*NOISE, 5, bc->conv, bc->convw,
+		       bc->convh, bc->nthresh, 0.005, 1, 1.0, 0,
+		       &objects, &nobj);
+  if (status == 0)
+    sep_freeobjarray(objects, nobj);
+  return status;
+}
+
+int bench_aper(benchcase *bc)
+{
+  double err, r1, fluxfrac, xw, yw;
+  int i, niter, status;
+
+  err = NOISE;
+  fluxfrac = 0.5;
+  if (bc->kind == APER_CIRCLE_BATCH)
+    return sep_sum_circle_batch(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+				0, bc->w, bc->h, 0.0, 1.0, 0, bc->n, bc->x,
+				bc->y, bc->rs, 1, bc->subpix, bc->nthreads,
+				bc->sum, bc->sumerr, bc->area, bc->flag);
+  if (bc->kind == APER_WINPOS_BATCH)
+    return sep_windowed_batch(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE, 0,
+			      bc->w, bc->h, 0.0, 1.0, 0, bc->n, bc->x, bc->y,
+			      bc->rs, bc->subpix, bc->nthreads, bc->sum,
+			      bc->sumerr, bc->niter, bc->flag);
+
+  status = 0;
+  for (i=0; i<bc->n && status==0; i++)
+    switch (bc->kind)
+      {
+      case APER_CIRCLE:
+	status = sep_sum_circle(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+				0, bc->w, bc->h, 0.0, 1.0, 0, bc->x[i],
+				bc->y[i], bc->r, bc->subpix, bc->sum+i,
+				bc->sumerr+i, bc->area+i, bc->flag+i);
+	break;
+      case APER_ELLIPSE:
+	status = sep_sum_ellipse(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+				 0, bc->w, bc->h, 0.0, 1.0, 0, bc->x[i],
+				 bc->y[i], 1.0, 0.6, 0.5, bc->r, bc->subpix,
+				 bc->sum+i, bc->sumerr+i, bc->area+i,
+				 bc->flag+i);
+	break;
+      case APER_CIRCANN:
+	status = sep_sum_circann(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+				 0, bc->w, bc->h, 0.0, 1.0, 0, bc->x[i],
+				 bc->y[i], 0.5*bc->r, bc->r, bc->subpix,
+				 bc->sum+i, bc->sumerr+i, bc->area+i,
+				 bc->flag+i);
+	break;
+      case APER_ELLIPANN:
+	status = sep_sum_ellipann(bc->im, &err, NULL, bc->dtype,
+				  SEP_TDOUBLE, 0, bc->w, bc->h, 0.0, 1.0, 0,
+				  bc->x[i], bc->y[i], 1.0, 0.6, 0.5,
+				  0.5*bc->r, bc->r, bc->subpix, bc->sum+i,
+				  bc->sumerr+i, bc->area+i, bc->flag+i);
+	break;
+      case APER_FLUXRAD:
+	status = sep_flux_radius(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+				 0, bc->w, bc->h, 0.0, 1.0, 0, bc->x[i],
+				 bc->y[i], bc->r, bc->subpix, NULL,
+				 &fluxfrac, 1, &r1, bc->flag+i);
+	break;
+      case APER_WINPOS:
+	/* radius is that of the window, 4 sigma */
+	status = sep_windowed(bc->im, &err, NULL, bc->dtype, SEP_TDOUBLE,
+			      0, bc->w, bc->h, 0.0, 1.0, 0, bc->x[i],
+			      bc->y[i], bc->r/4.0, bc->subpix, &xw, &yw,
+			      &niter, bc->flag+i, NULL);
+	break;
+      }
+  return status;
+}
+
+/*--------------------------------- timing ----------------------------------*/
+
+int cmpdbl(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y? -1: (x > y);
+}
+
+/* time fn(bc), per unit of nunits, and report it */
+int run(const char *name, const char *params, benchfunc fn, benchcase *bc,
+	int nunits)
+{
+  char key[256];
+  double t0, t, times[NBATCH], base;
+  int i, j, reps, status;
+
+  if (filter && !strstr(name, filter))
+    return 0;
+
+  /* calibrate the repetitions of each batch on one call (also warming up
+   * caches and allocations) */
+  t0 = now();
+  if ((status = fn(bc)))
+    return status;
+  t = now() - t0;
+  reps = (t > 0.0)? (int)(mintime / NBATCH / t): 1000;
+  if (reps < 1)
+    reps = 1;
+
+  for (j=0; j<NBATCH; j++)
+    {
+      t0 = now();
+      for (i=0; i<reps; i++)
+	if ((status = fn(bc)))
+	  return status;
+      times[j] = (now() - t0) / reps / nunits * 1e6;
+    }
+  qsort(times, NBATCH, sizeof(double), cmpdbl);
+
+  printf("%s\t%s\t%d\t%.4g\t%.4g", name, params, nunits, times[0],
+	 times[NBATCH/2]);
+  if (outfile)
+    fprintf(outfile, "%s\t%s\t%d\t%.4g\t%.4g\n", name, params, nunits,
+	    times[0], times[NBATCH/2]);
+
+  /* compare medians with the baseline */
+  snprintf(key, sizeof(key), "%s\t%s", name, params);
+  for (i=0; i<nbase; i++)
+    if (!strcmp(key, basekeys[i]))
+      {
+	base = basetimes[i];
+	printf("\t%.4g\t%.3f", base, times[NBATCH/2] / base);
+	logratios += log(times[NBATCH/2] / base);
+	nratios++;
+	break;
+      }
+  printf("\n");
+  fflush(stdout);
+  return 0;
+}
+
+/* read the keys and median times of an earlier output */
+int read_baseline(const char *fname)
+{
+  FILE *f;
+  char line[512], *tab;
+  double best, med;
+  int nunits, nalloc;
+
+  if (!(f = fopen(fname, "r")))
+    return 1;
+  nalloc = 0;
+  while (fgets(line, sizeof(line), f))
+    {
+      if (line[0] == '#' || !(tab = strchr(line, '\t')) ||
+	  !(tab = strchr(tab+1, '\t')) ||
+	  sscanf(tab+1, "%d %lf %lf", &nunits, &best, &med) != 3)
+	continue;
+      *tab = '\0';
+      if (nbase == nalloc)
+	{
+	  nalloc = nalloc? 2*nalloc: 256;
+	  basekeys = (char **)realloc(basekeys, nalloc*sizeof(char *));
+	  basetimes = (double *)realloc(basetimes, nalloc*sizeof(double));
+	}
+      basekeys[nbase] = strdup(line);
+      basetimes[nbase++] = med;
+    }
+  fclose(f);
+  return 0;
+}
+
+/*---------------------------------- sweeps ---------------------------------*/
+
+/* image of the given size and density in dtype dt, cached between calls */
+void *get_image(int w, int density, const dtypeinfo *dt)
+{
+  static float *im = NULL;
+  static void *conv = NULL;
+  static int imw = 0, imdensity = -1, convdtype = -1;
+
+  if (w != imw || density != imdensity)
+    {
+      free(im);
+      free(conv);
+      conv = NULL;
+      convdtype = -1;
+      if (!(im = make_image(w, w, density)))
+	return NULL;
+      imw = w;
+      imdensity = density;
+    }
+  if (dt->dtype == SEP_TFLOAT)
+    return im;
+  if (dt->dtype != convdtype)
+    {
+      free(conv);
+      if (!(conv = convert_image(im, w*w, dt)))
+	return NULL;
+      convdtype = dt->dtype;
+    }
+  return conv;
+}
+
+/* image benchmarks with the given parameters */
+int run_image(const char *name, benchfunc fn, int size, int density,
+	      const dtypeinfo *dt, int kernel, int nthresh)
+{
+  benchcase bc;
+  char params[128];
+  int status;
+
+  memset(&bc, 0, sizeof(bc));
+  if (!(bc.im = get_image(size, density, dt)))
+    return ALLOC_ERROR;
+  bc.dtype = dt->dtype;
+  bc.w = bc.h = size;
+  bc.conv = make_kernel(kernel);
+  bc.convw = bc.convh = kernel;
+  bc.nthresh = nthresh;
+
+  if (fn == bench_makeback)
+    snprintf(params, sizeof(params), "size=%d dtype=%s", size, dt->name);
+  else
+    snprintf(params, sizeof(params),
+	     "size=%d density=%d dtype=%s kernel=%d nthresh=%d",
+	     size, density, dt->name, kernel, nthresh);
+  status = run(name, params, fn, &bc, 1);
+  free(bc.conv);
+  return status;
+}
+
+/* aperture benchmarks with the given parameters */
+int run_aper(int kind, const dtypeinfo *dt, double r, int subpix,
+	     int nthreads)
+{
+  benchcase bc;
+  char params[128];
+  int i, status;
+
+  memset(&bc, 0, sizeof(bc));
+  if (!(bc.im = get_image(DEF_SIZE, DEF_DENSITY, dt)))
+    return ALLOC_ERROR;
+  bc.dtype = dt->dtype;
+  bc.w = bc.h = DEF_SIZE;
+  bc.kind = kind;
+  bc.n = NAPER;
+  bc.r = r;
+  bc.subpix = subpix;
+  bc.nthreads = nthreads;
+
+  status = ALLOC_ERROR;
+  bc.x = (double *)malloc(NAPER*sizeof(double));
+  bc.y = (double *)malloc(NAPER*sizeof(double));
+  bc.rs = (double *)malloc(NAPER*sizeof(double));
+  bc.sum = (double *)malloc(NAPER*sizeof(double));
+  bc.sumerr = (double *)malloc(NAPER*sizeof(double));
+  bc.area = (double *)malloc(NAPER*sizeof(double));
+  bc.niter = (int *)malloc(NAPER*sizeof(int));
+  bc.flag = (short *)malloc(NAPER*sizeof(short));
+  if (!bc.x || !bc.y || !bc.rs || !bc.sum || !bc.sumerr || !bc.area ||
+      !bc.niter || !bc.flag)
+    goto exit;
+  rngstate = 54321;
+  for (i=0; i<NAPER; i++)
+    {
+      bc.x[i] = 30.0 + (DEF_SIZE - 60.0)*urand();
+      bc.y[i] = 30.0 + (DEF_SIZE - 60.0)*urand();
+      /* windowed_batch: sigma, the radius being 4 sigma */
+      bc.rs[i] = (kind == APER_WINPOS_BATCH)? r/4.0: r;
+    }
+
+  if (kind == APER_CIRCLE_BATCH || kind == APER_WINPOS_BATCH)
+    snprintf(params, sizeof(params), "dtype=%s r=%g subpix=%d threads=%d",
+	     dt->name, r, subpix, nthreads);
+  else
+    snprintf(params, sizeof(params), "dtype=%s r=%g subpix=%d",
+	     dt->name, r, subpix);
+  status = run(aper_names[kind], params, bench_aper, &bc, NAPER);
+
+ exit:
+  free(bc.x);
+  free(bc.y);
+  free(bc.rs);
+  free(bc.sum);
+  free(bc.sumerr);
+  free(bc.area);
+  free(bc.niter);
+  free(bc.flag);
+  return status;
+}
+
+int run_all(void)
+{
+  int sizes[] = {256, 1024, 4096};
+  int densities[] = {1, 5, 20, 50};
+  int kernels[] = {0, 3, 5, 9, 13};
+  int nthreshs[] = {1, 8, 32, 64};
+  double radii[] = {1.0, 3.0, 5.0, 10.0, 20.0};
+  int subpixs[] = {0, 1, 5};
+  const dtypeinfo *def;
+  int i, k, nsizes, status;
+
+  def = dtypes;
+  nsizes = quick? 2: 3;
+
+#define TRY(x) if ((status = (x))) return status
+
+  /* background */
+  for (i=0; i<nsizes; i++)
+    TRY(run_image("makeback", bench_makeback, sizes[i], DEF_DENSITY, def,
+		  0, 0));
+  for (i=1; i<NDTYPES; i++)
+    TRY(run_image("makeback", bench_makeback, DEF_SIZE, DEF_DENSITY,
+		  dtypes+i, 0, 0));
+
+  /* extraction */
+  for (i=0; i<nsizes; i++)
+    TRY(run_image("extract", bench_extract, sizes[i], DEF_DENSITY, def,
+		  DEF_KERNEL, DEF_NTHRESH));
+  for (i=0; i<4; i++)
+    if (densities[i] != DEF_DENSITY)
+      TRY(run_image("extract", bench_extract, DEF_SIZE, densities[i], def,
+		    DEF_KERNEL, DEF_NTHRESH));
+  for (i=1; i<NDTYPES; i++)
+    TRY(run_image("extract", bench_extract, DEF_SIZE, DEF_DENSITY,
+		  dtypes+i, DEF_KERNEL, DEF_NTHRESH));
+  for (i=0; i<5; i++)
+    if (kernels[i] != DEF_KERNEL)
+      TRY(run_image("extract", bench_extract, DEF_SIZE, DEF_DENSITY, def,
+		    kernels[i], DEF_NTHRESH));
+  for (i=0; i<4; i++)
+    if (nthreshs[i] != DEF_NTHRESH)
+      TRY(run_image("extract", bench_extract, DEF_SIZE, DEF_DENSITY, def,
+		    DEF_KERNEL, nthreshs[i]));
+
+  /* apertures: radius x subpix, and dtypes at the defaults. flux_radius()
+   * and windowed() have no exact mode. */
+  for (k=APER_CIRCLE; k<=APER_WINPOS_BATCH; k++)
+    {
+      for (i=0; i<5*3; i++)
+	if (!(subpixs[i%3] == 0 && k >= APER_FLUXRAD))
+	  TRY(run_aper(k, def, radii[i/3], subpixs[i%3], 1));
+      for (i=1; i<NDTYPES; i++)
+	TRY(run_aper(k, dtypes+i, DEF_RADIUS, DEF_SUBPIX, 1));
+    }
+
+  /* threads of batches (only with OpenMP) */
+  for (i=2; i<=8; i*=2)
+    {
+      TRY(run_aper(APER_CIRCLE_BATCH, def, DEF_RADIUS, DEF_SUBPIX, i));
+      TRY(run_aper(APER_WINPOS_BATCH, def, DEF_RADIUS, DEF_SUBPIX, i));
+    }
+
+#undef TRY
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char errtext[512];
+  const char *basename, *outname;
+  int i, status;
+
+  basename = outname = NULL;
+  for (i=1; i<argc; i++)
+    {
+      if (!strcmp(argv[i], "-q"))
+	{
+	  quick = 1;
+	  mintime = 0.1;
+	}
+      else if (!strcmp(argv[i], "-t") && i+1 < argc)
+	mintime = atof(argv[++i]);
+      else if (!strcmp(argv[i], "-b") && i+1 < argc)
+	basename = argv[++i];
+      else if (!strcmp(argv[i], "-o") && i+1 < argc)
+	outname = argv[++i];
+      else if (argv[i][0] != '-' && !filter)
+	filter = argv[i];
+      else
+	{
+	  printf("Usage: bench [-q] [-t SECONDS] [-b BASELINE] [-o OUTPUT] "
+		 "[FILTER]\n");
+	  return 1;
+	}
+    }
+
+  if (basename && read_baseline(basename))
+    {
+      printf("cannot read baseline: %s\n", basename);
+      return 1;
+    }
+  if (outname && !(outfile = fopen(outname, "w")))
+    {
+      printf("cannot write to: %s\n", outname);
+      return 1;
+    }
+
+  printf("# sep version: %s\n", sep_version_string);
+  printf("# name\tparams\tunits\tbest_us\tmedian_us%s\n",
+	 basename? "\tbase_us\tratio": "");
+  if (outfile)
+    fprintf(outfile, "# sep version: %s\n"
+	    "# name\tparams\tunits\tbest_us\tmedian_us\n", sep_version_string);
+
+  status = run_all();
+
+  if (nratios)
+    printf("# geometric mean ratio to baseline over %d benchmarks: %.3f\n",
+	   nratios, exp(logratios / nratios));
+  if (outfile)
+    fclose(outfile);
+  if (status)
+    {
+      sep_get_errmsg(status, errtext);
+      printf("FAILED with status %d: %s\n", status, errtext);
+      sep_get_errdetail(errtext);
+      puts(errtext);
+    }
+  return status;
+}
@@ -214,28 +214,103 @@ float *tile_flt(float *im, int nx, int ny, int ntilex, int ntiley,
   return imout;
 }
 
+/* sep_readline_func reading the lines of a float image in memory */
+typedef struct
+{
+  float *im;
+  int nx;
+} linesource;
+
+int read_line_flt(void *userdata, int y, void *line, void *noiseline)
+{
+  linesource *src = (linesource *)userdata;
+
+  memcpy(line, src->im + (size_t)y*src->nx, src->nx*sizeof(float));
+  return 0;
+}
+
+/* sep_object_func checking the objects against those of sep_extract() */
+typedef struct
+{
+  sepobj *objects;
+  int nobj, n, ndiff;
+} objcheck;
+
+int check_obj(void *userdata, const sepobj *obj)
+{
+  objcheck *chk = (objcheck *)userdata;
+
+  if (chk->n >= chk->nobj || obj->x != chk->objects[chk->n].x ||
+      obj->y != chk->objects[chk->n].y ||
+      obj->npix != chk->objects[chk->n].npix)
+    chk->ndiff++;
+  chk->n++;
+  return 0;
+}
+
 void print_time(char *s, uint64_t tdiff)
 {
   printf("%-25s%6.1f ms\n", s, (double)tdiff / 1000000.);
 }
 
+/* time spent in each stage over the whole run (SEP_STATS builds only) */
+void print_stats(sepstats *st)
+{
+  printf("stage timings (summed over threads):\n");
+  printf("  background: %7.1f ms (stats %.1f, histo %.1f, guess %.1f, "
+	 "filter %.1f, spline %.1f) in %lu tiles\n",
+	 1e3*st->t_back, 1e3*st->t_backstat, 1e3*st->t_backhisto,
+	 1e3*st->t_backguess, 1e3*st->t_backfilter, 1e3*st->t_backspline,
+	 (unsigned long)st->nbacktile);
+  printf("  background evaluation: %7.1f ms\n", 1e3*st->t_backeval);
+  printf("  extraction: %7.1f ms (filter %.1f, deblend %.1f, lutz %.1f, "
+	 "analyse %.1f, clean %.1f, convert %.1f)\n",
+	 1e3*st->t_extract, 1e3*st->t_filter, 1e3*st->t_deblend,
+	 1e3*st->t_lutz, 1e3*st->t_analyse, 1e3*st->t_clean,
+	 1e3*st->t_convert);
+  printf("    %lu pixels, %lu detections, %lu lutz passes, %lu objects, "
+	 "%lu cleaned, pixel stack high-water mark %lu\n",
+	 (unsigned long)st->npix, (unsigned long)st->ndetect,
+	 (unsigned long)st->nlutz, (unsigned long)st->nobj,
+	 (unsigned long)st->ncleaned, (unsigned long)st->pixstack_max);
+  printf("  apertures: %7.1f ms for %lu apertures\n",
+	 1e3*st->t_aper, (unsigned long)st->naper);
+}
+
 int main(int argc, char **argv)
 {
   char *fname1, *fname2, *fname3;
   int i, status, nx, ny;
   double *flux, *fluxerr, *fluxt, *fluxerrt, *area, *areat;
-  short *flag, *flagt;
-  float *im, *imback;
+  double *xs, *ys, *rs, *fluxb, *fluxerrb, flux1, fluxerr1, area1;
+  double *as, *bs, *thetas, *rins, *routs, *rkrons, *kronrads;
+  double cxx, cyy, cxy, kronrad1, xwin1, ywin1;
+  short *flag, *flagt, *flagb, *kronflags, flag1;
+  float *im, *imback, *imback2, *imsub, *imr;
+  unsigned short *imu;
+  int j, padx, niter1, *niters;
   uint64_t t0, t1;
-  sepbackmap *bkmap = NULL;
+  sepbackmap *bkmap = NULL, *bkmap2 = NULL, *bkmap3 = NULL;
+  sepbackmap bkview;
+  void *bkbuf;
+  size_t bksize;
   float conv[] = {1,2,1, 2,4,2, 1,2,1};
-  int nobj = 0;
-  sepobj *objects = NULL;
+  int nobj = 0, nobj2 = 0;
+  sepobj *objects = NULL, *objects2 = NULL;
+  sep_extract_ctx *ctx = NULL;
+  sepmeasplan plan;
+  sepmeas *meas = NULL;
+  sepcatalog *cat = NULL;
+  linesource src;
+  objcheck chk;
   FILE *catout;
+  sepstats stats;
 
   status = 0;
   flux = fluxerr = NULL;
   flag = NULL;
+  imback2 = imsub = imr = NULL;
+  imu = NULL;
 
   /* Parse command-line arguments */
   if (argc != 4)
@@ -262,6 +337,110 @@ int main(int argc, char **argv)
   if (status) goto exit;
   print_time("sep_makeback()", t1-t0);
 
+  /* parallel background estimation should give exactly the same result */
+  t0 = gettime_ns();
+  status = sep_makeback_parallel(im, NULL, SEP_TFLOAT, 0, nx, ny, 64, 64,
+				 0.0, 3, 3, 0.0, 4, &bkmap2);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_makeback_parallel()", t1-t0);
+  for (i=0; i<bkmap->n; i++)
+    if (bkmap2->back[i] != bkmap->back[i] ||
+	bkmap2->sigma[i] != bkmap->sigma[i])
+      break;
+  sep_freeback(bkmap2);
+  if (i != bkmap->n)
+    {
+      printf("sep_makeback_parallel() result differs from sep_makeback()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* so should background estimation from the image read line by line */
+  src.im = im;
+  src.nx = nx;
+  t0 = gettime_ns();
+  status = sep_makeback_stream(read_line_flt, &src, SEP_TFLOAT, 0, nx, ny,
+			       64, 64, 0.0, 3, 3, 0.0, 0, &bkmap2);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_makeback_stream()", t1-t0);
+  for (i=0; i<bkmap->n; i++)
+    if (bkmap2->back[i] != bkmap->back[i] ||
+	bkmap2->sigma[i] != bkmap->sigma[i])
+      break;
+  sep_freeback(bkmap2);
+  if (i != bkmap->n)
+    {
+      printf("sep_makeback_stream() result differs from sep_makeback()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* a uint16 view with padded lines should give the same background and
+   * objects as a float copy of its values */
+  padx = 5;
+  imu = (unsigned short *)malloc((nx+padx)*ny*sizeof(unsigned short));
+  imr = (float *)malloc(nx*ny*sizeof(float));
+  for (j=0; j<ny; j++)
+    for (i=0; i<nx+padx; i++)
+      {
+	imu[j*(nx+padx)+i] = (i >= nx)? 65535:
+	  (im[j*nx+i] < 0.0)? 0: (unsigned short)(im[j*nx+i] + 0.5);
+	if (i < nx)
+	  imr[j*nx+i] = imu[j*(nx+padx)+i];
+      }
+  status = sep_makeback(imr, NULL, SEP_TFLOAT, 0, nx, ny, 64, 64,
+			0.0, 3, 3, 0.0, &bkmap2);
+  if (status) goto exit;
+  t0 = gettime_ns();
+  status = sep_makeback_strided(imu, NULL, SEP_TUSHORT, 0,
+				(nx+padx)*sizeof(unsigned short), 0, nx, ny,
+				64, 64, 0.0, 3, 3, 0.0, 1, &bkmap3);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_makeback_strided() [uint16]", t1-t0);
+  for (i=0; i<bkmap2->n; i++)
+    if (bkmap3->back[i] != bkmap2->back[i] ||
+	bkmap3->sigma[i] != bkmap2->sigma[i])
+      break;
+  sep_freeback(bkmap3);
+  if (i != bkmap2->n)
+    {
+      sep_freeback(bkmap2);
+      printf("sep_makeback_strided() result differs from sep_makeback()\n");
+      status = 1;
+      goto exit;
+    }
+
+  status = sep_extract_ctx_new(&ctx);
+  if (status) goto exit;
+  status = sep_extract(imr, NULL, SEP_TFLOAT, 0, nx, ny,
+		       1.5*bkmap2->globalrms + bkmap2->globalback, 5, conv, 3, 3,
+		       32, 0.005, 1, 1.0, 0, &objects, &nobj);
+  if (status) goto exit;
+  sep_extract_ctx_set_strides(ctx, (nx+padx)*sizeof(unsigned short), 0);
+  status = sep_extract_catalog(ctx, imu, NULL, SEP_TUSHORT, 0, nx, ny,
+			       1.5*bkmap2->globalrms + bkmap2->globalback, 5,
+			       conv, 3, 3, 32, 0.005, 1, 1.0, 0, &cat);
+  sep_extract_ctx_set_strides(ctx, 0, 0);
+  sep_freeback(bkmap2);
+  if (status) goto exit;
+  for (i=0; i<nobj && cat->nobj==nobj; i++)
+    if (cat->x[i] != objects[i].x || cat->y[i] != objects[i].y ||
+	cat->flux[i] != objects[i].flux)
+      break;
+  nobj2 = cat->nobj;
+  sep_freecatalog(cat);
+  sep_freeobjarray(objects, nobj);
+  objects = NULL;
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("strided uint16 extraction differs from sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
 
   /* evaluate background */
   imback = (float *)malloc((nx * ny)*sizeof(float));
@@ -275,12 +454,69 @@ int main(int argc, char **argv)
   write_image_flt(imback, nx, ny, fname3);
 
 
+  /* the background and the subtracted image in one pass, across threads */
+  imback2 = (float *)malloc((nx * ny)*sizeof(float));
+  imsub = (float *)malloc((nx * ny)*sizeof(float));
+  memcpy(imsub, im, (nx * ny)*sizeof(float));
+  t0 = gettime_ns();
+  status = sep_backarrays_parallel(bkmap, imback2, NULL, SEP_TFLOAT,
+				   imsub, SEP_TFLOAT, 4);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_backarrays_parallel()", t1-t0);
+
   /* subtract background */
   t0 = gettime_ns();
   status = sep_subbackarray(bkmap, im, SEP_TFLOAT);
   t1 = gettime_ns();
   if (status) goto exit;
   print_time("sep_subbackarray()", t1-t0);
+  if (memcmp(imback2, imback, (nx * ny)*sizeof(float)) ||
+      memcmp(imsub, im, (nx * ny)*sizeof(float)))
+    {
+      printf("sep_backarrays_parallel() result differs from "
+	     "sep_backarray() and sep_subbackarray()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* the map read back from its serialized form, or used in place, should
+   * give the same background, and so should a window of it */
+  bksize = sep_backmap_size(bkmap);
+  bkbuf = malloc(bksize);
+  bkmap2 = NULL;
+  t0 = gettime_ns();
+  status = sep_backmap_write(bkmap, bkbuf, bksize);
+  if (!status)
+    status = sep_backmap_read(bkbuf, bksize, &bkmap2);
+  t1 = gettime_ns();
+  if (!status)
+    status = sep_backarray(bkmap2, imback2, SEP_TFLOAT);
+  if (!status)
+    status = sep_backmap_view(bkbuf, bksize, &bkview);
+  if (!status)
+    status = sep_backarray(&bkview, imsub, SEP_TFLOAT);
+  if (!status &&
+      (memcmp(imback2, imback, (nx * ny)*sizeof(float)) ||
+       memcmp(imsub, imback, (nx * ny)*sizeof(float))))
+    {
+      printf("background of a serialized map differs\n");
+      status = 1;
+    }
+  if (!status)
+    status = sep_backwindow(&bkview, nx/4, nx/2, ny/3, ny/3 + 20,
+			    imback2, NULL, SEP_TFLOAT);
+  for (j=0; j<20 && !status; j++)
+    if (memcmp(imback2 + j*(nx/2 - nx/4), imback + (ny/3 + j)*nx + nx/4,
+	       (nx/2 - nx/4)*sizeof(float)))
+      {
+	printf("sep_backwindow() result differs from sep_backarray()\n");
+	status = 1;
+      }
+  sep_freeback(bkmap2);
+  free(bkbuf);
+  if (status) goto exit;
+  print_time("sep_backmap_write() + read()", t1-t0);
 
   /* extract sources */
   t0 = gettime_ns();
@@ -291,6 +527,238 @@ int main(int argc, char **argv)
   if (status) goto exit;
   print_time("sep_extract()", t1-t0);
 
+  /* extract sources again, reusing a context across calls */
+  for (i=0; i<2; i++)
+    {
+      t0 = gettime_ns();
+      status = sep_extract_with_ctx(ctx, im, NULL, SEP_TFLOAT, 0, nx, ny,
+				    1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+				    0.005, 1, 1.0, 0, &objects2, &nobj2);
+      t1 = gettime_ns();
+      if (status) goto exit;
+      sep_freeobjarray(objects2, nobj2);
+      if (nobj2 != nobj)
+	{
+	  printf("sep_extract_with_ctx() found %d objects, expected %d\n",
+		 nobj2, nobj);
+	  status = 1;
+	  goto exit;
+	}
+    }
+  print_time("sep_extract_with_ctx()", t1-t0);
+
+  /* parallel extraction should give exactly the same result */
+  t0 = gettime_ns();
+  status = sep_extract_parallel(im, NULL, SEP_TFLOAT, 0, nx, ny,
+				1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+				0.005, 1, 1.0, 0, 4, &objects2, &nobj2);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_extract_parallel()", t1-t0);
+  for (i=0; i<nobj && nobj2==nobj; i++)
+    if (objects2[i].x != objects[i].x || objects2[i].y != objects[i].y ||
+	objects2[i].npix != objects[i].npix)
+      break;
+  sep_freeobjarray(objects2, nobj2);
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("sep_extract_parallel() result differs from sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* ... and so should deblending across threads */
+  sep_extract_ctx_set_nthreads(ctx, 4);
+  t0 = gettime_ns();
+  status = sep_extract_with_ctx(ctx, im, NULL, SEP_TFLOAT, 0, nx, ny,
+				1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+				0.005, 1, 1.0, 0, &objects2, &nobj2);
+  t1 = gettime_ns();
+  sep_extract_ctx_set_nthreads(ctx, 1);
+  if (status) goto exit;
+  print_time("sep_extract_with_ctx() [4 threads]", t1-t0);
+  for (i=0; i<nobj && nobj2==nobj; i++)
+    if (objects2[i].x != objects[i].x || objects2[i].y != objects[i].y ||
+	objects2[i].npix != objects[i].npix)
+      break;
+  sep_freeobjarray(objects2, nobj2);
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("sep_extract_with_ctx() with deblending threads differs from "
+	     "sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* the catalog should hold the same objects and pixels */
+  t0 = gettime_ns();
+  status = sep_extract_catalog(ctx, im, NULL, SEP_TFLOAT, 0, nx, ny,
+			       1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+			       0.005, 1, 1.0, 0, &cat);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_extract_catalog()", t1-t0);
+  for (i=0; i<nobj && cat->nobj==nobj; i++)
+    if (cat->x[i] != objects[i].x || cat->y[i] != objects[i].y ||
+	cat->flux[i] != objects[i].flux ||
+	cat->pixoff[i+1] - cat->pixoff[i] != objects[i].npix ||
+	memcmp(cat->pix + cat->pixoff[i], objects[i].pix,
+	       objects[i].npix*sizeof(int)))
+      break;
+  nobj2 = cat->nobj;
+  sep_freecatalog(cat);
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("sep_extract_catalog() result differs from sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* windows extracted in place should give the objects of copies of them,
+   * in image coordinates */
+  {
+    sepwindow wins[3] = {{20, 180, 30, 150}, {nx-100, nx+50, -20, 90},
+			 {10, 10, 0, 50}};
+    int winoff[4], k, ww, wh, m, px, nw;
+    float *stamp;
+    sepobj *wobjs;
+
+    t0 = gettime_ns();
+    status = sep_extract_windows(ctx, im, NULL, SEP_TFLOAT, 0, nx, ny, 0, 0,
+				 wins, 3, 1.5*bkmap->globalrms, 5, conv, 3, 3,
+				 32, 0.005, 1, 1.0, 0, &objects2, winoff,
+				 &nobj2);
+    t1 = gettime_ns();
+    if (status) goto exit;
+    print_time("sep_extract_windows()", t1-t0);
+    for (k=0; k<3 && !status; k++)
+      {
+	wins[k].xmin = wins[k].xmin > 0? wins[k].xmin: 0;
+	wins[k].xmax = wins[k].xmax < nx? wins[k].xmax: nx;
+	wins[k].ymin = wins[k].ymin > 0? wins[k].ymin: 0;
+	wins[k].ymax = wins[k].ymax < ny? wins[k].ymax: ny;
+	ww = wins[k].xmax - wins[k].xmin;
+	wh = wins[k].ymax - wins[k].ymin;
+	if (ww <= 0)
+	  {
+	    status = (winoff[k+1] != winoff[k]);
+	    continue;
+	  }
+	stamp = (float *)malloc(ww*wh*sizeof(float));
+	for (j=0; j<wh; j++)
+	  memcpy(stamp + j*ww, im + (wins[k].ymin+j)*nx + wins[k].xmin,
+		 ww*sizeof(float));
+	status = sep_extract(stamp, NULL, SEP_TFLOAT, 0, ww, wh,
+			     1.5*bkmap->globalrms, 5, conv, 3, 3, 32, 0.005,
+			     1, 1.0, 0, &wobjs, &nw);
+	free(stamp);
+	if (status) break;
+	status = (nw != winoff[k+1] - winoff[k]);
+	for (i=0; i<nw && !status; i++)
+	  {
+	    m = winoff[k] + i;
+	    status = (objects2[m].x != wobjs[i].x + wins[k].xmin ||
+		      objects2[m].y != wobjs[i].y + wins[k].ymin ||
+		      objects2[m].flux != wobjs[i].flux ||
+		      objects2[m].npix != wobjs[i].npix);
+	    for (j=0; j<wobjs[i].npix && !status; j++)
+	      {
+		px = wobjs[i].pix[j];
+		status = (objects2[m].pix[j] !=
+			  (px%ww + wins[k].xmin) + (px/ww + wins[k].ymin)*nx);
+	      }
+	  }
+	sep_freeobjarray(wobjs, nw);
+      }
+    sep_freeobjarray(objects2, nobj2);
+    if (status)
+      {
+	printf("sep_extract_windows() result differs from sep_extract() of "
+	       "copies\n");
+	status = 1;
+	goto exit;
+      }
+  }
+
+  /* extraction fed line by line should give exactly the same result */
+  src.im = im;
+  src.nx = nx;
+  t0 = gettime_ns();
+  status = sep_extract_stream(ctx, read_line_flt, &src, SEP_TFLOAT, 0, nx, ny,
+			      1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+			      0.005, 1, 1.0, 0, NULL, NULL, &objects2, &nobj2);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_extract_stream()", t1-t0);
+  for (i=0; i<nobj && nobj2==nobj; i++)
+    if (objects2[i].x != objects[i].x || objects2[i].y != objects[i].y ||
+	objects2[i].npix != objects[i].npix)
+      break;
+  sep_freeobjarray(objects2, nobj2);
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("sep_extract_stream() result differs from sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* ... also when passing each object on as soon as it is final */
+  chk.objects = objects;
+  chk.nobj = nobj;
+  chk.n = chk.ndiff = 0;
+  status = sep_extract_stream(ctx, read_line_flt, &src, SEP_TFLOAT, 0, nx, ny,
+			      1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+			      0.005, 1, 1.0, 0, check_obj, &chk,
+			      &objects2, &nobj2);
+  if (status) goto exit;
+  if (nobj2 != nobj || chk.n != nobj || chk.ndiff)
+    {
+      printf("sep_extract_stream() objects passed on differ from "
+	     "sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
+  /* measuring while extracting should give the same objects (those left by
+   * cleaning) and fluxes */
+  sep_measplan_init(&plan);
+  plan.flags = SEP_MEAS_KRON | SEP_MEAS_APER;
+  plan.err = bkmap->globalrms;
+  plan.naper = 1;
+  plan.aper_r[0] = 5.0;
+  t0 = gettime_ns();
+  status = sep_extract_measure(ctx, im, NULL, SEP_TFLOAT, 0, nx, ny,
+			       1.5*bkmap->globalrms, 5, conv, 3, 3, 32,
+			       0.005, 1, 1.0, 0, &plan, &objects2, &meas,
+			       &nobj2);
+  t1 = gettime_ns();
+  if (status) goto exit;
+  print_time("sep_extract_measure()", t1-t0);
+  for (i=0; i<nobj && nobj2==nobj; i++)
+    {
+      if (objects2[i].x != objects[i].x || objects2[i].y != objects[i].y ||
+	  objects2[i].flux != objects[i].flux ||
+	  objects2[i].npix != objects[i].npix ||
+	  memcmp(objects2[i].pix, objects[i].pix,
+		 objects[i].npix*sizeof(int)))
+	break;
+      status = sep_sum_circle(im, &plan.err, NULL, SEP_TFLOAT, SEP_TDOUBLE,
+			      0, nx, ny, 0.0, 0.0, 0, objects[i].x,
+			      objects[i].y, 5.0, 5, &flux1, &fluxerr1, &area1,
+			      &flag1);
+      if (status) goto exit;
+      if (meas[i].flux_aper[0] != flux1 || meas[i].fluxerr_aper[0] != fluxerr1)
+	break;
+    }
+  sep_freeobjarray(objects2, nobj2);
+  free(meas);
+  if (nobj2 != nobj || i != nobj)
+    {
+      printf("sep_extract_measure() result differs from sep_extract()\n");
+      status = 1;
+      goto exit;
+    }
+
   /* aperture photometry */
   fluxt = flux = (double *)malloc(nobj * sizeof(double));
   fluxerrt = fluxerr = (double *)malloc(nobj * sizeof(double));
@@ -306,6 +774,180 @@ int main(int argc, char **argv)
   printf("sep_apercirc() [r= 5.0]  %6.3f us/aperture\n",
 	 (double)(t1 - t0) / 1000. / nobj);
 
+  /* same apertures in one batch */
+  xs = (double *)malloc(nobj * sizeof(double));
+  ys = (double *)malloc(nobj * sizeof(double));
+  rs = (double *)malloc(nobj * sizeof(double));
+  fluxb = (double *)malloc(nobj * sizeof(double));
+  fluxerrb = (double *)malloc(nobj * sizeof(double));
+  flagb = (short *)malloc(nobj * sizeof(short));
+  for (i=0; i<nobj; i++)
+    {
+      xs[i] = objects[i].x;
+      ys[i] = objects[i].y;
+      rs[i] = 5.0;
+    }
+  t0 = gettime_ns();
+  status = sep_sum_circle_batch(im, &(bkmap->globalrms), NULL,
+				SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0, 0,
+				nobj, xs, ys, rs, 1, 5, 0,
+				fluxb, fluxerrb, NULL, flagb);
+  t1 = gettime_ns();
+  for (i=0; i<nobj && !status; i++)
+    if (fluxb[i] != flux[i] || fluxerrb[i] != fluxerr[i] ||
+	flagb[i] != flag[i])
+      {
+	printf("sep_sum_circle_batch() result differs from "
+	       "sep_sum_circle()\n");
+	status = 1;
+      }
+  printf("sep_sum_circle_batch()   %6.3f us/aperture\n",
+	 (double)(t1 - t0) / 1000. / nobj);
+
+  /* ... and through cached weights, centres rounded to 1/16 pixel */
+  t0 = gettime_ns();
+  if (!status)
+    status = sep_sum_circle_batch(im, &(bkmap->globalrms), NULL,
+				  SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0,
+				  SEP_APER_CACHE, nobj, xs, ys, rs, 1, 5, 0,
+				  fluxb, fluxerrb, NULL, flagb);
+  t1 = gettime_ns();
+  for (i=0; i<nobj && !status; i++)
+    {
+      sep_sum_circle(im, &(bkmap->globalrms), NULL,
+		     SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0, 0,
+		     floor(xs[i]*16.0 + 0.5)/16.0, floor(ys[i]*16.0 + 0.5)/16.0,
+		     5.0, 5, &flux1, &fluxerr1, &area1, &flag1);
+      if (fluxb[i] != flux1 || fluxerrb[i] != fluxerr1 || flagb[i] != flag1)
+	{
+	  printf("sep_sum_circle_batch() with SEP_APER_CACHE differs from "
+		 "sep_sum_circle() at rounded centres\n");
+	  status = 1;
+	}
+    }
+  if (!status)
+    printf("sep_sum_circle_batch() [cached] %6.3f us/aperture\n",
+	   (double)(t1 - t0) / 1000. / nobj);
+
+  /* ellipses r = 2 & 3, annulus r = 4-6 and Kron radius within r = 6 of
+   * each object in one pass, against the separate functions */
+  as = (double *)malloc(nobj * sizeof(double));
+  bs = (double *)malloc(nobj * sizeof(double));
+  thetas = (double *)malloc(nobj * sizeof(double));
+  rins = (double *)malloc(nobj * sizeof(double));
+  routs = (double *)malloc(nobj * sizeof(double));
+  rkrons = (double *)malloc(nobj * sizeof(double));
+  kronrads = (double *)malloc(nobj * sizeof(double));
+  kronflags = (short *)malloc(nobj * sizeof(short));
+  free(rs);
+  free(fluxb);
+  free(fluxerrb);
+  free(flagb);
+  rs = (double *)malloc(2 * nobj * sizeof(double));
+  fluxb = (double *)malloc(3 * nobj * sizeof(double));
+  fluxerrb = (double *)malloc(3 * nobj * sizeof(double));
+  flagb = (short *)malloc(3 * nobj * sizeof(short));
+  for (i=0; i<nobj; i++)
+    {
+      as[i] = objects[i].a;
+      bs[i] = objects[i].b;
+      thetas[i] = objects[i].theta;
+      if (thetas[i] > M_PI/2.)
+	thetas[i] = M_PI/2.;
+      if (thetas[i] < -M_PI/2.)
+	thetas[i] = -M_PI/2.;
+      rs[2*i] = 2.0;
+      rs[2*i+1] = 3.0;
+      rins[i] = 4.0;
+      routs[i] = 6.0;
+      rkrons[i] = 6.0;
+    }
+  t0 = gettime_ns();
+  if (!status)
+    status = sep_sum_ellipse_multi(im, &(bkmap->globalrms), NULL,
+				   SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0,
+				   0, nobj, xs, ys, as, bs, thetas, rs, 2,
+				   rins, routs, 1, rkrons, 5, 0,
+				   fluxb, fluxerrb, NULL, flagb,
+				   kronrads, kronflags);
+  t1 = gettime_ns();
+  for (i=0; i<3*nobj && !status; i++)
+    {
+      if (i%3 < 2)
+	sep_sum_ellipse(im, &(bkmap->globalrms), NULL,
+			SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0, 0,
+			xs[i/3], ys[i/3], as[i/3], bs[i/3], thetas[i/3],
+			rs[2*(i/3) + i%3], 5, &flux1, &fluxerr1, &area1, &flag1);
+      else
+	sep_sum_ellipann(im, &(bkmap->globalrms), NULL,
+			 SEP_TFLOAT, SEP_TFLOAT, 0, nx, ny, 0.0, 1.0, 0,
+			 xs[i/3], ys[i/3], as[i/3], bs[i/3], thetas[i/3],
+			 rins[i/3], routs[i/3], 5,
+			 &flux1, &fluxerr1, &area1, &flag1);
+      if (fluxb[i] != flux1 || fluxerrb[i] != fluxerr1 || flagb[i] != flag1)
+	{
+	  printf("sep_sum_ellipse_multi() result differs from "
+		 "sep_sum_ellipse() / sep_sum_ellipann()\n");
+	  status = 1;
+	}
+    }
+  for (i=0; i<nobj && !status; i++)
+    {
+      sep_ellipse_coeffs(as[i], bs[i], thetas[i], &cxx, &cyy, &cxy);
+      sep_kron_radius(im, NULL, SEP_TFLOAT, 0, nx, ny, 0.0, xs[i], ys[i],
+		      cxx, cyy, cxy, rkrons[i], &kronrad1, &flag1);
+      if (kronrads[i] != kronrad1 || kronflags[i] != flag1)
+	{
+	  printf("sep_sum_ellipse_multi() Kron radius differs from "
+		 "sep_kron_radius()\n");
+	  status = 1;
+	}
+    }
+  if (!status)
+    printf("sep_sum_ellipse_multi()  %6.3f us/object\n",
+	   (double)(t1 - t0) / 1000. / nobj);
+
+  /* windowed positions of all objects in one batch, sigma = 2 */
+  niters = (int *)malloc(nobj * sizeof(int));
+  for (i=0; i<nobj; i++)
+    rkrons[i] = 2.0;
+  t0 = gettime_ns();
+  if (!status)
+    status = sep_windowed_batch(im, NULL, NULL, SEP_TFLOAT, 0, 0, nx, ny,
+				0.0, 1.0, 0, nobj, xs, ys, rkrons, 5, 0,
+				fluxb, fluxerrb, niters, flagb);
+  t1 = gettime_ns();
+  for (i=0; i<nobj && !status; i++)
+    {
+      sep_windowed(im, NULL, NULL, SEP_TFLOAT, 0, 0, nx, ny, 0.0, 1.0, 0,
+		   xs[i], ys[i], rkrons[i], 5, &xwin1, &ywin1, &niter1,
+		   &flag1, NULL);
+      if (fluxb[i] != xwin1 || fluxerrb[i] != ywin1 ||
+	  niters[i] != niter1 || flagb[i] != flag1)
+	{
+	  printf("sep_windowed_batch() result differs from sep_windowed()\n");
+	  status = 1;
+	}
+    }
+  free(niters);
+  free(xs);
+  free(ys);
+  free(rs);
+  free(as);
+  free(bs);
+  free(thetas);
+  free(rins);
+  free(routs);
+  free(rkrons);
+  free(kronrads);
+  free(kronflags);
+  free(fluxb);
+  free(fluxerrb);
+  free(flagb);
+  if (status) goto exit;
+  printf("sep_windowed_batch()     %6.3f us/object\n",
+	 (double)(t1 - t0) / 1000. / nobj);
+
   /* print results */
   printf("writing to file: %s\n", fname2);
   catout = fopen(fname2, "w+");
@@ -322,10 +964,18 @@ int main(int argc, char **argv)
     }
   fclose(catout);
 
+  if (sep_get_stats(&stats))
+    print_stats(&stats);
+
   /* clean-up & exit */
  exit:
+  sep_extract_ctx_free(ctx);
   sep_freeback(bkmap);
   free(im);
+  free(imback2);
+  free(imsub);
+  free(imu);
+  free(imr);
   free(flux);
   free(fluxerr);
   free(flag);
@@ -10,6 +10,7 @@ cimport numpy as np
 from libc cimport limits
 cimport cython
 from cpython.mem cimport PyMem_Malloc, PyMem_Free
+from cpython.bytes cimport PyBytes_FromStringAndSize, PyBytes_AS_STRING
 from warnings import warn
 
 np.import_array()  # To access the numpy C-API.
@@ -21,6 +22,8 @@ __version__ = "0.5.dev"
 
 # macro definitions from sep.h
 DEF SEP_TBYTE = 11
+DEF SEP_TUSHORT = 20
+DEF SEP_TSHORT = 21
 DEF SEP_TINT = 31
 DEF SEP_TFLOAT = 42
 DEF SEP_TDOUBLE = 82
@@ -46,7 +49,7 @@ APER_NONPOSITIVE = np.short(0x0080)
 DEF MEMORY_ALLOC_ERROR = 1
 
 # header definitions
-cdef extern from "sep.h":
+cdef extern from "sep.h" nogil:
 
     ctypedef struct sepbackmap:
         int w
@@ -72,6 +75,41 @@ cdef extern from "sep.h":
         short  flag
         int    *pix
 
+    ctypedef struct sepcatalog:
+        int    nobj
+        float  *thresh
+        int    *npix
+        int    *tnpix
+        int    *xmin
+        int    *xmax
+        int    *ymin
+        int    *ymax
+        double *x
+        double *y
+        double *x2
+        double *y2
+        double *xy
+        float  *a
+        float  *b
+        float  *theta
+        float  *cxx
+        float  *cyy
+        float  *cxy
+        float  *cflux
+        float  *flux
+        float  *cpeak
+        float  *peak
+        int    *xcpeak
+        int    *ycpeak
+        int    *xpeak
+        int    *ypeak
+        short  *flag
+        int    *pixoff
+        int    *pix
+
+    ctypedef struct sep_extract_ctx:
+        pass
+
     int sep_makeback(void* im, void *mask,
                      int dtype,
                      int mdtype,
@@ -82,9 +120,28 @@ cdef extern from "sep.h":
                      float fthresh,
                      sepbackmap **bkmap)
 
+    int sep_makeback_strided(void *im, void *mask,
+                             int dtype, int mdtype,
+                             size_t imstride, size_t mstride,
+                             int w, int h,
+                             int bw, int bh,
+                             float mthresh,
+                             int fw, int fh,
+                             float fthresh,
+                             int nthreads,
+                             sepbackmap **bkmap)
+
     int sep_backarray(sepbackmap *bkmap, void *arr, int dtype)
     int sep_backrmsarray(sepbackmap *bkmap, void *arr, int dtype)
     int sep_subbackarray(sepbackmap *bkmap, void *arr, int dtype)
+    int sep_backarrays_parallel(sepbackmap *bkmap, void *back, void *rms,
+                                int dtype, void *sub, int sdtype,
+                                int nthreads)
+    int sep_backwindow(sepbackmap *bkmap, int xmin, int xmax, int ymin,
+                       int ymax, void *back, void *rms, int dtype)
+    size_t sep_backmap_size(const sepbackmap *bkmap)
+    int sep_backmap_write(const sepbackmap *bkmap, void *buf, size_t size)
+    int sep_backmap_read(const void *buf, size_t size, sepbackmap **bkmap)
     void sep_freeback(sepbackmap *bkmap)
 
     int sep_extract(void *image,
@@ -106,6 +163,31 @@ cdef extern from "sep.h":
 
     void sep_freeobjarray(sepobj *objects, int nobj)
 
+    int sep_extract_ctx_new(sep_extract_ctx **ctx)
+    void sep_extract_ctx_free(sep_extract_ctx *ctx)
+    void sep_extract_ctx_set_strides(sep_extract_ctx *ctx,
+                                     size_t imstride, size_t nstride)
+    void sep_extract_ctx_set_nthreads(sep_extract_ctx *ctx, int nthreads)
+
+    int sep_extract_catalog(sep_extract_ctx *ctx,
+                            void *image,
+                            void *noise,
+                            int dtype,
+                            int ndtype,
+                            int w, int h,
+                            float thresh,
+                            int minarea,
+                            float *conv,
+                            int convw, int convh,
+                            int deblend_nthresh,
+                            double deblend_cont,
+                            int clean_flag,
+                            double clean_param,
+                            int use_matched_filter,
+                            sepcatalog **catalog)
+
+    void sep_freecatalog(sepcatalog *catalog)
+
     int sep_sum_circle(void *data, void *error, void *mask,
                        int dtype, int edtype, int mdtype, int w, int h,
                        double maskthresh, double gain, short inflags,
@@ -135,6 +217,57 @@ cdef extern from "sep.h":
                          double *sum, double *sumerr, double *area,
                          short *flag)
 
+    int sep_sum_circle_batch(void *data, void *error, void *mask,
+                             int dtype, int edtype, int mdtype, int w, int h,
+                             double maskthresh, double gain, short inflag,
+                             int n, const double *x, const double *y,
+                             const double *r, int nr, int subpix, int nthreads,
+                             double *sum, double *sumerr, double *area,
+                             short *flag)
+
+    int sep_sum_circann_batch(void *data, void *error, void *mask,
+                              int dtype, int edtype, int mdtype, int w, int h,
+                              double maskthresh, double gain, short inflag,
+                              int n, const double *x, const double *y,
+                              const double *rin, const double *rout, int nr,
+                              int subpix, int nthreads,
+                              double *sum, double *sumerr, double *area,
+                              short *flag)
+
+    int sep_sum_ellipse_batch(void *data, void *error, void *mask,
+                              int dtype, int edtype, int mdtype, int w, int h,
+                              double maskthresh, double gain, short inflag,
+                              int n, const double *x, const double *y,
+                              const double *a, const double *b,
+                              const double *theta, const double *r, int nr,
+                              int subpix, int nthreads,
+                              double *sum, double *sumerr, double *area,
+                              short *flag)
+
+    int sep_sum_ellipann_batch(void *data, void *error, void *mask,
+                               int dtype, int edtype, int mdtype,
+                               int w, int h,
+                               double maskthresh, double gain, short inflag,
+                               int n, const double *x, const double *y,
+                               const double *a, const double *b,
+                               const double *theta, const double *rin,
+                               const double *rout, int nr,
+                               int subpix, int nthreads,
+                               double *sum, double *sumerr, double *area,
+                               short *flag)
+
+    int sep_sum_ellipse_multi(void *data, void *error, void *mask,
+                              int dtype, int edtype, int mdtype, int w, int h,
+                              double maskthresh, double gain, short inflag,
+                              int n, const double *x, const double *y,
+                              const double *a, const double *b,
+                              const double *theta, const double *r, int nr,
+                              const double *rin, const double *rout,
+                              int nann, const double *rkron, int subpix,
+                              int nthreads, double *sum, double *sumerr,
+                              double *area, short *flag,
+                              double *kronrad, short *kronflag)
+
     int sep_flux_radius(void *data, void *error, void *mask,
                         int dtype, int edtype, int mdtype, int w, int h,
                         double maskthresh, double gain, short inflag,
@@ -154,6 +287,14 @@ cdef extern from "sep.h":
                      double *xout, double *yout, int *niter, short *flag,
                      double* extrastats)
 
+    int sep_windowed_batch(void *data, void *error, void *mask,
+                           int dtype, int edtype, int mdtype, int w, int h,
+                           double maskthresh, double gain, short inflag,
+                           int n, const double *x, const double *y,
+                           const double *sig, int subpix, int nthreads,
+                           double *xout,
+                           double *yout, int *niter, short *flag)
+
     int sep_ellipse_axes(double cxx, double cyy, double cxy,
                          double *a, double *b, double *theta)
 
@@ -171,6 +312,34 @@ cdef extern from "sep.h":
     void sep_get_errmsg(int status, char *errtext)
     void sep_get_errdetail(char *errtext)
 
+    ctypedef struct sepstats:
+        double t_extract
+        double t_filter
+        double t_deblend
+        double t_lutz
+        double t_analyse
+        double t_clean
+        double t_convert
+        double t_back
+        double t_backstat
+        double t_backhisto
+        double t_backguess
+        double t_backfilter
+        double t_backspline
+        double t_backeval
+        double t_aper
+        size_t npix
+        size_t ndetect
+        size_t nlutz
+        size_t pixstack_max
+        size_t nobj
+        size_t ncleaned
+        size_t nbacktile
+        size_t naper
+
+    int sep_get_stats(sepstats *stats)
+    void sep_reset_stats()
+
 # -----------------------------------------------------------------------------
 # Utility functions
 
@@ -191,6 +360,10 @@ cdef int _get_sep_dtype(dtype) except -1:
         return SEP_TDOUBLE
     elif t == np.intc:
         return SEP_TINT
+    elif t is np.int16:
+        return SEP_TSHORT
+    elif t is np.uint16:
+        return SEP_TUSHORT
     raise ValueError('input array dtype not supported: {0}'.format(dtype))
 
 
@@ -201,6 +374,27 @@ cdef int _check_array_get_dims(np.ndarray arr, int *w, int *h) except -1:
     if not arr.flags["C_CONTIGUOUS"]:
         raise ValueError("array is not C-contiguous")
 
+    return _get_dims(arr, w, h)
+
+cdef int _check_array_get_stride(np.ndarray arr, int *w, int *h,
+                                 size_t *stride) except -1:
+    """Same as _check_array_get_dims, but also accepting arrays whose rows
+    are contiguous but not adjacent (such as views of larger arrays), and
+    returning the number of bytes between rows (0 if adjacent)"""
+
+    if arr.flags["C_CONTIGUOUS"]:
+        stride[0] = 0
+    elif (arr.ndim == 2 and arr.strides[1] == arr.itemsize and
+          arr.strides[0] >= arr.shape[1] * arr.itemsize):
+        stride[0] = arr.strides[0]
+    else:
+        raise ValueError("array rows are not C-contiguous")
+
+    return _get_dims(arr, w, h)
+
+cdef int _get_dims(np.ndarray arr, int *w, int *h) except -1:
+    """Check that an array is 2-d and return its dimensions"""
+
     # Check that there are exactly 2 dimensions
     if arr.ndim != 2:
         raise ValueError("array must be 2-d")
@@ -300,20 +494,39 @@ cdef int _parse_arrays(np.ndarray data, err, var, mask,
         mbuf = mask.view(dtype=np.uint8)
         mptr[0] = <void*>&mbuf[0, 0]
 
+def _aper_params(*args):
+    """Broadcast aperture parameters against each other. Returns the
+    broadcast shape and the parameters as flat contiguous double arrays,
+    as taken by the batched C aperture functions. Arguments of the full
+    shape are used in place if they are writable (as memoryviews need) and
+    copied otherwise; the others are broadcast into new arrays."""
+    arrs = [np.asarray(arg, dtype=np.double) for arg in args]
+    shape = np.broadcast(*arrs).shape
+    result = []
+    for arr in arrs:
+        if arr.shape == shape:
+            arr = np.require(arr, np.double, ['C', 'W'])
+        else:
+            full = np.empty(shape, np.double)
+            full[...] = arr
+            arr = full
+        result.append(arr.ravel())
+    return shape, result
+
 # -----------------------------------------------------------------------------
 # Background Estimation
 
 cdef class Background:
     """
     Background(data, mask=None, maskthresh=0.0, bw=64, bh=64,
-               fw=3, fh=3, fthresh=0.0)
+               fw=3, fh=3, fthresh=0.0, nthreads=1)
 
     Representation of spatially variable image background and noise.
 
     Parameters
     ----------
     data : 2-d `~numpy.ndarray`
-        Data array.
+        Data array. Its rows must be contiguous but need not be adjacent.
     mask : 2-d `~numpy.ndarray`, optional
         Mask array, optional
     maskthresh : float, optional
@@ -328,6 +541,10 @@ cdef class Background:
         Filter width and height in boxes. Default is 3.
     fthresh : float, optional
         Filter threshold. Default is 0.0.
+    nthreads : int, optional
+        Number of threads estimating rows of boxes concurrently, if SEP is
+        built with OpenMP support (all available threads if 0). Results do
+        not depend on it. Default is 1.
     """
 
     cdef sepbackmap *ptr      # pointer to C struct
@@ -335,43 +552,56 @@ cdef class Background:
 
     @cython.boundscheck(False)
     @cython.wraparound(False)
-    def __cinit__(self, np.ndarray data not None, np.ndarray mask=None,
+    def __cinit__(self, data, np.ndarray mask=None,
                   float maskthresh=0.0, int bw=64, int bh=64,
-                  int fw=3, int fh=3, float fthresh=0.0):
+                  int fw=3, int fh=3, float fthresh=0.0, int nthreads=1):
 
         cdef int w, h, w2, h2, status, sep_dtype, sep_dtype2 
-        cdef np.uint8_t[:, :] buf
-        cdef np.uint8_t[:, :] buf2
+        cdef size_t stride, mstride
+        cdef void *dataptr
         cdef void *maskptr
 
-        _check_array_get_dims(data, &w, &h)
+        # the map is read in by frombytes()
+        if data is _FROMBYTES:
+            return
+        if not isinstance(data, np.ndarray):
+            raise TypeError("data must be a numpy.ndarray")
+
+        # rows need not be adjacent: they are read in place
+        _check_array_get_stride(data, &w, &h, &stride)
         sep_dtype = _get_sep_dtype(data.dtype)
         self.orig_dtype = data.dtype
-        buf = data.view(dtype=np.uint8)
+
+        # the background of 16-bit integer data is returned as float
+        if sep_dtype == SEP_TSHORT or sep_dtype == SEP_TUSHORT:
+            self.orig_dtype = np.dtype(np.float32)
 
         if mask is not None:
-            _check_array_get_dims(mask, &w2, &h2)
+            _check_array_get_stride(mask, &w2, &h2, &mstride)
             if (w != w2) or (h != h2):
                 raise ValueError("dimensions of data and mask must match")
             sep_dtype2 = _get_sep_dtype(mask.dtype)
-            buf2 = mask.view(dtype=np.uint8)
-            maskptr = &buf2[0, 0]
+            maskptr = np.PyArray_DATA(mask)
         else:
             sep_dtype2 = 0  # ignored if mask is NULL
             maskptr = NULL
-
-        status = sep_makeback(&buf[0, 0], maskptr, sep_dtype, sep_dtype2,
-                              w, h, bw, bh, maskthresh, fw, fh, fthresh,
-                              &self.ptr)
+            mstride = 0
+
+        dataptr = np.PyArray_DATA(data)
+        with nogil:
+            status = sep_makeback_strided(dataptr, maskptr, sep_dtype,
+                                          sep_dtype2, stride, mstride, w, h,
+                                          bw, bh, maskthresh, fw, fh, fthresh,
+                                          nthreads, &self.ptr)
         _assert_ok(status)
 
     # Note: all initialization work is done in __cinit__. This is just here
     # for the docstring.
     def __init__(self, np.ndarray data not None, np.ndarray mask=None,
                  float maskthresh=0.0, int bw=64, int bh=64,
-                 int fw=3, int fh=3, float fthresh=0.0):
+                 int fw=3, int fh=3, float fthresh=0.0, int nthreads=1):
         """Background(data, mask=None, maskthresh=0.0, bw=64, bh=64,
-                      fw=3, fh=3, fthresh=0.0)"""
+                      fw=3, fh=3, fthresh=0.0, nthreads=1)"""
         pass
 
     property globalback:
@@ -384,8 +614,8 @@ cdef class Background:
         def __get__(self):
             return self.ptr.globalrms
 
-    def back(self, dtype=None):
-        """back(dtype=None)
+    def back(self, dtype=None, int nthreads=1):
+        """back(dtype=None, nthreads=1)
 
         Create an array of the background.
 
@@ -394,14 +624,19 @@ cdef class Background:
         dtype : `~numpy.dtype`, optional
              Data type of output array. Default is the dtype of the original
              data.
+        nthreads : int, optional
+             Number of threads evaluating lines concurrently, if SEP is
+             built with OpenMP support (all available threads if 0).
+             Default is 1.
 
         Returns
         -------
         back : `~numpy.ndarray`
             Array with same dimensions as original data.
         """
-        cdef int sep_dtype
+        cdef int sep_dtype, status
         cdef np.uint8_t[:, :] buf
+        cdef void *bufptr
 
         if dtype is None:
             dtype = self.orig_dtype
@@ -410,14 +645,17 @@ cdef class Background:
         sep_dtype = _get_sep_dtype(dtype)
 
         result = np.empty((self.ptr.h, self.ptr.w), dtype=dtype)
-        buf = result.view(dtype=np.uint8)        
-        status = sep_backarray(self.ptr, &buf[0, 0], sep_dtype)
+        buf = result.view(dtype=np.uint8)
+        bufptr = &buf[0, 0]
+        with nogil:
+            status = sep_backarrays_parallel(self.ptr, bufptr, NULL,
+                                             sep_dtype, NULL, 0, nthreads)
         _assert_ok(status)
 
         return result
 
-    def rms(self, dtype=None):
-        """rms(dtype=None)
+    def rms(self, dtype=None, int nthreads=1):
+        """rms(dtype=None, nthreads=1)
 
         Create an array of the background rms.
 
@@ -426,14 +664,19 @@ cdef class Background:
         dtype : `~numpy.dtype`, optional
              Data type of output array. Default is the dtype of the original
              data.
+        nthreads : int, optional
+             Number of threads evaluating lines concurrently, if SEP is
+             built with OpenMP support (all available threads if 0).
+             Default is 1.
 
         Returns
         -------
         rms : `~numpy.ndarray`
             Array with same dimensions as original data.
         """
-        cdef int sep_dtype
+        cdef int sep_dtype, status
         cdef np.uint8_t[:, :] buf
+        cdef void *bufptr
 
         if dtype is None:
             dtype = self.orig_dtype
@@ -442,15 +685,18 @@ cdef class Background:
         sep_dtype = _get_sep_dtype(dtype)
 
         result = np.empty((self.ptr.h, self.ptr.w), dtype=dtype)
-        buf = result.view(dtype=np.uint8)        
-        status = sep_backrmsarray(self.ptr, &buf[0, 0], sep_dtype)
+        buf = result.view(dtype=np.uint8)
+        bufptr = &buf[0, 0]
+        with nogil:
+            status = sep_backarrays_parallel(self.ptr, NULL, bufptr,
+                                             sep_dtype, NULL, 0, nthreads)
         _assert_ok(status)
 
         return result
 
 
-    def subfrom(self, np.ndarray data not None):
-        """subfrom(data)
+    def subfrom(self, np.ndarray data not None, int nthreads=1):
+        """subfrom(data, nthreads=1)
 
         Subtract the background from an existing array.
 
@@ -459,10 +705,15 @@ cdef class Background:
         data : `~numpy.ndarray`
             Input array, which will be updated in-place. Shape must match
             that of the original image used to measure the background. 
+        nthreads : int, optional
+            Number of threads subtracting lines concurrently, if SEP is
+            built with OpenMP support (all available threads if 0).
+            Default is 1.
         """
 
         cdef int w, h, status, sep_dtype
         cdef np.uint8_t[:, :] buf
+        cdef void *bufptr
 
         assert self.ptr is not NULL
 
@@ -475,13 +726,137 @@ cdef class Background:
             raise ValueError("Data dimensions do not match background "
                              "dimensions")
 
-        status = sep_subbackarray(self.ptr, &buf[0, 0], sep_dtype)
+        bufptr = &buf[0, 0]
+        with nogil:
+            status = sep_backarrays_parallel(self.ptr, NULL, NULL,
+                                             SEP_TFLOAT, bufptr, sep_dtype,
+                                             nthreads)
+        _assert_ok(status)
+
+    def window(self, int xmin, int xmax, int ymin, int ymax, dtype=None):
+        """window(xmin, xmax, ymin, ymax, dtype=None)
+
+        Evaluate the background and rms of the pixels ``xmin <= x < xmax``,
+        ``ymin <= y < ymax`` only, with the values of
+        ``back()[ymin:ymax, xmin:xmax]`` and ``rms()[ymin:ymax, xmin:xmax]``.
+
+        Parameters
+        ----------
+        xmin, xmax, ymin, ymax : int
+             Window, within the image.
+        dtype : `~numpy.dtype`, optional
+             Data type of output arrays. Default is the dtype of the
+             original data.
+
+        Returns
+        -------
+        back, rms : `~numpy.ndarray`
+            Arrays of shape ``(ymax-ymin, xmax-xmin)``.
+        """
+        cdef int sep_dtype, status
+        cdef np.uint8_t[:, :] bbuf, rbuf
+        cdef void *bptr
+        cdef void *rptr
+
+        if not (0 <= xmin <= xmax <= self.ptr.w and
+                0 <= ymin <= ymax <= self.ptr.h):
+            raise ValueError("window not within the image")
+        if dtype is None:
+            dtype = self.orig_dtype
+        else:
+            dtype = np.dtype(dtype)
+        sep_dtype = _get_sep_dtype(dtype)
+
+        back = np.empty((ymax - ymin, xmax - xmin), dtype=dtype)
+        rms = np.empty((ymax - ymin, xmax - xmin), dtype=dtype)
+        if back.size == 0:
+            return back, rms
+        bbuf = back.view(dtype=np.uint8)
+        rbuf = rms.view(dtype=np.uint8)
+        bptr = &bbuf[0, 0]
+        rptr = &rbuf[0, 0]
+        with nogil:
+            status = sep_backwindow(self.ptr, xmin, xmax, ymin, ymax, bptr,
+                                    rptr, sep_dtype)
+        _assert_ok(status)
+
+        return back, rms
+
+    def tobytes(self):
+        """tobytes()
+
+        Serialize the background map: the tile grid, the global values and
+        the nodes of the background and rms splines, a few bytes per tile
+        rather than per pixel. Load it back with `Background.frombytes`.
+        Backgrounds can also be pickled.
+
+        Returns
+        -------
+        buf : bytes
+        """
+        cdef size_t size
+        cdef int status
+        cdef bytes buf
+
+        # written in place: the new object is not shared yet
+        size = sep_backmap_size(self.ptr)
+        buf = PyBytes_FromStringAndSize(NULL, size)
+        status = sep_backmap_write(self.ptr, PyBytes_AS_STRING(buf), size)
+        _assert_ok(status)
+        return buf
+
+    @staticmethod
+    def frombytes(buf, dtype=np.float32):
+        """frombytes(buf, dtype=np.float32)
+
+        Load a background map serialized by `tobytes`, from any object
+        supporting the buffer protocol, such as `bytes` or `mmap.mmap`.
+        Only the map is read: `back()`, `rms()` and `window()` evaluate it
+        as for the original `Background`, with the same results.
+
+        Parameters
+        ----------
+        buf : buffer
+            Serialized background map.
+        dtype : `~numpy.dtype`, optional
+            Default data type of the arrays returned (that of the original
+            data is not saved). Default is float32.
+
+        Returns
+        -------
+        bkg : `Background`
+        """
+        cdef Background bkg
+        cdef np.ndarray arr
+        cdef void *ptr
+        cdef size_t size
+        cdef int status
+
+        arr = np.frombuffer(buf, dtype=np.uint8)
+        ptr = np.PyArray_DATA(arr)
+        size = arr.shape[0]
+        bkg = Background.__new__(Background, _FROMBYTES)
+        bkg.orig_dtype = np.dtype(dtype)
+        with nogil:
+            status = sep_backmap_read(ptr, size, &bkg.ptr)
         _assert_ok(status)
+        return bkg
+
+    def __reduce__(self):
+        return (_background_frombytes, (self.tobytes(), self.orig_dtype))
 
     def __dealloc__(self):
         if self.ptr is not NULL:
             sep_freeback(self.ptr)
 
+
+# passed to Background() by Background.frombytes() for an empty object
+_FROMBYTES = object()
+
+def _background_frombytes(buf, dtype):
+    """Unpickle a Background."""
+    return Background.frombytes(buf, dtype)
+
 # -----------------------------------------------------------------------------
 # Source Extraction
 
@@ -523,17 +898,19 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
             int minarea=5,
             np.ndarray conv=default_conv, int deblend_nthresh=32,
             double deblend_cont=0.005, bint clean=True,
-            double clean_param=1.0, bint use_matched_filter=False):
+            double clean_param=1.0, bint use_matched_filter=False,
+            int nthreads=1):
     """extract(data, thresh, err=None, minarea=5, conv=default_conv,
                deblend_nthresh=32, deblend_cont=0.005, clean=True,
-               clean_param=1.0)
+               clean_param=1.0, use_matched_filter=False, nthreads=1)
 
     Extract sources from an image.
 
     Parameters
     ----------
     data : `~numpy.ndarray`
-        Data array (2-d).
+        Data array (2-d). Its rows must be contiguous but need not be
+        adjacent, so that views of larger arrays are read without copying.
     thresh : float
         Threshold pixel value for detection. If an ``err`` array is not given,
         this is interpreted as an absolute threshold. If ``err`` is
@@ -562,6 +939,10 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
         determine if a given pixel is above the threshold. This can yield
         better detection of faint sources in areas of rapidly varying noise
         (such as found in coadded images made from semi-overlapping exposures).
+    nthreads : int, optional
+        Number of threads deblending detections concurrently, if SEP is
+        built with OpenMP support (all available threads if 0). The objects
+        found do not depend on it. Default is 1.
 
     Returns
     -------
@@ -587,26 +968,30 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
 
     """
 
-    cdef int w, h, convw, convh, status, sep_dtype, nobj, i
-    cdef np.uint8_t[:, :] buf
-    cdef np.uint8_t[:, :] noise_buf
-    cdef sepobj *objects
+    cdef int w, h, ew, eh, convw, convh, status, sep_dtype, nobj, i
+    cdef size_t stride, nstride
+    cdef sep_extract_ctx *ctx
+    cdef sepcatalog *cat
     cdef np.ndarray[Object] result
     cdef float[:, :] convflt
     cdef float *convptr
-    cdef np.uint8_t *noise_ptr
-    cdef int noise_dtype
+    cdef void *data_ptr
+    cdef void *noise_ptr
+    cdef int noise_dtype, clean_flag, matched
 
-    _check_array_get_dims(data, &w, &h)
+    # rows need not be adjacent: they are read in place
+    _check_array_get_stride(data, &w, &h, &stride)
     sep_dtype = _get_sep_dtype(data.dtype)
-    buf = data.view(dtype=np.uint8)
 
     if err is None:
         noise_ptr = NULL
         noise_dtype = 0
+        nstride = 0
     else:
-        noise_buf = err.view(dtype=np.uint8)
-        noise_ptr = &noise_buf[0,0]
+        _check_array_get_stride(err, &ew, &eh, &nstride)
+        if ew != w or eh != h:
+            raise ValueError("size of err array must match data")
+        noise_ptr = np.PyArray_DATA(err)
         noise_dtype = _get_sep_dtype(err.dtype)
 
     # Parse convolution input
@@ -620,11 +1005,22 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
         convw = convflt.shape[1]
         convh = convflt.shape[0]
 
-    status = sep_extract(&buf[0,0], noise_ptr, sep_dtype, noise_dtype, w, h,
-                         thresh, minarea, convptr, convw, convh,
-                         deblend_nthresh, deblend_cont, clean, clean_param,
-                         use_matched_filter, &objects, &nobj)
+    status = sep_extract_ctx_new(&ctx)
+    _assert_ok(status)
+    sep_extract_ctx_set_strides(ctx, stride, nstride)
+    sep_extract_ctx_set_nthreads(ctx, nthreads)
+    data_ptr = np.PyArray_DATA(data)
+    clean_flag = clean
+    matched = use_matched_filter
+    with nogil:
+        status = sep_extract_catalog(ctx, data_ptr, noise_ptr, sep_dtype,
+                                     noise_dtype, w, h, thresh, minarea,
+                                     convptr, convw, convh, deblend_nthresh,
+                                     deblend_cont, clean_flag, clean_param,
+                                     matched, &cat)
+        sep_extract_ctx_free(ctx)
     _assert_ok(status)
+    nobj = cat.nobj
 
     # Allocate result record array and fill it
     result = np.empty(nobj, dtype=np.dtype([('thresh', np.float64),
@@ -655,37 +1051,40 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
                                             ('ypeak', np.int),
                                             ('flag', np.int)]))
 
-    for i in range(nobj):
-        result['thresh'][i] = objects[i].thresh
-        result['npix'][i] = objects[i].npix
-        result['tnpix'][i] = objects[i].tnpix
-        result['xmin'][i] = objects[i].xmin
-        result['xmax'][i] = objects[i].xmax
-        result['ymin'][i] = objects[i].ymin
-        result['ymax'][i] = objects[i].ymax
-        result['x'][i] = objects[i].x
-        result['y'][i] = objects[i].y
-        result['x2'][i] = objects[i].x2
-        result['y2'][i] = objects[i].y2
-        result['xy'][i] = objects[i].xy
-        result['a'][i] = objects[i].a
-        result['b'][i] = objects[i].b
-        result['theta'][i] = objects[i].theta
-        result['cxx'][i] = objects[i].cxx
-        result['cyy'][i] = objects[i].cyy
-        result['cxy'][i] = objects[i].cxy
-        result['cflux'][i] = objects[i].cflux
-        result['flux'][i] = objects[i].flux
-        result['cpeak'][i] = objects[i].cpeak
-        result['peak'][i] = objects[i].peak
-        result['xcpeak'][i] = objects[i].xcpeak
-        result['ycpeak'][i] = objects[i].ycpeak
-        result['xpeak'][i] = objects[i].xpeak
-        result['ypeak'][i] = objects[i].ypeak
-        result['flag'][i] = objects[i].flag
-
-    # Free C array
-    sep_freeobjarray(objects, nobj)
+    # Fill it a column at a time from the columns of the catalog; the
+    # cython arrays are views of the C columns, so no per-object work is
+    # done in Python.
+    if nobj > 0:
+        result['thresh'] = <float[:nobj]>cat.thresh
+        result['npix'] = <int[:nobj]>cat.npix
+        result['tnpix'] = <int[:nobj]>cat.tnpix
+        result['xmin'] = <int[:nobj]>cat.xmin
+        result['xmax'] = <int[:nobj]>cat.xmax
+        result['ymin'] = <int[:nobj]>cat.ymin
+        result['ymax'] = <int[:nobj]>cat.ymax
+        result['x'] = <double[:nobj]>cat.x
+        result['y'] = <double[:nobj]>cat.y
+        result['x2'] = <double[:nobj]>cat.x2
+        result['y2'] = <double[:nobj]>cat.y2
+        result['xy'] = <double[:nobj]>cat.xy
+        result['a'] = <float[:nobj]>cat.a
+        result['b'] = <float[:nobj]>cat.b
+        result['theta'] = <float[:nobj]>cat.theta
+        result['cxx'] = <float[:nobj]>cat.cxx
+        result['cyy'] = <float[:nobj]>cat.cyy
+        result['cxy'] = <float[:nobj]>cat.cxy
+        result['cflux'] = <float[:nobj]>cat.cflux
+        result['flux'] = <float[:nobj]>cat.flux
+        result['cpeak'] = <float[:nobj]>cat.cpeak
+        result['peak'] = <float[:nobj]>cat.peak
+        result['xcpeak'] = <int[:nobj]>cat.xcpeak
+        result['ycpeak'] = <int[:nobj]>cat.ycpeak
+        result['xpeak'] = <int[:nobj]>cat.xpeak
+        result['ypeak'] = <int[:nobj]>cat.ypeak
+        result['flag'] = <short[:nobj]>cat.flag
+
+    # Free C catalog
+    sep_freecatalog(cat)
 
     return result
 
@@ -696,9 +1095,10 @@ def extract(np.ndarray data not None, float thresh, np.ndarray err=None,
 @cython.wraparound(False)
 def sum_circle(np.ndarray data not None, x, y, r,
                var=None, err=None, gain=None, np.ndarray mask=None,
-               double maskthresh=0.0, bkgann=None, int subpix=5):
+               double maskthresh=0.0, bkgann=None, int subpix=5,
+               int nthreads=1):
     """sum_circle(data, x, y, r, err=None, var=None, mask=None, maskthresh=0.0,
-                  bkgann=None, gain=None, subpix=5)
+                  bkgann=None, gain=None, subpix=5, nthreads=1)
 
     Sum data in circular aperture(s).
 
@@ -740,6 +1140,11 @@ def sum_circle(np.ndarray data not None, x, y, r,
         Subpixel sampling factor. If 0, exact overlap is calculated.
         Default is 5.
 
+    nthreads : int, optional
+        Number of threads summing apertures concurrently, if SEP is built
+        with OpenMP support (all available threads if 0). Results do not
+        depend on it. Default is 1.
+
     Returns
     -------
     sum : `~numpy.ndarray`
@@ -752,17 +1157,16 @@ def sum_circle(np.ndarray data not None, x, y, r,
         Integer giving flags. (0 if no flags set.)
     """
 
-    cdef double flux1, fluxerr1, area1,
-    cdef double bkgflux, bkgfluxerr, bkgarea, gain_
+    cdef double gain_
     cdef float scalarerr
-    cdef short flag1, bkgflag
     cdef short inflag
-    cdef size_t i
-    cdef int w, h, dtype, edtype, mdtype, status
+    cdef int n, w, h, dtype, edtype, mdtype, status
     cdef void *ptr
     cdef void *eptr
     cdef void *mptr
-    cdef np.broadcast it
+    cdef double[::1] xv, yv, rv, rinv, routv, sumv, sumerrv, areav
+    cdef double[::1] bsumv, bsumerrv, bareav
+    cdef short[::1] flagv, bflagv
 
     dtype = 0
     edtype = 0
@@ -782,100 +1186,60 @@ def sum_circle(np.ndarray data not None, x, y, r,
     if gain is not None:
         gain_ = gain
 
-    # Require that inputs are float64 arrays. This has to be done because we
-    # are using a broadcasting iterator below, where we need to know the type
-    # in advance. There are other ways to do this, e.g., using NpyIter_Multi
-    # in the numpy C-API. However, the best way to use this from cython
-    # is not clear to me at this time.
-    #
-    # docs.scipy.org/doc/numpy/reference/c-api.iterator.html#NpyIter_MultiNew
-    dt = np.dtype(np.double)
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
-    r = np.require(r, dtype=dt)
-
     if bkgann is None:
-
-        # allocate ouput arrays
-        shape = np.broadcast(x, y, r).shape
-        sum = np.empty(shape, dt)
-        sumerr = np.empty(shape, dt)
-        flag = np.empty(shape, np.short)
-
-        it = np.broadcast(x, y, r, sum, sumerr, flag)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            status = sep_sum_circle(
-                ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                subpix,
-                <double*>np.PyArray_MultiIter_DATA(it, 3),
-                <double*>np.PyArray_MultiIter_DATA(it, 4),
-                &area1,
-                <short*>np.PyArray_MultiIter_DATA(it, 5))
-            _assert_ok(status)
-
-            # Advance the iterator
-            np.PyArray_MultiIter_NEXT(it)
-
-        return sum, sumerr, flag
-
+        shape, (x, y, r) = _aper_params(x, y, r)
     else:
         rin, rout = bkgann
+        shape, (x, y, r, rin, rout) = _aper_params(x, y, r, rin, rout)
 
-        # Require float arrays (see note above)
-        rin = np.require(rin, dtype=dt)
-        rout = np.require(rout, dtype=dt)
-
-        # allocate ouput arrays
-        shape = np.broadcast(x, y, r, rin, rout).shape
-        sum = np.empty(shape, dt)
-        sumerr = np.empty(shape, dt)
-        flag = np.empty(shape, np.short)
+    # allocate ouput arrays
+    n = len(x)
+    sum = np.empty(n, np.double)
+    sumerr = np.empty(n, np.double)
+    area = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    if n == 0:
+        return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
+
+    xv, yv, rv = x, y, r
+    sumv, sumerrv, areav, flagv = sum, sumerr, area, flag
+    with nogil:
+        status = sep_sum_circle_batch(
+            ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
+            maskthresh, gain_, inflag, n, &xv[0], &yv[0], &rv[0], 1,
+            subpix, nthreads, &sumv[0], &sumerrv[0], &areav[0], &flagv[0])
+    _assert_ok(status)
 
-        it = np.broadcast(x, y, r, rin, rout, sum, sumerr, flag)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            status = sep_sum_circle(
-                ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                subpix, &flux1, &fluxerr1, &area1, &flag1)
-            _assert_ok(status)
-                
-            # background subtraction
-            # Note that background output flags are not used.
-            status = sep_sum_circann(
+    if bkgann is not None:
+        # background subtraction
+        # Note that background output flags are not used.
+        bkgflux = np.empty(n, np.double)
+        bkgfluxerr = np.empty(n, np.double)
+        bkgarea = np.empty(n, np.double)
+        bkgflag = np.empty(n, np.short)
+        rinv, routv = rin, rout
+        bsumv, bsumerrv, bareav, bflagv = bkgflux, bkgfluxerr, bkgarea, bkgflag
+        with nogil:
+            status = sep_sum_circann_batch(
                 ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag | SEP_MASK_IGNORE,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                1, &bkgflux, &bkgfluxerr, &bkgarea, &bkgflag)
-            _assert_ok(status)
-
-            flux1 -= bkgflux / bkgarea * area1
-            bkgfluxerr = bkgfluxerr / bkgarea * area1
-            fluxerr1 = fluxerr1*fluxerr1 + bkgfluxerr*bkgfluxerr
-            (<double*>np.PyArray_MultiIter_DATA(it, 5))[0] = flux1
-            (<double*>np.PyArray_MultiIter_DATA(it, 6))[0] = fluxerr1
-            (<short*>np.PyArray_MultiIter_DATA(it, 7))[0] = flag1
+                maskthresh, gain_, inflag | SEP_MASK_IGNORE, n,
+                &xv[0], &yv[0], &rinv[0], &routv[0], 1, 1, nthreads,
+                &bsumv[0], &bsumerrv[0], &bareav[0], &bflagv[0])
+        _assert_ok(status)
 
-            np.PyArray_MultiIter_NEXT(it)
+        sum -= bkgflux / bkgarea * area
+        bkgfluxerr = bkgfluxerr / bkgarea * area
+        sumerr = sumerr*sumerr + bkgfluxerr*bkgfluxerr
 
-        return sum, sumerr, flag
+    return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
 def sum_circann(np.ndarray data not None, x, y, rin, rout,
                 var=None, err=None, gain=None, np.ndarray mask=None,
-                double maskthresh=0.0, int subpix=5):
+                double maskthresh=0.0, int subpix=5, int nthreads=1):
     """sum_circann(data, x, y, rin, rout, err=None, var=None, mask=None,
-                   maskthresh=0.0, gain=None, subpix=5)
+                   maskthresh=0.0, gain=None, subpix=5, nthreads=1)
 
     Sum data in circular annular aperture(s).
 
@@ -910,6 +1274,11 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
     subpix : int, optional
         Subpixel sampling factor. Default is 5.
 
+    nthreads : int, optional
+        Number of threads summing apertures concurrently, if SEP is built
+        with OpenMP support (all available threads if 0). Results do not
+        depend on it. Default is 1.
+
     Returns
     -------
     sum : `~numpy.ndarray`
@@ -922,15 +1291,15 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
         Integer giving flags. (0 if no flags set.)
     """
 
-    cdef double area1, gain_
+    cdef double gain_
     cdef float scalarerr
     cdef short inflag
-    cdef size_t i
-    cdef int w, h, dtype, edtype, mdtype, status
+    cdef int n, w, h, dtype, edtype, mdtype, status
     cdef void *ptr
     cdef void *eptr
     cdef void *mptr
-    cdef np.broadcast it
+    cdef double[::1] xv, yv, rinv, routv, sumv, sumerrv
+    cdef short[::1] flagv
 
     dtype = 0
     edtype = 0
@@ -941,7 +1310,6 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
     eptr = NULL
     mptr = NULL
     scalarerr = 0.0
-    area1 = 0.0
     inflag = 0
     _parse_arrays(data, err, var, mask,
                   &dtype, &edtype, &mdtype, &w, &h,
@@ -951,46 +1319,36 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
     if gain is not None:
         gain_ = gain
 
-    # convert inputs to double arrays
-    dt = np.dtype(np.double)
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
-    rin = np.require(rin, dtype=dt)
-    rout = np.require(rout, dtype=dt)
+    shape, (x, y, rin, rout) = _aper_params(x, y, rin, rout)
 
     # allocate ouput arrays
-    shape = np.broadcast(x, y, rin, rout).shape
-    sum = np.empty(shape, dt)
-    sumerr = np.empty(shape, dt)
-    flag = np.empty(shape, np.short)
-
-    it = np.broadcast(x, y, rin, rout, sum, sumerr, flag)
-    while np.PyArray_MultiIter_NOTDONE(it):
-        status = sep_sum_circann(
+    n = len(x)
+    sum = np.empty(n, np.double)
+    sumerr = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    if n == 0:
+        return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
+
+    xv, yv, rinv, routv = x, y, rin, rout
+    sumv, sumerrv, flagv = sum, sumerr, flag
+    with nogil:
+        status = sep_sum_circann_batch(
             ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-            maskthresh, gain_, inflag,
-            (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-            subpix,
-            <double*>np.PyArray_MultiIter_DATA(it, 4),
-            <double*>np.PyArray_MultiIter_DATA(it, 5),
-            &area1,
-            <short*>np.PyArray_MultiIter_DATA(it, 6))
-
-        _assert_ok(status)
-
-        np.PyArray_MultiIter_NEXT(it)
+            maskthresh, gain_, inflag, n, &xv[0], &yv[0],
+            &rinv[0], &routv[0], 1, subpix, nthreads,
+            &sumv[0], &sumerrv[0], NULL, &flagv[0])
+    _assert_ok(status)
 
-    return sum, sumerr, flag
+    return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
 
 
 def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
                 var=None, err=None, gain=None, np.ndarray mask=None,
-                double maskthresh=0.0, bkgann=None, int subpix=5):
+                double maskthresh=0.0, bkgann=None, int subpix=5,
+                int nthreads=1):
     """sum_ellipse(data, x, y, a, b, theta, r, err=None, var=None, mask=None,
-                   maskthresh=0.0, bkgann=None, gain=None, subpix=5)
+                   maskthresh=0.0, bkgann=None, gain=None, subpix=5,
+                   nthreads=1)
 
     Sum data in elliptical aperture(s).
 
@@ -1045,6 +1403,11 @@ def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
     subpix : int, optional
         Subpixel sampling factor. Default is 5.
 
+    nthreads : int, optional
+        Number of threads summing apertures concurrently, if SEP is built
+        with OpenMP support (all available threads if 0). Results do not
+        depend on it. Default is 1.
+
     Returns
     -------
     sum : `~numpy.ndarray`
@@ -1058,17 +1421,16 @@ def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
 
     """
 
-    cdef double flux1, fluxerr1, x1, y1, r1, area1, rin1, rout1
-    cdef double bkgflux, bkgfluxerr, bkgarea, gain_
+    cdef double gain_
     cdef float scalarerr
-    cdef short flag1, bkgflag
     cdef short inflag
-    cdef size_t i
-    cdef int w, h, dtype, edtype, mdtype, status
+    cdef int n, w, h, dtype, edtype, mdtype, status
     cdef void *ptr
     cdef void *eptr
     cdef void *mptr
-    cdef np.broadcast it
+    cdef double[::1] xv, yv, av, bv, thetav, rv, rinv, routv
+    cdef double[::1] sumv, sumerrv, areav
+    cdef short[::1] flagv
 
     dtype = 0
     edtype = 0
@@ -1088,107 +1450,70 @@ def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
     if gain is not None:
         gain_ = gain
 
-    # Require that inputs are float64 arrays. See note in circular aperture.
-    dt = np.dtype(np.double)
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
-    a = np.require(a, dtype=dt)
-    b = np.require(b, dtype=dt)
-    theta = np.require(theta, dtype=dt)
-    r = np.require(r, dtype=dt)
-
     if bkgann is None:
-
-        # allocate ouput arrays
-        shape = np.broadcast(x, y, a, b, theta, r).shape
-        sum = np.empty(shape, dt)
-        sumerr = np.empty(shape, dt)
-        flag = np.empty(shape, np.short)
-
-        it = np.broadcast(x, y, a, b, theta, r, sum, sumerr, flag)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            status = sep_sum_ellipse(
-                ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-                subpix,
-                <double*>np.PyArray_MultiIter_DATA(it, 6),
-                <double*>np.PyArray_MultiIter_DATA(it, 7),
-                &area1,
-                <short*>np.PyArray_MultiIter_DATA(it, 8))
-
-            _assert_ok(status)
-
-            np.PyArray_MultiIter_NEXT(it)
-
-        return sum, sumerr, flag
-
+        shape, (x, y, a, b, theta, r) = _aper_params(x, y, a, b, theta, r)
     else:
         rin, rout = bkgann
+        shape, (x, y, a, b, theta, r, rin, rout) = _aper_params(
+            x, y, a, b, theta, r, rin, rout)
 
-        # Require float arrays (see note above)
-        rin = np.require(rin, dtype=dt)
-        rout = np.require(rout, dtype=dt)
-
-        # allocate ouput arrays
-        shape = np.broadcast(x, y, a, b, theta, r, rin, rout).shape
-        sum = np.empty(shape, dt)
-        sumerr = np.empty(shape, dt)
-        flag = np.empty(shape, np.short)
-
-        it = np.broadcast(x, y, a, b, theta, r, rin, rout, sum, sumerr, flag)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            status = sep_sum_ellipse(
+    # allocate ouput arrays
+    n = len(x)
+    sum = np.empty(n, np.double)
+    sumerr = np.empty(n, np.double)
+    area = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    if n == 0:
+        return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
+
+    xv, yv, av, bv, thetav, rv = x, y, a, b, theta, r
+    if bkgann is None:
+        sumv, sumerrv, areav, flagv = sum, sumerr, area, flag
+        with nogil:
+            status = sep_sum_ellipse_batch(
                 ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-                subpix, &flux1, &fluxerr1, &area1, &flag1)
-            _assert_ok(status)
-
-            status = sep_sum_ellipann(
+                maskthresh, gain_, inflag, n, &xv[0], &yv[0],
+                &av[0], &bv[0], &thetav[0], &rv[0], 1, subpix, nthreads,
+                &sumv[0], &sumerrv[0], &areav[0], &flagv[0])
+        _assert_ok(status)
+    else:
+        # aperture and background annulus in a single pass: results for
+        # each object are interleaved as (aperture, annulus)
+        msum = np.empty(2*n, np.double)
+        msumerr = np.empty(2*n, np.double)
+        marea = np.empty(2*n, np.double)
+        mflag = np.empty(2*n, np.short)
+        rinv, routv = rin, rout
+        sumv, sumerrv, areav, flagv = msum, msumerr, marea, mflag
+        with nogil:
+            status = sep_sum_ellipse_multi(
                 ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-                maskthresh, gain_, inflag,
-                (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 6))[0],
-                (<double*>np.PyArray_MultiIter_DATA(it, 7))[0],
-                subpix, &bkgflux, &bkgfluxerr, &bkgarea, &bkgflag)
-            _assert_ok(status)
-
-            flux1 -= bkgflux / bkgarea * area1
-            bkgfluxerr = bkgfluxerr / bkgarea * area1
-            fluxerr1 = fluxerr1*fluxerr1 + bkgfluxerr*bkgfluxerr
+                maskthresh, gain_, inflag, n, &xv[0], &yv[0],
+                &av[0], &bv[0], &thetav[0], &rv[0], 1, &rinv[0], &routv[0],
+                1, NULL, subpix, nthreads, &sumv[0], &sumerrv[0], &areav[0],
+                &flagv[0], NULL, NULL)
+        _assert_ok(status)
 
-            (<double*>np.PyArray_MultiIter_DATA(it, 8))[0] = flux1
-            (<double*>np.PyArray_MultiIter_DATA(it, 9))[0] = fluxerr1
-            (<short*>np.PyArray_MultiIter_DATA(it, 10))[0] = flag1
+        sum, bkgflux = msum[0::2], msum[1::2]
+        sumerr, bkgfluxerr = msumerr[0::2], msumerr[1::2]
+        area, bkgarea = marea[0::2], marea[1::2]
+        flag = mflag[0::2]
 
-            #PyArray_MultiIter_NEXT is used to advance the iterator
-            np.PyArray_MultiIter_NEXT(it)
+        sum -= bkgflux / bkgarea * area
+        bkgfluxerr = bkgfluxerr / bkgarea * area
+        sumerr = sumerr*sumerr + bkgfluxerr*bkgfluxerr
 
-        return sum, sumerr, flag
+    return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
 
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
 def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
                  var=None, err=None, gain=None, np.ndarray mask=None,
-                 double maskthresh=0.0, int subpix=5):
+                 double maskthresh=0.0, int subpix=5, int nthreads=1):
     """sum_ellipann(data, x, y, a, b, theta, rin, rout, err=None, var=None,
-                    mask=None, maskthresh=0.0, gain=None, subpix=5)
+                    mask=None, maskthresh=0.0, gain=None, subpix=5,
+                    nthreads=1)
 
     Sum data in elliptical annular aperture(s).
 
@@ -1230,6 +1555,11 @@ def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
     subpix : int, optional
         Subpixel sampling factor. Default is 5.
 
+    nthreads : int, optional
+        Number of threads summing apertures concurrently, if SEP is built
+        with OpenMP support (all available threads if 0). Results do not
+        depend on it. Default is 1.
+
     Returns
     -------
     sum : `~numpy.ndarray`
@@ -1242,17 +1572,15 @@ def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
         Integer giving flags. (0 if no flags set.)
     """
 
-    cdef double flux1, fluxerr1, x1, y1, r1, area1, rin1, rout1
-    cdef double bkgflux, bkgfluxerr, bkgarea, gain_
+    cdef double gain_
     cdef float scalarerr
-    cdef short flag1, bkgflag
     cdef short inflag
-    cdef size_t i
-    cdef int w, h, dtype, edtype, mdtype, status
+    cdef int n, w, h, dtype, edtype, mdtype, status
     cdef void *ptr
     cdef void *eptr
     cdef void *mptr
-    cdef np.broadcast it
+    cdef double[::1] xv, yv, av, bv, thetav, rinv, routv, sumv, sumerrv
+    cdef short[::1] flagv
 
     dtype = 0
     edtype = 0
@@ -1272,43 +1600,28 @@ def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
     if gain is not None:
         gain_ = gain
 
-    # Require that inputs are float64 arrays. See note in circular aperture.
-    dt = np.dtype(np.double)
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
-    a = np.require(a, dtype=dt)
-    b = np.require(b, dtype=dt)
-    theta = np.require(theta, dtype=dt)
-    rin = np.require(rin, dtype=dt)
-    rout = np.require(rout, dtype=dt)
+    shape, (x, y, a, b, theta, rin, rout) = _aper_params(x, y, a, b, theta,
+                                                         rin, rout)
 
     # allocate ouput arrays
-    shape = np.broadcast(x, y, a, b, theta, rin, rout).shape
-    sum = np.empty(shape, dt)
-    sumerr = np.empty(shape, dt)
-    flag = np.empty(shape, np.short)
-
-    it = np.broadcast(x, y, a, b, theta, rin, rout, sum, sumerr, flag)
-    while np.PyArray_MultiIter_NOTDONE(it):
-        status = sep_sum_ellipann(
+    n = len(x)
+    sum = np.empty(n, np.double)
+    sumerr = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    if n == 0:
+        return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
+
+    xv, yv, av, bv, thetav, rinv, routv = x, y, a, b, theta, rin, rout
+    sumv, sumerrv, flagv = sum, sumerr, flag
+    with nogil:
+        status = sep_sum_ellipann_batch(
             ptr, eptr, mptr, dtype, edtype, mdtype, w, h,
-            maskthresh, gain_, inflag,
-            (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-            (<double*>np.PyArray_MultiIter_DATA(it, 6))[0],
-            subpix,
-            <double*>np.PyArray_MultiIter_DATA(it, 7),
-            <double*>np.PyArray_MultiIter_DATA(it, 8),
-            &area1,
-            <short*>np.PyArray_MultiIter_DATA(it, 9))
-        _assert_ok(status)
-        np.PyArray_MultiIter_NEXT(it)
+            maskthresh, gain_, inflag, n, &xv[0], &yv[0],
+            &av[0], &bv[0], &thetav[0], &rinv[0], &routv[0], 1, subpix,
+            nthreads, &sumv[0], &sumerrv[0], NULL, &flagv[0])
+    _assert_ok(status)
 
-    return sum, sumerr, flag
+    return sum.reshape(shape), sumerr.reshape(shape), flag.reshape(shape)
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
@@ -1367,13 +1680,10 @@ def flux_radius(np.ndarray data not None, x, y, rmax, frac, normflux=None,
 
     """
 
-    cdef double flux1, fluxerr1, x1, y1, r1, area1, rin1, rout1
-    cdef double bkgflux, bkgfluxerr, bkgarea, gain_
+    cdef double gain_
     cdef float scalarerr
-    cdef short flag1, bkgflag
     cdef short inflag
-    cdef size_t i
-    cdef int w, h, dtype, edtype, mdtype, status, fracn
+    cdef int i, n, w, h, dtype, edtype, mdtype, status, fracn
     cdef void *ptr
     cdef void *eptr
     cdef void *mptr
@@ -1385,6 +1695,7 @@ def flux_radius(np.ndarray data not None, x, y, rmax, frac, normflux=None,
     cdef double[:] rtmp
     cdef double[:] normfluxbuf
     cdef double *normfluxptr
+    cdef double *normflux1
 
     dtype = 0
     edtype = 0
@@ -1434,18 +1745,24 @@ def flux_radius(np.ndarray data not None, x, y, rmax, frac, normflux=None,
 
     # Allocate ouput arrays. (We'll reshape these later to match the
     # input shapes.)
-    flag = np.empty(len(xtmp), np.short)
-    radius = np.empty((len(xtmp), len(fractmp)), dt)
-
-    for i in range(len(xtmp)):
-        if normfluxptr != NULL:
-            normfluxptr = &normfluxbuf[i]
-        status = sep_flux_radius(ptr, eptr, mptr, dtype, edtype,
-                                 mdtype, w, h, maskthresh, gain_,
-                                 inflag, xtmp[i], ytmp[i], rtmp[i],
-                                 subpix, normfluxptr, &fractmp[0],
-                                 fracn, &radius[i, 0], &flag[i])
-        _assert_ok(status)
+    n = len(xtmp)
+    flag = np.empty(n, np.short)
+    radius = np.empty((n, fracn), dt)
+
+    status = 0
+    normflux1 = NULL
+    with nogil:
+        for i in range(n):
+            if normfluxptr != NULL:
+                normflux1 = normfluxptr + i
+            status = sep_flux_radius(ptr, eptr, mptr, dtype, edtype,
+                                     mdtype, w, h, maskthresh, gain_,
+                                     inflag, xtmp[i], ytmp[i], rtmp[i],
+                                     subpix, normflux1, &fractmp[0],
+                                     fracn, &radius[i, 0], &flag[i])
+            if status:
+                break
+    _assert_ok(status)
 
     return (np.asarray(radius).reshape(inshape + infracshape),
             np.asarray(flag).reshape(inshape))
@@ -1483,11 +1800,12 @@ def mask_ellipse(np.ndarray arr not None, x, y, a=None, b=None, theta=None,
         Scale factor of ellipse(s). Default is 1.
     """
 
-    cdef int w, h
+    cdef int i, n, w, h
     cdef np.uint8_t[:,:] buf
+    cdef unsigned char *bufptr
     cdef double cxx, cyy, cxy
+    cdef double[::1] xv, yv, av, bv, thetav, rv, cxxv, cyyv, cxyv
 
-    dt = np.dtype(np.double)
 
     # only boolean arrays supported
     if not (arr.dtype.type is np.bool_ or arr.dtype.type is np.ubyte):
@@ -1495,55 +1813,41 @@ def mask_ellipse(np.ndarray arr not None, x, y, a=None, b=None, theta=None,
                          .format(arr.dtype))
     _check_array_get_dims(arr, &w, &h)
     buf = arr.view(dtype=np.uint8)
-
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
+    bufptr = <unsigned char *>&buf[0, 0]
 
     # New Behavior:
     if (a is not None and b is not None and theta is not None):
-        r = np.require(r, dtype=dt)
-        a = np.require(a, dtype=dt)
-        b = np.require(b, dtype=dt)
-        theta = np.require(theta, dtype=dt)
-
-        it = np.broadcast(x, y, a, b, theta, r)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            sep_ellipse_coeffs((<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                               (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                               (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                               &cxx, &cyy, &cxy)
-            sep_set_ellipse(<unsigned char *>&buf[0, 0], w, h,
-                            (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                            cxx, cyy, cxy,
-                            (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-                            1)
-            np.PyArray_MultiIter_NEXT(it)
+        _, (x, y, a, b, theta, r) = _aper_params(x, y, a, b, theta, r)
+        n = len(x)
+        if n == 0:
+            return
+        xv, yv, av, bv, thetav, rv = x, y, a, b, theta, r
+        with nogil:
+            for i in range(n):
+                sep_ellipse_coeffs(av[i], bv[i], thetav[i], &cxx, &cyy, &cxy)
+                sep_set_ellipse(bufptr, w, h, xv[i], yv[i], cxx, cyy, cxy,
+                                rv[i], 1)
 
     # deprecated behavior
     elif ("cxx" in kwargs and "cyy" in kwargs and "cxy" in kwargs):
         if "scale" in kwargs:
             r = kwargs["scale"]
-        r = np.require(r, dtype=dt)
-        cxx_ = np.require(kwargs["cxx"], dtype=dt)
-        cyy_ = np.require(kwargs["cyy"], dtype=dt)
-        cxy_ = np.require(kwargs["cxy"], dtype=dt)
-
-        it = np.broadcast(x, y, cxx_, cyy_, cxy_, r)
-        while np.PyArray_MultiIter_NOTDONE(it):
-            sep_set_ellipse(<unsigned char *>&buf[0, 0], w, h,
-                            (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                            (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-                            1)
-            np.PyArray_MultiIter_NEXT(it)
+        _, (x, y, cxx_, cyy_, cxy_, r) = _aper_params(
+            x, y, kwargs["cxx"], kwargs["cyy"], kwargs["cxy"], r)
+        n = len(x)
+        if n == 0:
+            return
+        xv, yv, cxxv, cyyv, cxyv, rv = x, y, cxx_, cyy_, cxy_, r
+        with nogil:
+            for i in range(n):
+                sep_set_ellipse(bufptr, w, h, xv[i], yv[i], cxxv[i], cyyv[i],
+                                cxyv[i], rv[i], 1)
     else:
         raise ValueError("Must specify a, b and theta")
 
 
+@cython.boundscheck(False)
+@cython.wraparound(False)
 def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
                 np.ndarray mask=None, double maskthresh=0.0):
     """kron_radius(data, x, y, a, b, theta, r, mask=None, maskthresh=0.0)
@@ -1600,11 +1904,13 @@ def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
 
     """
 
-    cdef int w, h, mw, mh
+    cdef int i, n, w, h, mw, mh, dtype, mdtype
     cdef np.uint8_t[:,:] buf, mbuf
     cdef void *ptr
     cdef void *mptr
     cdef double cxx, cyy, cxy
+    cdef double[::1] xv, yv, av, bv, thetav, rv, krv
+    cdef short[::1] flagv
 
     mptr = NULL
     mdtype = 0
@@ -1615,15 +1921,6 @@ def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
     buf = data.view(dtype=np.uint8)
     ptr = <void*>&buf[0, 0]
 
-    # See note in apercirc on requiring specific array type
-    dt = np.dtype(np.double)
-    x = np.require(x, dtype=dt)
-    y = np.require(y, dtype=dt)
-    a = np.require(a, dtype=dt)
-    b = np.require(b, dtype=dt)
-    theta = np.require(theta, dtype=dt)
-    r = np.require(r, dtype=dt)
-
     if mask is not None:
         _check_array_get_dims(mask, &mw, &mh)
         if mw != w or mh != h:
@@ -1632,31 +1929,33 @@ def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
         mbuf = mask.view(dtype=np.uint8)
         mptr = <void*>&mbuf[0, 0]
 
-    # allocate output arrays
-    shape = np.broadcast(x, y, a, b, theta, r).shape
-    kr = np.empty(shape, np.float)
-    flag = np.empty(shape, np.short)
-
-    it = np.broadcast(x, y, a, b, theta, r, kr, flag)
-    while np.PyArray_MultiIter_NOTDONE(it):
-        sep_ellipse_coeffs((<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                           (<double*>np.PyArray_MultiIter_DATA(it, 3))[0],
-                           (<double*>np.PyArray_MultiIter_DATA(it, 4))[0],
-                           &cxx, &cyy, &cxy)
-        sep_kron_radius(ptr, mptr, dtype, mdtype, w, h, maskthresh,
-                        (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                        (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                        cxx, cyy, cxy,
-                        (<double*>np.PyArray_MultiIter_DATA(it, 5))[0],
-                        <double*>np.PyArray_MultiIter_DATA(it, 6),
-                        <short*>np.PyArray_MultiIter_DATA(it, 7))
-        np.PyArray_MultiIter_NEXT(it)
+    shape, (x, y, a, b, theta, r) = _aper_params(x, y, a, b, theta, r)
 
-    return kr, flag 
+    # allocate output arrays
+    n = len(x)
+    kr = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    if n == 0:
+        return kr.reshape(shape), flag.reshape(shape)
+
+    xv, yv, av, bv, thetav, rv = x, y, a, b, theta, r
+    krv, flagv = kr, flag
+    with nogil:
+        for i in range(n):
+            sep_ellipse_coeffs(av[i], bv[i], thetav[i], &cxx, &cyy, &cxy)
+            sep_kron_radius(ptr, mptr, dtype, mdtype, w, h, maskthresh,
+                            xv[i], yv[i], cxx, cyy, cxy, rv[i],
+                            &krv[i], &flagv[i])
+
+    return kr.reshape(shape), flag.reshape(shape)
 
+@cython.boundscheck(False)
+@cython.wraparound(False)
 def winpos(np.ndarray data not None, xinit, yinit, sig,
-           np.ndarray mask=None, double maskthresh=0.0, int subpix=11):
-    """winpos(data, xinit, yinit, sig, mask=None, maskthresh=0.0, subpix=11)
+           np.ndarray mask=None, double maskthresh=0.0, int subpix=11,
+           int nthreads=1):
+    """winpos(data, xinit, yinit, sig, mask=None, maskthresh=0.0, subpix=11,
+              nthreads=1)
 
     Calculate more accurate object centroids using 'windowed' algorithm.
 
@@ -1694,6 +1993,11 @@ def winpos(np.ndarray data not None, xinit, yinit, sig,
         aperture.  11 is used in Source Extractor. For exact overlap
         calculation, use 0.
 
+    nthreads : int, optional
+        Number of threads iterating objects concurrently, if SEP is built
+        with OpenMP support (all available threads if 0). Results do not
+        depend on it. Default is 1.
+
     Returns
     -------
     x, y : np.ndarray
@@ -1704,14 +2008,13 @@ def winpos(np.ndarray data not None, xinit, yinit, sig,
 
     """
 
-    cdef int w, h, mw, mh, status
+    cdef int n, w, h, mw, mh, dtype, mdtype, status
     cdef np.uint8_t[:,:] buf, mbuf
     cdef void *ptr
     cdef void *mptr
-    cdef double cxx, cyy, cxy
-    cdef int niter
-
-    niter = 0  # not currently used or returned.
+    cdef double[::1] xinitv, yinitv, sigv, xv, yv
+    cdef int[::1] niterv
+    cdef short[::1] flagv
 
     mptr = NULL
     mdtype = 0
@@ -1722,12 +2025,6 @@ def winpos(np.ndarray data not None, xinit, yinit, sig,
     buf = data.view(dtype=np.uint8)
     ptr = <void*>&buf[0, 0]
 
-    # See note in apercirc on requiring specific array type
-    dt = np.dtype(np.double)
-    xinit = np.require(xinit, dtype=dt)
-    yinit = np.require(yinit, dtype=dt)
-    sig = np.require(sig, dtype=dt)
-
     if mask is not None:
         _check_array_get_dims(mask, &mw, &mh)
         if mw != w or mh != h:
@@ -1736,29 +2033,27 @@ def winpos(np.ndarray data not None, xinit, yinit, sig,
         mbuf = mask.view(dtype=np.uint8)
         mptr = <void*>&mbuf[0, 0]
 
-    # allocate output arrays
-    shape = np.broadcast(xinit, yinit, sig).shape
-    x = np.empty(shape, np.float)
-    y = np.empty(shape, np.float)
-    flag = np.empty(shape, np.short)
+    shape, (xinit, yinit, sig) = _aper_params(xinit, yinit, sig)
 
-    it = np.broadcast(xinit, yinit, sig, x, y, flag)
-    while np.PyArray_MultiIter_NOTDONE(it):
-        status = sep_windowed(ptr, NULL, mptr, dtype, 0, mdtype, w, h,
-                              maskthresh, 0., 0,
-                              (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                              (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                              (<double*>np.PyArray_MultiIter_DATA(it, 2))[0],
-                              subpix,
-                              <double*>np.PyArray_MultiIter_DATA(it, 3),
-                              <double*>np.PyArray_MultiIter_DATA(it, 4),
-                              &niter,
-                              <short*>np.PyArray_MultiIter_DATA(it, 5),
-                              NULL)
-        _assert_ok(status);
-        np.PyArray_MultiIter_NEXT(it)
+    # allocate output arrays
+    n = len(xinit)
+    x = np.empty(n, np.double)
+    y = np.empty(n, np.double)
+    flag = np.empty(n, np.short)
+    niter = np.empty(n, np.intc)  # not currently returned.
+    if n == 0:
+        return x.reshape(shape), y.reshape(shape), flag.reshape(shape)
+
+    xinitv, yinitv, sigv = xinit, yinit, sig
+    xv, yv, niterv, flagv = x, y, niter, flag
+    with nogil:
+        status = sep_windowed_batch(ptr, NULL, mptr, dtype, 0, mdtype, w, h,
+                                    maskthresh, 0., 0, n, &xinitv[0],
+                                    &yinitv[0], &sigv[0], subpix, nthreads,
+                                    &xv[0], &yv[0], &niterv[0], &flagv[0])
+    _assert_ok(status)
 
-    return x, y, flag 
+    return x.reshape(shape), y.reshape(shape), flag.reshape(shape)
 
 
 
@@ -1869,13 +2164,33 @@ def ellipse_axes(cxx, cyy, cxy):
 # Utility functions
 
 def set_extract_pixstack(size_t size):
-    """Set the size in pixels of the internal pixel buffer used in extract()"""
+    """Set the maximum size in pixels of the internal pixel buffer used in
+    extract(). The buffer grows as needed up to this size."""
     sep_set_extract_pixstack(size)
 
 def get_extract_pixstack():
-    """Get the size in pixels of the internal pixel buffer used in extract()"""
+    """Get the maximum size in pixels of the internal pixel buffer used in
+    extract()"""
     return sep_get_extract_pixstack()
 
+def get_stats():
+    """Get the time spent in each stage of the library and its counters,
+    summed over all calls and threads since the last `reset_stats()`.
+
+    Returns a dict of the times in seconds (keys starting with ``t_``) and
+    the counters, or None if SEP was not built with the ``SEP_STATS`` macro
+    defined (set the ``SEP_STATS`` environment variable when running
+    setup.py).
+    """
+    cdef sepstats st
+    if not sep_get_stats(&st):
+        return None
+    return st
+
+def reset_stats():
+    """Reset the times and counters returned by `get_stats()`."""
+    sep_reset_stats()
+
 # -----------------------------------------------------------------------------
 # deprecated stuff
 
@@ -14,7 +14,10 @@ else:
 
 sourcefiles = [fname] + glob(os.path.join("src", "*.c"))
 include_dirs=[numpy.get_include(), "src"]
-extensions = [Extension("sep", sourcefiles, include_dirs=include_dirs)]
+# set SEP_STATS in the environment to keep per-stage timings & counters
+define_macros = [("SEP_STATS", None)] if os.environ.get("SEP_STATS") else []
+extensions = [Extension("sep", sourcefiles, include_dirs=include_dirs,
+                        define_macros=define_macros)]
 if USE_CYTHON:
     from Cython.Build import cythonize
     extensions = cythonize(extensions)
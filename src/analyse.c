@@ -34,8 +34,8 @@
  * This used to be in analyse() / examineiso().
  */
 
-int analysemthresh(int objnb, objliststruct *objlist, int minarea,
-		   PIXTYPE thresh)
+int analysemthresh(sep_extract_ctx *ctx, int objnb, objliststruct *objlist,
+		   int minarea, PIXTYPE thresh)
 {
   objstruct *obj = objlist->obj+objnb;
   pliststruct *pixel = objlist->plist;
@@ -101,7 +101,7 @@ int analysemthresh(int objnb, objliststruct *objlist, int minarea,
 
 /************************* preanalyse **************************************/
 
-void  preanalyse(int no, objliststruct *objlist)
+void  preanalyse(sep_extract_ctx *ctx, int no, objliststruct *objlist)
 {
   objstruct	*obj = &objlist->obj[no];
   pliststruct	*pixel = objlist->plist, *pixt;
@@ -170,7 +170,7 @@ void  preanalyse(int no, objliststruct *objlist)
   If robust = 1, you must have run previously with robust=0
 */
 
-void  analyse(int no, objliststruct *objlist, int robust)
+void  analyse(sep_extract_ctx *ctx, int no, objliststruct *objlist, int robust)
 {
   objstruct	*obj = &objlist->obj[no];
   pliststruct	*pixel = objlist->plist, *pixt;
@@ -181,7 +181,7 @@ void  analyse(int no, objliststruct *objlist, int robust)
 		temp,temp2, theta,pmx2,pmy2;
   int		x, y, xmin, ymin, area2, dnpix;
 
-  preanalyse(no, objlist);
+  preanalyse(ctx, no, objlist);
   
   dnpix = 0;
   mx = my = tv = 0.0;
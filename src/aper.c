@@ -34,6 +34,15 @@
 #define WINPOS_NSIG     4       /* Measurement radius */
 #define WINPOS_STEPMIN  0.0001  /* Minimum change in position for continuing */
 #define WINPOS_FAC      2.0     /* Centroid offset factor (2 for a Gaussian) */
+#define WINPOS_MARGIN   2       /* Pixels read around a box, for moves */
+
+#define APER_BATCH_CHUNK 16     /* Sources handed to a thread at a time */
+
+#define APER_CACHE_STEPS    16           /* Centre positions per pixel */
+#define APER_CACHE_NBIN     4096         /* Hash bins of a weights cache */
+#define APER_CACHE_MAXBYTES (1<<25)      /* Weights kept per thread */
+#define APER_CACHE_ORIGIN   (1<<20)      /* Centre pixel of cached weights */
+#define APER_CACHE_MAXPOS   1.0e8        /* Largest centre coordinate */
 
 /****************************************************************************/
 /* conversions between ellipse representations */
@@ -138,11 +147,249 @@ static void boxextent_ellipse(double x, double y,
   boxextent(x, y, dxlim, dylim, w, h, xmin, xmax, ymin, ymax, flag);
 }
 
-/* determine oversampled annulus for a circle */
+/* converters of the input arrays, resolved once for many apertures. `kind`
+ * selects a core reading the arrays directly, for the common combinations
+ * of types (APER_KIND_ANY reads everything through the converters). */
+#define APER_KIND_ANY     0
+#define APER_KIND_FLT     1     /* float data, error & mask */
+#define APER_KIND_FLT_BYT 2     /* float data & error, byte mask */
+#define APER_KIND_DBL     3     /* double data, error & mask */
+#define APER_KIND_DBL_BYT 4     /* double data & error, byte mask */
+
+#define APER_CAT(a, b) a ## b
+#define APER_XCAT(a, b) APER_CAT(a, b)
+
+typedef struct
+{
+  converter convert, econvert, mconvert;
+  int       size, esize, msize;
+  int       kind;
+} aperconv;
+
+static int get_aperconv(int dtype, int edtype, int mdtype,
+                        void *error, void *mask, short inflag, aperconv *cv)
+{
+  int status;
+
+  cv->econvert = cv->mconvert = NULL;
+  cv->esize = cv->msize = 0;
+  cv->kind = APER_KIND_ANY;
+  if ((status = get_converter(dtype, &cv->convert, &cv->size)))
+    return status;
+  if (error && (status = get_converter(edtype, &cv->econvert, &cv->esize)))
+    return status;
+  if (mask && (status = get_converter(mdtype, &cv->mconvert, &cv->msize)))
+    return status;
+
+  /* a scalar error is always read through its converter */
+  if ((dtype == SEP_TFLOAT || dtype == SEP_TDOUBLE) &&
+      (!error || !(inflag & SEP_ERROR_IS_ARRAY) || edtype == dtype))
+    {
+      if (!mask || mdtype == dtype)
+	cv->kind = (dtype == SEP_TFLOAT)? APER_KIND_FLT: APER_KIND_DBL;
+      else if (mdtype == SEP_TBYTE)
+	cv->kind = (dtype == SEP_TFLOAT)? APER_KIND_FLT_BYT: APER_KIND_DBL_BYT;
+    }
+
+  return RETURN_OK;
+}
+
+/* sources of a batch, sorted by position so that neighbouring apertures
+ * are summed one after the other */
+typedef struct
+{
+  double y, x;
+  int    i;
+} apersrc;
+
+static int compare_apersrc(const void *a, const void *b)
+{
+  const apersrc *sa = (const apersrc *)a, *sb = (const apersrc *)b;
+
+  if (sa->y != sb->y)
+    return sa->y < sb->y? -1: 1;
+  if (sa->x != sb->x)
+    return sa->x < sb->x? -1: 1;
+  return sa->i - sb->i;
+}
+
+static int sort_sources(int n, const double *x, const double *y,
+			apersrc **order)
+{
+  int i, status = RETURN_OK;
+
+  *order = NULL;
+  QMALLOC(*order, apersrc, n>0? n: 1, status);
+  for (i=0; i<n; i++)
+    {
+      (*order)[i].y = (int)(y[i] + 0.5);  /* row of the centre pixel */
+      (*order)[i].x = x[i];
+      (*order)[i].i = i;
+    }
+  qsort(*order, n, sizeof(apersrc), compare_apersrc);
+
+ exit:
+  return status;
+}
+
+/* cache of aperture weights, for batches summed with SEP_APER_CACHE: the
+ * weights of the pixels of an aperture depend only on its parameters and
+ * on the offset of its centre from the centre pixel, which is rounded to
+ * 1/APER_CACHE_STEPS pixel. Weights are stored as spans of consecutive
+ * pixels of a row, in the order the aperture cores visit them. */
+typedef struct
+{
+  double par[5];        /* aperture parameters */
+  int    subpix;
+  int    qx, qy;        /* offset of the centre, in 1/APER_CACHE_STEPS */
+} aperkey;
+
+typedef struct
+{
+  int dy;               /* row, relative to the row of the centre pixel */
+  int x, n;             /* first pixel (relative to the centre pixel) and
+			   number of pixels */
+  int w;                /* index of the first weight, -1 if all are 1 */
+} aperspan;
+
+typedef struct aperweights
+{
+  aperkey  key;
+  aperspan *span;
+  int      nspan;
+  double   *weight;
+  int      nweight;
+  size_t   nbytes;         /* memory used */
+  struct aperweights *next;
+} aperweights;
+
+typedef struct
+{
+  aperweights *bin[APER_CACHE_NBIN];
+  size_t      nbytes;
+} apercache;
+
+static void free_aperweights(aperweights *ws)
+{
+  if (ws)
+    {
+      free(ws->span);
+      free(ws->weight);
+      free(ws);
+    }
+}
+
+static void free_apercache(apercache *cache)
+{
+  aperweights *ws, *next;
+  int i;
+
+  for (i=0; i<APER_CACHE_NBIN; i++)
+    for (ws=cache->bin[i]; ws; ws=next)
+      {
+	next = ws->next;
+	free_aperweights(ws);
+      }
+}
+
+static unsigned int hash_aperkey(const aperkey *key)
+{
+  const unsigned char *c = (const unsigned char *)key;
+  unsigned int hash = 2166136261u;
+  size_t i;
+
+  for (i=0; i<sizeof(aperkey); i++)
+    hash = (hash ^ c[i]) * 16777619u;
+  return hash % APER_CACHE_NBIN;
+}
+
+static aperweights *find_aperweights(apercache *cache, const aperkey *key)
+{
+  aperweights *ws;
+
+  for (ws=cache->bin[hash_aperkey(key)]; ws; ws=ws->next)
+    if (!memcmp(&ws->key, key, sizeof(aperkey)))
+      return ws;
+  return NULL;
+}
+
+/* keep weights in the cache, unless it is full; return 1 if kept */
+static int add_aperweights(apercache *cache, aperweights *ws)
+{
+  unsigned int i;
+
+  if (cache->nbytes + ws->nbytes > APER_CACHE_MAXBYTES)
+    return 0;
+  i = hash_aperkey(&ws->key);
+  ws->next = cache->bin[i];
+  cache->bin[i] = ws;
+  cache->nbytes += ws->nbytes;
+  return 1;
+}
+
+/* append a pixel of weight `overlap` at (x, dy) to the weights being built,
+ * whose arrays have room enough */
+static void push_aperweight(aperweights *ws, int dy, int x, double overlap)
+{
+  aperspan *span;
+  int full;
+
+  full = (overlap == 1.0);
+  span = ws->nspan? ws->span + ws->nspan - 1: NULL;
+  if (!span || span->dy != dy || span->x + span->n != x ||
+      (span->w < 0) != full)
+    {
+      span = ws->span + ws->nspan++;
+      span->dy = dy;
+      span->x = x;
+      span->n = 0;
+      span->w = full? -1: ws->nweight;
+    }
+  if (!full)
+    ws->weight[ws->nweight++] = overlap;
+  span->n++;
+}
+
+/* sums of apertures through cached weights, for each array type */
+#define APER_FUNC sum_spans
+#define APER_TEMPLATE "aperspans.c.inc"
+#include "apertypes.c.inc"
+#undef APER_FUNC
+#undef APER_TEMPLATE
+
+static int sum_spans(void *data, void *error, void *mask, aperconv *cv,
+		     int w, double maskthresh, double gain, short inflag,
+		     int ix0, int iy0, int *box, aperweights *ws,
+		     double *sum, double *sumerr, double *area, short *flag)
+{
+  switch (cv->kind)
+    {
+    case APER_KIND_FLT:
+      return sum_spans_flt(data, error, mask, cv, w, maskthresh, gain, inflag,
+			   ix0, iy0, box, ws, sum, sumerr, area, flag);
+    case APER_KIND_FLT_BYT:
+      return sum_spans_flt_byt(data, error, mask, cv, w, maskthresh, gain,
+			       inflag, ix0, iy0, box, ws,
+			       sum, sumerr, area, flag);
+    case APER_KIND_DBL:
+      return sum_spans_dbl(data, error, mask, cv, w, maskthresh, gain, inflag,
+			   ix0, iy0, box, ws, sum, sumerr, area, flag);
+    case APER_KIND_DBL_BYT:
+      return sum_spans_dbl_byt(data, error, mask, cv, w, maskthresh, gain,
+			       inflag, ix0, iy0, box, ws,
+			       sum, sumerr, area, flag);
+    default:
+      return sum_spans_any(data, error, mask, cv, w, maskthresh, gain, inflag,
+			   ix0, iy0, box, ws, sum, sumerr, area, flag);
+    }
+}
+
+/* determine oversampled annulus for a circle (r_in2 < 0 if no pixel can be
+ * fully within the circle, including the pixel at its centre) */
 static void oversamp_ann_circle(double r, double *r_in2, double *r_out2)
 {
    *r_in2 = r - 0.7072;
-   *r_in2 = (*r_in2 > 0.0) ? (*r_in2)*(*r_in2) : 0.0;
+   *r_in2 = (*r_in2 > 0.0) ? (*r_in2)*(*r_in2) : -1.0;
    *r_out2 = r + 0.7072;
    *r_out2 = (*r_out2) * (*r_out2);
 }
@@ -152,7 +399,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
                                  double *r_out2)
 {
    *r_in2 = r - 0.7072/b;
-   *r_in2 = (*r_in2 > 0.0) ? (*r_in2)*(*r_in2) : 0.0;
+   *r_in2 = (*r_in2 > 0.0) ? (*r_in2)*(*r_in2) : -1.0;
    *r_out2 = r + 0.7072/b;
    *r_out2 = (*r_out2) * (*r_out2);
 }
@@ -161,7 +408,13 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 /* circular aperture */
 
 #define APER_NAME sep_sum_circle
+#define APER_CORE sum_circle_core
+#define APER_VALS r
+#define APER_BATCH_NAME sep_sum_circle_batch
+#define APER_BATCH_ARGS const double *r
+#define APER_BATCH_VALS r[j]
 #define APER_ARGS double r
+#define APER_KEY key.par[0] = r
 #define APER_DECL double r2, r_in2, r_out2
 #define APER_CHECKS                             \
   if (r < 0.0)                                  \
@@ -171,6 +424,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
   oversamp_ann_circle(r, &r_in2, &r_out2)
 #define APER_BOXEXTENT boxextent(x, y, r, r, w, h,                      \
                                  &xmin, &xmax, &ymin, &ymax, flag)
+#define APER_EXACT_ROW
 #define APER_EXACT circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, r)
 #define APER_RPIX2 dx*dx + dy*dy
 #define APER_RPIX2_SUBPIX dx1*dx1 + dy2
@@ -179,11 +433,18 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 #define APER_COMPARE3 rpix2 < r2
 #include "aperbody.c.inc"
 #undef APER_NAME
+#undef APER_CORE
+#undef APER_VALS
+#undef APER_BATCH_NAME
+#undef APER_BATCH_ARGS
+#undef APER_BATCH_VALS
 #undef APER_ARGS
+#undef APER_KEY
 #undef APER_DECL
 #undef APER_CHECKS
 #undef APER_INIT
 #undef APER_BOXEXTENT
+#undef APER_EXACT_ROW
 #undef APER_EXACT
 #undef APER_RPIX2
 #undef APER_RPIX2_SUBPIX
@@ -195,8 +456,22 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 /* elliptical aperture */
 
 #define APER_NAME sep_sum_ellipse
+#define APER_CORE sum_ellipse_core
+#define APER_VALS a, b, theta, r
+#define APER_BATCH_NAME sep_sum_ellipse_batch
+#define APER_BATCH_ARGS                                         \
+  const double *a, const double *b, const double *theta, const double *r
+#define APER_BATCH_VALS a[i], b[i], theta[i], r[j]
 #define APER_ARGS double a, double b, double theta, double r
-#define APER_DECL double cxx, cyy, cxy, r2, r_in2, r_out2
+#define APER_KEY                                                \
+  key.par[0] = a;                                               \
+  key.par[1] = b;                                               \
+  key.par[2] = theta;                                           \
+  key.par[3] = r
+#define APER_DECL                                               \
+  double cxx, cyy, cxy, r2, r_in2, r_out2;                      \
+  shearellipse ell;                                             \
+  edgeline lo, hi
 #define APER_CHECKS                                                     \
   if (!(r >= 0.0 && b >= 0.0 && a >= b &&                               \
         theta >= -PI/2. && theta <= PI/2.))                             \
@@ -205,11 +480,16 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
   r2 = r*r;                                                     \
   oversamp_ann_ellipse(r, b, &r_in2, &r_out2);                  \
   sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy);            \
-  a *= r;                                                       \
-  b *= r
+  shearellipse_init(a, b, theta, r, &ell)
 #define APER_BOXEXTENT boxextent_ellipse(x, y, cxx, cyy, cxy, r, w, h, \
                                          &xmin, &xmax, &ymin, &ymax, flag)
-#define APER_EXACT ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a, b, theta)
+#define APER_EXACT_ROW                                  \
+  if (subpix == 0)                                      \
+    {                                                   \
+      edgeline_init(&ell, iy - y - 0.5, &lo);           \
+      edgeline_init(&ell, iy - y + 0.5, &hi);           \
+    }
+#define APER_EXACT shearoverlap(&ell, &lo, &hi, dx-0.5, dx+0.5)
 #define APER_RPIX2 cxx*dx*dx + cyy*dy*dy + cxy*dx*dy
 #define APER_RPIX2_SUBPIX cxx*dx1*dx1 + cyy*dy2 + cxy*dx1*dy
 #define APER_COMPARE1 rpix2 < r_out2
@@ -217,11 +497,18 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 #define APER_COMPARE3 rpix2 < r2
 #include "aperbody.c.inc"
 #undef APER_NAME
+#undef APER_CORE
+#undef APER_VALS
+#undef APER_BATCH_NAME
+#undef APER_BATCH_ARGS
+#undef APER_BATCH_VALS
 #undef APER_ARGS
+#undef APER_KEY
 #undef APER_DECL
 #undef APER_CHECKS
 #undef APER_INIT
 #undef APER_BOXEXTENT
+#undef APER_EXACT_ROW
 #undef APER_EXACT
 #undef APER_RPIX2
 #undef APER_RPIX2_SUBPIX
@@ -233,7 +520,15 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 /* circular annulus aperture */
 
 #define APER_NAME sep_sum_circann
+#define APER_CORE sum_circann_core
+#define APER_VALS rin, rout
+#define APER_BATCH_NAME sep_sum_circann_batch
+#define APER_BATCH_ARGS const double *rin, const double *rout
+#define APER_BATCH_VALS rin[j], rout[j]
 #define APER_ARGS double rin, double rout
+#define APER_KEY                                \
+  key.par[0] = rin;                             \
+  key.par[1] = rout
 #define APER_DECL double rin2, rin_in2, rin_out2, rout2, rout_in2, rout_out2
 #define APER_CHECKS                             \
   if (!(rin >= 0.0 && rout >= rin))             \
@@ -245,6 +540,7 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
   oversamp_ann_circle(rout, &rout_in2, &rout_out2)
 #define APER_BOXEXTENT boxextent(x, y, rout, rout, w, h, \
                                  &xmin, &xmax, &ymin, &ymax, flag)
+#define APER_EXACT_ROW
 #define APER_EXACT (circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, rout) - \
                     circoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, rin))
 #define APER_RPIX2 dx*dx + dy*dy
@@ -254,11 +550,18 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 #define APER_COMPARE3 (rpix2 < rout2) && (rpix2 > rin2)
 #include "aperbody.c.inc"
 #undef APER_NAME
+#undef APER_CORE
+#undef APER_VALS
+#undef APER_BATCH_NAME
+#undef APER_BATCH_ARGS
+#undef APER_BATCH_VALS
 #undef APER_ARGS
+#undef APER_KEY
 #undef APER_DECL
 #undef APER_CHECKS
 #undef APER_INIT
 #undef APER_BOXEXTENT
+#undef APER_EXACT_ROW
 #undef APER_EXACT
 #undef APER_RPIX2
 #undef APER_RPIX2_SUBPIX
@@ -270,10 +573,25 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 /* elliptical annulus aperture */
 
 #define APER_NAME sep_sum_ellipann
+#define APER_CORE sum_ellipann_core
+#define APER_VALS a, b, theta, rin, rout
+#define APER_BATCH_NAME sep_sum_ellipann_batch
+#define APER_BATCH_ARGS                                         \
+  const double *a, const double *b, const double *theta,        \
+  const double *rin, const double *rout
+#define APER_BATCH_VALS a[i], b[i], theta[i], rin[j], rout[j]
 #define APER_ARGS double a, double b, double theta, double rin, double rout
+#define APER_KEY                                                \
+  key.par[0] = a;                                               \
+  key.par[1] = b;                                               \
+  key.par[2] = theta;                                           \
+  key.par[3] = rin;                                             \
+  key.par[4] = rout
 #define APER_DECL                                               \
   double cxx, cyy, cxy;                                         \
-  double rin2, rin_in2, rin_out2, rout2, rout_in2, rout_out2
+  double rin2, rin_in2, rin_out2, rout2, rout_in2, rout_out2;   \
+  shearellipse ellin, ellout;                                   \
+  edgeline loin, hiin, loout, hiout
 #define APER_CHECKS                                         \
   if (!(rin >= 0.0 && rout >= rin && b >= 0.0 && a >= b &&  \
         theta >= -PI/2. && theta <= PI/2.))                 \
@@ -283,12 +601,22 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
   oversamp_ann_ellipse(rin, b, &rin_in2, &rin_out2);            \
   rout2 = rout*rout;                                            \
   oversamp_ann_ellipse(rout, b, &rout_in2, &rout_out2);         \
-  sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy)
+  sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy);            \
+  shearellipse_init(a, b, theta, rin, &ellin);                  \
+  shearellipse_init(a, b, theta, rout, &ellout)
 #define APER_BOXEXTENT boxextent_ellipse(x, y, cxx, cyy, cxy, rout, w, h, \
                                          &xmin, &xmax, &ymin, &ymax, flag)
-#define APER_EXACT                                                      \
-  (ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a*rout, b*rout, theta) - \
-   ellipoverlap(dx-0.5, dy-0.5, dx+0.5, dy+0.5, a*rin, b*rin, theta))
+#define APER_EXACT_ROW                                  \
+  if (subpix == 0)                                      \
+    {                                                   \
+      edgeline_init(&ellin, iy - y - 0.5, &loin);       \
+      edgeline_init(&ellin, iy - y + 0.5, &hiin);       \
+      edgeline_init(&ellout, iy - y - 0.5, &loout);     \
+      edgeline_init(&ellout, iy - y + 0.5, &hiout);     \
+    }
+#define APER_EXACT                                                  \
+  (shearoverlap(&ellout, &loout, &hiout, dx-0.5, dx+0.5) -          \
+   shearoverlap(&ellin, &loin, &hiin, dx-0.5, dx+0.5))
 #define APER_RPIX2 cxx*dx*dx + cyy*dy*dy + cxy*dx*dy
 #define APER_RPIX2_SUBPIX cxx*dx1*dx1 + cyy*dy2 + cxy*dx1*dy
 #define APER_COMPARE1 (rpix2 < rout_out2) && (rpix2 > rin_in2)
@@ -296,11 +624,18 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2,
 #define APER_COMPARE3 (rpix2 < rout2) && (rpix2 > rin2)
 #include "aperbody.c.inc"
 #undef APER_NAME
+#undef APER_CORE
+#undef APER_VALS
+#undef APER_BATCH_NAME
+#undef APER_BATCH_ARGS
+#undef APER_BATCH_VALS
 #undef APER_ARGS
+#undef APER_KEY
 #undef APER_DECL
 #undef APER_CHECKS
 #undef APER_INIT
 #undef APER_BOXEXTENT
+#undef APER_EXACT_ROW
 #undef APER_EXACT
 #undef APER_RPIX2
 #undef APER_RPIX2_SUBPIX
@@ -508,6 +843,217 @@ int sep_sum_circann_multi(void *data, void *error, void *mask,
   return status;
 }
 
+/*****************************************************************************/
+/* concentric elliptical apertures & annuli of a source, in one pass */
+
+/* an ellipse (isann = 0) or an elliptical annulus of sep_sum_ellipse_multi,
+ * with the oversampling limits, exact overlap set-up & running sums of
+ * sum_ellipse_core or sum_ellipann_core */
+typedef struct
+{
+  double r2, r_in2, r_out2;        /* ellipse, or outer edge of annulus */
+  double rin2, rin_in2, rin_out2;  /* inner edge of annulus (< 0 if none) */
+  int isann;
+  int box[4];                      /* xmin, xmax, ymin, ymax */
+  shearellipse ell, ellin;
+  edgeline lo, hi, loin, hiin;
+  double tv, sigtv, totarea, maskarea;
+  short flag;
+} multiaper;
+
+/* Set up the nr ellipses and nann annuli of a source in ap[0..nr+nann-1],
+ * followed by the box & flag of its Kron ellipse in ap[nr+nann] if rkron
+ * >= 0. */
+static int init_ellipse_multi(double x, double y, double a, double b,
+			      double theta, const double *r, int nr,
+			      const double *rin, const double *rout, int nann,
+			      double rkron,
+			      int w, int h, multiaper *ap)
+{
+  double cxx, cyy, cxy, rk;
+  int k;
+  multiaper *apk;
+
+  if (!(b >= 0.0 && a >= b && theta >= -PI/2. && theta <= PI/2.))
+    return ILLEGAL_APER_PARAMS;
+  for (k=0; k<nr; k++)
+    if (!(r[k] >= 0.0))
+      return ILLEGAL_APER_PARAMS;
+  for (k=0; k<nann; k++)
+    if (!(rin[k] >= 0.0 && rout[k] >= rin[k]))
+      return ILLEGAL_APER_PARAMS;
+
+  sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy);
+  memset(ap, 0, (size_t)(nr+nann+1)*sizeof(multiaper));
+
+  for (k=0, apk=ap; k<nr+nann; k++, apk++)
+    {
+      apk->isann = (k >= nr);
+      rk = apk->isann? rout[k-nr]: r[k];
+      apk->r2 = rk*rk;
+      oversamp_ann_ellipse(rk, b, &apk->r_in2, &apk->r_out2);
+      shearellipse_init(a, b, theta, rk, &apk->ell);
+      if (apk->isann)
+	{
+	  apk->rin2 = rin[k-nr]*rin[k-nr];
+	  oversamp_ann_ellipse(rin[k-nr], b, &apk->rin_in2, &apk->rin_out2);
+	  shearellipse_init(a, b, theta, rin[k-nr], &apk->ellin);
+	}
+      else
+	apk->rin2 = apk->rin_in2 = apk->rin_out2 = -1.0;
+      boxextent_ellipse(x, y, cxx, cyy, cxy, rk, w, h, apk->box, apk->box+1,
+			apk->box+2, apk->box+3, &apk->flag);
+    }
+
+  if (rkron >= 0.0)
+    boxextent_ellipse(x, y, cxx, cyy, cxy, rkron, w, h, apk->box, apk->box+1,
+		      apk->box+2, apk->box+3, &apk->flag);
+
+  return RETURN_OK;
+}
+
+#define APER_FUNC sum_ellipse_multi_core
+#define APER_TEMPLATE "apermulti.c.inc"
+#include "apertypes.c.inc"
+#undef APER_FUNC
+#undef APER_TEMPLATE
+
+/* sums of source i with the core matching the array types */
+#define MULTI_CALL(variant)						\
+  APER_XCAT(sum_ellipse_multi_core, variant)(data, error, mask, &cv, w, h, \
+					     maskthresh, gain, inflag,	\
+					     x[i], y[i], subpix,	\
+					     cxx, cyy, cxy, rkron2, ap, m, \
+					     rows + SEP_THREAD_NUM()*4*(long)w, \
+					     sum+j, sumerr+j, area1, flag+j, \
+					     kronrad1, kronflag1)
+
+int sep_sum_ellipse_multi(void *data, void *error, void *mask,
+			  int dtype, int edtype, int mdtype, int w, int h,
+			  double maskthresh, double gain, short inflag,
+			  int n, const double *x, const double *y,
+			  const double *a, const double *b, const double *theta,
+			  const double *r, int nr,
+			  const double *rin, const double *rout, int nann,
+			  const double *rkron, int subpix, int nthreads,
+			  double *sum, double *sumerr, double *area, short *flag,
+			  double *kronrad, short *kronflag)
+{
+  aperconv cv;
+  apersrc *order;
+  multiaper *aps, *ap;
+  double cxx, cyy, cxy, rk, rkron2, *rows, *areas, *area1, *kronrad1;
+  int i, j, l, m, erri, st, status;
+  short *kronflag1;
+  STATS_DECL(t0);
+
+  if (subpix < 0)
+    return ILLEGAL_SUBPIX;
+  if (nr < 0 || nann < 0)
+    return ILLEGAL_APER_PARAMS;
+  if ((status = get_aperconv(dtype, edtype, mdtype, error, mask, inflag,
+			     &cv)))
+    return status;
+  m = nr + nann;
+  if (m == 0 && !rkron)
+    return RETURN_OK;
+  if ((status = sort_sources(n, x, y, &order)))
+    return status;
+  STATS_START(t0);
+
+  /* sources are only processed concurrently with OpenMP */
+#ifdef _OPENMP
+  if (nthreads <= 0)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+
+  /* apertures & row buffers of the current source of each thread, and
+   * their areas if not requested */
+  rows = areas = NULL;
+  if (!(aps = (multiaper *)malloc((size_t)nthreads*(m+1)*sizeof(multiaper)))
+      || !(rows = (double *)malloc((size_t)nthreads*4*w*sizeof(double)))
+      || (!area && !(areas = (double *)malloc((size_t)nthreads*(m+1)*
+					       sizeof(double)))))
+    {
+      free(rows);
+      free(aps);
+      free(order);
+      return MEMORY_ALLOC_ERROR;
+    }
+
+  /* report the error of the first failing source, whatever the order */
+  erri = n;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, APER_BATCH_CHUNK) \
+  num_threads(nthreads) private(i, j, st, ap, cxx, cyy, cxy, rk, rkron2, \
+				area1, kronrad1, kronflag1)
+#endif
+  for (l=0; l<n; l++)
+    {
+      i = order[l].i;
+      j = i*m;
+      ap = aps + SEP_THREAD_NUM()*(m+1);
+      area1 = area? area+j: areas + SEP_THREAD_NUM()*(m+1);
+      rk = rkron? rkron[i]: -1.0;
+      st = (rkron && !(rk >= 0.0))? ILLEGAL_APER_PARAMS:
+	init_ellipse_multi(x[i], y[i], a[i], b[i], theta[i], r+i*nr, nr,
+			   rin+i*nann, rout+i*nann, nann, rk, w, h, ap);
+      if (st == RETURN_OK)
+	{
+	  sep_ellipse_coeffs(a[i], b[i], theta[i], &cxx, &cyy, &cxy);
+	  rkron2 = -1.0;
+	  kronrad1 = NULL;
+	  kronflag1 = NULL;
+	  if (rkron)
+	    {
+	      rkron2 = rk*rk;
+	      kronrad1 = kronrad + i;
+	      kronflag1 = kronflag + i;
+	    }
+	  switch (cv.kind)
+	    {
+	    case APER_KIND_FLT:
+	      MULTI_CALL(_flt);
+	      break;
+	    case APER_KIND_FLT_BYT:
+	      MULTI_CALL(_flt_byt);
+	      break;
+	    case APER_KIND_DBL:
+	      MULTI_CALL(_dbl);
+	      break;
+	    case APER_KIND_DBL_BYT:
+	      MULTI_CALL(_dbl_byt);
+	      break;
+	    default:
+	      MULTI_CALL(_any);
+	    }
+	}
+      else
+	{
+#ifdef _OPENMP
+#pragma omp critical (sep_aper_multi_error)
+#endif
+	  if (i < erri)
+	    {
+	      erri = i;
+	      status = st;
+	    }
+	}
+    }
+
+  free(areas);
+  free(rows);
+  free(aps);
+  free(order);
+  STATS_TIME(t_aper, t0);
+  STATS_ADD(naper, (size_t)n*m);
+  return status;
+}
+#undef MULTI_CALL
+
 
 /* for use in flux_radius */
 static double inverse(double xmax, double *y, int n, double ytarg)
@@ -703,39 +1249,141 @@ void sep_set_ellipse(unsigned char *arr, int w, int h,
  * windowed stats.
  */
 
-int sep_windowed(void *data, void *error, void *mask,
-                 int dtype, int edtype, int mdtype, int w, int h,
-                 double maskthresh, double gain, short inflag,
-                 double x, double y, double sig, int subpix,
-                 double *xout, double *yout, int *niter, short *flag,
-                 double* extrastats)
+/* image read by the windowed position functions, with its converters */
+typedef struct
 {
-  PIXTYPE pix, varpix;
+  void            *data, *mask;
+  array_converter convert;
+  converter       mconvert;
+  int             size, msize;
+  int             w, h;
+  double          maskthresh;
+  short           inflag;
+} winimage;
+
+/* pixels of a box of the image, read once for all the iterations of a
+ * source (and for the following sources, as long as they fall within it):
+ * their values and whether they are masked */
+typedef struct
+{
+  PIXTYPE *pix;
+  BYTE    *masked;
+  int     xmin, xmax, ymin, ymax;  /* box held; xmax, ymax exclusive */
+  size_t  npix;                    /* pixels allocated */
+} winbox;
+
+static int get_winimage(void *data, void *error, void *mask,
+			int dtype, int edtype, int mdtype, int w, int h,
+			double maskthresh, short inflag, winimage *im)
+{
+  converter econvert;
+  int status, esize;
+
+  im->data = data;
+  im->mask = mask;
+  im->mconvert = NULL;
+  im->msize = 0;
+  im->w = w;
+  im->h = h;
+  im->maskthresh = maskthresh;
+  im->inflag = inflag;
+  if ((status = get_array_converter(dtype, &im->convert, &im->size)))
+    return status;
+  /* the error is not used yet, but its dtype is still checked */
+  if (error && (status = get_converter(edtype, &econvert, &esize)))
+    return status;
+  if (mask && (status = get_converter(mdtype, &im->mconvert, &im->msize)))
+    return status;
+  return RETURN_OK;
+}
+
+/* read the box of radius r (plus a margin, for the moves of the centre)
+ * around x, y into b */
+static int read_winbox(winimage *im, double x, double y, double r,
+		       winbox *b)
+{
+  BYTE *maskt;
+  size_t pos, npix;
+  int ix, iy, bw, xmin, xmax, ymin, ymax, status;
+  short flag;
+  PIXTYPE *pix;
+  BYTE *masked;
+
+  status = RETURN_OK;
+  flag = 0;  /* truncation is flagged by the iterations */
+  boxextent(x, y, r+WINPOS_MARGIN, r+WINPOS_MARGIN, im->w, im->h,
+	    &xmin, &xmax, &ymin, &ymax, &flag);
+  if (xmax < xmin)
+    xmax = xmin;
+  if (ymax < ymin)
+    ymax = ymin;
+  bw = xmax - xmin;
+  npix = (size_t)bw*(ymax - ymin);
+
+  if (npix > b->npix)
+    {
+      free(b->pix);
+      free(b->masked);
+      b->masked = NULL;
+      b->npix = 0;
+      b->xmin = b->xmax = b->ymin = b->ymax = 0;
+      QMALLOC(b->pix, PIXTYPE, npix, status);
+      if (im->mask)
+	QMALLOC(b->masked, BYTE, npix, status);
+      b->npix = npix;
+    }
+
+  for (iy=ymin; iy<ymax; iy++)
+    {
+      pos = (size_t)iy*im->w + xmin;
+      pix = b->pix + (size_t)(iy-ymin)*bw;
+      im->convert((BYTE *)im->data + pos*im->size, bw, pix);
+      if (im->mask)
+	{
+	  maskt = (BYTE *)im->mask + pos*im->msize;
+	  masked = b->masked + (size_t)(iy-ymin)*bw;
+	  for (ix=0; ix<bw; ix++, maskt+=im->msize)
+	    masked[ix] = (im->mconvert(maskt) > im->maskthresh);
+	}
+    }
+  b->xmin = xmin;
+  b->xmax = xmax;
+  b->ymin = ymin;
+  b->ymax = ymax;
+
+ exit:
+  return status;
+}
+
+static void free_winbox(winbox *b)
+{
+  free(b->pix);
+  free(b->masked);
+}
+
+/* iterate the windowed position of one source, reading its pixels from b
+ * (updated as needed). Only the pixels of each row that might be within the
+ * aperture are visited, in the same order as a scan of the whole box, so
+ * that the sums are the same. */
+static int windowed_core(winimage *im, double x, double y, double sig,
+			 int subpix, winbox *b, double *xout, double *yout,
+			 int *niter, short *flag)
+{
+  PIXTYPE pix;
   double dx, dy, dx1, dy2, offset, scale, scale2, tmp, dxpos, dypos, weight;
   double maskarea, maskweight, maskdxpos, maskdypos;
-  double r, tv, twv, sigtv, totarea, overlap, rpix2, invtwosig2;
-  double wpix;
-  int i, ix, iy, xmin, xmax, ymin, ymax, sx, sy, status, size, esize, msize;
-  long pos;
-  short errisarray, errisstd;
-  BYTE *datat, *errort, *maskt;
-  converter convert, econvert, mconvert;
+  double r, tv, twv, totarea, overlap, rpix2, invtwosig2;
+  double wpix, half;
   double r2, r_in2, r_out2;
+  size_t j;
+  int i, ix, iy, ix0, ix1, bw, xmin, xmax, ymin, ymax, sx, sy, status;
+  short masked;
 
-  /* input checks */
   if (sig < 0.0)
     return ILLEGAL_APER_PARAMS;
-  if (subpix < 0)
-    return ILLEGAL_SUBPIX;
 
   /* initializations */
-  size = esize = msize = 0;
-  tv = sigtv = 0.0;
-  overlap = totarea = maskweight = 0.0;
-  datat = maskt = NULL;
-  errort = error;
   *flag = 0;
-  varpix = 0.0;
   scale = 1.0/subpix;
   scale2 = scale*scale;
   offset = 0.5*(scale-1.0);
@@ -748,58 +1396,44 @@ int sep_windowed(void *data, void *error, void *mask,
   r2 = r*r;
   oversamp_ann_circle(r, &r_in2, &r_out2);
 
-  /* get data converter(s) for input array(s) */
-  if ((status = get_converter(dtype, &convert, &size)))
-    return status;
-  if (error && (status = get_converter(edtype, &econvert, &esize)))
-    return status;
-  if (mask && (status = get_converter(mdtype, &mconvert, &msize)))
-    return status;
-
-  /* get options */
-  errisarray = inflag & SEP_ERROR_IS_ARRAY;
-  if (!error)
-    errisarray = 0; /* in case user set flag but error is NULL */
-  errisstd = !(inflag & SEP_ERROR_IS_VAR);
-
-  /* If error exists and is scalar, set the pixel variance now */
-  if (error && !errisarray)
-    {
-      varpix = econvert(errort);
-      if (errisstd)
-        varpix *= varpix;
-    }
-
   /* iteration loop */
   for (i=0; i<WINPOS_NITERMAX; i++)
     {
 
-      /* get extent of box */
-      boxextent(x, y, r, r, w, h,
+      /* get extent of box, and read it unless already held */
+      boxextent(x, y, r, r, im->w, im->h,
                 &xmin, &xmax, &ymin, &ymax, flag);
-
-      /* TODO: initialize values */
-      //mx2ph
-      //my2ph
-      // esum, emxy, emx2, emy2, mx2, my2, mxy
-      tv = twv = sigtv = 0.0;
-      overlap = totarea = maskarea = maskweight = 0.0;
+      if (xmin < xmax && ymin < ymax &&
+	  (xmin < b->xmin || xmax > b->xmax ||
+	   ymin < b->ymin || ymax > b->ymax) &&
+	  (status = read_winbox(im, x, y, r, b)))
+	return status;
+      bw = b->xmax - b->xmin;
+
+      tv = twv = 0.0;
+      totarea = maskarea = maskweight = 0.0;
       dxpos = dypos = 0.0;
       maskdxpos = maskdypos = 0.0;
 
       /* loop over rows in the box */
       for (iy=ymin; iy<ymax; iy++)
         {
-          /* set pointers to the start of this row */
-          pos = (iy%h) * w + xmin;
-          datat = data + pos*size;
-          if (errisarray)
-            errort = error + pos*esize;
-          if (mask)
-            maskt = mask + pos*msize;
+	  /* pixels of this row that might be within the aperture, with a
+	   * pixel to spare on each side for rounding */
+	  dy = iy - y;
+	  if (!(dy*dy < r_out2))
+	    continue;
+	  half = sqrt(r_out2 - dy*dy);
+	  ix0 = (int)floor(x - half);
+	  ix1 = (int)floor(x + half) + 2;
+	  if (ix0 < xmin)
+	    ix0 = xmin;
+	  if (ix1 > xmax)
+	    ix1 = xmax;
+	  j = (size_t)(iy - b->ymin)*bw + (ix0 - b->xmin);
 
           /* loop over pixels in this row */
-          for (ix=xmin; ix<xmax; ix++)
+          for (ix=ix0; ix<ix1; ix++, j++)
             {
               dx = ix - x;
               dy = iy - y;
@@ -830,14 +1464,8 @@ int sep_windowed(void *data, void *error, void *mask,
                     /* definitely fully in aperture */
                     overlap = 1.0;
 
-                  /* get pixel value and variance value */
-                  pix = convert(datat);
-                  if (errisarray)
-                    {
-                      varpix = econvert(errort);
-                      if (errisstd)
-                        varpix *= varpix;
-                    }
+                  pix = b->pix[j];
+		  masked = im->mask? b->masked[j]: 0;
 
                   /* offset of this pixel from center */
                   dx = ix - x; 
@@ -846,7 +1474,7 @@ int sep_windowed(void *data, void *error, void *mask,
                   /* weight by gaussian */
                   weight = exp(-rpix2*invtwosig2);
 
-                  if (mask && (mconvert(maskt) > maskthresh))
+                  if (masked)
                     {
                       *flag |= SEP_APER_HASMASKED;
                       maskarea += overlap;
@@ -866,12 +1494,6 @@ int sep_windowed(void *data, void *error, void *mask,
                   totarea += overlap;
 
                 } /* closes "if pixel might be within aperture" */
-
-              /* increment pointers by one element */
-              datat += size;
-              if (errisarray)
-                errort += esize;
-              maskt += msize;
             } /* closes loop over x */
         } /* closes loop over y */
 
@@ -888,10 +1510,10 @@ int sep_windowed(void *data, void *error, void *mask,
        * the masked pixels had the value of the average unmasked value
        * in the aperture.
        */
-      if (mask)
+      if (im->mask)
         {
           /* this option will probably not yield accurate values */
-          if (inflag & SEP_MASK_IGNORE)
+          if (im->inflag & SEP_MASK_IGNORE)
             totarea -= maskarea;
           else
             {
@@ -922,5 +1544,100 @@ int sep_windowed(void *data, void *error, void *mask,
   *yout = y;
   *niter = i+1;
 
+  return RETURN_OK;
+}
+
+int sep_windowed(void *data, void *error, void *mask,
+                 int dtype, int edtype, int mdtype, int w, int h,
+                 double maskthresh, double gain, short inflag,
+                 double x, double y, double sig, int subpix,
+                 double *xout, double *yout, int *niter, short *flag,
+                 double* extrastats)
+{
+  winimage im;
+  winbox b;
+  int status;
+
+  /* input checks */
+  if (sig < 0.0)
+    return ILLEGAL_APER_PARAMS;
+  if (subpix < 0)
+    return ILLEGAL_SUBPIX;
+
+  if ((status = get_winimage(data, error, mask, dtype, edtype, mdtype, w, h,
+			     maskthresh, inflag, &im)))
+    return status;
+  memset(&b, 0, sizeof(winbox));
+  status = windowed_core(&im, x, y, sig, subpix, &b, xout, yout, niter,
+			 flag);
+  free_winbox(&b);
+  return status;
+}
+
+int sep_windowed_batch(void *data, void *error, void *mask,
+		       int dtype, int edtype, int mdtype, int w, int h,
+		       double maskthresh, double gain, short inflag,
+		       int n, const double *x, const double *y,
+		       const double *sig, int subpix, int nthreads,
+		       double *xout, double *yout, int *niter, short *flag)
+{
+  winimage im;
+  winbox *boxes;
+  apersrc *order;
+  int i, l, erri, st, status;
+
+  if (subpix < 0)
+    return ILLEGAL_SUBPIX;
+  if ((status = get_winimage(data, error, mask, dtype, edtype, mdtype, w, h,
+			     maskthresh, inflag, &im)))
+    return status;
+  if ((status = sort_sources(n, x, y, &order)))
+    return status;
+
+  /* sources are only processed concurrently with OpenMP */
+#ifdef _OPENMP
+  if (nthreads <= 0)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+
+  /* pixels of the current box of each thread */
+  if (!(boxes = (winbox *)calloc(nthreads, sizeof(winbox))))
+    {
+      free(order);
+      return MEMORY_ALLOC_ERROR;
+    }
+
+  /* report the error of the first failing source, whatever the order */
+  erri = n;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, APER_BATCH_CHUNK) \
+  num_threads(nthreads) private(i, st)
+#endif
+  for (l=0; l<n; l++)
+    {
+      i = order[l].i;
+      st = windowed_core(&im, x[i], y[i], sig[i], subpix,
+			 boxes + SEP_THREAD_NUM(), xout+i, yout+i, niter+i,
+			 flag+i);
+      if (st != RETURN_OK)
+	{
+#ifdef _OPENMP
+#pragma omp critical (sep_windowed_batch_error)
+#endif
+	  if (i < erri)
+	    {
+	      erri = i;
+	      status = st;
+	    }
+	}
+    }
+
+  for (l=0; l<nthreads; l++)
+    free_winbox(boxes+l);
+  free(boxes);
+  free(order);
   return status;
 }
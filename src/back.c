@@ -20,6 +20,7 @@
 *
 *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,184 +38,366 @@ typedef struct
 {
   float	 mode, mean, sigma;	/* Background mode, mean and sigma */
   LONG	 *histo;	       	/* Pointer to a histogram */
+  ULONG	 *cumhisto;		/* room for its cumulative sums (or NULL) */
   int	 nlevels;		/* Nb of histogram bins */
   float	 qzero, qscale;		/* Position of histogram */
   float	 lcut, hcut;		/* Histogram cuts */
   int	 npix;			/* Number of pixels involved */
 } backstruct;
 
-void backhisto(backstruct *, PIXTYPE *, PIXTYPE *,
-	       int, int, int, int, PIXTYPE);
-void backstat(backstruct *, PIXTYPE *, PIXTYPE *,
-	      int, int, int, int, PIXTYPE);
+void backhisto(backstruct *, PIXTYPE *, PIXTYPE *, int *, int, PIXTYPE);
+void backstat(backstruct *, PIXTYPE *, PIXTYPE *, int, PIXTYPE);
 int filterback(sepbackmap *bkmap, int fw, int fh, float fthresh);
 float backguess(backstruct *, float *, float *);
+int backmedsplit(ULONG *cum, int lcut, int hcut);
+void backmoments(LONG *histo, int lcut, int hcut, double *mea, double *sig);
 int makebackspline(sepbackmap *, float *, float *);
 
 
+/* Working memory for processing a row of background boxes, one box at a
+ * time. There is one such arena per thread, reused for all rows processed by
+ * the thread. */
+typedef struct
+{
+  PIXTYPE     *buf, *mbuf;   /* image and mask box converted to PIXTYPE */
+  int         *bins;         /* histogram bin of each pixel of the box */
+  backstruct  backmesh;      /* info about the background "box" */
+  LONG        *histo;        /* room for the histogram of the box */
+  ULONG       *cumhisto;     /* room for its cumulative sums */
+} backarena;
+
+/* Interpolation weights along x: the columns in [start[k], start[k+1])
+ * lie between nodes node[k] and node[k]+1 */
+typedef struct
+{
+  int    nspan;              /* number of spans of columns */
+  int    *start;             /* first column of each span (nspan+1) */
+  int    *node;              /* left node of each span */
+  float  *cdx, *cdx2;        /* 1-dx and (1-dx)^2-1 for each column */
+  float  *dx, *dx2;          /* dx and dx^2-1 for each column */
+} backcols;
+
+/* Image and mask types of a background estimation */
+typedef struct
+{
+  int              dtype, mdtype;    /* image and mask datatype codes */
+  int              elsize, melsize;  /* size (in bytes) of their elements */
+  size_t           stride, mstride;  /* bytes between their lines */
+  array_converter  convert, mconvert;
+  int              hasmask;
+  PIXTYPE          maskthresh;
+} backinput;
+
+int newbackmap(int w, int h, int bw, int bh, sepbackmap **bkm);
+int initbackinput(backinput *in, int dtype, int mdtype, int w,
+		  size_t stride, size_t mstride, int hasmask, float mthresh);
+int initbackarena(backarena *a, backinput *in, sepbackmap *bkmap);
+void freebackarena(backarena *a);
+void backrow(sepbackmap *bkmap, backarena *a, backinput *in, int j,
+	     void *imt, void *maskt);
+int finishback(sepbackmap *bkmap, int fw, int fh, float fthresh);
+int makebackcols(sepbackmap *bkmap, backcols *cols);
+void freebackcols(backcols *cols);
+void backline_spline(sepbackmap *bkmap, float *map, float *dmap,
+		     backcols *cols, int y, int x0, int x1, float *work,
+		     float *line);
+int backline_one(sepbackmap *bkmap, float *map, float *dmap, int y,
+		 float *line);
+int readbackheader(const BYTE *buf, size_t size, sepbackmap *bkmap,
+		   int *swap);
+void swapbytes4(void *ptr, size_t n);
+
 int sep_makeback(void *im, void *mask, int dtype, int mdtype, int w, int h,
 		 int bw, int bh, float mthresh, int fw, int fh,
 		 float fthresh, sepbackmap **bkm)
 {
-  BYTE *imt, *maskt;
-  int npix;                   /* size of image */
-  int nx, ny, nb;             /* number of background boxes in x, y, total */
-  int bufsize;                /* size of a "row" of boxes in pixels (w*bh) */
-  int elsize;                 /* size (in bytes) of an image array element */
-  int melsize;                /* size (in bytes) of a mask array element */
-  PIXTYPE *buf, *buft, *mbuf, *mbuft;
-  PIXTYPE maskthresh;
-  array_converter convert, mconvert;
-  backstruct *backmesh, *bm;  /* info about each background "box" */
-  sepbackmap *bkmap;          /* output */
-  int j,k,m, status;
+  return sep_makeback_parallel(im, mask, dtype, mdtype, w, h, bw, bh,
+			       mthresh, fw, fh, fthresh, 1, bkm);
+}
 
-  status = RETURN_OK;
-  npix = w*h;
-  bufsize = w*bh;
-  maskthresh = mask? mthresh: 0.0;
+/*****************************************************************************/
+/* Allocate a background map for an image of w x h pixels in boxes of
+ * bw x bh, with the node values left to be filled */
 
-  backmesh = bm = NULL;
+int newbackmap(int w, int h, int bw, int bh, sepbackmap **bkm)
+{
+  sepbackmap *bkmap;
+  int nx, ny, status;
+
+  status = RETURN_OK;
   bkmap = NULL;
-  buf = mbuf = buft = mbuft = NULL;
-  convert = mconvert = NULL;
 
   /* determine number of background boxes */
   if ((nx = (w-1)/bw + 1) < 1)
     nx = 1;
   if ((ny = (h-1)/bh + 1) < 1)
     ny = 1;
-  nb = nx*ny;
-
-  /* Allocate temp memory & initialize */
-  QMALLOC(backmesh, backstruct, nx, status);
-  bm = backmesh;
-  for (m=nx; m--; bm++)
-    bm->histo=NULL;
 
-  /* Allocate the returned struct */
   QMALLOC(bkmap, sepbackmap, 1, status);
   bkmap->w = w;
   bkmap->h = h;
   bkmap->nx = nx;
   bkmap->ny = ny;
-  bkmap->n = nb;
+  bkmap->n = nx*ny;
   bkmap->bw = bw;
   bkmap->bh = bh;
   bkmap->back = NULL;
   bkmap->sigma = NULL;
   bkmap->dback = NULL;
   bkmap->dsigma = NULL;
-  QMALLOC(bkmap->back, float, nb, status);
-  QMALLOC(bkmap->sigma, float, nb, status);
-  QMALLOC(bkmap->dback, float, nb, status);
-  QMALLOC(bkmap->dsigma, float, nb, status);
+  QMALLOC(bkmap->back, float, bkmap->n, status);
+  QMALLOC(bkmap->sigma, float, bkmap->n, status);
+  QMALLOC(bkmap->dback, float, bkmap->n, status);
+  QMALLOC(bkmap->dsigma, float, bkmap->n, status);
 
-  /* cast input array pointers. These are used to step through the arrays. */
-  imt = (BYTE *)im;
-  maskt = (BYTE *)mask;
+  *bkm = bkmap;
+  return status;
+
+ exit:
+  sep_freeback(bkmap);
+  *bkm = NULL;
+  return status;
+}
+
+/* Get the converters of the image and (if hasmask) mask types, and the
+   strides of lines of width w (contiguous lines if 0) */
+int initbackinput(backinput *in, int dtype, int mdtype, int w,
+		  size_t stride, size_t mstride, int hasmask, float mthresh)
+{
+  char errtext[80];
+  int status;
+
+  in->dtype = dtype;
+  in->mdtype = mdtype;
+  in->hasmask = hasmask;
+  in->maskthresh = hasmask? mthresh: 0.0;
+  in->convert = in->mconvert = NULL;
+  in->elsize = in->melsize = 0;
 
   /* get the correct array converter and element size, based on dtype code */
-  status = get_array_converter(dtype, &convert, &elsize);
-  if (status != RETURN_OK)
-    goto exit;
-  if (mask)
-    {
-      status = get_array_converter(mdtype, &mconvert, &melsize);
-      if (status != RETURN_OK)
-	goto exit;
-    }
+  if ((status = get_array_converter(dtype, &in->convert, &in->elsize)) !=
+      RETURN_OK)
+    return status;
+  if (hasmask &&
+      (status = get_array_converter(mdtype, &in->mconvert, &in->melsize)) !=
+      RETURN_OK)
+    return status;
 
-  /* If the input array type is not PIXTYPE, allocate a buffer to hold
-     converted values */
-  if (dtype != PIXDTYPE)
+  in->stride = stride? stride: (size_t)in->elsize*w;
+  in->mstride = mstride? mstride: (size_t)in->melsize*w;
+  if (in->stride < (size_t)in->elsize*w ||
+      in->mstride < (size_t)in->melsize*w)
     {
-      QMALLOC(buf, PIXTYPE, bufsize, status);
-      buft = buf;
-      if (status != RETURN_OK)
-	goto exit;
-    }
-  if (mask && (mdtype != PIXDTYPE))
-    {
-      QMALLOC(mbuf, PIXTYPE, bufsize, status);
-      mbuft = mbuf;
-      if (status != RETURN_OK)
-	goto exit;
+      sprintf(errtext, "in background: %lu or %lu bytes for lines of %d",
+	      (unsigned long)stride, (unsigned long)mstride, w);
+      put_errdetail(errtext);
+      return ILLEGAL_STRIDE;
     }
+  return status;
+}
 
-  /* loop over rows of background boxes.
-   * (here, we could loop over individual boxes rather than entire
-   * rows, but this is convenient for converting the image and mask
-   * arrays.  This is also how it is originally done in SExtractor,
-   * because the pixel buffers are only read in from disk in
-   * increments of a row of background boxes at a time.)
-   */
-  for (j=0; j<ny; j++)
-    {
-      /* if the last row, modify the width appropriately*/
-      if (j == ny-1 && npix%bufsize)
-        bufsize = npix%bufsize;
+/* Allocate the working memory of a row of boxes: buffers to hold the
+   converted values of one box, and its histogram */
+int initbackarena(backarena *a, backinput *in, sepbackmap *bkmap)
+{
+  int bufsize, status;
 
-      /* convert this row to PIXTYPE and store in buffer(s)*/
-      if (dtype != PIXDTYPE)
-	convert(imt, bufsize, buft);
-      else
-	buft = (PIXTYPE *)imt;
+  status = RETURN_OK;
+  memset(a, 0, sizeof(backarena));
+  bufsize = (bkmap->w < bkmap->bw? bkmap->w: bkmap->bw) *
+    (bkmap->h < bkmap->bh? bkmap->h: bkmap->bh);
+  QMALLOC(a->buf, PIXTYPE, bufsize, status);
+  if (in->hasmask)
+    QMALLOC(a->mbuf, PIXTYPE, bufsize, status);
+  QMALLOC(a->bins, int, bufsize, status);
+  QMALLOC(a->histo, LONG, QUANTIF_NMAXLEVELS, status);
+  QMALLOC(a->cumhisto, ULONG, QUANTIF_NMAXLEVELS+1, status);
+  return status;
 
-      if (mask)
+ exit:
+  freebackarena(a);
+  return status;
+}
+
+void freebackarena(backarena *a)
+{
+  free(a->buf);
+  free(a->mbuf);
+  free(a->bins);
+  free(a->histo);
+  free(a->cumhisto);
+  memset(a, 0, sizeof(backarena));
+}
+
+/* Compute the background and sigma of the boxes of row j, from the image
+   and mask (can be NULL) of the row, starting at its first pixel. Each box
+   is converted to PIXTYPE into a contiguous buffer, small enough to stay in
+   cache for the passes of backstat() and backhisto() over it, so that the
+   image is only read once. */
+void backrow(sepbackmap *bkmap, backarena *a, backinput *in, int j,
+	     void *imt, void *maskt)
+{
+  backstruct *bm;
+  BYTE *boxt, *mboxt;
+  int bw, bh, w, m, nx, y;
+  STATS_DECL(t0);
+  STATS_DECL(t1);
+
+  STATS_START(t0);
+  nx = bkmap->nx;
+  w = bkmap->w;
+  bm = &a->backmesh;
+
+  /* if the last row, modify the height appropriately */
+  bh = (j == bkmap->ny-1)? bkmap->h - j*bkmap->bh: bkmap->bh;
+
+  for (m=0; m<nx; m++)
+    {
+      /* the last box of the row may be narrower */
+      bw = bkmap->bw;
+      if (m == nx-1 && w%bw)
+	bw = w%bw;
+
+      /* convert this box to PIXTYPE and store in buffer(s) */
+      boxt = (BYTE *)imt + (size_t)in->elsize*m*bkmap->bw;
+      for (y=0; y<bh; y++, boxt+=in->stride)
+	in->convert(boxt, bw, a->buf + y*bw);
+      if (maskt)
 	{
-	  if (mdtype != PIXDTYPE)
-	    mconvert(maskt, bufsize, mbuft);
-	  else
-	    mbuft = (PIXTYPE *)maskt;
+	  mboxt = (BYTE *)maskt + (size_t)in->melsize*m*bkmap->bw;
+	  for (y=0; y<bh; y++, mboxt+=in->mstride)
+	    in->mconvert(mboxt, bw, a->mbuf + y*bw);
 	}
 
-      /* Get clipped mean, sigma for all boxes in the row */
-      backstat(backmesh, buft, mbuft, bufsize, nx, w, bw, maskthresh);
-
-      /* Allocate histograms in each box in this row. */
-      bm = backmesh;
-      for (m=nx; m--; bm++)
-	if (bm->mean <= -BIG)
-	  bm->histo=NULL;
-	else
-	  QCALLOC(bm->histo, LONG, bm->nlevels, status);
-      backhisto(backmesh, buft, mbuft, bufsize, nx, w, bw, maskthresh);
-
-      /* Compute background statistics from the histograms */
-      bm = backmesh;
-      for (m=0; m<nx; m++, bm++)
+      /* Get clipped mean, sigma for the box */
+      STATS_START(t1);
+      backstat(bm, a->buf, maskt? a->mbuf: NULL, bw*bh, in->maskthresh);
+      STATS_TIME(t_backstat, t1);
+
+      /* Fill its histogram */
+      STATS_START(t1);
+      if (bm->mean <= -BIG)
+	bm->histo=NULL;
+      else
 	{
-	  k = m+nx*j;
-	  backguess(bm, bkmap->back+k, bkmap->sigma+k);
-	  free(bm->histo);
-	  bm->histo = NULL;
+	  bm->histo = a->histo;
+	  bm->cumhisto = a->cumhisto;
+	  memset(bm->histo, 0, bm->nlevels*sizeof(LONG));
+	  backhisto(bm, a->buf, maskt? a->mbuf: NULL, a->bins, bw*bh,
+		    in->maskthresh);
 	}
+      STATS_TIME(t_backhisto, t1);
 
-      /* increment array pointers to next row of background boxes */
-      imt += elsize * bufsize;
-      if (mask)
-	maskt += melsize * bufsize;
+      /* Compute background statistics from the histogram */
+      STATS_START(t1);
+      backguess(bm, bkmap->back+m+nx*j, bkmap->sigma+m+nx*j);
+      STATS_TIME(t_backguess, t1);
     }
 
-  /* free memory */
-  free(buf);
-  buf = NULL;
-  free(mbuf);
-  mbuf = NULL;
-  free(backmesh);
-  backmesh = NULL;
+  STATS_ADD(nbacktile, nx);
+  STATS_TIME(t_back, t0);
+}
+
+/* Filter the node values, once all the rows have been computed, and
+   compute the 2nd derivatives of the splines */
+int finishback(sepbackmap *bkmap, int fw, int fh, float fthresh)
+{
+  int status;
+  STATS_DECL(t0);
+  STATS_DECL(t1);
 
   /* Median-filter and check suitability of the background map */
-  if ((status = filterback(bkmap, fw, fh, fthresh)) != RETURN_OK)
+  STATS_START(t0);
+  status = filterback(bkmap, fw, fh, fthresh);
+  STATS_TIME(t_backfilter, t0);
+  if (status != RETURN_OK)
     goto exit;
 
   /* Compute 2nd derivatives along the y-direction */
-  if ((status = makebackspline(bkmap, bkmap->back, bkmap->dback)) !=
+  STATS_START(t1);
+  if ((status = makebackspline(bkmap, bkmap->back, bkmap->dback)) ==
       RETURN_OK)
+    status = makebackspline(bkmap, bkmap->sigma, bkmap->dsigma);
+  STATS_TIME(t_backspline, t1);
+
+ exit:
+  STATS_TIME(t_back, t0);
+  return status;
+}
+
+int sep_makeback_parallel(void *im, void *mask, int dtype, int mdtype,
+			  int w, int h, int bw, int bh, float mthresh,
+			  int fw, int fh, float fthresh, int nthreads,
+			  sepbackmap **bkm)
+{
+  return sep_makeback_strided(im, mask, dtype, mdtype, 0, 0, w, h, bw, bh,
+			      mthresh, fw, fh, fthresh, nthreads, bkm);
+}
+
+int sep_makeback_strided(void *im, void *mask, int dtype, int mdtype,
+			 size_t imstride, size_t mstride,
+			 int w, int h, int bw, int bh, float mthresh,
+			 int fw, int fh, float fthresh, int nthreads,
+			 sepbackmap **bkm)
+{
+  BYTE *imt, *maskt;
+  backinput in;
+  backarena *arenas;          /* per-thread working memory */
+  sepbackmap *bkmap;          /* output */
+  int i, j, status;
+
+  arenas = NULL;
+  bkmap = NULL;
+
+  if ((status = newbackmap(w, h, bw, bh, &bkmap)) != RETURN_OK)
     goto exit;
-  if ((status = makebackspline(bkmap, bkmap->sigma, bkmap->dsigma)) !=
-      RETURN_OK)
+  if ((status = initbackinput(&in, dtype, mdtype, w, imstride, mstride,
+			      mask != NULL, mthresh)) != RETURN_OK)
+    goto exit;
+
+  /* rows of boxes are only processed concurrently with OpenMP */
+#ifdef _OPENMP
+  if (nthreads <= 0)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  if (nthreads > bkmap->ny)
+    nthreads = bkmap->ny;
+
+  /* Allocate temp memory for each thread. */
+  QCALLOC(arenas, backarena, nthreads, status);
+  for (i=0; i<nthreads; i++)
+    if ((status = initbackarena(arenas+i, &in, bkmap)) != RETURN_OK)
+      goto exit;
+
+  /* loop over rows of background boxes.
+   * (here, we could loop over individual boxes rather than entire
+   * rows, but this is convenient for converting the image and mask
+   * arrays.  This is also how it is originally done in SExtractor,
+   * because the pixel buffers are only read in from disk in
+   * increments of a row of background boxes at a time.)
+   * Rows are independent of each other, so that they can be processed
+   * concurrently.
+   */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(nthreads) \
+  private(imt, maskt)
+#endif
+  for (j=0; j<bkmap->ny; j++)
+    {
+      imt = (BYTE *)im + in.stride*bh*j;
+      maskt = mask? (BYTE *)mask + in.mstride*bh*j: NULL;
+      backrow(bkmap, arenas + SEP_THREAD_NUM(), &in, j, imt, maskt);
+    }
+
+  /* free memory */
+  for (i=0; i<nthreads; i++)
+    freebackarena(arenas+i);
+  free(arenas);
+  arenas = NULL;
+
+  if ((status = finishback(bkmap, fw, fh, fthresh)) != RETURN_OK)
     goto exit;
 
   *bkm = bkmap;
@@ -222,204 +405,282 @@ int sep_makeback(void *im, void *mask, int dtype, int mdtype, int w, int h,
 
   /* If we encountered a problem, clean up any allocated memory */
  exit:
-  free(buf);
-  free(mbuf);
-  if (backmesh)
-    {
-      bm = backmesh;
-      for (m=0; m<nx; m++, bm++)
-	free(bm->histo);
-    }
-  free(backmesh);
+  if (arenas)
+    for (i=0; i<nthreads; i++)
+      freebackarena(arenas+i);
+  free(arenas);
   sep_freeback(bkmap);
   *bkm = NULL;
   return status;
 }
 
+/****************************** backbuilder *********************************/
+/* Background estimation from an image supplied one row of boxes at a time:
+ * only the working memory of one row and the node maps are kept. */
+
+struct sep_backbuilder
+{
+  sepbackmap  *bkmap;        /* map being built */
+  backinput   in;
+  backarena   arena;
+  int         fw, fh;        /* filter size in tiles */
+  float       fthresh;       /* filter threshold */
+  int         row;           /* next row of boxes */
+};
+
+int sep_backbuilder_new(int dtype, int mdtype, int w, int h, int bw, int bh,
+			float mthresh, int fw, int fh, float fthresh,
+			int hasmask, sep_backbuilder **bb)
+{
+  sep_backbuilder *b;
+  int status;
+
+  status = RETURN_OK;
+  *bb = NULL;
+  QCALLOC(b, sep_backbuilder, 1, status);
+  b->fw = fw;
+  b->fh = fh;
+  b->fthresh = fthresh;
+  if ((status = newbackmap(w, h, bw, bh, &b->bkmap)) != RETURN_OK)
+    goto exit;
+  if ((status = initbackinput(&b->in, dtype, mdtype, w, 0, 0, hasmask,
+			      mthresh)) != RETURN_OK)
+    goto exit;
+  if ((status = initbackarena(&b->arena, &b->in, b->bkmap)) != RETURN_OK)
+    goto exit;
+
+  *bb = b;
+  return status;
+
+ exit:
+  sep_backbuilder_free(b);
+  return status;
+}
+
+int sep_backbuilder_addrow(sep_backbuilder *bb, void *im, void *mask)
+{
+  char errtext[80];
+
+  if (bb->row >= bb->bkmap->ny || (mask != NULL) != bb->in.hasmask)
+    {
+      sprintf(errtext, "in sep_backbuilder_addrow(): row %d of %d%s",
+	      bb->row, bb->bkmap->ny,
+	      ((mask != NULL) != bb->in.hasmask)? ", mask mismatch": "");
+      put_errdetail(errtext);
+      return ILLEGAL_BACK_ROW;
+    }
+  backrow(bb->bkmap, &bb->arena, &bb->in, bb->row++, im, mask);
+  return RETURN_OK;
+}
+
+int sep_backbuilder_finish(sep_backbuilder *bb, sepbackmap **bkmap)
+{
+  char errtext[80];
+  int status;
+
+  *bkmap = NULL;
+  if (bb->row != bb->bkmap->ny)
+    {
+      sprintf(errtext, "in sep_backbuilder_finish(): %d of %d rows",
+	      bb->row, bb->bkmap->ny);
+      put_errdetail(errtext);
+      return ILLEGAL_BACK_ROW;
+    }
+
+  freebackarena(&bb->arena);
+  if ((status = finishback(bb->bkmap, bb->fw, bb->fh, bb->fthresh)) !=
+      RETURN_OK)
+    return status;
+  *bkmap = bb->bkmap;
+  bb->bkmap = NULL;
+  return status;
+}
+
+void sep_backbuilder_free(sep_backbuilder *bb)
+{
+  if (bb)
+    {
+      sep_freeback(bb->bkmap);
+      freebackarena(&bb->arena);
+    }
+  free(bb);
+}
+
+int sep_makeback_stream(sep_readline_func readline, void *userdata,
+			int dtype, int mdtype, int w, int h, int bw, int bh,
+			float mthresh, int fw, int fh, float fthresh,
+			int hasmask, sepbackmap **bkmap)
+{
+  sep_backbuilder *bb;
+  BYTE *buf, *mbuf;
+  int elsize, melsize, nrow, y, j, status;
+
+  buf = mbuf = NULL;
+  *bkmap = NULL;
+  if ((status = sep_backbuilder_new(dtype, mdtype, w, h, bw, bh, mthresh,
+				    fw, fh, fthresh, hasmask, &bb)) !=
+      RETURN_OK)
+    return status;
+  elsize = bb->in.elsize;
+  melsize = bb->in.melsize;
+
+  /* one row of boxes of the image and mask, as supplied */
+  QMALLOC(buf, BYTE, (size_t)elsize*w*bh, status);
+  if (hasmask)
+    QMALLOC(mbuf, BYTE, (size_t)melsize*w*bh, status);
+
+  for (j=y=0; j<bb->bkmap->ny; j++)
+    {
+      nrow = (j == bb->bkmap->ny-1)? h - j*bh: bh;
+      for (; nrow--; y++)
+	if (readline(userdata, y,
+		     buf + (size_t)elsize*w*(y - j*bh),
+		     mbuf? mbuf + (size_t)melsize*w*(y - j*bh): NULL))
+	  {
+	    status = LINE_READ_ERROR;
+	    goto exit;
+	  }
+      if ((status = sep_backbuilder_addrow(bb, buf, mbuf)) != RETURN_OK)
+	goto exit;
+    }
+
+  status = sep_backbuilder_finish(bb, bkmap);
+
+ exit:
+  free(buf);
+  free(mbuf);
+  sep_backbuilder_free(bb);
+  return status;
+}
+
 /******************************** backstat **********************************/
 /*
-Compute robust statistical estimators in a row of meshes.
+Compute robust statistical estimators in a mesh, from its npix pixels and
+mask values (wbuf, can be NULL).
 */
-void backstat(backstruct *backmesh,
-	      PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-	      int n, int w, int bw, PIXTYPE maskthresh)
+void backstat(backstruct *bm, PIXTYPE *buf, PIXTYPE *wbuf, int npixtot,
+	      PIXTYPE maskthresh)
 {
-  backstruct	*bm;
-  double	pix, wpix, sig, mean, sigma, step;
-  PIXTYPE	*buft,*wbuft;
+  double	pix, sig, mean, sigma, step;
   PIXTYPE       lcut,hcut;
-  int		m,h,x,y, npix,wnpix, offset, lastbite;
-  
-  h = bufsize/w;  /* height of background boxes in this row */
-  bm = backmesh;
-  offset = w - bw;
+  int		i, npix;
+
   step = sqrt(2/PI)*QUANTIF_NSIGMA/QUANTIF_AMIN;
+  mean = sigma = 0.0;
+  npix = 0;
 
-  for (m = n; m--; bm++,buf+=bw)
+  /* We separate the weighted case at this level to avoid penalty in CPU */
+  if (wbuf)
     {
-      if (!m && (lastbite=w%bw))
-	{
-	  bw = lastbite;
-	  offset = w-bw;
-	}
-
-      mean = sigma = 0.0;
-      buft=buf;
-      npix = 0;
-
-      /* We separate the weighted case at this level to avoid penalty in CPU */
-      if (wbuf)
+      for (i=0; i<npixtot; i++)
 	{
-	  wbuft = wbuf;
-	  for (y=h; y--; buft+=offset,wbuft+=offset)
-	    for (x=bw; x--;)
-	      {
-		pix = *(buft++);
-		if ((wpix = *(wbuft++)) <= maskthresh && pix > -BIG)
-		  {
-		    mean += pix;
-		    sigma += pix*pix;
-		    npix++;
-		  }
-	      }
+	  pix = buf[i];
+	  if (wbuf[i] <= maskthresh && pix > -BIG)
+	    {
+	      mean += pix;
+	      sigma += pix*pix;
+	      npix++;
+	    }
 	}
-      else
-	for (y=h; y--; buft+=offset)
-	  for (x=bw; x--;)
-	    if ((pix = *(buft++)) > -BIG)
-	      {
-		mean += pix;
-		sigma += pix*pix;
-		npix++;
-	      }
-
-      /*-- If not enough valid pixels, discard this mesh */
-      if ((float)npix < (float)(bw*h*BACK_MINGOODFRAC))
+    }
+  else
+    for (i=0; i<npixtot; i++)
+      if ((pix = buf[i]) > -BIG)
 	{
-	  bm->mean = bm->sigma = -BIG;
-	  if (wbuf)
-	    wbuf += bw;
-	  continue;
+	  mean += pix;
+	  sigma += pix*pix;
+	  npix++;
 	}
 
-      mean /= (double)npix;
-      sigma = (sig = sigma/npix - mean*mean)>0.0? sqrt(sig):0.0;
-      lcut = bm->lcut = (PIXTYPE)(mean - 2.0*sigma);
-      hcut = bm->hcut = (PIXTYPE)(mean + 2.0*sigma);
-      mean = sigma = 0.0;
-      npix = wnpix = 0;
-      buft = buf;
-      
-      /* do statistics for this mesh again, with cuts */
-      if (wbuf)
+  /*-- If not enough valid pixels, discard this mesh */
+  if ((float)npix < (float)(npixtot*BACK_MINGOODFRAC))
+    {
+      bm->mean = bm->sigma = -BIG;
+      return;
+    }
+
+  mean /= (double)npix;
+  sigma = (sig = sigma/npix - mean*mean)>0.0? sqrt(sig):0.0;
+  lcut = bm->lcut = (PIXTYPE)(mean - 2.0*sigma);
+  hcut = bm->hcut = (PIXTYPE)(mean + 2.0*sigma);
+  mean = sigma = 0.0;
+  npix = 0;
+
+  /* do statistics for this mesh again, with cuts */
+  if (wbuf)
+    {
+      for (i=0; i<npixtot; i++)
 	{
-	  wbuft=wbuf;
-	  for (y=h; y--; buft+=offset, wbuft+=offset)
-	    for (x=bw; x--;)
-	      {
-		pix = *(buft++);
-		if ((wpix = *(wbuft++))<=maskthresh && pix<=hcut && pix>=lcut)
-		  {
-		    mean += pix;
-		    sigma += pix*pix;
-		    npix++;
-		  }
-	      }
-	}
-      else
-	for (y=h; y--; buft+=offset)
-	  for (x=bw; x--;)
+	  pix = buf[i];
+	  if (wbuf[i]<=maskthresh && pix<=hcut && pix>=lcut)
 	    {
-	      pix = *(buft++);
-	      if (pix<=hcut && pix>=lcut)
-		{
-		  mean += pix;
-		  sigma += pix*pix;
-		  npix++;
-		}
+	      mean += pix;
+	      sigma += pix*pix;
+	      npix++;
 	    }
-
-      bm->npix = npix;
-      mean /= (double)npix;
-      sig = sigma/npix - mean*mean;
-      sigma = sig>0.0 ? sqrt(sig):0.0;
-      bm->mean = mean;
-      bm->sigma = sigma;
-      if ((bm->nlevels = (int)(step*npix+1)) > QUANTIF_NMAXLEVELS)
-	bm->nlevels = QUANTIF_NMAXLEVELS;
-      bm->qscale = sigma>0.0? 2*QUANTIF_NSIGMA*sigma/bm->nlevels : 1.0;
-      bm->qzero = mean - QUANTIF_NSIGMA*sigma;
-
-      if (wbuf)
-	wbuf += bw;
+	}
     }
+  else
+    for (i=0; i<npixtot; i++)
+      {
+	pix = buf[i];
+	if (pix<=hcut && pix>=lcut)
+	  {
+	    mean += pix;
+	    sigma += pix*pix;
+	    npix++;
+	  }
+      }
 
-  return;
-
+  bm->npix = npix;
+  mean /= (double)npix;
+  sig = sigma/npix - mean*mean;
+  sigma = sig>0.0 ? sqrt(sig):0.0;
+  bm->mean = mean;
+  bm->sigma = sigma;
+  if ((bm->nlevels = (int)(step*npix+1)) > QUANTIF_NMAXLEVELS)
+    bm->nlevels = QUANTIF_NMAXLEVELS;
+  bm->qscale = sigma>0.0? 2*QUANTIF_NSIGMA*sigma/bm->nlevels : 1.0;
+  bm->qzero = mean - QUANTIF_NSIGMA*sigma;
 }
 
 /******************************** backhisto *********************************/
 /*
-Fill histograms in a row of meshes.
+Fill the histogram of a mesh, from its npix pixels and mask values (wbuf,
+can be NULL). The bins of all pixels are computed first (into `bins`), in
+a loop that compilers can vectorize.
 */
-void backhisto(backstruct *backmesh,
-	       PIXTYPE *buf, PIXTYPE *wbuf, int bufsize,
-	       int n, int w, int bw, PIXTYPE maskthresh)
+void backhisto(backstruct *bm, PIXTYPE *buf, PIXTYPE *wbuf, int *bins,
+	       int npix, PIXTYPE maskthresh)
 {
-  backstruct	*bm;
-  PIXTYPE	*buft,*wbuft;
-  float	        qscale, cste, wpix;
+  float	        qscale, cste;
   LONG		*histo;
-  int		h,m,x,y, nlevels, lastbite, offset, bin;
+  int		i, nlevels, bin;
 
-  h = bufsize/w;
-  bm = backmesh;
-  offset = w - bw;
-  for (m=0; m++<n; bm++ , buf+=bw)
-    {
-      if (m==n && (lastbite=w%bw))
-	{
-	  bw = lastbite;
-	  offset = w-bw;
-	}
-
-      /*-- Skip bad meshes */
-      if (bm->mean <= -BIG)
-	{
-	  if (wbuf)
-	    wbuf += bw;
-	  continue;
-	}
+  nlevels = bm->nlevels;
+  histo = bm->histo;
+  qscale = bm->qscale;
+  cste = 0.499999 - bm->qzero/qscale;
 
-      nlevels = bm->nlevels;
-      histo = bm->histo;
-      qscale = bm->qscale;
-      cste = 0.499999 - bm->qzero/qscale;
-      buft = buf;
+  for (i=0; i<npix; i++)
+    bins[i] = (int)(buf[i]/qscale + cste);
 
-      if (wbuf)
+  if (wbuf)
+    {
+      for (i=0; i<npix; i++)
 	{
-	  wbuft = wbuf;
-	  for (y=h; y--; buft+=offset, wbuft+=offset)
-	    for (x=bw; x--;)
-	      {
-		bin = (int)(*(buft++)/qscale + cste);
-		if ((wpix = *(wbuft++))<=maskthresh && bin<nlevels && bin>=0)
-		  (*(histo+bin))++;
-	      }
-	  wbuf += bw;
+	  bin = bins[i];
+	  if (wbuf[i]<=maskthresh && bin<nlevels && bin>=0)
+	    histo[bin]++;
 	}
-      else
-	for (y=h; y--; buft += offset)
-	  for (x=bw; x--;)
-	    {
-	      bin = (int)(*(buft++)/qscale + cste);
-	      
-	      if (bin>=0 && bin<nlevels)
-		(*(histo+bin))++;
-	    }
     }
-  return;
+  else
+    for (i=0; i<npix; i++)
+      {
+	bin = bins[i];
+	if (bin>=0 && bin<nlevels)
+	  histo[bin]++;
+      }
 }
 
 /******************************* backguess **********************************/
@@ -434,7 +695,8 @@ float	backguess(backstruct *bkg, float *mean, float *sigma)
   LONG		*histo, *hilow, *hihigh, *histot;
   unsigned long lowsum, highsum, sum;
   double	ftemp, mea, sig, sig1, med, dpix;
-  int		i, n, lcut,hcut, nlevelsm1, pix;
+  ULONG		*cum;
+  int		i, n, lcut,hcut, nlevelsm1, pix, usecum;
 
   /* Leave here if the mesh is already classified as `bad' */
   if (bkg->mean<=-BIG)
@@ -451,24 +713,52 @@ float	backguess(backstruct *bkg, float *mean, float *sigma)
   sig1 = 1.0;
   mea = med = bkg->mean;
 
+  /* With the cumulative histogram, the median search of each iteration is
+   * done by bisection. The sums of each iteration are then summed in any
+   * order, which is exact (like the sums of the loop below) as they are
+   * sums of integers, provided they stay below 2^53. */
+  usecum = 0;
+  cum = bkg->cumhisto;
+  if (cum)
+    {
+      cum[0] = 0;
+      for (i=0; i<=nlevelsm1; i++)
+	cum[i+1] = cum[i] + histo[i];
+      usecum = (double)cum[nlevelsm1+1]*nlevelsm1*nlevelsm1 <
+	9007199254740992.0;
+    }
+
   /* iterate until sigma converges or drops below 0.1 (up to 100 iterations) */
   for (n=100; n-- && (sig>=0.1) && (fabs(sig/sig1-1.0)>EPS);)
     {
       sig1 = sig;
-      sum = mea = sig = 0.0;
-      lowsum = highsum = 0;
-      histot = hilow = histo+lcut;
-      hihigh = histo+hcut;
-
-      for (i=lcut; i<=hcut; i++)
+      if (usecum && lcut <= hcut)
 	{
-	  if (lowsum<highsum)
-	    lowsum += *(hilow++);
-	  else
-	    highsum +=  *(hihigh--);
-	  sum += (pix = *(histot++));
-	  mea += (dpix = (double)pix*i);
-	  sig += dpix*i;
+	  sum = cum[hcut+1] - cum[lcut];
+	  backmoments(histo, lcut, hcut, &mea, &sig);
+	  i = lcut + backmedsplit(cum, lcut, hcut);
+	  hilow = histo + i;
+	  hihigh = hilow - 1;
+	  lowsum = cum[i] - cum[lcut];
+	  highsum = cum[hcut+1] - cum[i];
+	}
+      else
+	{
+	  sum = mea = sig = 0.0;
+	  lowsum = highsum = 0;
+	  histot = hilow = histo+lcut;
+	  hihigh = histo+hcut;
+
+	  for (i=lcut; i<=hcut; i++)
+	    {
+	      if (lowsum<highsum)
+		lowsum += *(hilow++);
+	      else
+		highsum +=  *(hihigh--);
+	      sum += (pix = *(histot++));
+	      mea += (dpix = (double)pix*i);
+	      sig += dpix*i;
+	    }
 	}
 
       med = hihigh>=histo?((hihigh-histo) + 0.5 +
@@ -499,6 +789,73 @@ float	backguess(backstruct *bkg, float *mean, float *sigma)
   return *mean;
 }
 
+/* Number of bins of [lcut, hcut] (with cumulative histogram `cum`) taken
+ * from the low end by the median search of backguess(), which adds the next
+ * bin from the low end while the low sum is below the high sum, and else
+ * the next from the high end, until all bins are taken. Bin k from the low
+ * end is taken before bin j from the high end if and only if its low sum
+ * before it is below the high sum before bin j, so bin k is among those
+ * taken if k plus the number of high-end bins taken before it is below the
+ * number of bins, found by bisection. */
+int backmedsplit(ULONG *cum, int lcut, int hcut)
+{
+  ULONG v;
+  int n, k, klo, khi, j, jlo, jhi;
+
+  n = hcut - lcut + 1;
+  klo = 0;
+  khi = n;
+  while (klo < khi)
+    {
+      k = (klo + khi)/2;
+      v = cum[lcut+k] - cum[lcut];
+      /* high-end bins whose high sum before them is <= v */
+      jlo = 0;
+      jhi = n+1;
+      while (jlo < jhi)
+	{
+	  j = (jlo + jhi)/2;
+	  if (cum[hcut+1] - cum[hcut+1-j] > v)
+	    jhi = j;
+	  else
+	    jlo = j+1;
+	}
+      if (k + jlo >= n)
+	khi = k;
+      else
+	klo = k+1;
+    }
+  return klo;
+}
+
+/* Sums of i*histo[i] and i*i*histo[i] over [lcut, hcut], in several
+ * independent partial sums (see backguess()) */
+void backmoments(LONG *histo, int lcut, int hcut, double *mea, double *sig)
+{
+  double m0, m1, m2, m3, s0, s1, s2, s3, d0, d1, d2, d3;
+  int i;
+
+  m0 = m1 = m2 = m3 = s0 = s1 = s2 = s3 = 0.0;
+  for (i=lcut; i+3<=hcut; i+=4)
+    {
+      m0 += (d0 = (double)histo[i]*i);
+      m1 += (d1 = (double)histo[i+1]*(i+1));
+      m2 += (d2 = (double)histo[i+2]*(i+2));
+      m3 += (d3 = (double)histo[i+3]*(i+3));
+      s0 += d0*i;
+      s1 += d1*(i+1);
+      s2 += d2*(i+2);
+      s3 += d3*(i+3);
+    }
+  for (; i<=hcut; i++)
+    {
+      m0 += (d0 = (double)histo[i]*i);
+      s0 += d0*i;
+    }
+  *mea = (m0 + m1) + (m2 + m3);
+  *sig = (s0 + s1) + (s2 + s3);
+}
+
 /****************************************************************************/
 
 int filterback(sepbackmap *bkmap, int fw, int fh, float fthresh)
@@ -755,148 +1112,97 @@ float sep_backpix_linear(sepbackmap *bkmap, int x, int y)
 
 
 /*****************************************************************************/
+/* Bicubic-spline interpolation of the background map along image lines.
+ *
+ * Along x, the interpolation weights of each column only depend on its
+ * position relative to the background nodes, not on the line, so they are
+ * computed once (backcols) for all the lines evaluated by a call. Each line
+ * is then evaluated one span of columns between two nodes at a time, with
+ * loops over columns that compilers can vectorize, giving exactly the
+ * values of the original pixel by pixel evaluation.
+ */
 
-int sep_backline_flt(sepbackmap *bkmap, int y, float *line)
-/* Interpolate background at line y (bicubic spline interpolation between
- * background map vertices) and save to line */
+void freebackcols(backcols *cols)
 {
-  int i,j,x,yl, nbx,nbxm1,nby, nx,width, ystep, changepoint, status;
-  float	dx,dx0,dy,dy3, cdx,cdy,cdy3, temp, xstep;
-  float *node,*nodep,*dnode, *blo,*bhi,*dblo,*dbhi, *u;
+  free(cols->start);
+  free(cols->node);
+  free(cols->cdx);
+  free(cols->cdx2);
+  free(cols->dx);
+  free(cols->dx2);
+  memset(cols, 0, sizeof(backcols));
+}
 
-  status = RETURN_OK;
-  node = NULL;
-  dnode = NULL;
-  u = NULL;
+int makebackcols(sepbackmap *bkmap, backcols *cols)
+{
+  int i,j,x,k, nbx,nbxm1, nx,width, changepoint, status;
+  float dx,dx0,cdx, xstep;
 
+  status = RETURN_OK;
+  memset(cols, 0, sizeof(backcols));
   width = bkmap->w;
   nbx = bkmap->nx;
   nbxm1 = nbx - 1;
-  nby = bkmap->ny;
-  if (nby > 1)
+  if (nbx<2)
+    return status;
+
+  QMALLOC(cols->start, int, width+1, status);
+  QMALLOC(cols->node, int, width, status);
+  QMALLOC(cols->cdx, float, width, status);
+  QMALLOC(cols->cdx2, float, width, status);
+  QMALLOC(cols->dx, float, width, status);
+  QMALLOC(cols->dx2, float, width, status);
+
+  /* same stepping along the line as in SExtractor's subbackline() */
+  nx = bkmap->bw;
+  xstep = 1.0/nx;
+  changepoint = nx/2;
+  dx  = (xstep - 1)/2;	/* dx of the first pixel in the row */
+  dx0 = ((nx+1)%2)*xstep/2;	/* dx of the 1st pixel right to a bkgnd node */
+  k = 0;
+  cols->nspan = 0;
+  for (x=i=j=0; j<width; j++, i++, dx += xstep)
     {
-      dy = (float)y/bkmap->bh - 0.5;
-      dy -= (yl = (int)dy);
-      if (yl<0)
+      if (i==changepoint && x>0 && x<nbxm1)
 	{
-	  yl = 0;
-	  dy -= 1.0;
-	}
-      else if (yl>=nby-1)
-	{
-	  yl = nby<2 ? 0 : nby-2;
-	  dy += 1.0;
+	  k++;
+	  dx = dx0;
 	}
-      /*-- Interpolation along y for each node */
-      cdy = 1 - dy;
-      dy3 = (dy*dy*dy-dy);
-      cdy3 = (cdy*cdy*cdy-cdy);
-      ystep = nbx*yl;
-      blo = bkmap->back + ystep;
-      bhi = blo + nbx;
-      dblo = bkmap->dback + ystep;
-      dbhi = dblo + nbx;
-      QMALLOC(node, float, nbx, status);  /* Interpolated background */
-      nodep = node;
-      for (x=nbx; x--;)
-	*(nodep++) = cdy**(blo++) + dy**(bhi++) + cdy3**(dblo++) +
-	  dy3**(dbhi++);
-
-      /*-- Computation of 2nd derivatives along x */
-      QMALLOC(dnode, float, nbx, status);  /* 2nd derivative along x */
-      if (nbx>1)
+      if (!j || k != cols->node[cols->nspan-1])
 	{
-	  QMALLOC(u, float, nbxm1, status);  /* temporary array */
-	  *dnode = *u = 0.0;	/* "natural" lower boundary condition */
-	  nodep = node+1;
-	  for (x=nbxm1; --x; nodep++)
-	    {
-	      temp = -1/(*(dnode++)+4);
-	      *dnode = temp;
-	      temp *= *(u++) - 6*(*(nodep+1)+*(nodep-1)-2**nodep);
-	      *u = temp;
-	    }
-	  *(++dnode) = 0.0;	/* "natural" upper boundary condition */
-	  for (x=nbx-2; x--;)
-	    {
-	      temp = *(dnode--);
-	      *dnode = (*dnode*temp+*(u--))/6.0;
-	    }
-	  free(u);
-	  u = NULL;
-	  dnode--;
+	  cols->start[cols->nspan] = j;
+	  cols->node[cols->nspan++] = k;
 	}
-    }
-  else
-    {
-      /*-- No interpolation and no new 2nd derivatives needed along y */
-      node = bkmap->back;
-      dnode = bkmap->dback;
-    }
-
-  /*-- Interpolation along x */
-  if (nbx>1)
-    {
-      nx = bkmap->bw;
-      xstep = 1.0/nx;
-      changepoint = nx/2;
-      dx  = (xstep - 1)/2;	/* dx of the first pixel in the row */
-      dx0 = ((nx+1)%2)*xstep/2;	/* dx of the 1st pixel right to a bkgnd node */
-      blo = node;
-      bhi = node + 1;
-      dblo = dnode;
-      dbhi = dnode + 1;
-      for (x=i=0,j=width; j--; i++, dx += xstep)
+      cdx = 1 - dx;
+      cols->cdx[j] = cdx;
+      cols->cdx2[j] = cdx*cdx-1;
+      cols->dx[j] = dx;
+      cols->dx2[j] = dx*dx-1;
+      if (i==nx)
 	{
-	  if (i==changepoint && x>0 && x<nbxm1)
-	    {
-	      blo++;
-	      bhi++;
-	      dblo++;
-	      dbhi++;
-	      dx = dx0;
-	    }
-	  cdx = 1 - dx;
-
-	  *(line++) = (float)(cdx*(*blo+(cdx*cdx-1)**dblo) 
-			      + dx*(*bhi+(dx*dx-1)**dbhi));
-
-	  if (i==nx)
-	    {
-	      x++;
-	      i = 0;
-	    }
+	  x++;
+	  i = 0;
 	}
     }
-  else
-    for (j=width; j--;)
-      {
-	*(line++) = (float)*node;
-      }
+  cols->start[cols->nspan] = width;
 
  exit:
-  free(node);
-  free(dnode);
-  free(u);
+  if (status != RETURN_OK)
+    freebackcols(cols);
   return status;
 }
 
-
-/*****************************************************************************/
-
-int sep_backrmsline_flt(sepbackmap *bkmap, int y, float *line)
-/* Bicubic-spline interpolation of the background noise along the current
- * scanline (y). NOTE: Most of the code is a copy of subbackline(), for
- * optimization reasons.
- */
+/* Interpolate `map` (with 2nd derivatives along y `dmap`) at columns x0 to
+ * x1-1 of line y into `line`, using `work` (3*nx floats) for the nodes and
+ * their 2nd derivatives along x. */
+void backline_spline(sepbackmap *bkmap, float *map, float *dmap,
+		     backcols *cols, int y, int x0, int x1, float *work,
+		     float *line)
 {
-  int i,j,x,yl, nbx,nbxm1,nby, nx, width, ystep, changepoint, status;
-  float	dx,dx0,dy,dy3, cdx,cdy,cdy3, temp, xstep;
+  int j,k,x,yl, nbx,nbxm1,nby, ystep, jlo,jhi;
+  float	dy,dy3, cdy,cdy3, temp, b0,b1,db0,db1;
   float *node,*nodep,*dnode, *blo,*bhi,*dblo,*dbhi, *u;
-  status = RETURN_OK;
-  node = NULL;
-  dnode = NULL;
-  u = NULL;
+  float *cdx,*cdx2,*dx,*dx2;
 
   nbx = bkmap->nx;
   nbxm1 = nbx - 1;
@@ -920,20 +1226,20 @@ int sep_backrmsline_flt(sepbackmap *bkmap, int y, float *line)
       dy3 = (dy*dy*dy-dy);
       cdy3 = (cdy*cdy*cdy-cdy);
       ystep = nbx*yl;
-      blo = bkmap->sigma + ystep;
+      blo = map + ystep;
       bhi = blo + nbx;
-      dblo = bkmap->dsigma + ystep;
+      dblo = dmap + ystep;
       dbhi = dblo + nbx;
-      QMALLOC(node, float, nbx, status); /* Interpolated background */
-      nodep = node;
+      node = nodep = work;  /* Interpolated background */
       for (x=nbx; x--;)
-	*(nodep++) = cdy**(blo++)+dy**(bhi++)+cdy3**(dblo++)+dy3**(dbhi++);
+	*(nodep++) = cdy**(blo++) + dy**(bhi++) + cdy3**(dblo++) +
+	  dy3**(dbhi++);
 
       /*-- Computation of 2nd derivatives along x */
-      QMALLOC(dnode, float, nbx, status); /* 2nd derivative along x */
+      dnode = work + nbx;  /* 2nd derivative along x */
       if (nbx>1)
 	{
-	  QMALLOC(u, float, nbxm1, status);	/* temporary array */
+	  u = dnode + nbx;  /* temporary array */
 	  *dnode = *u = 0.0;	/* "natural" lower boundary condition */
 	  nodep = node+1;
 	  for (x=nbxm1; --x; nodep++)
@@ -949,62 +1255,77 @@ int sep_backrmsline_flt(sepbackmap *bkmap, int y, float *line)
 	      temp = *(dnode--);
 	      *dnode = (*dnode*temp+*(u--))/6.0;
 	    }
-	  free(u);
-	  u = NULL;
 	  dnode--;
 	}
     }
   else
     {
       /*-- No interpolation and no new 2nd derivatives needed along y */
-      node = bkmap->sigma;
-      dnode = bkmap->dsigma;
+      node = map;
+      dnode = dmap;
     }
-  
+
   /*-- Interpolation along x */
-  width = bkmap->w;
   if (nbx>1)
     {
-      nx = bkmap->bw;
-      xstep = 1.0/nx;
-      changepoint = nx/2;
-      dx  = (xstep - 1)/2;	/* dx of the first pixel in the row */
-      dx0 = ((nx+1)%2)*xstep/2;	/* dx of the 1st pixel right to a bkgnd node */
-      blo = node;
-      bhi = node + 1;
-      dblo = dnode;
-      dbhi = dnode + 1;
-      for (x=i=0,j=width; j--; i++, dx += xstep)
+      cdx = cols->cdx;
+      cdx2 = cols->cdx2;
+      dx = cols->dx;
+      dx2 = cols->dx2;
+      for (k=0; k<cols->nspan; k++)
 	{
-	  if (i==changepoint && x>0 && x<nbxm1)
-	    {
-	      blo++;
-	      bhi++;
-	      dblo++;
-	      dbhi++;
-	      dx = dx0;
-	    }
-	  cdx = 1 - dx;
-	  *(line++) = (float)(cdx*(*blo+(cdx*cdx-1)**dblo)
-			      + dx*(*bhi+(dx*dx-1)**dbhi));
-	  if (i==nx)
-	    {
-	      x++;
-	      i = 0;
-	    }
+	  jlo = cols->start[k] > x0? cols->start[k]: x0;
+	  jhi = cols->start[k+1] < x1? cols->start[k+1]: x1;
+	  if (jlo >= jhi)
+	    continue;
+	  x = cols->node[k];
+	  b0 = node[x];
+	  b1 = node[x+1];
+	  db0 = dnode[x];
+	  db1 = dnode[x+1];
+	  for (j=jlo; j<jhi; j++)
+	    line[j-x0] = cdx[j]*(b0+cdx2[j]*db0) + dx[j]*(b1+dx2[j]*db1);
 	}
     }
   else
-    for (j=width; j--;)
-      *(line++) = (float)*node;
+    for (j=x0; j<x1; j++)
+      line[j-x0] = *node;
+}
+
+int backline_one(sepbackmap *bkmap, float *map, float *dmap, int y,
+		 float *line)
+{
+  backcols cols;
+  float *work;
+  int status;
+
+  status = RETURN_OK;
+  work = NULL;
+  if ((status = makebackcols(bkmap, &cols)) != RETURN_OK)
+    return status;
+  QMALLOC(work, float, 3*bkmap->nx, status);
+  backline_spline(bkmap, map, dmap, &cols, y, 0, bkmap->w, work, line);
 
  exit:
-  free(node);
-  free(dnode);
-  free(u);
+  free(work);
+  freebackcols(&cols);
   return status;
 }
 
+int sep_backline_flt(sepbackmap *bkmap, int y, float *line)
+/* Interpolate background at line y (bicubic spline interpolation between
+ * background map vertices) and save to line */
+{
+  return backline_one(bkmap, bkmap->back, bkmap->dback, y, line);
+}
+
+int sep_backrmsline_flt(sepbackmap *bkmap, int y, float *line)
+/* Bicubic-spline interpolation of the background noise along the current
+ * scanline (y). */
+{
+  return backline_one(bkmap, bkmap->sigma, bkmap->dsigma, y, line);
+}
+
 /*****************************************************************************/
 /* Multiple dtype functions and convenience functions.
  * These mostly wrap the two "line" functions above. */
@@ -1067,134 +1388,420 @@ int sep_backrmsline(sepbackmap *bkmap, int y, void *line, int dtype)
 
 int sep_backarray(sepbackmap *bkmap, void *arr, int dtype)
 {
-  int y, width, size, status;
-  array_writer write_array;
-  float *tmpline;
-  BYTE *line;
+  return sep_backarrays_parallel(bkmap, arr, NULL, dtype, NULL, 0, 1);
+}
+
+int sep_backrmsarray(sepbackmap *bkmap, void *arr, int dtype)
+{
+  return sep_backarrays_parallel(bkmap, NULL, arr, dtype, NULL, 0, 1);
+}
+
+int sep_subbackline(sepbackmap *bkmap, int y, void *line, int dtype)
+{
+  array_writer subtract_array;
+  int status, size;
+  PIXTYPE *tmpline;
 
   tmpline = NULL;
   status = RETURN_OK;
-  width = bkmap->w;
 
-  if (dtype == SEP_TFLOAT)
-    {
-      tmpline = (float *)arr;
-      for (y=0; y<bkmap->h; y++, tmpline+=width)
-	if ((status = sep_backline_flt(bkmap, y, tmpline)) != RETURN_OK)
-	  return status;
-      return status;
-    }
-  
-  if ((status = get_array_writer(dtype, &write_array, &size)) != RETURN_OK)
+  QMALLOC(tmpline, PIXTYPE, bkmap->w, status);
+
+  status = sep_backline_flt(bkmap, y, tmpline);
+  if (status != RETURN_OK)
     goto exit;
 
-  QMALLOC(tmpline, float, width, status);
+  status = get_array_subtractor(dtype, &subtract_array, &size);
+  if (status != RETURN_OK)
+    goto exit;
 
-  line = (BYTE *)arr;
-  for (y=0; y<bkmap->h; y++, line += size*width)
-    {
-      if ((status = sep_backline_flt(bkmap, y, tmpline)) != RETURN_OK)
-	goto exit;
-      write_array(tmpline, width, line);
-    }
+  subtract_array(tmpline, bkmap->w, line);
 
  exit:
   free(tmpline);
   return status;
 }
 
-int sep_backrmsarray(sepbackmap *bkmap, void *arr, int dtype)
+int sep_subbackarray(sepbackmap *bkmap, void *arr, int dtype)
 {
-  int y, width, size, status;
-  array_writer write_array;
-  float *tmpline;
+  return sep_backarrays_parallel(bkmap, NULL, NULL, SEP_TFLOAT, arr, dtype,
+				 1);
+}
+
+int sep_backarrays_parallel(sepbackmap *bkmap, void *back, void *rms,
+			    int dtype, void *sub, int sdtype, int nthreads)
+{
+  array_writer write_array, subtract_array;
+  backcols cols;
+  float *buf, *work, *bline, *rline;
   BYTE *line;
+  size_t width;
+  int y, size, ssize, nbuf, status;
+  STATS_DECL(t0);
 
-  tmpline = NULL;
+  STATS_START(t0);
   status = RETURN_OK;
+  buf = NULL;
+  write_array = subtract_array = NULL;
+  size = ssize = 0;
   width = bkmap->w;
+  memset(&cols, 0, sizeof(backcols));
 
   if (dtype == SEP_TFLOAT)
-    {
-      tmpline = (float *)arr;
-      for (y=0; y<bkmap->h; y++, tmpline+=width)
-	if ((status = sep_backrmsline_flt(bkmap, y, tmpline)) != RETURN_OK)
-	  return status;
-      return status;
-    }
-  
-  if ((status = get_array_writer(dtype, &write_array, &size)) != RETURN_OK)
+    size = sizeof(float);
+  else if ((back || rms) &&
+	   (status = get_array_writer(dtype, &write_array, &size)) !=
+	   RETURN_OK)
+    goto exit;
+  if (sub &&
+      (status = get_array_subtractor(sdtype, &subtract_array, &ssize)) !=
+      RETURN_OK)
+    goto exit;
+
+  /* lines are only evaluated concurrently with OpenMP */
+#ifdef _OPENMP
+  if (nthreads <= 0)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  if (nthreads > bkmap->h)
+    nthreads = bkmap->h;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  if ((status = makebackcols(bkmap, &cols)) != RETURN_OK)
     goto exit;
 
-  QMALLOC(tmpline, float, width, status);
+  /* per thread: the spline nodes, then a background line (unless it is
+   * written in place) and an RMS line (likewise) */
+  nbuf = 3*bkmap->nx + 2*width;
+  QMALLOC(buf, float, (size_t)nthreads*nbuf, status);
 
-  line = (BYTE *)arr;
-  for (y=0; y<bkmap->h; y++, line += size*width)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(nthreads) \
+  private(work, bline, rline, line)
+#endif
+  for (y=0; y<bkmap->h; y++)
     {
-      if ((status = sep_backrmsline_flt(bkmap, y, tmpline)) != RETURN_OK)
-	goto exit;
-      write_array(tmpline, width, line);
+      work = buf + (size_t)SEP_THREAD_NUM()*nbuf;
+      bline = work + 3*bkmap->nx;
+      rline = bline + width;
+
+      /* background: written out, then subtracted */
+      if (back || sub)
+	{
+	  if (back && !write_array)
+	    bline = (float *)back + y*width;
+	  backline_spline(bkmap, bkmap->back, bkmap->dback, &cols, y, 0,
+			  width, work, bline);
+	  if (back && write_array)
+	    write_array(bline, width, (BYTE *)back + y*width*size);
+	  if (sub)
+	    {
+	      line = (BYTE *)sub + y*width*ssize;
+	      subtract_array(bline, width, line);
+	    }
+	}
+
+      /* RMS */
+      if (rms)
+	{
+	  if (!write_array)
+	    rline = (float *)rms + y*width;
+	  backline_spline(bkmap, bkmap->sigma, bkmap->dsigma, &cols, y, 0,
+			  width, work, rline);
+	  if (write_array)
+	    write_array(rline, width, (BYTE *)rms + y*width*size);
+	}
     }
 
  exit:
-  free(tmpline);
+  free(buf);
+  freebackcols(&cols);
+  STATS_TIME(t_backeval, t0);
   return status;
 }
 
-int sep_subbackline(sepbackmap *bkmap, int y, void *line, int dtype)
+int sep_backwindow(sepbackmap *bkmap, int xmin, int xmax, int ymin, int ymax,
+		   void *back, void *rms, int dtype)
 {
-  array_writer subtract_array;
-  int status, size;
-  PIXTYPE *tmpline;
+  array_writer write_array;
+  backcols cols;
+  float *work, *line, *bline, *rline;
+  size_t ww, off;
+  int y, size, status;
+  char errtext[80];
 
-  tmpline = NULL;
   status = RETURN_OK;
+  work = NULL;
+  write_array = NULL;
+  memset(&cols, 0, sizeof(backcols));
 
-  QMALLOC(tmpline, PIXTYPE, bkmap->w, status);
+  if (xmin < 0 || xmax > bkmap->w || xmax < xmin ||
+      ymin < 0 || ymax > bkmap->h || ymax < ymin)
+    {
+      sprintf(errtext, "in sep_backwindow(): x %d to %d, y %d to %d of "
+	      "%d x %d", xmin, xmax, ymin, ymax, bkmap->w, bkmap->h);
+      put_errdetail(errtext);
+      return ILLEGAL_WINDOW;
+    }
+  if (xmin == xmax || ymin == ymax)
+    return status;
 
-  status = sep_backline_flt(bkmap, y, tmpline);
-  if (status != RETURN_OK)
+  if (dtype == SEP_TFLOAT)
+    size = sizeof(float);
+  else if ((status = get_array_writer(dtype, &write_array, &size)) !=
+	   RETURN_OK)
     goto exit;
 
-  status = get_array_subtractor(dtype, &subtract_array, &size);
-  if (status != RETURN_OK)
+  if ((status = makebackcols(bkmap, &cols)) != RETURN_OK)
     goto exit;
 
-  subtract_array(tmpline, bkmap->w, line);
+  /* the spline nodes, then a line of the window to convert from */
+  ww = xmax - xmin;
+  QMALLOC(work, float, 3*bkmap->nx + ww, status);
+  line = work + 3*bkmap->nx;
+
+  for (y=ymin; y<ymax; y++)
+    {
+      off = (y-ymin)*ww;
+      if (back)
+	{
+	  bline = write_array? line: (float *)back + off;
+	  backline_spline(bkmap, bkmap->back, bkmap->dback, &cols, y, xmin,
+			  xmax, work, bline);
+	  if (write_array)
+	    write_array(line, ww, (BYTE *)back + off*size);
+	}
+      if (rms)
+	{
+	  rline = write_array? line: (float *)rms + off;
+	  backline_spline(bkmap, bkmap->sigma, bkmap->dsigma, &cols, y, xmin,
+			  xmax, work, rline);
+	  if (write_array)
+	    write_array(line, ww, (BYTE *)rms + off*size);
+	}
+    }
 
  exit:
-  free(tmpline);
+  free(work);
+  freebackcols(&cols);
   return status;
 }
 
-int sep_subbackarray(sepbackmap *bkmap, void *arr, int dtype)
+/*****************************************************************************/
+/* Serialized background maps.
+ *
+ * A header of BACKMAP_HEADER bytes:
+ *
+ *   0  "SEPBKMAP"
+ *   8  0x01020304 as a 4-byte int, telling the byte order
+ *  12  format version (BACKMAP_VERSION)
+ *  16  w, h, bw, bh, nx, ny as 4-byte ints
+ *  40  globalback, globalrms as 4-byte floats
+ *  48  zeros
+ *
+ * followed by the nx*ny node values of back, dback, sigma and dsigma, in
+ * the byte order of the machine that wrote them. The node arrays are
+ * aligned for floats whenever the buffer is, so that a mapped file can be
+ * used in place. */
+
+#define BACKMAP_MAGIC   "SEPBKMAP"
+#define BACKMAP_ORDER   0x01020304
+#define BACKMAP_VERSION 1
+#define BACKMAP_HEADER  64
+
+size_t sep_backmap_size(const sepbackmap *bkmap)
 {
-  array_writer subtract_array;
-  int y, status, size, width;
-  PIXTYPE *tmpline;
-  BYTE *arrt;
+  return BACKMAP_HEADER + 4*(size_t)bkmap->n*sizeof(float);
+}
 
-  tmpline = NULL;
-  status = RETURN_OK;
-  width = bkmap->w;
-  arrt = (BYTE *)arr;
+int sep_backmap_write(const sepbackmap *bkmap, void *buf, size_t size)
+{
+  BYTE *b = (BYTE *)buf;
+  int hdr[8];
+  float glob[2];
+  size_t n;
+  char errtext[80];
 
-  QMALLOC(tmpline, PIXTYPE, width, status);
+  if (size < sep_backmap_size(bkmap))
+    {
+      sprintf(errtext, "in sep_backmap_write(): %lu bytes for %lu",
+	      (unsigned long)size, (unsigned long)sep_backmap_size(bkmap));
+      put_errdetail(errtext);
+      return ILLEGAL_BACKMAP;
+    }
 
-  status = get_array_subtractor(dtype, &subtract_array, &size);
-  if (status != RETURN_OK)
-    goto exit;
+  hdr[0] = BACKMAP_ORDER;
+  hdr[1] = BACKMAP_VERSION;
+  hdr[2] = bkmap->w;
+  hdr[3] = bkmap->h;
+  hdr[4] = bkmap->bw;
+  hdr[5] = bkmap->bh;
+  hdr[6] = bkmap->nx;
+  hdr[7] = bkmap->ny;
+  glob[0] = bkmap->globalback;
+  glob[1] = bkmap->globalrms;
+  memset(b, 0, BACKMAP_HEADER);
+  memcpy(b, BACKMAP_MAGIC, 8);
+  memcpy(b+8, hdr, sizeof(hdr));
+  memcpy(b+40, glob, sizeof(glob));
+
+  n = (size_t)bkmap->n*sizeof(float);
+  b += BACKMAP_HEADER;
+  memcpy(b, bkmap->back, n);
+  memcpy(b+n, bkmap->dback, n);
+  memcpy(b+2*n, bkmap->sigma, n);
+  memcpy(b+3*n, bkmap->dsigma, n);
+
+  return RETURN_OK;
+}
 
-  for (y=0; y<bkmap->h; y++, arrt+=(width*size))
-    { 
-      if ((status = sep_backline_flt(bkmap, y, tmpline)) != RETURN_OK)
-	goto exit;
-      subtract_array(tmpline, width, arrt);
+/* reverse the bytes of each of the n 4-byte words at ptr */
+void swapbytes4(void *ptr, size_t n)
+{
+  BYTE *b, t;
+
+  for (b=(BYTE *)ptr; n--; b+=4)
+    {
+      t = b[0];
+      b[0] = b[3];
+      b[3] = t;
+      t = b[1];
+      b[1] = b[2];
+      b[2] = t;
     }
+}
 
- exit:
-  free(tmpline);
-  return status;
+/* Check the header of a serialized map of size bytes and read it into
+ * bkmap (without node arrays); swap tells whether it is in the other byte
+ * order. */
+int readbackheader(const BYTE *buf, size_t size, sepbackmap *bkmap,
+		   int *swap)
+{
+  int hdr[8];
+  float glob[2];
+  char errtext[80];
+
+  if (size < BACKMAP_HEADER || memcmp(buf, BACKMAP_MAGIC, 8))
+    {
+      put_errdetail("not a serialized background map");
+      return ILLEGAL_BACKMAP;
+    }
+
+  memcpy(hdr, buf+8, sizeof(hdr));
+  memcpy(glob, buf+40, sizeof(glob));
+  *swap = (hdr[0] != BACKMAP_ORDER);
+  if (*swap)
+    {
+      swapbytes4(hdr, 8);
+      swapbytes4(glob, 2);
+      if (hdr[0] != BACKMAP_ORDER)
+	{
+	  put_errdetail("serialized background map of unknown byte order");
+	  return ILLEGAL_BACKMAP;
+	}
+    }
+  if (hdr[1] != BACKMAP_VERSION)
+    {
+      sprintf(errtext, "serialized background map version %d, not %d",
+	      hdr[1], BACKMAP_VERSION);
+      put_errdetail(errtext);
+      return ILLEGAL_BACKMAP;
+    }
+
+  memset(bkmap, 0, sizeof(sepbackmap));
+  bkmap->w = hdr[2];
+  bkmap->h = hdr[3];
+  bkmap->bw = hdr[4];
+  bkmap->bh = hdr[5];
+  bkmap->nx = hdr[6];
+  bkmap->ny = hdr[7];
+  bkmap->globalback = glob[0];
+  bkmap->globalrms = glob[1];
+
+  /* the tiles must be those of the image, as set by newbackmap() */
+  if (bkmap->w < 1 || bkmap->h < 1 || bkmap->bw < 1 || bkmap->bh < 1 ||
+      bkmap->nx != (bkmap->w-1)/bkmap->bw + 1 ||
+      bkmap->ny != (bkmap->h-1)/bkmap->bh + 1 ||
+      bkmap->nx > INT_MAX/bkmap->ny)
+    {
+      sprintf(errtext, "serialized background map of %d x %d tiles of "
+	      "%d x %d for %d x %d", bkmap->nx, bkmap->ny, bkmap->bw,
+	      bkmap->bh, bkmap->w, bkmap->h);
+      put_errdetail(errtext);
+      return ILLEGAL_BACKMAP;
+    }
+  bkmap->n = bkmap->nx*bkmap->ny;
+
+  if (size < sep_backmap_size(bkmap))
+    {
+      sprintf(errtext, "serialized background map truncated: %lu bytes "
+	      "of %lu", (unsigned long)size,
+	      (unsigned long)sep_backmap_size(bkmap));
+      put_errdetail(errtext);
+      return ILLEGAL_BACKMAP;
+    }
+
+  return RETURN_OK;
+}
+
+int sep_backmap_read(const void *buf, size_t size, sepbackmap **bkm)
+{
+  const BYTE *b = (const BYTE *)buf;
+  sepbackmap hdr, *bkmap;
+  size_t n;
+  int swap, status;
+
+  *bkm = NULL;
+  if ((status = readbackheader(b, size, &hdr, &swap)) != RETURN_OK)
+    return status;
+  if ((status = newbackmap(hdr.w, hdr.h, hdr.bw, hdr.bh, &bkmap)) !=
+      RETURN_OK)
+    return status;
+  bkmap->globalback = hdr.globalback;
+  bkmap->globalrms = hdr.globalrms;
+
+  n = (size_t)bkmap->n*sizeof(float);
+  b += BACKMAP_HEADER;
+  memcpy(bkmap->back, b, n);
+  memcpy(bkmap->dback, b+n, n);
+  memcpy(bkmap->sigma, b+2*n, n);
+  memcpy(bkmap->dsigma, b+3*n, n);
+  if (swap)
+    {
+      swapbytes4(bkmap->back, bkmap->n);
+      swapbytes4(bkmap->dback, bkmap->n);
+      swapbytes4(bkmap->sigma, bkmap->n);
+      swapbytes4(bkmap->dsigma, bkmap->n);
+    }
+
+  *bkm = bkmap;
+  return RETURN_OK;
+}
+
+int sep_backmap_view(const void *buf, size_t size, sepbackmap *bkmap)
+{
+  const BYTE *b = (const BYTE *)buf;
+  int swap, status;
+
+  if ((status = readbackheader(b, size, bkmap, &swap)) != RETURN_OK)
+    return status;
+  if (swap || ((size_t)b & (sizeof(float)-1)))
+    {
+      put_errdetail(swap? "serialized background map in the other byte "
+		    "order": "serialized background map not aligned");
+      return ILLEGAL_BACKMAP;
+    }
+
+  b += BACKMAP_HEADER;
+  bkmap->back = (float *)b;
+  bkmap->dback = bkmap->back + bkmap->n;
+  bkmap->sigma = bkmap->dback + bkmap->n;
+  bkmap->dsigma = bkmap->sigma + bkmap->n;
+
+  return RETURN_OK;
 }
 
 /*****************************************************************************/
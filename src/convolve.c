@@ -28,6 +28,56 @@
 #include "sepcore.h"
 #include "extract.h"
 
+#define CONV_SEPTOL 1e-6  /* tolerance (relative to the largest element) on
+			     the kernel elements for it to be separable */
+#define FFT_SEGFAC    4     /* FFT length in units of the kernel width */
+#define FFT_MINLEN    64    /* minimum FFT length */
+#define FFT_DENOM_EPS 1e-10 /* relative level of the rounding errors of
+			       matched filter denominators with FFTs */
+
+/* Find whether a kernel is separable, that is, the outer product of a column
+ * vector and a row vector (within a tolerance of CONV_SEPTOL), as Gaussian
+ * kernels are.
+ *
+ * conv : convolution kernel
+ * convw, convh : width and height of conv
+ * convx : output row vector (convw elements long)
+ * convy : output column vector (convh elements long)
+ *
+ * Returns 1 and fills convx and convy, such that
+ * conv[cy*convw+cx] ~ convy[cy]*convx[cx], if the kernel is separable.
+ * Returns 0 otherwise.
+ */
+int separable_kernel(float *conv, int convw, int convh,
+		     float *convx, float *convy)
+{
+  float pivot, tol;
+  int   convn, cx, cy, i, ipivot;
+
+  /* use the largest element as pivot: its row and column are the vectors */
+  convn = convw * convh;
+  ipivot = 0;
+  for (i=1; i<convn; i++)
+    if (fabs(conv[i]) > fabs(conv[ipivot]))
+      ipivot = i;
+  pivot = conv[ipivot];
+  if (pivot == 0.0)
+    return 0;
+
+  for (cy=0; cy<convh; cy++)
+    convy[cy] = conv[cy*convw + ipivot%convw];
+  for (cx=0; cx<convw; cx++)
+    convx[cx] = conv[(ipivot/convw)*convw + cx] / pivot;
+
+  tol = CONV_SEPTOL * fabs(pivot);
+  for (cy=0; cy<convh; cy++)
+    for (cx=0; cx<convw; cx++)
+      if (fabs(conv[cy*convw+cx] - convy[cy]*convx[cx]) > tol)
+	return 0;
+
+  return 1;
+}
+
 /* Convolve one line of an image with a given kernel.
  *
  * buf : arraybuffer struct containing buffer of data to convolve, and image
@@ -39,12 +89,11 @@
 int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh,
              PIXTYPE *out)
 {
-  int convw2, convn, cx, cy, i, dcx, y0;
+  int convw2, cx, cy, dcx, x, n, y0;
+  float c;
   PIXTYPE *line;    /* current line in input buffer */
-  PIXTYPE *outend;  /* end of output buffer */
-  PIXTYPE *src, *dst, *dstend;
+  PIXTYPE *src, *dst;
 
-  outend = out + buf->dw;
   convw2 = convw/2;
   y0 = y - convh/2;  /* start line in image */
 
@@ -67,32 +116,108 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh,
   memset(out, 0, buf->dw*sizeof(PIXTYPE));  /* initialize output to zero */
 
   /* loop over pixels in the convolution kernel */
-  convn = convw * convh;
-  for (i=0; i<convn; i++)
+  for (cy=0; cy<convh; cy++)
     {
-      cx = i % convw;  /* x index in conv kernel */
-      cy = i / convw;  /* y index in conv kernel */
       line = buf->bptr + buf->bw * (y0 - buf->yoff + cy); /* start of line */
+      for (cx=0; cx<convw; cx++)
+	{
+	  c = conv[cy*convw + cx];
+
+	  /* get start positions in the source and target line, and the
+	   * number of pixels to add */
+	  dcx = cx - convw2; /* offset of conv pixel from conv center;
+				determines offset between in and out line */
+	  if (dcx >= 0)
+	    {
+	      src = line + dcx;
+	      dst = out;
+	      n = buf->dw - dcx;
+	    }
+	  else
+	    {
+	      src = line;
+	      dst = out - dcx;
+	      n = buf->dw + dcx;
+	    }
+
+	  /* multiply and add the values (an indexed loop with the kernel
+	   * value in a local, so that the compiler can vectorize it) */
+	  for (x=0; x<n; x++)
+	    dst[x] += c * src[x];
+	}
+    }
+
+  return RETURN_OK;
+}
+
+/* Convolve one line of an image with a separable kernel, given as its row
+ * and column vectors (see separable_kernel()). This first combines the
+ * needed lines with the column vector, then convolves the result with the
+ * row vector, taking convw+convh rather than convw*convh operations per
+ * pixel.
+ *
+ * buf : arraybuffer struct containing buffer of data to convolve, and image
+ *       dimension metadata.
+ * convx, convy : row and column vectors of the kernel
+ * convw, convh : width and height of the kernel
+ * work : work buffer (buf->dw elements long)
+ * out : output convolved line (buf->dw elements long)
+ */
+int convolve_sep(arraybuffer *buf, int y, float *convx, float *convy,
+		 int convw, int convh, PIXTYPE *work, PIXTYPE *out)
+{
+  int convw2, cx, cy, dcx, x, n, y0;
+  float c;
+  PIXTYPE *line;
+  PIXTYPE *src, *dst;
 
-      /* get start and end positions in the source and target line */
-      dcx = cx - convw2; /* offset of conv pixel from conv center;
-                            determines offset between in and out line */
+  convw2 = convw/2;
+  y0 = y - convh/2;
+
+  /* Cut off top and bottom of kernel if it extends beyond image */
+  if (y0 + convh > buf->dh)
+    convh = buf->dh - y0;
+  if (y0 < 0)
+    {
+      convh = convh + y0;
+      convy -= y0;
+      y0 = 0;
+    }
+
+  /* check that buffer has needed lines */
+  if ((y0 < buf->yoff) || (y0+convh > buf->yoff + buf->bh))
+    return LINE_NOT_IN_BUF;
+
+  /* vertical pass */
+  memset(work, 0, buf->dw*sizeof(PIXTYPE));
+  for (cy=0; cy<convh; cy++)
+    {
+      c = convy[cy];
+      line = buf->bptr + buf->bw * (y0 - buf->yoff + cy);
+      for (x=0; x<buf->dw; x++)
+	work[x] += c * line[x];
+    }
+
+  /* horizontal pass */
+  memset(out, 0, buf->dw*sizeof(PIXTYPE));
+  for (cx=0; cx<convw; cx++)
+    {
+      c = convx[cx];
+      dcx = cx - convw2;
       if (dcx >= 0)
 	{
-	  src = line + dcx;
+	  src = work + dcx;
 	  dst = out;
-	  dstend = outend - dcx;
+	  n = buf->dw - dcx;
 	}
       else
 	{
-	  src = line;
+	  src = work;
 	  dst = out - dcx;
-	  dstend = outend;
+	  n = buf->dw + dcx;
 	}
-
-      /* multiply and add the values */
-      while (dst < dstend)
-	*(dst++) += conv[i] * *(src++);
+      for (x=0; x<n; x++)
+	dst[x] += c * src[x];
     }
 
   return RETURN_OK;
@@ -123,11 +248,12 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
                    float *conv, int convw, int convh,
                    PIXTYPE *work, PIXTYPE *out)
 {
-  int convw2, convn, cx, cy, i, dcx, y0;
+  int convw2, cx, cy, dcx, x, n, y0;
+  float c, c2;
   PIXTYPE imval, nval;
   PIXTYPE *imline, *nline;    /* current line in input buffer */
   PIXTYPE *outend;            /* end of output buffer */
-  PIXTYPE *src_im, *src_n, *dst_num, *dst_denom, *dst_num_end;
+  PIXTYPE *src_im, *src_n, *dst_num, *dst_denom;
 
   outend = out + imbuf->dw;
   convw2 = convw/2;
@@ -159,55 +285,570 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
   memset(work, 0, imbuf->bw*sizeof(PIXTYPE));
 
   /* loop over pixels in the convolution kernel */
-  convn = convw * convh;
-  for (i=0; i<convn; i++)
+  for (cy=0; cy<convh; cy++)
     {
-      cx = i % convw;  /* x index in conv kernel */
-      cy = i / convw;  /* y index in conv kernel */
       imline = imbuf->bptr + imbuf->bw * (y0 - imbuf->yoff + cy);
       nline = nbuf->bptr + nbuf->bw * (y0 - nbuf->yoff + cy);
+      for (cx=0; cx<convw; cx++)
+	{
+	  c = conv[cy*convw + cx];
+	  c2 = c * c;
 
-      /* get start and end positions in the source and target line */
-      dcx = cx - convw2; /* offset of conv pixel from conv center;
-                            determines offset between in and out line */
+	  /* get start positions in the source and target line, and the
+	   * number of pixels to add */
+	  dcx = cx - convw2; /* offset of conv pixel from conv center;
+				determines offset between in and out line */
+	  if (dcx >= 0)
+	    {
+	      src_im = imline + dcx;
+	      src_n = nline + dcx;
+	      dst_num = out;
+	      dst_denom = work;
+	      n = imbuf->dw - dcx;
+	    }
+	  else
+	    {
+	      src_im = imline;
+	      src_n = nline;
+	      dst_num = out - dcx;
+	      dst_denom = work - dcx;
+	      n = imbuf->dw + dcx;
+	    }
+
+	  /* actually calculate values */
+	  for (x=0; x<n; x++)
+	    {
+	      imval = src_im[x];
+	      nval = src_n[x];
+	      if (nval != 0.0)
+		{
+		  dst_num[x]   += c * imval / (nval * nval);
+		  dst_denom[x] += c2 / (nval * nval);
+		}
+	    }
+	}
+    }  /* close loop over convolution kernel */
+
+  /* take the square root of the denominator (work) buffer and divide the
+   * numerator by it. */
+  for (dst_num=out, dst_denom=work; dst_num < outend; dst_num++, dst_denom++)
+      *dst_num = *dst_num / sqrt(*dst_denom);
+
+  return RETURN_OK;
+}
+
+/* Apply a matched filter to one line of an image with a separable kernel,
+ * given as its row and column vectors (see separable_kernel()). The
+ * numerator and denominator of the matched filter are then convolutions of
+ * f/n^2 and 1/n^2 with conv and conv^2, which are both separable.
+ *
+ * imbuf : arraybuffer for data array
+ * nbuf : arraybuffer for noise array
+ * y : line to apply the matched filter to in an image
+ * convx, convy : row and column vectors of the kernel
+ * convw, convh : width and height of the kernel
+ * work : work buffer (3*`imbuf->dw` elements long)
+ * out : output line (`imbuf->dw` elements long)
+ */
+int matched_filter_sep(arraybuffer *imbuf, arraybuffer *nbuf, int y,
+		       float *convx, float *convy, int convw, int convh,
+		       PIXTYPE *work, PIXTYPE *out)
+{
+  int convw2, cx, cy, dcx, x, n, w, y0;
+  float c, c2;
+  PIXTYPE nval, ivar;
+  PIXTYPE *imline, *nline;
+  PIXTYPE *vnum, *vdenom, *denom;  /* parts of the work buffer */
+  PIXTYPE *src_num, *src_denom, *dst_num, *dst_denom;
+
+  w = imbuf->dw;
+  convw2 = convw/2;
+  y0 = y - convh/2;
+
+  /* Cut off top and bottom of kernel if it extends beyond image */
+  if (y0 + convh > imbuf->dh)
+    convh = imbuf->dh - y0;
+  if (y0 < 0)
+    {
+      convh = convh + y0;
+      convy -= y0;
+      y0 = 0;
+    }
+
+  /* check that buffer has needed lines */
+  if ((y0 < imbuf->yoff) || (y0+convh > imbuf->yoff + imbuf->bh) ||
+      (y0 < nbuf->yoff)  || (y0+convh > nbuf->yoff + nbuf->bh))
+    return LINE_NOT_IN_BUF;
+
+  /* check that image and noise buffer match */
+  if ((imbuf->yoff != nbuf->yoff) || (imbuf->dw != nbuf->dw))
+    return LINE_NOT_IN_BUF;
+
+  vnum = work;
+  vdenom = work + w;
+  denom = work + 2*w;
+
+  /* vertical pass */
+  memset(vnum, 0, w*sizeof(PIXTYPE));
+  memset(vdenom, 0, w*sizeof(PIXTYPE));
+  for (cy=0; cy<convh; cy++)
+    {
+      c = convy[cy];
+      c2 = c * c;
+      imline = imbuf->bptr + imbuf->bw * (y0 - imbuf->yoff + cy);
+      nline = nbuf->bptr + nbuf->bw * (y0 - nbuf->yoff + cy);
+      for (x=0; x<w; x++)
+	{
+	  nval = nline[x];
+	  if (nval != 0.0)
+	    {
+	      ivar = 1.0 / (nval * nval);
+	      vnum[x] += c * imline[x] * ivar;
+	      vdenom[x] += c2 * ivar;
+	    }
+	}
+    }
+
+  /* horizontal pass */
+  memset(out, 0, w*sizeof(PIXTYPE));
+  memset(denom, 0, w*sizeof(PIXTYPE));
+  for (cx=0; cx<convw; cx++)
+    {
+      c = convx[cx];
+      c2 = c * c;
+      dcx = cx - convw2;
       if (dcx >= 0)
 	{
-	  src_im = imline + dcx;
-          src_n = nline + dcx;
+	  src_num = vnum + dcx;
+	  src_denom = vdenom + dcx;
 	  dst_num = out;
-          dst_denom = work;
-	  dst_num_end = outend - dcx;
+	  dst_denom = denom;
+	  n = w - dcx;
 	}
       else
 	{
-	  src_im = imline;
-          src_n = nline;
+	  src_num = vnum;
+	  src_denom = vdenom;
 	  dst_num = out - dcx;
-          dst_denom = work - dcx;
-	  dst_num_end = outend;
-	}
-
-      /* actually calculate values */
-      while (dst_num < dst_num_end)
-        {
-          imval = *src_im;
-          nval = *src_n;
-          if (nval != 0.0)
-            {
-              *dst_num   += conv[i] * imval / (nval * nval);
-              *dst_denom += conv[i] * conv[i] / (nval * nval);
-            }
-          src_im++;
-          src_n++;
-          dst_num++;
-          dst_denom++;
-        }
-    }  /* close loop over convolution kernel */
+	  dst_denom = denom - dcx;
+	  n = w + dcx;
+	}
+      for (x=0; x<n; x++)
+	{
+	  dst_num[x] += c * src_num[x];
+	  dst_denom[x] += c2 * src_denom[x];
+	}
+    }
 
-  /* take the square root of the denominator (work) buffer and divide the
-   * numerator by it. */
-  for (dst_num=out, dst_denom=work; dst_num < outend; dst_num++, dst_denom++)
-      *dst_num = *dst_num / sqrt(*dst_denom);
+  for (x=0; x<w; x++)
+    out[x] = out[x] / sqrt(denom[x]);
+
+  return RETURN_OK;
+}
+
+/*--------------------- filtering with FFTs along lines ----------------------*/
+
+/* Lines are filtered by overlap-save: each line is cut into segments of
+ * seglen output pixels, and each segment, with the convw-1 input pixels
+ * around it, is convolved with the kernel rows using FFTs of length n.
+ * The transform of each input line is kept for the convh output lines that
+ * need it, so that filtering costs O(log(n) + convh) rather than
+ * O(convw*convh) operations per pixel. Since the inputs are real, two
+ * segments (or the numerator and denominator inputs of the matched filter)
+ * are transformed together as the real and imaginary parts of a block. */
+
+/* In-place complex FFT of length n (a power of 2) of interleaved data
+ * (re, im, re, im, ...). tw holds the n/2 twiddle factors
+ * exp(-2 pi i k / n). The inverse transform is not normalized. */
+static void fft(double *data, int n, double *tw, int inverse)
+{
+  double tr, ti, wr, wi;
+  int    i, j, k, a, b, bit, half, step;
+
+  /* bit-reversal permutation */
+  for (i=1, j=0; i<n; i++)
+    {
+      for (bit = n>>1; j & bit; bit >>= 1)
+	j ^= bit;
+      j ^= bit;
+      if (i < j)
+	{
+	  tr = data[2*i]; data[2*i] = data[2*j]; data[2*j] = tr;
+	  ti = data[2*i+1]; data[2*i+1] = data[2*j+1]; data[2*j+1] = ti;
+	}
+    }
+
+  /* butterflies */
+  for (half=1, step=n/2; half<n; half*=2, step/=2)
+    for (k=0; k<half; k++)
+      {
+	wr = tw[2*k*step];
+	wi = inverse? -tw[2*k*step+1]: tw[2*k*step+1];
+	for (i=k; i<n; i+=2*half)
+	  {
+	    a = 2*i;
+	    b = 2*(i+half);
+	    tr = wr*data[b] - wi*data[b+1];
+	    ti = wr*data[b+1] + wi*data[b];
+	    data[b] = data[a] - tr;
+	    data[b+1] = data[a+1] - ti;
+	    data[a] += tr;
+	    data[a+1] += ti;
+	  }
+      }
+}
+
+/* Whether a line contains values (NaN, infinite or <= -BIG) that would
+ * spoil the transforms of the whole segments they are in. */
+static int badline(PIXTYPE *line, int n)
+{
+  int x;
+
+  for (x=0; x<n; x++)
+    if (!(line[x] > -BIG && line[x] < BIG))
+      return 1;
+  return 0;
+}
+
+/* Prepare a kernel for filtering the lines of an image of width w with
+ * FFTs: the transform length and segments are chosen and the rows of the
+ * kernel are transformed. If matched is true, the transforms needed by
+ * matched_filter_fft() are computed as well.
+ *
+ * The kernel array is not copied, and must persist as long as fk is used.
+ * fk must be freed with fftkernel_free(), also on error.
+ */
+int fftkernel_init(fftkernel *fk, float *conv, int convw, int convh, int w,
+		   int matched)
+{
+  double *kn, *kd, *row, tn, td;
+  int    n, nmax, convw2, cx, cy, k, m, status;
+
+  status = RETURN_OK;
+  memset(fk, 0, sizeof(fftkernel));
+  kd = NULL;
+
+  /* Transforms a few times longer than the kernel keep the overhead of
+   * the overlaps small, but transforming more than a line is useless. */
+  for (nmax=1; nmax < w + convw - 1; nmax*=2)
+    ;
+  for (n=1; n < FFT_SEGFAC*(convw-1) || n < FFT_MINLEN; n*=2)
+    ;
+  if (n > nmax)
+    n = nmax;
+  fk->n = n;
+  fk->seglen = n - convw + 1;
+  fk->nseg = (w + fk->seglen - 1) / fk->seglen;
+  fk->conv = conv;
+  fk->convw = convw;
+  fk->convh = convh;
+  convw2 = convw/2;
+
+  QMALLOC(fk->twiddle, double, n, status);
+  for (k=0; k<n/2; k++)
+    {
+      fk->twiddle[2*k] = cos(2.0*PI*k/n);
+      fk->twiddle[2*k+1] = -sin(2.0*PI*k/n);
+    }
+
+  /* Place each kernel row so that the circular convolution of a block
+   * starting at x0-convw2 gives out[x] = sum(conv[cx] * in[x+cx-convw2])
+   * at index x-x0+convw2, then transform it. The normalization of the
+   * inverse transforms is folded in here. */
+  QCALLOC(fk->kern, double, 2*(size_t)n*convh, status);
+  if (matched)
+    {
+      QCALLOC(fk->kernmf, double, 4*(size_t)n*convh, status);
+      QCALLOC(kd, double, 2*(size_t)n, status);
+    }
+  for (cy=0; cy<convh; cy++)
+    {
+      row = fk->kern + 2*(size_t)n*cy;
+      if (kd)
+	memset(kd, 0, 2*(size_t)n*sizeof(double));
+      for (cx=0; cx<convw; cx++)
+	{
+	  m = (convw2 - cx + n) % n;
+	  tn = conv[cy*convw+cx];
+	  row[2*m] = tn / n;
+	  if (kd)
+	    kd[2*m] = tn * tn / n;
+	  if (tn*tn > fk->conv2max)
+	    fk->conv2max = tn*tn;
+	}
+      fft(row, n, fk->twiddle, 0);
+
+      /* For the matched filter, the blocks hold a + i b, where a and b are
+       * the real numerator and denominator inputs, with transform Z. The
+       * transform of (a*conv + i b*conv^2) is then
+       * Z(k)*(Kn+Kd)/2 + conj(Z(-k))*(Kn-Kd)/2. Store both factors. */
+      if (kd)
+	{
+	  fft(kd, n, fk->twiddle, 0);
+	  kn = fk->kernmf + 4*(size_t)n*cy;
+	  for (k=0; k<2*n; k++)
+	    {
+	      tn = row[k];
+	      td = kd[k];
+	      kn[k] = 0.5*(tn + td);
+	      kn[2*n+k] = 0.5*(tn - td);
+	    }
+	}
+    }
+
+ exit:
+  free(kd);
+  return status;
+}
+
+void fftkernel_free(fftkernel *fk)
+{
+  free(fk->twiddle);
+  free(fk->kern);
+  free(fk->kernmf);
+  memset(fk, 0, sizeof(fftkernel));
+}
+
+/* Allocate the transforms of the lines used for filtering with fk. */
+int fftlines_init(fftlines *fl, fftkernel *fk)
+{
+  int status = RETURN_OK;
+
+  memset(fl, 0, sizeof(fftlines));
+  QMALLOC(fl->lines, double, 2*(size_t)fk->n*fk->nseg*fk->convh, status);
+  QMALLOC(fl->acc, double, 2*(size_t)fk->n, status);
+  QMALLOC(fl->bad, int, fk->convh, status);
+  QMALLOC(fl->scale, double, fk->convh, status);
+
+ exit:
+  return status;
+}
+
+void fftlines_free(fftlines *fl)
+{
+  free(fl->lines);
+  free(fl->acc);
+  free(fl->bad);
+  free(fl->scale);
+  memset(fl, 0, sizeof(fftlines));
+}
+
+/* Convolve one line of an image with a kernel prepared by
+ * fftkernel_init(). Lines must be filtered in increasing order. Output
+ * lines depending on values that would spoil the transforms (see
+ * badline()) are filtered with convolve() instead.
+ *
+ * buf : arraybuffer struct containing buffer of data to convolve, and image
+ *       dimension metadata.
+ * fk : prepared kernel
+ * fl : transforms of the input lines
+ * out : output convolved line (buf->dw elements long)
+ */
+int convolve_fft(arraybuffer *buf, int y, fftkernel *fk, fftlines *fl,
+		 PIXTYPE *out)
+{
+  double  *z, *kr, *acc;
+  PIXTYPE *line;
+  int     n, l, w, nblk, convh, convw2, b, t, x, x0, k, y0, yy, lo, hi;
+
+  n = fk->n;
+  l = fk->seglen;
+  w = buf->dw;
+  nblk = (fk->nseg + 1) / 2;
+  convh = fk->convh;
+  convw2 = fk->convw/2;
+  acc = fl->acc;
+
+  /* lines of the kernel within the image */
+  y0 = y - convh/2;
+  lo = (y0 < 0)? 0: y0;
+  hi = (y0 + convh > buf->dh)? buf->dh: y0 + convh;
+
+  /* check that buffer has needed lines */
+  if ((lo < buf->yoff) || (hi > buf->yoff + buf->bh))
+    return LINE_NOT_IN_BUF;
+
+  /* transform the lines not seen yet: block b holds segments 2b and 2b+1
+   * as its real and imaginary parts */
+  if (fl->ynext < lo)
+    fl->ynext = lo;
+  for (; fl->ynext < hi; fl->ynext++)
+    {
+      yy = fl->ynext;
+      line = buf->bptr + buf->bw * (yy - buf->yoff);
+      if ((fl->bad[yy%convh] = badline(line, w)))
+	continue;
+      for (b=0; b<nblk; b++)
+	{
+	  z = fl->lines + 2*(size_t)n*(nblk*(yy%convh) + b);
+	  x0 = 2*b*l - convw2;
+	  for (t=0; t<n; t++)
+	    {
+	      x = x0 + t;
+	      z[2*t] = (x >= 0 && x < w)? line[x]: 0.0;
+	      x += l;
+	      z[2*t+1] = (x >= 0 && x < w)? line[x]: 0.0;
+	    }
+	  fft(z, n, fk->twiddle, 0);
+	}
+    }
+
+  for (yy=lo; yy<hi; yy++)
+    if (fl->bad[yy%convh])
+      return convolve(buf, y, fk->conv, fk->convw, fk->convh, out);
+
+  for (b=0; b<nblk; b++)
+    {
+      /* multiply by the kernel rows and sum */
+      memset(acc, 0, 2*(size_t)n*sizeof(double));
+      for (yy=lo; yy<hi; yy++)
+	{
+	  z = fl->lines + 2*(size_t)n*(nblk*(yy%convh) + b);
+	  kr = fk->kern + 2*(size_t)n*(yy-y0);
+	  for (k=0; k<2*n; k+=2)
+	    {
+	      acc[k]   += z[k]*kr[k] - z[k+1]*kr[k+1];
+	      acc[k+1] += z[k]*kr[k+1] + z[k+1]*kr[k];
+	    }
+	}
+      fft(acc, n, fk->twiddle, 1);
+
+      /* the valid part of the circular convolutions */
+      x0 = 2*b*l;
+      for (t=0; t<l && x0+t<w; t++)
+	out[x0+t] = acc[2*(convw2+t)];
+      x0 += l;
+      for (t=0; t<l && x0+t<w; t++)
+	out[x0+t] = acc[2*(convw2+t)+1];
+    }
+
+  return RETURN_OK;
+}
+
+/* Apply a matched filter (see matched_filter()) to one line of an image
+ * with a kernel prepared by fftkernel_init(), in the same way as
+ * convolve_fft(). The numerator and denominator inputs, f/n^2 and 1/n^2,
+ * are transformed together as the real and imaginary parts of the blocks.
+ *
+ * imbuf : arraybuffer for data array
+ * nbuf : arraybuffer for noise array
+ * y : line to apply the matched filter to in an image
+ * fk : prepared kernel (with matched filter transforms)
+ * fl : transforms of the input lines
+ * work : work buffer (`imbuf->dw` elements long)
+ * out : output line (`imbuf->dw` elements long)
+ *
+ * Where all the noise values under the kernel are zero, the output is
+ * -BIG.
+ */
+int matched_filter_fft(arraybuffer *imbuf, arraybuffer *nbuf, int y,
+		       fftkernel *fk, fftlines *fl, PIXTYPE *work,
+		       PIXTYPE *out)
+{
+  double  *z, *kp, *kq, *acc, ivar, scale, zr, zi, cr, ci, denmin;
+  PIXTYPE *imline, *nline;
+  int     n, l, w, nseg, convh, convw2, b, t, x, x0, k, km, y0, yy, lo, hi;
+
+  n = fk->n;
+  l = fk->seglen;
+  w = imbuf->dw;
+  nseg = fk->nseg;
+  convh = fk->convh;
+  convw2 = fk->convw/2;
+  acc = fl->acc;
+
+  y0 = y - convh/2;
+  lo = (y0 < 0)? 0: y0;
+  hi = (y0 + convh > imbuf->dh)? imbuf->dh: y0 + convh;
+
+  /* check that buffer has needed lines */
+  if ((lo < imbuf->yoff) || (hi > imbuf->yoff + imbuf->bh) ||
+      (lo < nbuf->yoff)  || (hi > nbuf->yoff + nbuf->bh))
+    return LINE_NOT_IN_BUF;
+
+  /* check that image and noise buffer match */
+  if ((imbuf->yoff != nbuf->yoff) || (imbuf->dw != nbuf->dw))
+    return LINE_NOT_IN_BUF;
+
+  /* transform the lines not seen yet */
+  if (fl->ynext < lo)
+    fl->ynext = lo;
+  for (; fl->ynext < hi; fl->ynext++)
+    {
+      yy = fl->ynext;
+      imline = imbuf->bptr + imbuf->bw * (yy - imbuf->yoff);
+      nline = nbuf->bptr + nbuf->bw * (yy - nbuf->yoff);
+      if ((fl->bad[yy%convh] = (badline(imline, w) || badline(nline, w))))
+	continue;
+      scale = 0.0;
+      for (b=0; b<nseg; b++)
+	{
+	  z = fl->lines + 2*(size_t)n*(nseg*(yy%convh) + b);
+	  x0 = b*l - convw2;
+	  for (t=0; t<n; t++)
+	    {
+	      x = x0 + t;
+	      if (x >= 0 && x < w && nline[x] != 0.0)
+		{
+		  ivar = 1.0 / ((double)nline[x] * nline[x]);
+		  z[2*t] = imline[x] * ivar;
+		  z[2*t+1] = ivar;
+		  if (ivar > scale)
+		    scale = ivar;
+		}
+	      else
+		z[2*t] = z[2*t+1] = 0.0;
+	    }
+	  fft(z, n, fk->twiddle, 0);
+	}
+      fl->scale[yy%convh] = scale;
+    }
+
+  scale = 0.0;
+  for (yy=lo; yy<hi; yy++)
+    {
+      if (fl->bad[yy%convh])
+	return matched_filter(imbuf, nbuf, y, fk->conv, fk->convw, fk->convh,
+			      work, out);
+      if (fl->scale[yy%convh] > scale)
+	scale = fl->scale[yy%convh];
+    }
+
+  /* Denominators below the rounding errors of the transforms are zero */
+  denmin = FFT_DENOM_EPS * fk->conv2max * scale;
+
+  for (b=0; b<nseg; b++)
+    {
+      /* multiply by the kernel rows and sum */
+      memset(acc, 0, 2*(size_t)n*sizeof(double));
+      for (yy=lo; yy<hi; yy++)
+	{
+	  z = fl->lines + 2*(size_t)n*(nseg*(yy%convh) + b);
+	  kp = fk->kernmf + 4*(size_t)n*(yy-y0);
+	  kq = kp + 2*n;
+	  for (k=0; k<n; k++)
+	    {
+	      km = (n-k) & (n-1);
+	      zr = z[2*k];
+	      zi = z[2*k+1];
+	      cr = z[2*km];         /* conj(Z(-k)) */
+	      ci = -z[2*km+1];
+	      acc[2*k]   += zr*kp[2*k] - zi*kp[2*k+1] +
+		cr*kq[2*k] - ci*kq[2*k+1];
+	      acc[2*k+1] += zr*kp[2*k+1] + zi*kp[2*k] +
+		cr*kq[2*k+1] + ci*kq[2*k];
+	    }
+	}
+      fft(acc, n, fk->twiddle, 1);
+
+      x0 = b*l;
+      for (t=0; t<l && x0+t<w; t++)
+	{
+	  zr = acc[2*(convw2+t)];
+	  zi = acc[2*(convw2+t)+1];
+	  out[x0+t] = (zi > denmin)? zr / sqrt(zi): -BIG;
+	}
+    }
 
   return RETURN_OK;
 }
@@ -28,21 +28,24 @@
 #include "sepcore.h"
 #include "extract.h"
 
-#ifndef	RAND_MAX
-#define	RAND_MAX 2147483647
-#endif
 #define	NSONMAX	1024  /* max. number per level */
 #define NSONMAX_STR "1024" /* just for error message */
 #define	NBRANCH	16    /* starting number per branch */
 
 
 
-int belong(int, objliststruct *, int, objliststruct *);
-int *createsubmap(objliststruct *, int, int *, int *, int *, int *);
-int gatherup(objliststruct *, objliststruct *);
+void labelobjs(objliststruct *, int, int *, int, int, int);
+int belong(int, objliststruct *, int, int, int *, int, int, int);
+int gatherup(sep_extract_ctx *, objliststruct *, objliststruct *);
 
-static objliststruct *objlist=NULL;
-static short	     *son=NULL, *ok=NULL;
+/* Random number generator with per-context state. This is the portable
+ * rand() implementation given in the C standard, so that results of
+ * deblending are the same on all platforms. */
+static int ctxrand(sep_extract_ctx *ctx)
+{
+  ctx->randstate = ctx->randstate * 1103515245 + 12345;
+  return (int)((ctx->randstate / 65536) % (SEP_RAND_MAX + 1));
+}
 
 /******************************** deblend ************************************/
 /*
@@ -52,23 +55,27 @@ NOTE: Even if the object is not deblended, the output objlist threshold is
 
 This can return two error codes: DEBLEND_OVERFLOW or MEMORY_ALLOC_ERROR
 */
-int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
-	    int deblend_nthresh, double deblend_mincont, int minarea)
+int deblend(sep_extract_ctx *ctx, objliststruct *objlistin, int l,
+	    objliststruct *objlistout, int deblend_nthresh,
+	    double deblend_mincont, int minarea)
 {
   objstruct		*obj;
-  static objliststruct	debobjlist, debobjlist2;
+  objliststruct		debobjlist, debobjlist2;
+  objliststruct		*objlist = ctx->deblend.objlist;
+  short			*son = ctx->deblend.son, *ok = ctx->deblend.ok;
   double		thresh, thresh0, value0;
   int			h,i,j,k,m,subx,suby,subh,subw,
                         xn,
 			nbm = NBRANCH,
 			status;
-  int                   *submap;
+  int                   *submap, *lmap;
+  STATS_DECL(t0);
 
-  submap = NULL;
+  submap = lmap = NULL;
   status = RETURN_OK;
   xn = deblend_nthresh;
 
-  /* reset global static objlist for deblending */
+  /* reset context objlist for deblending */
   memset(objlist, 0, (size_t)xn*sizeof(objliststruct));
 
   /* initialize local object lists */
@@ -88,14 +95,22 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
       goto exit;
     }
 
+  /* The same area holds the objects of each level the pixels belong to
+   * (see labelobjs), to find the parent of each new sub-object quickly. */
+  if (!(lmap = (int *)malloc((size_t)subw*subh*sizeof(int))))
+    {
+      status = MEMORY_ALLOC_ERROR;
+      goto exit;
+    }
+
   /* set thresholds of object lists based on object threshold */
   thresh0 = objlistin->obj[l].thresh;
   objlistout->thresh = debobjlist2.thresh = thresh0;
 
   /* add input object to global deblending objlist and one local objlist */
-  if ((status = addobjdeep(l, objlistin, &objlist[0])) != RETURN_OK)
+  if ((status = addobjdeep(ctx, l, objlistin, &objlist[0])) != RETURN_OK)
     goto exit;
-  if ((status = addobjdeep(l, objlistin, &debobjlist2)) != RETURN_OK)
+  if ((status = addobjdeep(ctx, l, objlistin, &debobjlist2)) != RETURN_OK)
     goto exit;
 
   value0 = objlist[0].obj[0].fdflux*deblend_mincont;
@@ -114,18 +129,22 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
 	  goto exit;
 	}
       
+      labelobjs(&objlist[k-1], k-1, lmap, subx, suby, subw);
       for (i=0; i<objlist[k-1].nobj; i++)
 	{
-	  status = lutz(objlistin->plist, submap, subx, suby, subw,
+	  STATS_START(t0);
+	  status = lutz(ctx, objlistin->plist, submap, subx, suby, subw,
 			&objlist[k-1].obj[i], &debobjlist, minarea);
+	  STATS_TIME(t_lutz, t0);
+	  STATS_ADD(nlutz, 1);
 	  if (status != RETURN_OK)
 	    goto exit;
 	  
 	  for (j=h=0; j<debobjlist.nobj; j++)
-	    if (belong(j, &debobjlist, i, &objlist[k-1]))
+	    if (belong(j, &debobjlist, i, k-1, lmap, subx, suby, subw))
 	      {
 		debobjlist.obj[j].thresh = debobjlist.thresh;
-		if ((status = addobjdeep(j, &debobjlist, &objlist[k]))
+		if ((status = addobjdeep(ctx, j, &debobjlist, &objlist[k]))
 		    != RETURN_OK)
 		  goto exit;
 		m = objlist[k].nobj - 1;
@@ -135,12 +154,15 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
 		    goto exit;
 		  }
 		if (h>=nbm-1)
-		  if (!(son = (short *)
-			realloc(son,xn*NSONMAX*(nbm+=16)*sizeof(short))))
-		    {
-		      status = MEMORY_ALLOC_ERROR;
-		      goto exit;
-		    }
+		  {
+		    if (!(son = (short *)
+			  realloc(son,xn*NSONMAX*(nbm+=16)*sizeof(short))))
+		      {
+			status = MEMORY_ALLOC_ERROR;
+			goto exit;
+		      }
+		    ctx->deblend.son = son;
+		  }
 		son[k-1+xn*(i+NSONMAX*(h++))] = (short)m;
 		ok[k+xn*m] = (short)1;
 	      }
@@ -167,7 +189,7 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
 		    obj[j].fdflux - obj[j].thresh * obj[j].fdnpix > value0)
 		  {
 		    objlist[k+1].obj[j].flag |= SEP_OBJ_MERGED;
-		    status = addobjdeep(j, &objlist[k+1], &debobjlist2);
+		    status = addobjdeep(ctx, j, &objlist[k+1], &debobjlist2);
 		    if (status != RETURN_OK)
 		      goto exit;
 		  }
@@ -177,9 +199,9 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
     }
   
   if (ok[0])
-    status = addobjdeep(0, &debobjlist2, objlistout);
+    status = addobjdeep(ctx, 0, &debobjlist2, objlistout);
   else
-    status = gatherup(&debobjlist2, objlistout);
+    status = gatherup(ctx, &debobjlist2, objlistout);
   
  exit:
   if (status == DEBLEND_OVERFLOW)
@@ -189,6 +211,7 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
 
   free(submap);
   submap = NULL;
+  free(lmap);
   free(debobjlist2.obj);
   free(debobjlist2.plist);
   
@@ -207,33 +230,47 @@ int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
 
 /******************************* allocdeblend ******************************/
 /*
-Allocate the memory allocated by global pointers in refine.c
+Allocate the memory used by deblend() in the extraction context. Buffers
+already in the context are kept if they are large enough for deblend_nthresh.
 */
-int allocdeblend(int deblend_nthresh)
+int allocdeblend(sep_extract_ctx *ctx, int deblend_nthresh)
 {
+  deblendbuffers *db = &ctx->deblend;
   int status=RETURN_OK;
-  QMALLOC(son, short,  deblend_nthresh*NSONMAX*NBRANCH, status);
-  QMALLOC(ok, short,  deblend_nthresh*NSONMAX, status);
-  QMALLOC(objlist, objliststruct, deblend_nthresh, status);
+
+  if (deblend_nthresh <= db->nthresh)
+    return status;
+
+  freedeblend(ctx);
+  QMALLOC(db->son, short,  deblend_nthresh*NSONMAX*NBRANCH, status);
+  QMALLOC(db->ok, short,  deblend_nthresh*NSONMAX, status);
+  QMALLOC(db->objlist, objliststruct, deblend_nthresh, status);
+  db->nthresh = deblend_nthresh;
 
   return status;
  exit:
-  freedeblend();
+  freedeblend(ctx);
   return status;
 }
 
 /******************************* freedeblend *******************************/
 /*
-Free the memory allocated by global pointers in refine.c
+Free the memory used by deblend() in the extraction context.
 */
-void freedeblend(void)
+void freedeblend(sep_extract_ctx *ctx)
 {
-  free(son);
-  son = NULL;
-  free(ok);
-  ok = NULL;
-  free(objlist);
-  objlist = NULL;
+  deblendbuffers *db = &ctx->deblend;
+
+  free(db->son);
+  db->son = NULL;
+  free(db->ok);
+  db->ok = NULL;
+  free(db->objlist);
+  db->objlist = NULL;
+  db->nthresh = 0;
+  free(db->plist);
+  db->plist = NULL;
+  db->plistbytes = 0;
   return;
 }
 
@@ -242,7 +279,8 @@ void freedeblend(void)
 Collect faint remaining pixels and allocate them to their most probable
 progenitor.
 */
-int gatherup(objliststruct *objlistin, objliststruct *objlistout)
+int gatherup(sep_extract_ctx *ctx, objliststruct *objlistin,
+	     objliststruct *objlistout)
 {
   char        *bmp;
   float       *amp, *p, dx,dy, drand, dist, distmin;
@@ -265,7 +303,7 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
   QMALLOC(n, int, nobj, status);
 
   for (i=1; i<nobj; i++)
-    analyse(i, objlistin, 0);
+    analyse(ctx, i, objlistin, 0);
 
   p[0] = 0.0;
   bmwidth = objin->xmax - (xs=objin->xmin) + 1;
@@ -287,7 +325,7 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
 	   pixt=pixelin+PLIST(pixt,nextpix))
 	bmp[(PLIST(pixt,x)-xs) + (PLIST(pixt,y)-ys)*bmwidth] = '\1';
       
-      status = addobjdeep(i, objlistin, objlistout);
+      status = addobjdeep(ctx, i, objlistin, objlistout);
       if (status != RETURN_OK)
 	goto exit;
       n[i] = objlistout->nobj - 1;
@@ -303,7 +341,7 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
   objout = objlistout->obj;		/* DO NOT MOVE !!! */
 
   if (!(pixelout=(pliststruct *)realloc(objlistout->plist,
-					(objlistout->npix + npix)*plistsize)))
+					(objlistout->npix + npix)*ctx->plistsize)))
     {
       status = MEMORY_ALLOC_ERROR;
       goto exit;
@@ -319,8 +357,8 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
       y = PLIST(pixt,y);
       if (!bmp[(x-xs) + (y-ys)*bmwidth])
 	{
-	  pixt2 = pixelout + (l=(k++*plistsize));
-	  memcpy(pixt2, pixt, (size_t)plistsize);
+	  pixt2 = pixelout + (l=(k++*ctx->plistsize));
+	  memcpy(pixt2, pixt, (size_t)ctx->plistsize);
 	  PLIST(pixt2, nextpix) = -1;
 	  distmin = 1e+31;
 	  for (objt = objin+(i=1); i<nobj; i++, objt++)
@@ -337,7 +375,7 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
 	    }			
 	  if (p[nobj-1] > 1.0e-31)
 	    {
-	      drand = p[nobj-1]*rand()/RAND_MAX;
+	      drand = p[nobj-1]*ctxrand(ctx)/SEP_RAND_MAX;
 	      for (i=1; i<nobj && p[i]<drand; i++);
 	      if (i==nobj)
 		i=iclst;
@@ -350,7 +388,7 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
 
   objlistout->npix = k;
   if (!(objlistout->plist = (pliststruct *)realloc(pixelout,
-						   objlistout->npix*plistsize)))
+					   objlistout->npix*ctx->plistsize)))
     status = MEMORY_ALLOC_ERROR;
 
  exit:
@@ -362,26 +400,44 @@ int gatherup(objliststruct *objlistin, objliststruct *objlistout)
   return status;
 }
 
+/********************************* labelobjs *********************************/
+/*
+Mark each pixel of the objects in `objlist`, the objects found at deblending
+threshold `level`, with the level and the number of its object in the map
+`lmap` of the area of the submap. Marks of pixels left from lower levels are
+never confused with those of `level`, so the map needs no clearing.
+*/
+void labelobjs(objliststruct *objlist, int level, int *lmap, int subx,
+	       int suby, int subw)
+{
+  pliststruct *pixel = objlist->plist, *pixt;
+  int         i, tag;
+
+  for (i=0; i<objlist->nobj; i++)
+    {
+      tag = level*NSONMAX + i;
+      for (pixt=pixel+objlist->obj[i].firstpix; pixt>=pixel;
+	   pixt=pixel+PLIST(pixt,nextpix))
+	lmap[(PLIST(pixt,x)-subx) + (PLIST(pixt,y)-suby)*subw] = tag;
+    }
+}
+
 /**************** belong (originally in manobjlist.c) ************************/
 /*
  * say if an object is "included" in another. Returns 1 if the pixels of the
- * first object are included in the pixels of the second object.
+ * first object are included in the pixels of object `shellnb` of deblending
+ * threshold `level`, as marked in `lmap` by labelobjs(). The objects of a
+ * level are disjoint and each object of the next level lies within one of
+ * them, so it is enough to look at the first pixel.
  */
 
-int belong(int corenb, objliststruct *coreobjlist,
-	   int shellnb, objliststruct *shellobjlist)
+int belong(int corenb, objliststruct *coreobjlist, int shellnb, int level,
+	   int *lmap, int subx, int suby, int subw)
 {
-  objstruct   *cobj = &(coreobjlist->obj[corenb]),
-              *sobj = &(shellobjlist->obj[shellnb]);
-  pliststruct *cpl = coreobjlist->plist, *spl = shellobjlist->plist, *pixt;
-
-  int         xc=PLIST(cpl+cobj->firstpix,x), yc=PLIST(cpl+cobj->firstpix,y);
-
-  for (pixt = spl+sobj->firstpix; pixt>=spl; pixt = spl+PLIST(pixt,nextpix))
-    if ((PLIST(pixt,x) == xc) && (PLIST(pixt,y) == yc))
-      return 1;
+  pliststruct *cpl = coreobjlist->plist + coreobjlist->obj[corenb].firstpix;
 
-  return 0;
+  return lmap[(PLIST(cpl,x)-subx) + (PLIST(cpl,y)-suby)*subw] ==
+    level*NSONMAX + shellnb;
 }
 
 
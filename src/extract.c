@@ -22,6 +22,7 @@
 
 /* Note: was scan.c in SExtractor. */
 
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,11 +34,63 @@
 #define DETECT_MAXAREA 0             /* replaces prefs.ext_maxarea */
 #define	WTHRESH_CONVFAC	1e-4         /* Factor to apply to weights when */
 			             /* thresholding filtered weight-maps */
+#define FFTCONV_MINAREA    121       /* min. size of non-separable */
+#define FFTCONV_MINAREA_MF 49        /* filters applied with FFTs (without */
+				     /* or with matched filter) */
+#define SEPCONV_MINAREA    25        /* min. size of separable filters */
+				     /* applied as two 1-d passes */
+#define SCAN_CHUNK         32        /* pixels tested at once for activity */
+
+/* Parameters of one extraction, shared by all strips of the image */
+typedef struct
+{
+  void    *image, *noise;     /* arrays, or line buffers if streaming */
+  int     dtype, ndtype, w, h;
+  size_t  imstride, nstride;  /* bytes between lines (0 if streaming) */
+  sep_readline_func readline; /* supplies the lines if streaming */
+  void    *userdata;          /* passed to readline */
+  PIXTYPE thresh;             /* relative threshold if noise is given */
+  int     minarea;
+  float   *conv;              /* normalized filter (NULL if not filtering) */
+  int     convw, convh;
+  float   *convx, *convy;     /* its row and column vectors if separable,
+				 NULL otherwise (stored after conv) */
+  fftkernel fftk;             /* for filtering with FFTs (if fftk.n > 0) */
+  int     deblend_nthresh;
+  double  deblend_cont;
+  int     use_matched_filter;
+} extractparams;
+
+/* Objects passed on to the caller while the scan proceeds */
+typedef struct
+{
+  sep_object_func emit;       /* receives each final object */
+  void    *userdata;          /* passed to emit */
+  int     clean_flag;
+  double  clean_param;
+  int     nready;             /* objects of the list set up for cleaning */
+  double  amax, hmax;         /* largest semi-major axis and extent below
+				 the centroid of all objects so far */
+  int     first;              /* first object of the list not yet released */
+  int     *survives;          /* cleaning result of each object of the list */
+  int     size;               /* allocated length of survives */
+  int     nemit;              /* number of objects passed so far */
+} objemitter;
+
+/* Catalog of sep_extract_measure(), filled as objects are passed on */
+typedef struct
+{
+  const sepmeasplan *plan;
+  void    *image, *error;     /* arrays measured */
+  int     dtype, edtype, w, h;
+  short   inflag;             /* of the aperture functions */
+  sepobj  *objects;
+  sepmeas *meas;
+  int     nobj, size;         /* objects gathered, allocated length */
+  int     status;             /* of the last object gathered */
+} measgather;
 
 /* globals */
-int plistexist_cdvalue, plistexist_thresh, plistexist_var;
-int plistoff_value, plistoff_cdvalue, plistoff_thresh, plistoff_var;
-int plistsize;
 size_t extract_pixstack = 300000;
 
 /* get and set pixstack */
@@ -51,14 +104,56 @@ size_t sep_get_extract_pixstack()
   return extract_pixstack;
 }
 
-int  sortit(infostruct *, objliststruct *, int,
+int  compactplist(sep_extract_ctx *, infostruct *, pliststruct *,
+		  objliststruct *);
+int  sortit(sep_extract_ctx *, infostruct *, objliststruct *, int,
 	    objliststruct *, int, double);
-void plistinit(void *, void *);
-void clean(objliststruct *objlist, double clean_param, int *survives);
+void plistinit(sep_extract_ctx *, void *, void *);
+int  allocscan(sep_extract_ctx *, int);
+void freescan(sep_extract_ctx *);
+int  initpixstack(sep_extract_ctx *, size_t, infostruct *);
+int  growpixstack(sep_extract_ctx *, size_t, infostruct *);
+int  initparams(extractparams *, void *, void *, int, int, int, int,
+		size_t, size_t, float, int, float *, int, int, int, double, int);
+void freeparams(extractparams *);
+int  extractall(sep_extract_ctx *, extractparams *, int, double,
+		objemitter *, sepobj **, sepcatalog **, int *);
+int  prepctx(sep_extract_ctx *, extractparams *);
+int  readlines(extractparams *, arraybuffer *, arraybuffer *);
+int  nextactive(const PIXTYPE *, const PIXTYPE *, const PIXTYPE *, PIXTYPE,
+		const char *, int, int);
+int  scanstrip(sep_extract_ctx *, extractparams *, int, int,
+	       objliststruct *, objliststruct *, objemitter *);
+int  emitobjs(sep_extract_ctx *, extractparams *, objliststruct *,
+	      objemitter *, int);
+void dropobjs(sep_extract_ctx *, objliststruct *, int);
+int  gatherobj(void *, const sepobj *);
+int  measureobj(measgather *, const sepobj *, sepmeas *);
+int  addseamobj(sep_extract_ctx *, infostruct *, pliststruct *,
+		objliststruct *);
+int  queuedetection(sep_extract_ctx *, infostruct *, pliststruct *, PIXTYPE,
+		    int, int);
+int  flushdeblend(sep_extract_ctx *, extractparams *, objliststruct *);
+void freequeue(sep_extract_ctx *);
+int  mergeseams(sep_extract_ctx **, int, extractparams *, int *,
+		objliststruct *, objliststruct *);
+int  findroot(int *, int);
+void seedrand(sep_extract_ctx *, extractparams *, int, int);
+int  joinseamobj(sep_extract_ctx *, extractparams *, objliststruct *, int *,
+		 int *, int, objliststruct *);
+int  mergeobjlists(sep_extract_ctx *, objliststruct *, int,
+		   objliststruct *);
+int  finishobjlist(sep_extract_ctx *, extractparams *, objliststruct *, int,
+		   double, sepobj **, sepcatalog **, int *);
+int  clean(objliststruct *objlist, double clean_param, int *survives);
+void cleanobj(objliststruct *objlist, int i, double clean_param,
+	      int *survives, int *cand, int ncand);
 int convertobj(int l, objliststruct *objlist, sepobj *objout, int w);
+int convertcatalog(objliststruct *objlist, int *survives, int nobj, int w,
+		   sepcatalog **catalog);
 
 int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                     int bufw, int bufh);
+                     size_t stride, int bufw, int bufh, int ystart);
 void arraybuffer_readline(arraybuffer *buf);
 void arraybuffer_free(arraybuffer *buf);
 
@@ -66,16 +161,20 @@ void arraybuffer_free(arraybuffer *buf);
 
 /* initialize buffer */
 /* bufw must be less than or equal to w */
+/* stride is the number of bytes between lines of the data array; if 0,
+ * every line is read from arr, where the caller puts it before reading it */
+/* after bufh calls to arraybuffer_readline(), midline is line ystart */
 int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                     int bufw, int bufh)
+                     size_t stride, int bufw, int bufh, int ystart)
 {
-  int status, yl;
+  int status;
   status = RETURN_OK;
 
   /* data info */
   buf->dptr = arr;
   buf->dw = w;
   buf->dh = h;
+  buf->dstride = stride;
 
   /* buffer array info */
   buf->bptr = NULL;
@@ -92,11 +191,7 @@ int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
     goto exit;
 
   /* initialize yoff */
-  buf->yoff = -bufh;
-
-  /* read in lines until the first data line is one line above midline */
-  for (yl=0; yl < bufh - bufh/2 - 1; yl++)
-    arraybuffer_readline(buf);
+  buf->yoff = ystart - bufh/2 - bufh;
 
   return status;
 
@@ -120,9 +215,8 @@ void arraybuffer_readline(arraybuffer *buf)
   buf->yoff++;
   y = buf->yoff + buf->bh - 1;
 
-  if (y < buf->dh)
-    buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->dw,
-                  buf->lastline);
+  if (y >= 0 && y < buf->dh)
+    buf->readline(buf->dptr + buf->dstride * y, buf->dw, buf->lastline);
 
   return;
 }
@@ -133,6 +227,216 @@ void arraybuffer_free(arraybuffer *buf)
   buf->bptr = NULL;
 }
 
+/******************************* allocscan ***********************************/
+/*
+Allocate the buffers used by the main scan in the extraction context for
+an image of width w. Buffers already large enough are kept.
+*/
+int allocscan(sep_extract_ctx *ctx, int w)
+{
+  scanbuffers *sb = &ctx->scan;
+  int stacksize, xl, status = RETURN_OK;
+
+  stacksize = w+1;
+  if (stacksize <= sb->stacksize)
+    return status;
+
+  freescan(ctx);
+  QMALLOC(sb->info, infostruct, stacksize, status);
+  QMALLOC(sb->store, infostruct, stacksize, status);
+  QMALLOC(sb->marker, char, stacksize, status);
+  QMALLOC(sb->dumscan, PIXTYPE, stacksize, status);
+  QMALLOC(sb->psstack, pixstatus, stacksize, status);
+  QMALLOC(sb->start, int, stacksize, status);
+  QMALLOC(sb->end, int, stacksize, status);
+  QMALLOC(sb->cdscan, PIXTYPE, stacksize, status);
+  QMALLOC(sb->sigscan, PIXTYPE, stacksize, status);
+  QMALLOC(sb->workscan, PIXTYPE, 3*stacksize, status);
+  for (xl=0; xl<stacksize; xl++)
+    sb->dumscan[xl] = -BIG;
+  sb->stacksize = stacksize;
+
+  return status;
+
+ exit:
+  freescan(ctx);
+  return status;
+}
+
+/******************************* freescan ************************************/
+void freescan(sep_extract_ctx *ctx)
+{
+  scanbuffers *sb = &ctx->scan;
+
+  free(sb->info);
+  free(sb->store);
+  free(sb->marker);
+  free(sb->dumscan);
+  free(sb->psstack);
+  free(sb->start);
+  free(sb->end);
+  free(sb->cdscan);
+  free(sb->sigscan);
+  free(sb->workscan);
+  memset(sb, 0, sizeof(scanbuffers));
+}
+
+/****************************** initpixstack *********************************
+ *
+ * Set up the pixel stack of the context, of at most `mem_pixstack` pixels
+ * with the current pixel list layout, and make all pixels "free". The stack
+ * starts at PIXSTACK_INIT pixels and grows as needed (see growpixstack); a
+ * stack grown by previous calls is kept, so that it is only reallocated if
+ * its layout or the limit changes. Otherwise only the part used since the
+ * free list was last linked needs relinking: pixels are taken from the free
+ * list in order, so everything beyond the high-water mark is still linked.
+ */
+int initpixstack(sep_extract_ctx *ctx, size_t mem_pixstack,
+		 infostruct *freeinfo)
+{
+  pixstackbuffer *pb = &ctx->pixstack;
+  pliststruct	 *pixt;
+  size_t	 npix;
+  int		 nposize, i, status = RETURN_OK;
+
+  npix = (mem_pixstack < PIXSTACK_INIT)? mem_pixstack: PIXSTACK_INIT;
+  nposize = (int)npix*ctx->plistsize;
+  if (ctx->plistsize == pb->plistsize && pb->size >= nposize &&
+      (size_t)pb->size <= mem_pixstack*ctx->plistsize)
+    nposize = pb->size;
+  else
+    {
+      free(pb->pixel);
+      pb->size = 0;
+      QMALLOC(pb->pixel, pliststruct, nposize, status);
+      pb->size = nposize;
+      pb->hwm = nposize;
+    }
+  pb->plistsize = ctx->plistsize;
+
+  /*----- at the beginning, "free" object fills the whole pixel list */
+  freeinfo->firstpix = 0;
+  freeinfo->lastpix = nposize-ctx->plistsize;
+  if (pb->hwm > 0)
+    {
+      pixt = pb->pixel;
+      for (i=ctx->plistsize; i<pb->hwm;
+	   i += ctx->plistsize, pixt += ctx->plistsize)
+	PLIST(pixt, nextpix) = i;
+      PLIST(pixt, nextpix) = (pb->hwm < nposize)? pb->hwm: -1;
+    }
+  pb->hwm = 0;
+
+ exit:
+  return status;
+}
+
+/****************************** growpixstack *********************************
+ *
+ * Double the size of the pixel stack of the context, up to `mem_pixstack`
+ * pixels, when only its last free pixel is left, and link the new pixels to
+ * the end of the free list. Pixels are referred to by their offset in the
+ * stack, so the lists of the objects being detected stay valid, but
+ * pointers into the stack must be updated from ctx->pixstack.pixel.
+ */
+int growpixstack(sep_extract_ctx *ctx, size_t mem_pixstack,
+		 infostruct *freeinfo)
+{
+  pixstackbuffer *pb = &ctx->pixstack;
+  pliststruct	 *pixel, *pixt;
+  size_t	 npix, maxpix;
+  int		 oldnposize, nposize, i;
+  char		 errtext[512];
+
+  /* offsets in the stack must fit in an int */
+  maxpix = INT_MAX / ctx->plistsize;
+  if (mem_pixstack < maxpix)
+    maxpix = mem_pixstack;
+  npix = pb->size / ctx->plistsize;
+  if (npix >= maxpix)
+    {
+      sprintf(errtext,
+	      "The limit of %lu active object pixels over the "
+	      "detection threshold was reached. Check that "
+	      "the image is background subtracted and the "
+	      "detection threshold is not too low.",
+	      (unsigned long)maxpix);
+      put_errdetail(errtext);
+      return PIXSTACK_FULL;
+    }
+
+  /* increase the stack size */
+  npix = (npix < maxpix/2)? 2*npix: maxpix;
+  oldnposize = pb->size;
+  nposize = (int)npix*ctx->plistsize;
+  if (!(pixel = (pliststruct *)realloc(pb->pixel, (size_t)nposize)))
+    {
+      sprintf(errtext, "pixel stack (%lu bytes) at line %d in module "
+	      __FILE__ " !", (unsigned long)nposize, __LINE__);
+      put_errdetail(errtext);
+      return MEMORY_ALLOC_ERROR;
+    }
+  pb->pixel = pixel;
+  pb->size = nposize;
+
+  /* set next free pixel to the start of the new block
+   * and link up all the pixels in the new block */
+  PLIST(pixel+freeinfo->firstpix, nextpix) = oldnposize;
+  pixt = pixel + oldnposize;
+  for (i=oldnposize + ctx->plistsize; i<nposize;
+       i += ctx->plistsize, pixt += ctx->plistsize)
+    PLIST(pixt, nextpix) = i;
+  PLIST(pixt, nextpix) = -1;
+
+  /* last free pixel is now at the end of the new block */
+  freeinfo->lastpix = nposize - ctx->plistsize;
+
+  return RETURN_OK;
+}
+
+/************************** extraction context *******************************/
+
+int sep_extract_ctx_new(sep_extract_ctx **ctx)
+{
+  int status = RETURN_OK;
+
+  QCALLOC(*ctx, sep_extract_ctx, 1, status);
+
+ exit:
+  return status;
+}
+
+void sep_extract_ctx_free(sep_extract_ctx *ctx)
+{
+  if (ctx)
+    {
+      freescan(ctx);
+      free(ctx->pixstack.pixel);
+      lutzfree(ctx);
+      freedeblend(ctx);
+      freequeue(ctx);
+    }
+  free(ctx);
+}
+
+void sep_extract_ctx_set_nthreads(sep_extract_ctx *ctx, int nthreads)
+{
+#ifdef _OPENMP
+  if (nthreads <= 0)
+    nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+  ctx->nthreads = nthreads;
+}
+
+void sep_extract_ctx_set_strides(sep_extract_ctx *ctx,
+				 size_t imstride, size_t nstride)
+{
+  ctx->imstride = imstride;
+  ctx->nstride = nstride;
+}
+
 /****************************** extract **************************************/
 int sep_extract(void *image, void *noise, int dtype, int ndtype, int w, int h,
 	        float thresh, int minarea, float *conv, int convw, int convh,
@@ -140,223 +444,1189 @@ int sep_extract(void *image, void *noise, int dtype, int ndtype, int w, int h,
 		int clean_flag, double clean_param, int use_matched_filter,
 		sepobj **objects, int *nobj)
 {
-  arraybuffer       imbuf, nbuf;
-  infostruct        curpixinfo, initinfo, freeinfo;
-  objliststruct     objlist;
-  char              newmarker;
-  size_t            mem_pixstack;
-  int               nposize, oldnposize;
-  int               co, i, j, luflag, pstop, xl, xl2, yl, cn;
-  int               stacksize, convn, status;
-  int               bufh;
-  short             trunflag;
-  PIXTYPE           relthresh, cdnewsymbol;
-  float             sum;
-  pixstatus         cs, ps;
+  sep_extract_ctx *ctx;
+  int status;
 
-  infostruct        *info, *store;
-  objliststruct     *finalobjlist;
-  pliststruct	    *pixel, *pixt;
-  char              *marker;
-  PIXTYPE           *scan, *cdscan, *wscan, *dumscan;
-  PIXTYPE           *sigscan, *workscan;
-  float             *convnorm;
-  int               *start, *end, *survives;
-  pixstatus         *psstack;
-  char              errtext[512];
+  if ((status = sep_extract_ctx_new(&ctx)) != RETURN_OK)
+    {
+      *objects = NULL;
+      *nobj = 0;
+      return status;
+    }
 
-  status = RETURN_OK;
-  pixel = NULL;
-  convnorm = NULL;
-  scan = wscan = cdscan = dumscan = NULL;
-  sigscan = workscan = NULL;
-  info = NULL;
-  store = NULL;
-  marker = NULL;
-  psstack = NULL;
-  start = end = NULL;
-  finalobjlist = NULL; /* final return value */
-  convn = 0;
-  sum = 0.0;
+  status = sep_extract_with_ctx(ctx, image, noise, dtype, ndtype, w, h,
+				thresh, minarea, conv, convw, convh,
+				deblend_nthresh, deblend_cont, clean_flag,
+				clean_param, use_matched_filter, objects, nobj);
 
-  mem_pixstack = sep_get_extract_pixstack();
+  sep_extract_ctx_free(ctx);
 
-  /* seed the random number generator consistently on each call to get
-     consistent results. rand() is used in deblending. */
-  srand(1);
+  return status;
+}
 
-  /* If we have a noise array, thresh is actually relthresh; we'll use
-   * relthresh below to set the threshold for each pixel. */
-  relthresh = thresh;
+int sep_extract_with_ctx(sep_extract_ctx *ctx, void *image, void *noise,
+			 int dtype, int ndtype, int w, int h,
+			 float thresh, int minarea, float *conv,
+			 int convw, int convh, int deblend_nthresh,
+			 double deblend_cont, int clean_flag,
+			 double clean_param, int use_matched_filter,
+			 sepobj **objects, int *nobj)
+{
+  extractparams     p;
+  int               status;
 
-  objlist.thresh = thresh;
+  status = initparams(&p, image, noise, dtype, ndtype, w, h, ctx->imstride,
+		      ctx->nstride, thresh, minarea, conv, convw, convh,
+		      deblend_nthresh, deblend_cont, use_matched_filter);
+  if (status == RETURN_OK)
+    status = extractall(ctx, &p, clean_flag, clean_param, NULL, objects, NULL,
+			nobj);
+  freeparams(&p);
 
-  /*Allocate memory for buffers */
-  stacksize = w+1;
-  QMALLOC(info, infostruct, stacksize, status);
-  QCALLOC(store, infostruct, stacksize, status);
-  QMALLOC(marker, char, stacksize, status);
-  QMALLOC(dumscan, PIXTYPE, stacksize, status);
-  QMALLOC(psstack, pixstatus, stacksize, status);
-  QCALLOC(start, int, stacksize, status);
-  QMALLOC(end, int, stacksize, status);
-  if ((status = lutzalloc(w, h)) != RETURN_OK)
+  if (status != RETURN_OK)
+    {
+      *objects = NULL;
+      *nobj = 0;
+    }
+
+  return status;
+}
+
+/************************** sep_extract_catalog ******************************/
+int sep_extract_catalog(sep_extract_ctx *ctx, void *image, void *noise,
+			int dtype, int ndtype, int w, int h,
+			float thresh, int minarea, float *conv,
+			int convw, int convh, int deblend_nthresh,
+			double deblend_cont, int clean_flag,
+			double clean_param, int use_matched_filter,
+			sepcatalog **catalog)
+{
+  extractparams     p;
+  sepobj            *objects;
+  int               nobj, status;
+
+  *catalog = NULL;
+  status = initparams(&p, image, noise, dtype, ndtype, w, h, ctx->imstride,
+		      ctx->nstride, thresh, minarea, conv, convw, convh,
+		      deblend_nthresh, deblend_cont, use_matched_filter);
+  if (status == RETURN_OK)
+    status = extractall(ctx, &p, clean_flag, clean_param, NULL, &objects,
+			catalog, &nobj);
+  freeparams(&p);
+
+  return status;
+}
+
+/************************** sep_extract_windows ******************************/
+/*
+Extract sources from each window of the image in turn, reading the window in
+place through the line strides and reusing the buffers of the context, and
+shift the objects found to the coordinates of the image.
+*/
+int sep_extract_windows(sep_extract_ctx *ctx, void *image, void *noise,
+			int dtype, int ndtype, int w, int h,
+			size_t imstride, size_t nstride,
+			const sepwindow *windows, int nwin,
+			float thresh, int minarea, float *conv,
+			int convw, int convh, int deblend_nthresh,
+			double deblend_cont, int clean_flag,
+			double clean_param, int use_matched_filter,
+			sepobj **objects, int *winoff, int *nobj)
+{
+  extractparams     p;
+  array_converter   cvt;
+  sepobj            *wobjects, *all, *obj;
+  int               elsize, nelsize, x0, x1, y0, y1, ww, i, j, k, n, nall,
+		    size, status;
+  char              errtext[80];
+
+  status = RETURN_OK;
+  all = wobjects = NULL;
+  nall = size = n = 0;
+  nelsize = 0;
+  winoff[0] = 0;
+
+  if ((status = get_array_converter(dtype, &cvt, &elsize)) != RETURN_OK)
     goto exit;
-  if ((status = allocdeblend(deblend_nthresh)) != RETURN_OK)
+  if (noise &&
+      (status = get_array_converter(ndtype, &cvt, &nelsize)) != RETURN_OK)
     goto exit;
+  if (!imstride)
+    imstride = (size_t)elsize*w;
+  if (!nstride)
+    nstride = (size_t)nelsize*w;
+  if (imstride < (size_t)elsize*w || (noise && nstride < (size_t)nelsize*w))
+    {
+      sprintf(errtext, "in sep_extract_windows(): %lu or %lu bytes for "
+	      "lines of %d", (unsigned long)imstride, (unsigned long)nstride,
+	      w);
+      put_errdetail(errtext);
+      status = ILLEGAL_STRIDE;
+      goto exit;
+    }
 
-  /* Initialize buffers for input array(s).
-   * The buffer size depends on whether or not convolution is active.
-   * If not convolving, the buffer size is just a single line. If convolving,
-   * the buffer height equals the height of the convolution kernel.
-   */
-  bufh = conv ? convh : 1;
-  status = arraybuffer_init(&imbuf, image, dtype, w, h, stacksize, bufh);
-  if (status != RETURN_OK)
-    goto exit;
-  if (noise)
+  for (k=0; k<nwin; k++)
     {
-      status = arraybuffer_init(&nbuf, noise, ndtype, w, h, stacksize, bufh);
+      /* the part of the window within the image */
+      x0 = windows[k].xmin > 0? windows[k].xmin: 0;
+      x1 = windows[k].xmax < w? windows[k].xmax: w;
+      y0 = windows[k].ymin > 0? windows[k].ymin: 0;
+      y1 = windows[k].ymax < h? windows[k].ymax: h;
+      ww = x1 - x0;
+      if (ww <= 0 || y1 <= y0)
+	{
+	  winoff[k+1] = nall;
+	  continue;
+	}
+
+      status = initparams(&p, (BYTE *)image + imstride*y0 + (size_t)elsize*x0,
+			  noise? ((BYTE *)noise + nstride*y0 +
+				  (size_t)nelsize*x0): NULL,
+			  dtype, ndtype, ww, y1-y0, imstride, nstride, thresh,
+			  minarea, conv, convw, convh, deblend_nthresh,
+			  deblend_cont, use_matched_filter);
+      if (status == RETURN_OK)
+	status = extractall(ctx, &p, clean_flag, clean_param, NULL, &wobjects,
+			    NULL, &n);
+      freeparams(&p);
       if (status != RETURN_OK)
-        goto exit;
+	goto exit;
+
+      /* append the objects of the window, in image coordinates */
+      if (nall + n > size)
+	{
+	  size = (nall + n > 2*size)? nall + n: 2*size;
+	  if (!(obj = (sepobj *)realloc(all, size*sizeof(sepobj))))
+	    {
+	      status = MEMORY_ALLOC_ERROR;
+	      goto exit;
+	    }
+	  all = obj;
+	}
+      for (i=0; i<n; i++)
+	{
+	  obj = all + nall++;
+	  *obj = wobjects[i];
+	  obj->xmin += x0;
+	  obj->xmax += x0;
+	  obj->ymin += y0;
+	  obj->ymax += y0;
+	  obj->x += x0;
+	  obj->y += y0;
+	  obj->xcpeak += x0;
+	  obj->ycpeak += y0;
+	  obj->xpeak += x0;
+	  obj->ypeak += y0;
+	  for (j=0; j<obj->npix; j++)
+	    obj->pix[j] = (obj->pix[j]%ww + x0) + (obj->pix[j]/ww + y0)*w;
+	}
+      free(wobjects);
+      wobjects = NULL;
+      n = 0;
+      winoff[k+1] = nall;
     }
 
-  /* `scan` (or `wscan`) is always a pointer to the current line being
-   * processed. It might be the only line in the buffer, or it might be the 
-   * middle line. */
-  scan = imbuf.midline;
-  if (noise)
-    wscan = nbuf.midline;
+  *objects = all;
+  *nobj = nall;
+  return status;
 
-  /* More initializations */
-  initinfo.pixnb = 0;
-  initinfo.flag = 0;
-  initinfo.firstpix = initinfo.lastpix = -1;
+ exit:
+  sep_freeobjarray(wobjects, n);
+  sep_freeobjarray(all, nall);
+  *objects = NULL;
+  *nobj = 0;
+  return status;
+}
 
-  for (xl=0; xl<stacksize; xl++)
+/*************************** sep_extract_stream ******************************/
+/*
+Extract sources from an image supplied line by line by the caller. Only the
+lines under the filter are held in memory, in the buffers of the scan, and
+objects may be passed on to the caller as they are found (see emitobjs).
+*/
+int sep_extract_stream(sep_extract_ctx *ctx,
+		       sep_readline_func readline, void *userdata,
+		       int dtype, int ndtype, int w, int h,
+		       float thresh, int minarea, float *conv,
+		       int convw, int convh, int deblend_nthresh,
+		       double deblend_cont, int clean_flag,
+		       double clean_param, int use_matched_filter,
+		       sep_object_func emit, void *emitdata,
+		       sepobj **objects, int *nobj)
+{
+  extractparams     p;
+  objemitter        em;
+  array_converter   cvt;
+  BYTE              *line, *nline;
+  int               elsize, nelsize, status;
+
+  status = RETURN_OK;
+  line = nline = NULL;
+  p.conv = NULL;
+  memset(&p.fftk, 0, sizeof(fftkernel));
+
+  /* the caller puts each line here */
+  if ((status = get_array_converter(dtype, &cvt, &elsize)) != RETURN_OK)
+    goto exit;
+  QMALLOC(line, BYTE, (size_t)elsize*w, status);
+  if (ndtype)
     {
-    marker[xl]  = 0 ;
-    dumscan[xl] = -BIG ;
+      if ((status = get_array_converter(ndtype, &cvt, &nelsize)) !=
+	  RETURN_OK)
+	goto exit;
+      QMALLOC(nline, BYTE, (size_t)nelsize*w, status);
     }
 
-  co = pstop = 0;
-  objlist.nobj = 1;
-  curpixinfo.pixnb = 1;
+  status = initparams(&p, line, nline, dtype, ndtype, w, h, 0, 0, thresh,
+		      minarea, conv, convw, convh, deblend_nthresh,
+		      deblend_cont, use_matched_filter);
+  if (status != RETURN_OK)
+    goto exit;
+  p.imstride = p.nstride = 0;
+  p.readline = readline;
+  p.userdata = userdata;
 
-  /* Init finalobjlist (the return catalog) */
-  QMALLOC(finalobjlist, objliststruct, 1, status);
-  finalobjlist->obj = NULL;
-  finalobjlist->plist = NULL;
-  finalobjlist->nobj = finalobjlist->npix = 0;
+  if (emit)
+    {
+      memset(&em, 0, sizeof(objemitter));
+      em.emit = emit;
+      em.userdata = emitdata;
+      em.clean_flag = clean_flag;
+      em.clean_param = clean_param;
+    }
+  status = extractall(ctx, &p, clean_flag, clean_param, emit? &em: NULL,
+		      objects, NULL, nobj);
 
+ exit:
+  freeparams(&p);
+  free(line);
+  free(nline);
 
-  /* Allocate memory for the pixel list */
-  plistinit(conv, noise);
-  if (!(pixel = objlist.plist = malloc(nposize=mem_pixstack*plistsize)))
+  if (status != RETURN_OK)
     {
-      status = MEMORY_ALLOC_ERROR;
-      goto exit;
+      *objects = NULL;
+      *nobj = 0;
     }
 
-  /*----- at the beginning, "free" object fills the whole pixel list */
-  freeinfo.firstpix = 0;
-  freeinfo.lastpix = nposize-plistsize;
-  pixt = pixel;
-  for (i=plistsize; i<nposize; i += plistsize, pixt += plistsize)
-    PLIST(pixt, nextpix) = i;
-  PLIST(pixt, nextpix) = -1;
+  return status;
+}
 
-  /* can only use a matched filter when convolving and when there is a noise
-   * array */
-  if (!(conv && noise))
-    use_matched_filter = 0;
+/************************** sep_extract_measure ******************************/
+void sep_measplan_init(sepmeasplan *plan)
+{
+  memset(plan, 0, sizeof(sepmeasplan));
+  plan->subpix = 5;
+  plan->kron_r = 6.0;
+  plan->kron_fac = 2.5;
+  plan->kron_rmin = 1.75;
+  plan->fluxfrac = 0.5;
+}
 
-  if (conv)
+/*
+Extract sources from an image array as sep_extract_stream() does, passing
+each object as it is found to gatherobj(), which measures it while the rows
+it covers are still in cache and adds it to the catalog. When cleaning, an
+object found early can still be cleaned away by one found much later, so the
+objects are only measured once clean() has run on the full list, as in
+sep_extract().
+*/
+int sep_extract_measure(sep_extract_ctx *ctx, void *image, void *noise,
+			int dtype, int ndtype, int w, int h,
+			float thresh, int minarea, float *conv,
+			int convw, int convh, int deblend_nthresh,
+			double deblend_cont, int clean_flag,
+			double clean_param, int use_matched_filter,
+			const sepmeasplan *plan, sepobj **objects,
+			sepmeas **meas, int *nobj)
+{
+  extractparams     p;
+  objemitter        em;
+  measgather        g;
+  array_converter   cvt;
+  int               elsize, i, status;
+
+  memset(&g, 0, sizeof(measgather));
+  *meas = NULL;
+
+  if (plan->naper < 0 || plan->naper > SEP_MEAS_MAXAPER ||
+      !(plan->kron_r >= 0.0 && plan->kron_fac >= 0.0 &&
+	plan->fluxfrac >= 0.0))
     {
-      /* allocate memory for convolved buffers */
-      QMALLOC(cdscan, PIXTYPE, stacksize, status);
-      if (use_matched_filter)
-        {
-          QMALLOC(sigscan, PIXTYPE, stacksize, status);
-          QMALLOC(workscan, PIXTYPE, stacksize, status);
-        }
-
-      /* normalize the filter */
-      convn = convw * convh;
-      QMALLOC(convnorm, PIXTYPE, convn, status);
-      for (i=0; i<convn; i++)
-	sum += fabs(conv[i]);
-      for (i=0; i<convn; i++)
-	convnorm[i] = conv[i] / sum;
+      *objects = NULL;
+      *nobj = 0;
+      return ILLEGAL_APER_PARAMS;
+    }
+  if (plan->subpix < 0)
+    {
+      *objects = NULL;
+      *nobj = 0;
+      return ILLEGAL_SUBPIX;
     }
 
-  /*----- MAIN LOOP ------ */
-  for (yl=0; yl<=h; yl++)
+  /* the noise, if any, is the error of each pixel for the measurements */
+  g.plan = plan;
+  g.image = image;
+  g.dtype = dtype;
+  g.w = w;
+  g.h = h;
+  if (noise)
     {
+      g.error = noise;
+      g.edtype = ndtype;
+      g.inflag = SEP_ERROR_IS_ARRAY;
+    }
+  else if (plan->err > 0.0)
+    {
+      g.error = (void *)&plan->err;
+      g.edtype = SEP_TDOUBLE;
+    }
 
-      ps = COMPLETE;
-      cs = NONOBJECT;
-    
-      /* Need an empty line for Lutz' algorithm to end gracely */
-      if (yl==h)
+  status = initparams(&p, image, noise, dtype, ndtype, w, h, ctx->imstride,
+		      ctx->nstride, thresh, minarea, conv, convw, convh,
+		      deblend_nthresh, deblend_cont, use_matched_filter);
+
+  /* the measurements read the arrays as contiguous lines */
+  if (status == RETURN_OK &&
+      (get_array_converter(dtype, &cvt, &elsize) != RETURN_OK ||
+       p.imstride != (size_t)elsize*w ||
+       (noise && (get_array_converter(ndtype, &cvt, &elsize) != RETURN_OK ||
+		  p.nstride != (size_t)elsize*w))))
+    {
+      put_errdetail("in sep_extract_measure(): lines must be contiguous");
+      status = ILLEGAL_STRIDE;
+    }
+  if (status == RETURN_OK && clean_flag)
+    {
+      status = extractall(ctx, &p, clean_flag, clean_param, NULL,
+			  &g.objects, NULL, &g.nobj);
+      if (status == RETURN_OK)
 	{
-	  if (conv)
-	    {
-	      free(cdscan);
-	      cdscan = NULL;
-	    }
-	  cdscan = dumscan;
+	  g.size = g.nobj;
+	  g.meas = (sepmeas *)malloc((g.nobj? g.nobj: 1)*sizeof(sepmeas));
+	  if (!g.meas)
+	    status = MEMORY_ALLOC_ERROR;
 	}
+      for (i=0; i<g.nobj && status == RETURN_OK; i++)
+	status = measureobj(&g, g.objects+i, g.meas+i);
+    }
+  else if (status == RETURN_OK)
+    {
+      memset(&em, 0, sizeof(objemitter));
+      em.emit = gatherobj;
+      em.userdata = &g;
+      status = extractall(ctx, &p, clean_flag, clean_param, &em, objects,
+			  NULL, nobj);
+    }
+  freeparams(&p);
 
-      else
-	{
-          arraybuffer_readline(&imbuf);
-          if (noise)
-            arraybuffer_readline(&nbuf);
+  /* report why a measurement failed rather than the emission */
+  if (status == OBJECT_EMIT_ERROR && g.status != RETURN_OK)
+    status = g.status;
 
-	  /* filter the lines */
-	  if (conv)
-	    {
-              status = convolve(&imbuf, yl, convnorm, convw, convh, cdscan);
-              if (status != RETURN_OK)
-                goto exit;
+  if (status != RETURN_OK)
+    {
+      sep_freeobjarray(g.objects, g.nobj);
+      free(g.meas);
+      *objects = NULL;
+      *nobj = 0;
+      return status;
+    }
 
-	      if (use_matched_filter)
-                {
-                  status = matched_filter(&imbuf, &nbuf, yl, convnorm, convw,
-                                          convh, workscan, sigscan);
+  *objects = g.objects;
+  *meas = g.meas;
+  *nobj = g.nobj;
+  return status;
+}
 
-                  if (status != RETURN_OK)
-                    goto exit;
-                }
-            }
-	  else
-	    {
-	      cdscan = scan;
-	    }	  
+/* sep_object_func of sep_extract_measure(): add a copy of the object and its
+ * measurements to the catalog */
+int gatherobj(void *userdata, const sepobj *obj)
+{
+  measgather *g;
+  sepobj     *objects, *objout;
+  sepmeas    *meas;
+  int        size, status;
+
+  g = (measgather *)userdata;
+  status = RETURN_OK;
+
+  if (g->nobj == g->size)
+    {
+      size = g->size? 2*g->size: 64;
+      if (!(objects = (sepobj *)realloc(g->objects, size*sizeof(sepobj))))
+	{
+	  status = MEMORY_ALLOC_ERROR;
+	  goto exit;
 	}
-      
-      trunflag = (yl==0 || yl==h-1)? SEP_OBJ_TRUNC: 0;
-      
-      for (xl=0; xl<=w; xl++)
+      g->objects = objects;
+      if (!(meas = (sepmeas *)realloc(g->meas, size*sizeof(sepmeas))))
 	{
-	  if (xl == w)
-	    cdnewsymbol = -BIG;
-	  else
-	    cdnewsymbol = cdscan[xl];
+	  status = MEMORY_ALLOC_ERROR;
+	  goto exit;
+	}
+      g->meas = meas;
+      g->size = size;
+    }
 
-	  newmarker = marker[xl];  /* marker at this pixel */
-	  marker[xl] = 0;
+  objout = g->objects + g->nobj;
+  *objout = *obj;
+  objout->pix = NULL;
+  QMALLOC(objout->pix, int, obj->npix, status);
+  memcpy(objout->pix, obj->pix, obj->npix*sizeof(int));
+  g->nobj++;
 
-	  curpixinfo.flag = trunflag;
+  status = measureobj(g, objout, g->meas + g->nobj - 1);
 
-	  if (noise)
-            thresh = relthresh * ((xl==w || yl==h)? 0.0: wscan[xl]);
+ exit:
+  g->status = status;
+  return status != RETURN_OK;
+}
 
-          /* luflag: is pixel above thresh (Y/N)? */
-          if (use_matched_filter)
-            luflag = ((xl != w) && (sigscan[xl] > relthresh))? 1: 0;
-          else
+/* measure an object as planned (see sep_extract_measure) */
+int measureobj(measgather *g, const sepobj *obj, sepmeas *m)
+{
+  const sepmeasplan *plan;
+  double x, y, a, b, theta, cxx, cyy, cxy, r, frac, area;
+  int    k, status;
+  short  flag;
+
+  plan = g->plan;
+  memset(m, 0, sizeof(sepmeas));
+  x = obj->x;
+  y = obj->y;
+  a = obj->a;
+  b = obj->b;
+
+  /* the float angle can round beyond the range of the aperture functions */
+  theta = obj->theta;
+  if (theta > PI/2.)
+    theta = PI/2.;
+  else if (theta < -PI/2.)
+    theta = -PI/2.;
+
+  if (plan->flags & SEP_MEAS_KRON)
+    {
+      sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy);
+      status = sep_kron_radius(g->image, NULL, g->dtype, 0, g->w, g->h, 0.0,
+			       x, y, cxx, cyy, cxy, plan->kron_r,
+			       &m->kronrad, &m->kronflag);
+      if (status != RETURN_OK)
+	return status;
+
+      /* small or ill-defined Kron ellipses are replaced by a circle */
+      if (m->kronrad * sqrt(a*b) < plan->kron_rmin)
+	{
+	  status = sep_sum_circle(g->image, g->error, NULL,
+				  g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+				  plan->gain, g->inflag, x, y, plan->kron_rmin,
+				  plan->subpix, &m->kronflux, &m->kronfluxerr,
+				  &area, &m->kronfluxflag);
+	  m->kronfluxflag |= SEP_APER_CIRCLE;
+	}
+      else
+	status = sep_sum_ellipse(g->image, g->error, NULL,
+				 g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+				 plan->gain, g->inflag, x, y, a, b, theta,
+				 plan->kron_fac * m->kronrad, plan->subpix,
+				 &m->kronflux, &m->kronfluxerr, &area,
+				 &m->kronfluxflag);
+      if (status != RETURN_OK)
+	return status;
+    }
+
+  if (plan->flags & SEP_MEAS_APER)
+    for (k=0; k<plan->naper; k++)
+      {
+	status = sep_sum_circle(g->image, g->error, NULL,
+				g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+				plan->gain, g->inflag, x, y, plan->aper_r[k],
+				plan->subpix, m->flux_aper+k, m->fluxerr_aper+k,
+				&area, m->flag_aper+k);
+	if (status != RETURN_OK)
+	  return status;
+      }
+
+  if (plan->flags & SEP_MEAS_FLUXRAD)
+    {
+      frac = plan->fluxfrac;
+      status = sep_flux_radius(g->image, g->error, NULL,
+			       g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+			       plan->gain, g->inflag, x, y, plan->kron_r * a,
+			       plan->subpix,
+			       (plan->flags & SEP_MEAS_KRON)? &m->kronflux: NULL,
+			       &frac, 1, &m->fluxrad, &m->fluxradflag);
+      if (status != RETURN_OK)
+	return status;
+    }
+
+  if (plan->flags & SEP_MEAS_WIN)
+    {
+      /* window from the half-flux radius, unless given */
+      r = plan->win_sig;
+      if (r <= 0.0)
+	{
+	  if ((plan->flags & SEP_MEAS_FLUXRAD) && plan->fluxfrac == 0.5)
+	    r = m->fluxrad;
+	  else
+	    {
+	      frac = 0.5;
+	      status = sep_flux_radius(g->image, g->error, NULL,
+				       g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+				       plan->gain, g->inflag, x, y,
+				       plan->kron_r * a, plan->subpix,
+				       (plan->flags & SEP_MEAS_KRON)?
+				       &m->kronflux: NULL,
+				       &frac, 1, &r, &flag);
+	      if (status != RETURN_OK)
+		return status;
+	    }
+	  r *= 2.0/2.35;
+	}
+      status = sep_windowed(g->image, g->error, NULL,
+			    g->dtype, g->edtype, 0, g->w, g->h, 0.0,
+			    plan->gain, g->inflag, x, y, r, plan->subpix,
+			    &m->xwin, &m->ywin, &m->winniter, &m->winflag,
+			    NULL);
+      if (status != RETURN_OK)
+	return status;
+    }
+
+  return RETURN_OK;
+}
+
+/******************************* extractall **********************************/
+/*
+Scan the whole image as a single strip and convert the objects found to an
+array of sepobj structs (or to a catalog if `catalog` is not NULL), or pass
+them to the caller through `em` if it is not NULL.
+*/
+int extractall(sep_extract_ctx *ctx, extractparams *p, int clean_flag,
+	       double clean_param, objemitter *em, sepobj **objects,
+	       sepcatalog **catalog, int *nobj)
+{
+  objliststruct     *finalobjlist;
+  int               status;
+  STATS_DECL(t0);
+
+  STATS_START(t0);
+  status = RETURN_OK;
+  finalobjlist = NULL; /* final return value */
+
+  /* Init finalobjlist (the return catalog) */
+  QCALLOC(finalobjlist, objliststruct, 1, status);
+
+  status = scanstrip(ctx, p, 0, p->h, finalobjlist, NULL, em);
+  if (status != RETURN_OK)
+    goto exit;
+
+  if (em)
+    {
+      /* pass on the objects still held for cleaning */
+      status = emitobjs(ctx, p, finalobjlist, em, INT_MAX);
+      *objects = NULL;
+      *nobj = em->nemit;
+    }
+  else
+    /* convert `finalobjlist` to an array of `sepobj` structs */
+    status = finishobjlist(ctx, p, finalobjlist, clean_flag, clean_param,
+			   objects, catalog, nobj);
+
+ exit:
+  if (em)
+    free(em->survives);
+  if (finalobjlist)
+    {
+      free(finalobjlist->obj);
+      free(finalobjlist->plist);
+      free(finalobjlist);
+    }
+
+  STATS_TIME(t_extract, t0);
+  return status;
+}
+
+/************************** sep_extract_parallel *****************************/
+/*
+Extract sources by splitting the image into horizontal strips that are
+scanned concurrently, one context per strip. Detections touching a seam
+between two strips are set aside during the scan, joined with their other
+parts once all strips are done, and then deblended and analysed. The objects
+from all strips are finally put in the order in which the serial scan would
+have completed them, so that the result is identical to sep_extract().
+*/
+int sep_extract_parallel(void *image, void *noise, int dtype, int ndtype,
+			 int w, int h, float thresh, int minarea,
+			 float *conv, int convw, int convh,
+			 int deblend_nthresh, double deblend_cont,
+			 int clean_flag, double clean_param,
+			 int use_matched_filter, int nthreads,
+			 sepobj **objects, int *nobj)
+{
+  extractparams     p;
+  sep_extract_ctx   **ctxs;
+  objliststruct     *lists, *seamlists, finalobjlist;
+  int               *stripy;
+  int               i, s, nstrips, errs, status, st;
+  char              errtext[512];
+  STATS_DECL(t0);
+
+  STATS_START(t0);
+  status = RETURN_OK;
+  ctxs = NULL;
+  lists = seamlists = NULL;
+  stripy = NULL;
+  nstrips = 0;
+  memset(&finalobjlist, 0, sizeof(objliststruct));
+  memset(&p, 0, sizeof(extractparams));
+  *objects = NULL;
+  *nobj = 0;
+
+  if (nthreads <= 0)
+    {
+#ifdef _OPENMP
+      nthreads = omp_get_max_threads();
+#else
+      nthreads = 1;
+#endif
+    }
+
+  /* need at least one line per strip */
+  nstrips = (nthreads < h)? nthreads: h;
+  if (nstrips <= 1)
+    return sep_extract(image, noise, dtype, ndtype, w, h, thresh, minarea,
+		       conv, convw, convh, deblend_nthresh, deblend_cont,
+		       clean_flag, clean_param, use_matched_filter,
+		       objects, nobj);
+
+  status = initparams(&p, image, noise, dtype, ndtype, w, h, 0, 0, thresh,
+		      minarea, conv, convw, convh, deblend_nthresh,
+		      deblend_cont, use_matched_filter);
+  if (status != RETURN_OK)
+    goto exit;
+
+  /* one context per thread */
+  QCALLOC(ctxs, sep_extract_ctx *, nstrips, status);
+  for (i=0; i<nstrips; i++)
+    if ((status = sep_extract_ctx_new(&ctxs[i])) != RETURN_OK)
+      goto exit;
+
+  /* lists[0:nstrips] hold the objects found by each strip and
+   * lists[nstrips:2*nstrips] those found by each thread when joining seams */
+  QCALLOC(lists, objliststruct, 2*nstrips, status);
+  QCALLOC(seamlists, objliststruct, nstrips, status);
+  QMALLOC(stripy, int, nstrips+1, status);
+  for (s=0; s<=nstrips; s++)
+    stripy[s] = (int)(((long)h * s) / nstrips);
+
+  /* scan the strips; keep the error of the first failing strip */
+  errs = nstrips;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static,1) num_threads(nstrips) private(st)
+#endif
+  for (s=0; s<nstrips; s++)
+    {
+      st = scanstrip(ctxs[SEP_THREAD_NUM()], &p, stripy[s], stripy[s+1],
+		     &lists[s], &seamlists[s], NULL);
+      if (st != RETURN_OK)
+	{
+#ifdef _OPENMP
+#pragma omp critical (sep_extract_error)
+#endif
+	  if (s < errs)
+	    {
+	      errs = s;
+	      status = st;
+	      sep_get_errdetail(errtext);
+	    }
+	}
+    }
+  if (status != RETURN_OK)
+    {
+      put_errdetail(errtext);
+      goto exit;
+    }
+
+  /* join, deblend and analyse the detections cut by seams */
+  status = mergeseams(ctxs, nstrips, &p, stripy, seamlists, lists+nstrips);
+  if (status != RETURN_OK)
+    goto exit;
+
+  /* put all objects in serial order */
+  status = mergeobjlists(ctxs[0], lists, 2*nstrips, &finalobjlist);
+  if (status != RETURN_OK)
+    goto exit;
+
+  status = finishobjlist(ctxs[0], &p, &finalobjlist, clean_flag, clean_param,
+			 objects, NULL, nobj);
+
+ exit:
+  free(finalobjlist.obj);
+  free(finalobjlist.plist);
+  if (lists)
+    for (i=0; i<2*nstrips; i++)
+      {
+	free(lists[i].obj);
+	free(lists[i].plist);
+      }
+  if (seamlists)
+    for (i=0; i<nstrips; i++)
+      {
+	free(seamlists[i].obj);
+	free(seamlists[i].plist);
+      }
+  free(lists);
+  free(seamlists);
+  free(stripy);
+  if (ctxs)
+    for (i=0; i<nstrips; i++)
+      sep_extract_ctx_free(ctxs[i]);
+  free(ctxs);
+  freeparams(&p);
+
+  if (status != RETURN_OK)
+    {
+      *objects = NULL;
+      *nobj = 0;
+    }
+
+  STATS_TIME(t_extract, t0);
+  return status;
+}
+
+/******************************* initparams **********************************/
+/*
+Fill the parameters of an extraction, normalizing the filter and choosing
+how to apply it. The parameters must be freed with freeparams(), also on
+error.
+*/
+int initparams(extractparams *p, void *image, void *noise,
+	       int dtype, int ndtype, int w, int h,
+	       size_t imstride, size_t nstride, float thresh, int minarea,
+	       float *conv, int convw, int convh, int deblend_nthresh,
+	       double deblend_cont, int use_matched_filter)
+{
+  array_converter cvt;
+  float sum;
+  int   i, convn, elsize, status;
+  char  errtext[80];
+
+  status = RETURN_OK;
+  p->image = image;
+  p->noise = noise;
+  p->dtype = dtype;
+  p->ndtype = ndtype;
+  p->w = w;
+  p->h = h;
+  p->thresh = thresh;
+  p->minarea = minarea;
+  p->conv = NULL;
+  p->convx = p->convy = NULL;
+  memset(&p->fftk, 0, sizeof(fftkernel));
+  p->convw = convw;
+  p->convh = convh;
+  p->deblend_nthresh = deblend_nthresh;
+  p->deblend_cont = deblend_cont;
+  p->readline = NULL;
+  p->userdata = NULL;
+
+  /* lines of the arrays are contiguous unless given strides */
+  if ((status = get_array_converter(dtype, &cvt, &elsize)) != RETURN_OK)
+    goto exit;
+  p->imstride = imstride? imstride: (size_t)elsize * w;
+  if (p->imstride < (size_t)elsize * w)
+    goto badstride;
+  p->nstride = 0;
+  if (noise)
+    {
+      if ((status = get_array_converter(ndtype, &cvt, &elsize)) != RETURN_OK)
+	goto exit;
+      p->nstride = nstride? nstride: (size_t)elsize * w;
+      if (p->nstride < (size_t)elsize * w)
+	goto badstride;
+    }
+
+  /* can only use a matched filter when convolving and when there is a noise
+   * array */
+  p->use_matched_filter = (conv && noise)? use_matched_filter: 0;
+
+  if (conv)
+    {
+      /* normalize the filter */
+      sum = 0.0;
+      convn = convw * convh;
+      QMALLOC(p->conv, float, convn + convw + convh, status);
+      for (i=0; i<convn; i++)
+	sum += fabs(conv[i]);
+      for (i=0; i<convn; i++)
+	p->conv[i] = conv[i] / sum;
+
+      /* Use separable filtering (a vertical, then a horizontal pass) for
+       * kernels large enough to pay for the extra pass, 5x5 and up. It
+       * changes filtered values at the level of float rounding, and
+       * approximates kernels that are only separable within CONV_SEPTOL,
+       * so that catalogs can differ very slightly from direct filtering. */
+      if (convw > 1 && convh > 1 && convn >= SEPCONV_MINAREA &&
+	  separable_kernel(p->conv, convw, convh, p->conv + convn,
+			   p->conv + convn + convw))
+	{
+	  p->convx = p->conv + convn;
+	  p->convy = p->convx + convw;
+	}
+
+      /* otherwise, filter large kernels with FFTs */
+      else if (convn >= (p->use_matched_filter? FFTCONV_MINAREA_MF:
+			 FFTCONV_MINAREA))
+	{
+	  status = fftkernel_init(&p->fftk, p->conv, convw, convh, w,
+				  p->use_matched_filter);
+	  if (status != RETURN_OK)
+	    goto exit;
+	}
+    }
+
+ exit:
+  return status;
+
+ badstride:
+  sprintf(errtext, "in initparams(): %lu or %lu bytes for lines of %d",
+	  (unsigned long)imstride, (unsigned long)nstride, w);
+  put_errdetail(errtext);
+  return ILLEGAL_STRIDE;
+}
+
+void freeparams(extractparams *p)
+{
+  fftkernel_free(&p->fftk);
+  free(p->conv);
+  p->conv = p->convx = p->convy = NULL;
+}
+
+/******************************** prepctx ************************************/
+/*
+Set the pixel list layout of the context for an extraction and make sure
+all of its buffers are allocated.
+*/
+int prepctx(sep_extract_ctx *ctx, extractparams *p)
+{
+  int status;
+
+  plistinit(ctx, p->conv, p->noise);
+  if ((status = allocscan(ctx, p->w)) != RETURN_OK)
+    return status;
+  if ((status = lutzalloc(ctx, p->w, p->h)) != RETURN_OK)
+    return status;
+  return allocdeblend(ctx, p->deblend_nthresh);
+}
+
+/******************************* readlines ***********************************/
+/*
+Read the next line into the image (and noise) buffers, first getting it from
+the caller when streaming.
+*/
+int readlines(extractparams *p, arraybuffer *imbuf, arraybuffer *nbuf)
+{
+  char errtext[80];
+  int  y;
+
+  y = imbuf->yoff + imbuf->bh;  /* line entering the buffers */
+  if (p->readline && y >= 0 && y < p->h &&
+      p->readline(p->userdata, y, p->image, p->noise))
+    {
+      sprintf(errtext, "failed to read line %d", y);
+      put_errdetail(errtext);
+      return LINE_READ_ERROR;
+    }
+
+  arraybuffer_readline(imbuf);
+  if (p->noise)
+    arraybuffer_readline(nbuf);
+
+  return RETURN_OK;
+}
+
+/****************************** nextactive ***********************************/
+/*
+Return the first pixel of a line from x on (w if none) that is above the
+threshold or carries a marker left by the previous line. Outside of a
+segment, the pixels before it leave the state of the scan unchanged. The
+line is `sig` compared to thresh with the matched filter, otherwise `cd`
+compared to thresh (or to thresh*noise[x] with a noise line); with neither,
+only markers count (the empty line closing the scan). Pixels are tested
+SCAN_CHUNK at a time, in loops compilers can vectorize.
+*/
+int nextactive(const PIXTYPE *sig, const PIXTYPE *cd, const PIXTYPE *noise,
+	       PIXTYPE thresh, const char *marker, int x, int w)
+{
+  PIXTYPE t;
+  int     i, any;
+
+  for (; x+SCAN_CHUNK<=w; x+=SCAN_CHUNK)
+    {
+      any = 0;
+      if (sig)
+	for (i=x; i<x+SCAN_CHUNK; i++)
+	  any |= (sig[i] > thresh) | (marker[i] != 0);
+      else if (cd && noise)
+	for (i=x; i<x+SCAN_CHUNK; i++)
+	  {
+	    t = thresh * noise[i];
+	    any |= (cd[i] > t) | (marker[i] != 0);
+	  }
+      else if (cd)
+	for (i=x; i<x+SCAN_CHUNK; i++)
+	  any |= (cd[i] > thresh) | (marker[i] != 0);
+      else
+	for (i=x; i<x+SCAN_CHUNK; i++)
+	  any |= (marker[i] != 0);
+      if (any)
+	break;
+    }
+
+  for (; x<w; x++)
+    {
+      if (marker[x])
+	break;
+      if (sig)
+	{
+	  if (sig[x] > thresh)
+	    break;
+	}
+      else if (cd)
+	{
+	  t = noise? thresh * noise[x]: thresh;
+	  if (cd[x] > t)
+	    break;
+	}
+    }
+
+  return x;
+}
+
+/******************************* scanstrip ***********************************/
+/*
+Scan image lines ystart to yend-1 with Lutz' algorithm, deblending and
+analysing each detection as soon as it is complete and adding the results to
+finalobjlist. If seamlist is not NULL, detections touching the first or last
+line of the strip where it borders another strip are instead copied
+unprocessed to seamlist, to be joined with the rest of the detection later.
+*/
+int scanstrip(sep_extract_ctx *ctx, extractparams *p, int ystart, int yend,
+	      objliststruct *finalobjlist, objliststruct *seamlist,
+	      objemitter *em)
+{
+  arraybuffer       imbuf, nbuf;
+  fftlines          imfft, mffft;
+  infostruct        curpixinfo, initinfo, freeinfo;
+  objliststruct     objlist;
+  char              newmarker;
+  size_t            mem_pixstack;
+  int               co, i, luflag, pstop, xl, xl2, yl, cn, n0;
+  int               w, h, stacksize, status, pixhwm;
+  int               bufh;
+  short             trunflag, seamflag;
+  PIXTYPE           thresh, relthresh, cdnewsymbol;
+  pixstatus         cs, ps;
+
+  infostruct        *info, *store;
+  pliststruct	    *pixel, *pixt;
+  char              *marker;
+  PIXTYPE           *scan, *cdscan, *wscan, *dumscan;
+  PIXTYPE           *sigscan, *workscan;
+  const PIXTYPE     *actsig, *actcd, *actnoise;
+  int               *start, *end;
+  pixstatus         *psstack;
+  STATS_DECL(t0);
+
+  status = RETURN_OK;
+  w = p->w;
+  h = p->h;
+  scan = wscan = cdscan = NULL;
+  imbuf.bptr = nbuf.bptr = NULL;
+  memset(&imfft, 0, sizeof(fftlines));
+  memset(&mffft, 0, sizeof(fftlines));
+  pixhwm = 0;
+
+  mem_pixstack = sep_get_extract_pixstack();
+
+  /* If we have a noise array, thresh is actually relthresh; we'll use
+   * relthresh below to set the threshold for each pixel. */
+  thresh = relthresh = p->thresh;
+
+  objlist.thresh = thresh;
+
+  /* Allocate memory for buffers (kept in the context between calls) */
+  stacksize = w+1;
+  if ((status = prepctx(ctx, p)) != RETURN_OK)
+    goto exit;
+  info = ctx->scan.info;
+  store = ctx->scan.store;
+  marker = ctx->scan.marker;
+  dumscan = ctx->scan.dumscan;
+  psstack = ctx->scan.psstack;
+  start = ctx->scan.start;
+  end = ctx->scan.end;
+  sigscan = ctx->scan.sigscan;
+  workscan = ctx->scan.workscan;
+  memset(store, 0, (size_t)stacksize*sizeof(infostruct));
+  memset(start, 0, (size_t)stacksize*sizeof(int));
+  memset(marker, 0, (size_t)stacksize);
+
+  /* Initialize buffers for input array(s).
+   * The buffer size depends on whether or not convolution is active.
+   * If not convolving, the buffer size is just a single line. If convolving,
+   * the buffer height equals the height of the convolution kernel.
+   */
+  bufh = p->conv ? p->convh : 1;
+  status = arraybuffer_init(&imbuf, p->image, p->dtype, w, h, p->imstride,
+			    stacksize, bufh, ystart);
+  if (status != RETURN_OK)
+    goto exit;
+  if (p->noise)
+    {
+      status = arraybuffer_init(&nbuf, p->noise, p->ndtype, w, h, p->nstride,
+				stacksize, bufh, ystart);
+      if (status != RETURN_OK)
+        goto exit;
+    }
+
+  /* read in lines until ystart is one line above midline */
+  for (i=0; i<bufh-1; i++)
+    if ((status = readlines(p, &imbuf, &nbuf)) != RETURN_OK)
+      goto exit;
+
+  /* `scan` (or `wscan`) is always a pointer to the current line being
+   * processed. It might be the only line in the buffer, or it might be the
+   * middle line. */
+  scan = imbuf.midline;
+  if (p->noise)
+    wscan = nbuf.midline;
+  if (p->conv)
+    cdscan = ctx->scan.cdscan;
+  if (p->fftk.n)
+    {
+      if ((status = fftlines_init(&imfft, &p->fftk)) != RETURN_OK)
+	goto exit;
+      if (p->use_matched_filter &&
+	  (status = fftlines_init(&mffft, &p->fftk)) != RETURN_OK)
+	goto exit;
+    }
+
+  /* More initializations */
+  initinfo.pixnb = 0;
+  initinfo.flag = 0;
+  initinfo.firstpix = initinfo.lastpix = -1;
+
+  co = pstop = 0;
+  objlist.nobj = 1;
+  curpixinfo = initinfo;
+  curpixinfo.pixnb = 1;
+
+  /* Set up the pixel list */
+  if ((status = initpixstack(ctx, mem_pixstack, &freeinfo)) != RETURN_OK)
+    goto exit;
+  pixel = objlist.plist = ctx->pixstack.pixel;
+
+  /*----- MAIN LOOP ------ */
+  for (yl=ystart; yl<=yend; yl++)
+    {
+
+      ps = COMPLETE;
+      cs = NONOBJECT;
+
+      /* Need an empty line for Lutz' algorithm to end gracely */
+      if (yl==yend)
+	cdscan = dumscan;
+
+      else
+	{
+	  if ((status = readlines(p, &imbuf, &nbuf)) != RETURN_OK)
+	    goto exit;
+
+	  STATS_ADD(npix, w);
+
+	  /* filter the lines */
+	  STATS_START(t0);
+	  if (p->conv)
+	    {
+	      if (p->convx)
+		status = convolve_sep(&imbuf, yl, p->convx, p->convy,
+				      p->convw, p->convh, workscan, cdscan);
+	      else if (p->fftk.n)
+		status = convolve_fft(&imbuf, yl, &p->fftk, &imfft, cdscan);
+	      else
+		status = convolve(&imbuf, yl, p->conv, p->convw, p->convh,
+				  cdscan);
+              if (status != RETURN_OK)
+                goto exit;
+
+	      if (p->use_matched_filter)
+                {
+		  if (p->convx)
+		    status = matched_filter_sep(&imbuf, &nbuf, yl, p->convx,
+						p->convy, p->convw, p->convh,
+						workscan, sigscan);
+		  else if (p->fftk.n)
+		    status = matched_filter_fft(&imbuf, &nbuf, yl, &p->fftk,
+						&mffft, workscan, sigscan);
+		  else
+		    status = matched_filter(&imbuf, &nbuf, yl, p->conv,
+					    p->convw, p->convh, workscan,
+					    sigscan);
+
+                  if (status != RETURN_OK)
+                    goto exit;
+                }
+	      STATS_TIME(t_filter, t0);
+            }
+	  else
+	    {
+	      cdscan = scan;
+	    }
+	}
+
+      trunflag = (yl==0 || yl==h-1)? SEP_OBJ_TRUNC: 0;
+
+      /* detections on a line bordering another strip may continue there */
+      seamflag = (seamlist && ((yl==ystart && ystart>0) ||
+			       (yl==yend-1 && yend<h)))? OBJ_SEAM: 0;
+
+      /* what tells pixels above the threshold on this line */
+      actsig = actcd = actnoise = NULL;
+      if (yl != yend)
+	{
+	  if (p->use_matched_filter)
+	    actsig = sigscan;
+	  else
+	    {
+	      actcd = cdscan;
+	      actnoise = p->noise? wscan: NULL;
+	    }
+	}
+
+      for (xl=0; xl<=w; xl++)
+	{
+	  /* skip the pixels between segments that change nothing */
+	  if (cs == NONOBJECT && xl < w)
+	    xl = nextactive(actsig, actcd, actnoise, relthresh, marker, xl, w);
+
+	  if (xl == w)
+	    cdnewsymbol = -BIG;
+	  else
+	    cdnewsymbol = cdscan[xl];
+
+	  newmarker = marker[xl];  /* marker at this pixel */
+	  marker[xl] = 0;
+
+	  curpixinfo.flag = trunflag | seamflag;
+
+	  if (p->noise)
+            thresh = relthresh * ((xl==w || yl==yend)? 0.0: wscan[xl]);
+
+          /* luflag: is pixel above thresh (Y/N)? */
+          if (p->use_matched_filter)
+            luflag = ((xl != w) && (yl != yend) &&
+		      (sigscan[xl] > relthresh))? 1: 0;
+          else
             luflag = cdnewsymbol > thresh? 1: 0;
 
 	  if (luflag)
@@ -364,14 +1634,16 @@ int sep_extract(void *image, void *noise, int dtype, int ndtype, int w, int h,
 	      /* flag the current object if we're near the image bounds */
 	      if (xl==0 || xl==w-1)
 		curpixinfo.flag |= SEP_OBJ_TRUNC;
-	      
+
 	      /* point pixt to first free pixel in pixel list */
 	      /* and increment the "first free pixel" */
 	      pixt = pixel + (cn=freeinfo.firstpix);
 	      freeinfo.firstpix = PLIST(pixt, nextpix);
+	      if (cn >= pixhwm)
+		pixhwm = cn + ctx->plistsize;
 	      curpixinfo.lastpix = curpixinfo.firstpix = cn;
 
-	      /* set values for the new pixel */ 
+	      /* set values for the new pixel */
 	      PLIST(pixt, nextpix) = -1;
 	      PLIST(pixt, x) = xl;
 	      PLIST(pixt, y) = yl;
@@ -383,49 +1655,14 @@ int sep_extract(void *image, void *noise, int dtype, int ndtype, int w, int h,
 	      if (PLISTEXIST(thresh))
 		PLISTPIX(pixt, thresh) = thresh;
 
-	      /* Check if we are running out of free pixels in objlist.plist */
+	      /* Extend the pixel stack if we are running out of free pixels
+	       * in objlist.plist */
 	      if (freeinfo.firstpix==freeinfo.lastpix)
 		{
-		  status = PIXSTACK_FULL;
-		  sprintf(errtext,
-			  "The limit of %d active object pixels over the "
-			  "detection threshold was reached. Check that "
-			  "the image is background subtracted and the "
-			  "detection threshold is not too low.",
-			  (int)mem_pixstack);
-		  put_errdetail(errtext);
-		  goto exit;
-
-		  /* The code in the rest of this block increases the
-		   * stack size as needed. Currently, it is never
-		   * executed. This is because it isn't clear that
-		   * this is a good idea: most times when the stack
-		   * overflows it is due to user error: too-low
-		   * threshold or image not background subtracted. */
-
-		  /* increase the stack size */
-		  oldnposize = nposize;
- 		  mem_pixstack = (int)(mem_pixstack * 2);
-		  nposize = mem_pixstack * plistsize;
-		  pixel = (pliststruct *)realloc(pixel, nposize);
-		  objlist.plist = pixel;
-		  if (!pixel)
-		    {
-		      status = MEMORY_ALLOC_ERROR;
-		      goto exit;
-		    }
-
-		  /* set next free pixel to the start of the new block 
-		   * and link up all the pixels in the new block */
-		  PLIST(pixel+freeinfo.firstpix, nextpix) = oldnposize;
-		  pixt = pixel + oldnposize;
-		  for (i=oldnposize + plistsize; i<nposize;
-		       i += plistsize, pixt += plistsize)
-		    PLIST(pixt, nextpix) = i;
-		  PLIST(pixt, nextpix) = -1;
-
-		  /* last free pixel is now at the end of the new block */
-		  freeinfo.lastpix = nposize - plistsize;
+		  status = growpixstack(ctx, mem_pixstack, &freeinfo);
+		  if (status != RETURN_OK)
+		    goto exit;
+		  pixel = objlist.plist = ctx->pixstack.pixel;
 		}
 	      /*------------------------------------------------------------*/
 
@@ -476,195 +1713,1035 @@ int sep_extract(void *image, void *noise, int dtype, int ndtype, int w, int h,
 		  ps = OBJECT;
 		}
 
-	      else if (newmarker == 's')
-		{
-		  if ((cs == OBJECT) && (ps == COMPLETE))
-		    {
-		      pstop--;
-		      xl2 = start[co];
-		      update (&info[co-1],&info[co], pixel);
-		      if (start[--co] == UNKNOWN)
-			start[co] = xl2;
-		      else
-			marker[xl2] = 's';
-		    }
-		  ps = OBJECT;
-		}
+	      else if (newmarker == 's')
+		{
+		  if ((cs == OBJECT) && (ps == COMPLETE))
+		    {
+		      pstop--;
+		      xl2 = start[co];
+		      update (&info[co-1],&info[co], pixel);
+		      if (start[--co] == UNKNOWN)
+			start[co] = xl2;
+		      else
+			marker[xl2] = 's';
+		    }
+		  ps = OBJECT;
+		}
+
+	      else if (newmarker == 'f')
+		ps = INCOMPLETE;
+
+	      else if (newmarker == 'F')
+		{
+		  ps = psstack[--pstop];
+		  if ((cs == NONOBJECT) && (ps == COMPLETE))
+		    {
+		      if (start[co] == UNKNOWN)
+			{
+			  if (info[co].flag & OBJ_SEAM)
+			    {
+			      /* set aside until the seam is joined */
+			      status = addseamobj(ctx, &info[co], pixel,
+						  seamlist);
+			      if (status != RETURN_OK)
+				goto exit;
+			    }
+			  else if ((int)info[co].pixnb >= p->minarea &&
+				   ctx->nthreads > 1)
+			    {
+			      /* deblend later, concurrently with others */
+			      status = queuedetection(ctx, &info[co], pixel,
+						      thresh, yl, xl);
+			      if (status != RETURN_OK)
+				goto exit;
+			      if (ctx->queue.used >=
+				  (size_t)DEBLEND_QUEUE_NPIX*ctx->plistsize &&
+				  (status = flushdeblend(ctx, p, finalobjlist))
+				  != RETURN_OK)
+				goto exit;
+			    }
+			  else if ((int)info[co].pixnb >= p->minarea)
+			    {
+			      /* update threshold before object is processed */
+			      objlist.thresh = thresh;
+
+			      n0 = finalobjlist->nobj;
+			      seedrand(ctx, p, yl, xl);
+			      status = sortit(ctx, &info[co], &objlist,
+					      p->minarea, finalobjlist,
+					      p->deblend_nthresh,
+					      p->deblend_cont);
+			      if (status != RETURN_OK)
+				goto exit;
+			      for (i=n0; i<finalobjlist->nobj; i++)
+				{
+				  finalobjlist->obj[i].closey = yl;
+				  finalobjlist->obj[i].closex = xl;
+				}
+			    }
+
+			  /* free the chain-list */
+			  PLIST(pixel+info[co].lastpix, nextpix) =
+			    freeinfo.firstpix;
+			  freeinfo.firstpix = info[co].firstpix;
+			}
+		      else
+			{
+			  marker[end[co]] = 'F';
+			  store[start[co]] = info[co];
+			}
+		      co--;
+		      ps = psstack[--pstop];
+		    }
+		}
+	    }
+	  /* end of if (newmarker) ------------------------------------------*/
+
+	  /* update the info or end segment */
+	  if (luflag)
+	    {
+	      update(&info[co], &curpixinfo, pixel);
+	    }
+	  else if (cs == OBJECT)
+	    {
+	      cs = NONOBJECT;
+	      if (ps != COMPLETE)
+		{
+		  marker[xl] = 'f';
+		  end[co] = xl;
+		}
+	      else
+		{
+		  ps = psstack[--pstop];
+		  marker[xl] = 'F';
+		  store[start[co]] = info[co];
+		  co--;
+		}
+	    }
+
+	} /*------------ End of the loop over the x's -----------------------*/
+
+      /* pass on the objects that can no longer change */
+      if (em && ((status = flushdeblend(ctx, p, finalobjlist)) != RETURN_OK ||
+		 (status = emitobjs(ctx, p, finalobjlist, em, yl)) !=
+		 RETURN_OK))
+	goto exit;
+
+    } /*---------------- End of the loop over the y's -----------------------*/
+
+  /* deblend the detections still queued */
+  status = flushdeblend(ctx, p, finalobjlist);
+
+ exit:
+  ctx->queue.njob = 0;
+  ctx->queue.used = 0;
+  /* record how much of the pixel stack must be relinked on the next call */
+  if (pixhwm > ctx->pixstack.hwm)
+    ctx->pixstack.hwm = pixhwm;
+  STATS_MAX(pixstack_max, (size_t)(pixhwm / ctx->plistsize));
+  arraybuffer_free(&imbuf);
+  arraybuffer_free(&nbuf);
+  fftlines_free(&imfft);
+  fftlines_free(&mffft);
+
+  return status;
+}
+
+/******************************* addseamobj **********************************/
+/*
+Copy the pixels of a detection from the pixel stack to a new object in
+seamlist, without analysing it.
+*/
+int addseamobj(sep_extract_ctx *ctx, infostruct *info, pliststruct *pixel,
+	       objliststruct *seamlist)
+{
+  objliststruct objlist;
+  objstruct     obj;
+
+  memset(&obj, 0, sizeof(objstruct));
+  obj.firstpix = info->firstpix;
+  obj.lastpix = info->lastpix;
+  obj.fdnpix = info->pixnb;
+  obj.flag = info->flag;
+
+  objlist.obj = &obj;
+  objlist.nobj = 1;
+  objlist.plist = pixel;
+  objlist.npix = info->pixnb;
+
+  return addobjdeep(ctx, 0, &objlist, seamlist);
+}
+
+/****************************** queuedetection *******************************/
+/*
+Set aside a detection completed at x, y with threshold `thresh` (copying its
+pixels from `pixel`) to be deblended by flushdeblend().
+*/
+int queuedetection(sep_extract_ctx *ctx, infostruct *info, pliststruct *pixel,
+		   PIXTYPE thresh, int y, int x)
+{
+  deblendqueue *q = &ctx->queue;
+  deblendjob   *job;
+  pliststruct  *plist, *pixt, *pixt2;
+  size_t       nbytes;
+  int          i;
+
+  if (q->njob == q->size)
+    {
+      if (!(job = (deblendjob *)realloc(q->job, (q->size? 2*q->size: 64)*
+					sizeof(deblendjob))))
+	return MEMORY_ALLOC_ERROR;
+      q->job = job;
+      q->size = q->size? 2*q->size: 64;
+    }
+  nbytes = (size_t)info->pixnb*ctx->plistsize;
+  if (q->used + nbytes > q->plistbytes)
+    {
+      if (!(plist = (pliststruct *)realloc(q->plist, 2*(q->used + nbytes))))
+	return MEMORY_ALLOC_ERROR;
+      q->plist = plist;
+      q->plistbytes = 2*(q->used + nbytes);
+    }
+
+  job = q->job + q->njob++;
+  job->off = q->used;
+  job->info = *info;
+  job->info.firstpix = 0;
+  job->info.lastpix = (int)nbytes - ctx->plistsize;
+  job->thresh = thresh;
+  job->y = y;
+  job->x = x;
+
+  /* copy its pixels, linked in the same order */
+  plist = q->plist + q->used;
+  pixt2 = plist;
+  for (i=info->firstpix; i!=-1; i=PLIST(pixt, nextpix))
+    {
+      pixt = pixel + i;
+      memcpy(pixt2, pixt, (size_t)ctx->plistsize);
+      pixt2 += ctx->plistsize;
+      PLIST(pixt2 - ctx->plistsize, nextpix) = pixt2 - plist;
+    }
+  PLIST(pixt2 - ctx->plistsize, nextpix) = -1;
+  q->used += nbytes;
+
+  return RETURN_OK;
+}
+
+/******************************* flushdeblend ********************************/
+/*
+Deblend and analyse the queued detections across ctx->nthreads threads,
+largest first, and add the objects found to `finalobjlist` in the order of
+the queue, as the scan would have added them. The random numbers of each
+detection are seeded from its position, so the result is the same as
+deblending them one by one during the scan.
+*/
+typedef struct
+{
+  int       npix;
+  int       idx;
+} jobref;
+
+static int comparejobref(const void *a, const void *b)
+{
+  const jobref *ra = a, *rb = b;
+
+  if (ra->npix != rb->npix)
+    return ra->npix > rb->npix? -1: 1;
+  return (ra->idx > rb->idx) - (ra->idx < rb->idx);
+}
+
+int flushdeblend(sep_extract_ctx *ctx, extractparams *p,
+		 objliststruct *finalobjlist)
+{
+  deblendqueue    *q = &ctx->queue;
+  deblendjob      *job;
+  objliststruct   *out, joblist;
+  sep_extract_ctx *wctx, **workers;
+  jobref          *order;
+  int             i, j, k, n0, nthreads, errj, status, st;
+  char            errtext[512];
+
+  status = RETURN_OK;
+  out = NULL;
+  order = NULL;
+  if (!q->njob)
+    return status;
+
+  /* contexts of the other threads, set up like the scanning one */
+  nthreads = (ctx->nthreads < q->njob)? ctx->nthreads: q->njob;
+  if (q->nworkers < nthreads-1)
+    {
+      if (!(workers = (sep_extract_ctx **)
+	    realloc(q->workers, (nthreads-1)*sizeof(sep_extract_ctx *))))
+	{
+	  status = MEMORY_ALLOC_ERROR;
+	  goto exit;
+	}
+      q->workers = workers;
+      for (; q->nworkers<nthreads-1; q->nworkers++)
+	if ((status = sep_extract_ctx_new(&q->workers[q->nworkers]))
+	    != RETURN_OK)
+	  goto exit;
+    }
+  for (i=0; i<nthreads-1; i++)
+    {
+      wctx = q->workers[i];
+      plistinit(wctx, p->conv, p->noise);
+      if ((status = lutzalloc(wctx, p->w, p->h)) != RETURN_OK ||
+	  (status = allocdeblend(wctx, p->deblend_nthresh)) != RETURN_OK)
+	goto exit;
+    }
+
+  /* largest detections first, for the threads to finish together */
+  QMALLOC(order, jobref, q->njob, status);
+  for (j=0; j<q->njob; j++)
+    {
+      order[j].npix = q->job[j].info.pixnb;
+      order[j].idx = j;
+    }
+  qsort(order, q->njob, sizeof(jobref), comparejobref);
+  QCALLOC(out, objliststruct, q->njob, status);
+
+  /* report the error of the first failing detection, whatever the order */
+  errj = q->njob;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthreads) \
+  private(j, job, wctx, joblist, st)
+#endif
+  for (i=0; i<q->njob; i++)
+    {
+      j = order[i].idx;
+      job = q->job + j;
+      wctx = SEP_THREAD_NUM()? q->workers[SEP_THREAD_NUM()-1]: ctx;
+      memset(&joblist, 0, sizeof(objliststruct));
+      joblist.plist = q->plist + job->off;
+      joblist.thresh = job->thresh;
+      seedrand(wctx, p, job->y, job->x);
+      st = sortit(wctx, &job->info, &joblist, p->minarea, &out[j],
+		  p->deblend_nthresh, p->deblend_cont);
+      if (st != RETURN_OK)
+	{
+#ifdef _OPENMP
+#pragma omp critical (sep_deblend_error)
+#endif
+	  if (j < errj)
+	    {
+	      errj = j;
+	      status = st;
+	      sep_get_errdetail(errtext);
+	    }
+	}
+    }
+  if (status != RETURN_OK)
+    {
+      put_errdetail(errtext);
+      goto exit;
+    }
+
+  /* add the objects in the order of the queue */
+  for (j=0; j<q->njob; j++)
+    {
+      n0 = finalobjlist->nobj;
+      for (k=0; k<out[j].nobj; k++)
+	if ((status = addobjdeep(ctx, k, &out[j], finalobjlist)) != RETURN_OK)
+	  goto exit;
+      for (k=n0; k<finalobjlist->nobj; k++)
+	{
+	  finalobjlist->obj[k].closey = q->job[j].y;
+	  finalobjlist->obj[k].closex = q->job[j].x;
+	}
+    }
+
+ exit:
+  if (out)
+    for (j=0; j<q->njob; j++)
+      {
+	free(out[j].obj);
+	free(out[j].plist);
+      }
+  free(out);
+  free(order);
+  q->njob = 0;
+  q->used = 0;
+  return status;
+}
+
+/******************************** freequeue **********************************/
+/*
+Free the deblending queue of the context and the contexts of its threads.
+*/
+void freequeue(sep_extract_ctx *ctx)
+{
+  deblendqueue *q = &ctx->queue;
+  int          i;
+
+  for (i=0; i<q->nworkers; i++)
+    sep_extract_ctx_free(q->workers[i]);
+  free(q->workers);
+  free(q->job);
+  free(q->plist);
+  memset(q, 0, sizeof(deblendqueue));
+}
+
+/******************************* mergeseams **********************************/
+/*
+Join the parts of detections that were cut by the seams between strips
+(seamlists[s] holds the parts found in strip s, which spans lines stripy[s]
+to stripy[s+1]-1) and process each complete detection as scanstrip() would.
+Parts are joined when any of their pixels are 8-connected across a seam.
+The detections are processed in parallel; objects found by thread t are
+added to outlists[t].
+*/
+int mergeseams(sep_extract_ctx **ctxs, int nstrips, extractparams *p,
+	       int *stripy, objliststruct *seamlists, objliststruct *outlists)
+{
+  objstruct     *obj;
+  pliststruct   *pixt;
+  int           *offset, *parent, *above, *below, *gstart, *members;
+  int           i, j, k, n, s, x, dx, nparts, ngroups, errg, status, st;
+  char          errtext[512];
+
+  status = RETURN_OK;
+  offset = parent = above = below = gstart = members = NULL;
+
+  /* parts are numbered consecutively over all strips */
+  QMALLOC(offset, int, nstrips+1, status);
+  offset[0] = 0;
+  for (s=0; s<nstrips; s++)
+    offset[s+1] = offset[s] + seamlists[s].nobj;
+  nparts = offset[nstrips];
+  if (!nparts)
+    goto exit;
+
+  /* union-find forest of parts */
+  QMALLOC(parent, int, nparts, status);
+  for (i=0; i<nparts; i++)
+    parent[i] = i;
+
+  /* for each seam, label the pixels on the line above and below it with the
+   * part they belong to, and join parts with touching pixels */
+  QMALLOC(above, int, p->w, status);
+  QMALLOC(below, int, p->w, status);
+  for (s=1; s<nstrips; s++)
+    {
+      for (x=0; x<p->w; x++)
+	above[x] = below[x] = -1;
+      for (k=0; k<2; k++)
+	for (i=0; i<seamlists[s-1+k].nobj; i++)
+	  {
+	    obj = seamlists[s-1+k].obj + i;
+	    for (j=obj->firstpix; j!=-1; j=PLIST(pixt, nextpix))
+	      {
+		pixt = seamlists[s-1+k].plist + j;
+		if (PLIST(pixt, y) == stripy[s]-1+k)
+		  (k? below: above)[PLIST(pixt, x)] = offset[s-1+k] + i;
+	      }
+	  }
+      for (x=0; x<p->w; x++)
+	if (below[x] != -1)
+	  for (dx=-1; dx<=1; dx++)
+	    if (x+dx >= 0 && x+dx < p->w && above[x+dx] != -1)
+	      {
+		i = findroot(parent, below[x]);
+		j = findroot(parent, above[x+dx]);
+		if (i != j)
+		  parent[i > j? i: j] = i > j? j: i;
+	      }
+    }
+
+  /* list the parts of each detection: members[gstart[g]:gstart[g+1]] */
+  QCALLOC(gstart, int, nparts+1, status);
+  QMALLOC(members, int, nparts, status);
+  for (i=0; i<nparts; i++)
+    gstart[findroot(parent, i)+1]++;
+  for (i=0; i<nparts; i++)
+    gstart[i+1] += gstart[i];
+  for (i=0; i<nparts; i++)
+    {
+      j = findroot(parent, i);
+      members[gstart[j]++] = i;
+    }
+  for (i=nparts; i>0; i--)
+    gstart[i] = gstart[i-1];
+  gstart[0] = 0;
+
+  /* compact to the non-empty groups */
+  ngroups = 0;
+  for (i=0; i<nparts; i++)
+    if (gstart[i+1] > gstart[i])
+      gstart[ngroups++] = gstart[i];
+  gstart[ngroups] = nparts;
+
+  /* process the joined detections; keep the error of the first failing one */
+  errg = ngroups;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(nstrips) private(st, n)
+#endif
+  for (i=0; i<ngroups; i++)
+    {
+      n = SEP_THREAD_NUM();
+      st = joinseamobj(ctxs[n], p, seamlists, offset,
+		       members+gstart[i], gstart[i+1]-gstart[i],
+		       &outlists[n]);
+      if (st != RETURN_OK)
+	{
+#ifdef _OPENMP
+#pragma omp critical (sep_extract_error)
+#endif
+	  if (i < errg)
+	    {
+	      errg = i;
+	      status = st;
+	      sep_get_errdetail(errtext);
+	    }
+	}
+    }
+  if (status != RETURN_OK)
+    put_errdetail(errtext);
+
+ exit:
+  free(offset);
+  free(parent);
+  free(above);
+  free(below);
+  free(gstart);
+  free(members);
+  return status;
+}
+
+/* root of a part in a union-find forest */
+int findroot(int *parent, int i)
+{
+  while (parent[i] != i)
+    i = parent[i] = parent[parent[i]];
+  return i;
+}
+
+/* Seed the random number generator used in deblending from the position at
+ * which the detection completes, so that results don't depend on the order
+ * in which detections are processed. */
+void seedrand(sep_extract_ctx *ctx, extractparams *p, int y, int x)
+{
+  ctx->randstate = ((unsigned int)y*(unsigned int)p->w + (unsigned int)x) *
+    2654435761u + 1u;
+}
+
+/******************************* joinseamobj *********************************/
+/*
+Join the parts of one detection into a single pixel list ordered as the
+serial scan would have left it (by running Lutz' algorithm over the joined
+pixels), then deblend and analyse it, adding the objects to finalobjlist.
+*/
+int joinseamobj(sep_extract_ctx *ctx, extractparams *p,
+		objliststruct *seamlists, int *offset,
+		int *parts, int nparts, objliststruct *finalobjlist)
+{
+  objliststruct objlist, lutzlist;
+  objstruct     obj;
+  infostruct    info;
+  converter     cnoise;
+  pliststruct   *plist, *pixt, *pixt2;
+  PIXTYPE       *cdvalues, thresh;
+  int           *submap;
+  int           i, j, k, s, npix, subx, suby, subw, subh, xc, yc, n0;
+  int           nsize, status;
+
+  status = RETURN_OK;
+  plist = NULL;
+  cdvalues = NULL;
+  submap = NULL;
+  lutzlist.obj = NULL;
+  lutzlist.plist = NULL;
+  lutzlist.nobj = lutzlist.npix = 0;
+
+  if ((status = prepctx(ctx, p)) != RETURN_OK)
+    goto exit;
+
+  npix = 0;
+  for (k=0; k<nparts; k++)
+    {
+      for (s=0; offset[s+1] <= parts[k]; s++);
+      npix += seamlists[s].obj[parts[k]-offset[s]].fdnpix;
+    }
+  if (npix < p->minarea)
+    goto exit;
+
+  /* copy all pixels to one list and find the bounding box */
+  memset(&obj, 0, sizeof(objstruct));
+  obj.xmin = obj.ymin = MAXPICSIZE;
+  obj.xmax = obj.ymax = -1;
+  QMALLOC(plist, pliststruct, npix*ctx->plistsize, status);
+  pixt2 = plist;
+  for (k=0; k<nparts; k++)
+    {
+      for (s=0; offset[s+1] <= parts[k]; s++);
+      for (i=seamlists[s].obj[parts[k]-offset[s]].firstpix; i!=-1;
+	   i=PLIST(pixt, nextpix))
+	{
+	  pixt = seamlists[s].plist + i;
+	  memcpy(pixt2, pixt, (size_t)ctx->plistsize);
+	  PLIST(pixt2, nextpix) = (pixt2 - plist) + ctx->plistsize;
+	  if (PLIST(pixt2, x) < obj.xmin) obj.xmin = PLIST(pixt2, x);
+	  if (PLIST(pixt2, x) > obj.xmax) obj.xmax = PLIST(pixt2, x);
+	  if (PLIST(pixt2, y) < obj.ymin) obj.ymin = PLIST(pixt2, y);
+	  if (PLIST(pixt2, y) > obj.ymax) obj.ymax = PLIST(pixt2, y);
+	  pixt2 += ctx->plistsize;
+	}
+    }
+  PLIST(pixt2 - ctx->plistsize, nextpix) = -1;
+  obj.firstpix = 0;
+  obj.lastpix = (npix-1)*ctx->plistsize;
+  objlist.obj = &obj;
+  objlist.nobj = 1;
+  objlist.plist = plist;
+  objlist.npix = npix;
+
+  /* the serial scan completes a detection on the line below it, just right
+   * of its rightmost pixel on its last line */
+  yc = obj.ymax + 1;
+  xc = -1;
+  for (pixt=plist; pixt<pixt2; pixt+=ctx->plistsize)
+    if (PLIST(pixt, y) == obj.ymax && PLIST(pixt, x) > xc)
+      xc = PLIST(pixt, x);
+  xc++;
+
+  /* lutz() only keeps pixels with a filtered value above its threshold;
+   * with a matched filter this value doesn't decide detection, so set it
+   * high for the rescan and restore it afterwards */
+  if (p->use_matched_filter)
+    {
+      QMALLOC(cdvalues, PIXTYPE, npix, status);
+      for (pixt=plist, i=0; pixt<pixt2; pixt+=ctx->plistsize, i++)
+	{
+	  cdvalues[i] = PLISTPIX(pixt, cdvalue);
+	  PLISTPIX(pixt, cdvalue) = BIG;
+	}
+    }
+
+  /* rescan the joined pixels to get the serial ordering */
+  submap = createsubmap(&objlist, 0, &subx, &suby, &subw, &subh);
+  if (!submap)
+    {
+      status = MEMORY_ALLOC_ERROR;
+      goto exit;
+    }
+  lutzlist.thresh = -BIG;
+  status = lutz(ctx, plist, submap, subx, suby, subw, &obj, &lutzlist,
+		p->minarea);
+  if (status != RETURN_OK)
+    goto exit;
+  if (lutzlist.nobj != 1)
+    goto exit;  /* can't happen: the pixels are 8-connected */
+
+  if (cdvalues)
+    for (i=lutzlist.obj[0].firstpix; i!=-1; i=PLIST(pixt, nextpix))
+      {
+	pixt = lutzlist.plist + i;
+	j = submap[(PLIST(pixt, x)-subx) + (PLIST(pixt, y)-suby)*subw];
+	PLISTPIX(pixt, cdvalue) = cdvalues[j/ctx->plistsize];
+      }
+
+  /* same threshold as the serial scan has when completing the detection */
+  thresh = p->thresh;
+  if (p->noise)
+    {
+      if ((status = get_converter(p->ndtype, &cnoise, &nsize)) != RETURN_OK)
+	goto exit;
+      thresh = p->thresh * ((xc==p->w || yc==p->h)? 0.0:
+			    cnoise((BYTE *)p->noise + p->nstride*yc +
+				   (size_t)nsize*xc));
+    }
+
+  info.pixnb = lutzlist.npix;
+  info.flag = lutzlist.obj[0].flag;
+  info.firstpix = lutzlist.obj[0].firstpix;
+  info.lastpix = lutzlist.obj[0].lastpix;
+  objlist.plist = lutzlist.plist;
+  objlist.thresh = thresh;
+
+  n0 = finalobjlist->nobj;
+  seedrand(ctx, p, yc, xc);
+  status = sortit(ctx, &info, &objlist, p->minarea, finalobjlist,
+		  p->deblend_nthresh, p->deblend_cont);
+  if (status != RETURN_OK)
+    goto exit;
+  for (i=n0; i<finalobjlist->nobj; i++)
+    {
+      finalobjlist->obj[i].closey = yc;
+      finalobjlist->obj[i].closex = xc;
+    }
+
+ exit:
+  free(plist);
+  free(cdvalues);
+  free(submap);
+  free(lutzlist.obj);
+  free(lutzlist.plist);
+  return status;
+}
+
+/****************************** mergeobjlists ********************************/
+/*
+Merge object lists into one, ordering objects by the scan position where
+their parent detection was completed (then by list and position in list).
+*/
+typedef struct
+{
+  objstruct *obj;
+  int       list;
+  int       idx;
+} objref;
 
-	      else if (newmarker == 'f')
-		ps = INCOMPLETE;
+static int compareobjref(const void *a, const void *b)
+{
+  const objref *ra = a, *rb = b;
+
+  if (ra->obj->closey != rb->obj->closey)
+    return ra->obj->closey < rb->obj->closey? -1: 1;
+  if (ra->obj->closex != rb->obj->closex)
+    return ra->obj->closex < rb->obj->closex? -1: 1;
+  if (ra->list != rb->list)
+    return ra->list < rb->list? -1: 1;
+  return (ra->idx > rb->idx) - (ra->idx < rb->idx);
+}
 
-	      else if (newmarker == 'F')
-		{
-		  ps = psstack[--pstop];
-		  if ((cs == NONOBJECT) && (ps == COMPLETE))
-		    {
-		      if (start[co] == UNKNOWN)
-			{
-			  if ((int)info[co].pixnb >= minarea)
-			    {
-			      /* update threshold before object is processed */
-			      objlist.thresh = thresh;
+int mergeobjlists(sep_extract_ctx *ctx, objliststruct *lists, int nlists,
+		  objliststruct *objlistout)
+{
+  objref        *refs;
+  objstruct     *obj;
+  pliststruct   *plistin, *pixt;
+  int           i, j, l, n, npix, status;
 
-			      status = sortit(&info[co], &objlist, minarea,
-					      finalobjlist,
-					      deblend_nthresh,deblend_cont);
-			      if (status != RETURN_OK)
-				goto exit;
-			    }
+  status = RETURN_OK;
+  refs = NULL;
 
-			  /* free the chain-list */
-			  PLIST(pixel+info[co].lastpix, nextpix) =
-			    freeinfo.firstpix;
-			  freeinfo.firstpix = info[co].firstpix;
-			}
-		      else
-			{
-			  marker[end[co]] = 'F';
-			  store[start[co]] = info[co];
-			}
-		      co--;
-		      ps = psstack[--pstop];
-		    }
-		}
-	    }
-	  /* end of if (newmarker) ------------------------------------------*/
+  n = npix = 0;
+  for (l=0; l<nlists; l++)
+    {
+      n += lists[l].nobj;
+      npix += lists[l].npix;
+    }
+  if (!n)
+    goto exit;
 
-	  /* update the info or end segment */
-	  if (luflag)
-	    {
-	      update(&info[co], &curpixinfo, pixel);
-	    }
-	  else if (cs == OBJECT)
-	    {
-	      cs = NONOBJECT;
-	      if (ps != COMPLETE)
-		{
-		  marker[xl] = 'f';
-		  end[co] = xl;
-		}
-	      else
-		{
-		  ps = psstack[--pstop];
-		  marker[xl] = 'F';
-		  store[start[co]] = info[co];
-		  co--;
-		}
-	    }
+  QMALLOC(refs, objref, n, status);
+  for (l=0, n=0; l<nlists; l++)
+    for (i=0; i<lists[l].nobj; i++, n++)
+      {
+	refs[n].obj = lists[l].obj + i;
+	refs[n].list = l;
+	refs[n].idx = i;
+      }
+  qsort(refs, n, sizeof(objref), compareobjref);
+
+  QMALLOC(objlistout->obj, objstruct, n, status);
+  QMALLOC(objlistout->plist, pliststruct, npix*ctx->plistsize, status);
+  objlistout->nobj = n;
+  objlistout->npix = npix;
+
+  /* copy objects and their pixels */
+  pixt = objlistout->plist;
+  for (i=0; i<n; i++)
+    {
+      obj = objlistout->obj + i;
+      *obj = *(refs[i].obj);
+      plistin = lists[refs[i].list].plist;
+      obj->firstpix = pixt - objlistout->plist;
+      for (j=refs[i].obj->firstpix; j!=-1; j=PLIST(plistin+j, nextpix))
+	{
+	  memcpy(pixt, plistin+j, (size_t)ctx->plistsize);
+	  PLIST(pixt, nextpix) = (pixt - objlistout->plist) + ctx->plistsize;
+	  pixt += ctx->plistsize;
+	}
+      obj->lastpix = (pixt - objlistout->plist) - ctx->plistsize;
+      PLIST(objlistout->plist + obj->lastpix, nextpix) = -1;
+    }
 
-	} /*------------ End of the loop over the x's -----------------------*/
+ exit:
+  free(refs);
+  return status;
+}
 
-    } /*---------------- End of the loop over the y's -----------------------*/
+/****************************** finishobjlist ********************************/
+/*
+Clean the final object list (if requested) and convert the surviving
+objects to an array of `sepobj`, or to a catalog if `catalog` is not NULL.
+*/
+int finishobjlist(sep_extract_ctx *ctx, extractparams *p,
+		  objliststruct *finalobjlist, int clean_flag,
+		  double clean_param, sepobj **objects, sepcatalog **catalog,
+		  int *nobj)
+{
+  PIXTYPE thresh;
+  int     *survives;
+  int     i, j, status;
+  STATS_DECL(t0);
+
+  status = RETURN_OK;
+  survives = NULL;
+  *objects = NULL;
+  *nobj = 0;
+  j = 0;
+  STATS_ADD(nobj, finalobjlist->nobj);
+
+  /* threshold at the end of the scan */
+  thresh = p->noise? 0.0: p->thresh;
 
-  /* convert `finalobjlist` to an array of `sepobj` structs */
   if (clean_flag)
     {
+      STATS_START(t0);
+
       /* Calculate mthresh for all objects in the list (needed for cleaning) */
       for (i=0; i<finalobjlist->nobj; i++)
 	{
-	  status = analysemthresh(i, finalobjlist, minarea, thresh);
+	  status = analysemthresh(ctx, i, finalobjlist, p->minarea, thresh);
 	  if (status != RETURN_OK)
 	    goto exit;
 	}
 
       QMALLOC(survives, int, finalobjlist->nobj, status);
-      clean(finalobjlist, clean_param, survives);
+      status = clean(finalobjlist, clean_param, survives);
+      if (status != RETURN_OK)
+	goto exit;
 
-      /* count surviving objects and allocate space accordingly*/
-      *nobj = 0;
+      /* count surviving objects */
       for (i=0; i<finalobjlist->nobj; i++)
 	*nobj += survives[i];
-      QMALLOC(*objects, sepobj, *nobj, status);
-
-      /* fill */
-      j=0;
-      for (i=0; i<finalobjlist->nobj; i++)
-	if (survives[i])
-	    convertobj(i, finalobjlist, (*objects) + j++, w);
+      STATS_ADD(ncleaned, finalobjlist->nobj - *nobj);
+      STATS_TIME(t_clean, t0);
     }
   else
-    {
-      *nobj = finalobjlist->nobj;
-      QMALLOC(*objects, sepobj, *nobj, status);
-      for (i=0; i<finalobjlist->nobj; i++)
-	convertobj(i, finalobjlist, (*objects) + i, w);
-    }
+    *nobj = finalobjlist->nobj;
 
- exit:
-  free(finalobjlist->obj);
-  free(finalobjlist->plist);
-  free(finalobjlist);
-  freedeblend();
-  free(pixel);
-  lutzfree();
-  free(info);
-  free(store);
-  free(marker);
-  free(dumscan);
-  free(psstack);
-  free(start);
-  free(end);
-  arraybuffer_free(&imbuf);
-  if (noise)
-    arraybuffer_free(&nbuf);
-  if (conv)
-    free(convnorm);
-  if (use_matched_filter)
+  STATS_START(t0);
+  if (catalog)
     {
-      free(sigscan);
-      free(workscan);
+      status = convertcatalog(finalobjlist, survives, *nobj, p->w, catalog);
+      goto exit;
     }
 
+  /* allocate space for the surviving objects and fill */
+  QMALLOC(*objects, sepobj, *nobj, status);
+  for (i=0; i<finalobjlist->nobj; i++)
+    if (!survives || survives[i])
+      {
+	status = convertobj(i, finalobjlist, (*objects) + j, p->w);
+	if (status != RETURN_OK)
+	  goto exit;
+	j++;
+      }
+
+ exit:
+  STATS_TIME(t_convert, t0);
+  free(survives);
   if (status != RETURN_OK)
     {
-      free(cdscan);   /* only need to free these in case of early exit */
+      sep_freeobjarray(*objects, j);
       *objects = NULL;
       *nobj = 0;
     }
+  return status;
+}
+
+/******************************** emitobjs ***********************************/
+/*
+Pass on to the caller the objects of the list that can no longer change, `y`
+being the last line scanned: all new objects if not cleaning, otherwise those
+out of the clean zone of any object completed after `y`, assuming that
+objects still to come are no larger than the ones found so far. Objects are
+released in the order of the list, so that a held object also holds back the
+ones after it, and cleaned when released just as clean() would, against the
+objects found by then. Released objects are dropped from the list once they
+make up half of it.
+*/
+int emitobjs(sep_extract_ctx *ctx, extractparams *p, objliststruct *objlist,
+	     objemitter *em, int y)
+{
+  objstruct *obj;
+  sepobj    objout;
+  PIXTYPE   thresh;
+  int       *survives;
+  int       i, size, status;
+  STATS_DECL(t0);
+
+  status = RETURN_OK;
+  objout.pix = NULL;
+
+  if (em->clean_flag && em->nready < objlist->nobj)
+    {
+      if (objlist->nobj > em->size)
+	{
+	  size = 2*objlist->nobj;
+	  survives = (int *)realloc(em->survives, size*sizeof(int));
+	  if (!survives)
+	    return MEMORY_ALLOC_ERROR;
+	  em->survives = survives;
+	  em->size = size;
+	}
+
+      /* set up the new objects for cleaning (as in finishobjlist) */
+      thresh = p->noise? 0.0: p->thresh;
+      for (i=em->nready; i<objlist->nobj; i++)
+	{
+	  status = analysemthresh(ctx, i, objlist, p->minarea, thresh);
+	  if (status != RETURN_OK)
+	    return status;
+	  obj = objlist->obj + i;
+	  if (obj->a > em->amax)
+	    em->amax = obj->a;
+	  if (obj->ymax - obj->my > em->hmax)
+	    em->hmax = obj->ymax - obj->my;
+	  em->survives[i] = 1;
+	}
+      em->nready = objlist->nobj;
+    }
+
+  for (i=em->first; i<objlist->nobj; i++)
+    {
+      if (em->clean_flag)
+	{
+	  obj = objlist->obj + i;
+	  if (obj->my + CLEAN_ZONE*(obj->a + em->amax) + em->hmax +
+	      MARGIN_OFFSET >= y)
+	    break;
+	  STATS_START(t0);
+	  if (em->survives[i])
+	    cleanobj(objlist, i, em->clean_param, em->survives, NULL, 0);
+	  STATS_TIME(t_clean, t0);
+	  STATS_ADD(nobj, 1);
+	  if (!em->survives[i])
+	    {
+	      STATS_ADD(ncleaned, 1);
+	      continue;
+	    }
+	}
+      else
+	STATS_ADD(nobj, 1);
+
+      STATS_START(t0);
+      status = convertobj(i, objlist, &objout, p->w);
+      STATS_TIME(t_convert, t0);
+      if (status != RETURN_OK)
+	goto exit;
+      if (em->emit(em->userdata, &objout))
+	{
+	  status = OBJECT_EMIT_ERROR;
+	  goto exit;
+	}
+      free(objout.pix);
+      objout.pix = NULL;
+      em->nemit++;
+    }
+  em->first = i;
+
+  if (2*em->first >= objlist->nobj)
+    {
+      dropobjs(ctx, objlist, em->first);
+      if (em->clean_flag && objlist->nobj)
+	memmove(em->survives, em->survives+em->first,
+		(objlist->nobj)*sizeof(int));
+      em->nready -= em->first;
+      em->first = 0;
+    }
 
+ exit:
+  free(objout.pix);
   return status;
 }
 
+/******************************** dropobjs ***********************************/
+/*
+Remove the first n objects (and their pixels) from a list.
+*/
+void dropobjs(sep_extract_ctx *ctx, objliststruct *objlist, int n)
+{
+  pliststruct *pixt;
+  int         i, off;
+
+  if (!n)
+    return;
+
+  if (n == objlist->nobj)
+    {
+      /* addobjdeep() allocates anew the arrays of an empty list */
+      free(objlist->obj);
+      free(objlist->plist);
+      objlist->obj = NULL;
+      objlist->plist = NULL;
+      objlist->nobj = objlist->npix = 0;
+      return;
+    }
+
+  /* the pixels of each object follow those of the previous one */
+  off = objlist->obj[n].firstpix;
+  memmove(objlist->plist, objlist->plist+off,
+	  (size_t)objlist->npix*ctx->plistsize - off);
+  objlist->npix -= off/ctx->plistsize;
+  for (i=0, pixt=objlist->plist; i<objlist->npix;
+       i++, pixt+=ctx->plistsize)
+    if (PLIST(pixt, nextpix) != -1)
+      PLIST(pixt, nextpix) -= off;
+
+  objlist->nobj -= n;
+  memmove(objlist->obj, objlist->obj+n, objlist->nobj*sizeof(objstruct));
+  for (i=0; i<objlist->nobj; i++)
+    {
+      objlist->obj[i].firstpix -= off;
+      objlist->obj[i].lastpix -= off;
+    }
+}
 
 /********************************* sortit ************************************/
 /*
 build the object structure.
 */
-int sortit(infostruct *info, objliststruct *objlist, int minarea,
-	   objliststruct *finalobjlist,
+int sortit(sep_extract_ctx *ctx, infostruct *info, objliststruct *objlist,
+	   int minarea, objliststruct *finalobjlist,
 	   int deblend_nthresh, double deblend_mincont)
 {
-  objliststruct	        objlistout, *objlist2;
-  static objstruct	obj;
+  objliststruct	        objlistin, objlistout, *objlist2;
+  objstruct		obj;
   int 			i, status;
+  STATS_DECL(t0);
 
+  STATS_ADD(ndetect, 1);
   status=RETURN_OK;  
   objlistout.obj = NULL;
   objlistout.plist = NULL;
   objlistout.nobj = objlistout.npix = 0;
 
   /*----- Allocate memory to store object data */
-  objlist->obj = &obj;
-  objlist->nobj = 1;
+  objlistin.obj = &obj;
+  objlistin.nobj = 1;
+  objlistin.thresh = objlist->thresh;
 
   memset(&obj, 0, (size_t)sizeof(objstruct));
-  objlist->npix = info->pixnb;
-  obj.firstpix = info->firstpix;
-  obj.lastpix = info->lastpix;
   obj.flag = info->flag;
   obj.thresh = objlist->thresh;
 
-  preanalyse(0, objlist);
+  /* gather the pixels of the detection, which are scattered over the pixel
+   * stack, so that the many passes of deblend() read them in sequence */
+  if ((status = compactplist(ctx, info, objlist->plist, &objlistin))
+      != RETURN_OK)
+    goto exit;
+  obj.firstpix = 0;
+  obj.lastpix = (info->pixnb-1)*ctx->plistsize;
+
+  preanalyse(ctx, 0, &objlistin);
 
-  status = deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont,
-		   minarea);
+  STATS_START(t0);
+  status = deblend(ctx, &objlistin, 0, &objlistout, deblend_nthresh,
+		   deblend_mincont, minarea);
+  STATS_TIME(t_deblend, t0);
   if (status)
     {
       /* formerly, this wasn't a fatal error, so a flag was set for
        * the object and we continued. I'm leaving the flag-setting
        * here in case we want to change this to a non-fatal error in
        * the future, but currently the flag setting is irrelevant. */
-      objlist2 = objlist;
+      objlist2 = &objlistin;
       for (i=0; i<objlist2->nobj; i++)
 	objlist2->obj[i].flag |= SEP_OBJ_DOVERFLOW;
       goto exit;
@@ -675,14 +2752,16 @@ int sortit(infostruct *info, objliststruct *objlist, int minarea,
   /* Analyze the deblended objects and add to the final list */
   for (i=0; i<objlist2->nobj; i++)
     {
-      analyse(i, objlist2, 1);
+      STATS_START(t0);
+      analyse(ctx, i, objlist2, 1);
+      STATS_TIME(t_analyse, t0);
 
       /* this does nothing if DETECT_MAXAREA is 0 (and it currently is) */
       if (DETECT_MAXAREA && objlist2->obj[i].fdnpix > DETECT_MAXAREA)
 	continue;
 
       /* add the object to the final list */
-      status = addobjdeep(i, objlist2, finalobjlist);
+      status = addobjdeep(ctx, i, objlist2, finalobjlist);
       if (status != RETURN_OK)
 	goto exit;
     }
@@ -694,20 +2773,61 @@ int sortit(infostruct *info, objliststruct *objlist, int minarea,
 }
 
 
+/******************************* compactplist ********************************/
+/*
+Copy the pixels of the detection `info` from the pixel list `pixel` to
+consecutive elements of the compaction buffer of the context, linked in the
+same order, and make it the pixel list of `objlist`.
+*/
+int compactplist(sep_extract_ctx *ctx, infostruct *info, pliststruct *pixel,
+		 objliststruct *objlist)
+{
+  deblendbuffers *db = &ctx->deblend;
+  pliststruct	 *pixt, *pixt2;
+  size_t	 nbytes;
+  int		 i, status = RETURN_OK;
+
+  nbytes = (size_t)info->pixnb*ctx->plistsize;
+  if (nbytes > db->plistbytes)
+    {
+      free(db->plist);
+      db->plistbytes = 0;
+      QMALLOC(db->plist, pliststruct, nbytes, status);
+      db->plistbytes = nbytes;
+    }
+
+  pixt2 = db->plist;
+  for (i=info->firstpix; i!=-1; i=PLIST(pixt, nextpix))
+    {
+      pixt = pixel + i;
+      memcpy(pixt2, pixt, (size_t)ctx->plistsize);
+      pixt2 += ctx->plistsize;
+      PLIST(pixt2 - ctx->plistsize, nextpix) = pixt2 - db->plist;
+    }
+  PLIST(pixt2 - ctx->plistsize, nextpix) = -1;
+
+  objlist->plist = db->plist;
+  objlist->npix = info->pixnb;
+
+ exit:
+  return status;
+}
+
 /********** addobjdeep (originally in manobjlist.c) **************************/
 /*
 Add object number `objnb` from list `objl1` to list `objl2`.
 Unlike `addobjshallow` this also copies plist pixels to the second list.
 */
 
-int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2)
+int addobjdeep(sep_extract_ctx *ctx, int objnb, objliststruct *objl1,
+	       objliststruct *objl2)
 {
   objstruct	*objl2obj;
   pliststruct	*plist1 = objl1->plist, *plist2 = objl2->plist;
   int		fp, i, j, npx, objnb2;
   
   fp = objl2->npix;      /* 2nd list's plist size in pixels */
-  j = fp*plistsize;      /* 2nd list's plist size in bytes */
+  j = fp*ctx->plistsize; /* 2nd list's plist size in bytes */
   objnb2 = objl2->nobj;  /* # of objects currently in 2nd list*/
 
   /* Allocate space in `objl2` for the new object */
@@ -724,9 +2844,10 @@ int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2)
   /* Allocate space for the new object's pixels in 2nd list's plist */
   npx = objl1->obj[objnb].fdnpix;
   if (fp)
-    plist2 = (pliststruct *)realloc(plist2, (objl2->npix+=npx)*plistsize);
+    plist2 = (pliststruct *)realloc(plist2,
+				    (objl2->npix+=npx)*ctx->plistsize);
   else
-    plist2 = (pliststruct *)malloc((objl2->npix=npx)*plistsize);
+    plist2 = (pliststruct *)malloc((objl2->npix=npx)*ctx->plistsize);
 
   if (!plist2)
     goto earlyexit;
@@ -736,16 +2857,16 @@ int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2)
   plist2 += j;
   for(i=objl1->obj[objnb].firstpix; i!=-1; i=PLIST(plist1+i,nextpix))
     {
-      memcpy(plist2, plist1+i, (size_t)plistsize);
-      PLIST(plist2,nextpix) = (j+=plistsize);
-      plist2 += plistsize;
+      memcpy(plist2, plist1+i, (size_t)ctx->plistsize);
+      PLIST(plist2,nextpix) = (j+=ctx->plistsize);
+      plist2 += ctx->plistsize;
     }
-  PLIST(plist2-=plistsize, nextpix) = -1;
+  PLIST(plist2-=ctx->plistsize, nextpix) = -1;
   
   /* copy the object itself */
   objl2->obj[objnb2] = objl1->obj[objnb];
-  objl2->obj[objnb2].firstpix = fp*plistsize;
-  objl2->obj[objnb2].lastpix = j-plistsize;
+  objl2->obj[objnb2].firstpix = fp*ctx->plistsize;
+  objl2->obj[objnb2].lastpix = j-ctx->plistsize;
 
   return RETURN_OK;
   
@@ -762,39 +2883,39 @@ int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2)
  * (originally init_plist() in sextractor)
 PURPOSE	initialize a pixel-list and its components.
  ***/
-void plistinit(void *conv, void *var)
+void plistinit(sep_extract_ctx *ctx, void *conv, void *var)
 {
   pbliststruct	*pbdum = NULL;
 
-  plistsize = sizeof(pbliststruct);
-  plistoff_value = (char *)&pbdum->value - (char *)pbdum;
+  ctx->plistsize = sizeof(pbliststruct);
+  ctx->plistoff_value = (char *)&pbdum->value - (char *)pbdum;
 
   if (conv)
     {
-      plistexist_cdvalue = 1;
-      plistoff_cdvalue = plistsize;
-      plistsize += sizeof(PIXTYPE);
+      ctx->plistexist_cdvalue = 1;
+      ctx->plistoff_cdvalue = ctx->plistsize;
+      ctx->plistsize += sizeof(PIXTYPE);
     }
   else
     {
-      plistexist_cdvalue = 0;
-      plistoff_cdvalue = plistoff_value;
+      ctx->plistexist_cdvalue = 0;
+      ctx->plistoff_cdvalue = ctx->plistoff_value;
     }
 
   if (var)
     {
-      plistexist_var = 1;
-      plistoff_var = plistsize;
-      plistsize += sizeof(PIXTYPE);
+      ctx->plistexist_var = 1;
+      ctx->plistoff_var = ctx->plistsize;
+      ctx->plistsize += sizeof(PIXTYPE);
 
-      plistexist_thresh = 1;
-      plistoff_thresh = plistsize;
-      plistsize += sizeof(PIXTYPE);
+      ctx->plistexist_thresh = 1;
+      ctx->plistoff_thresh = ctx->plistsize;
+      ctx->plistsize += sizeof(PIXTYPE);
     }
   else
     {
-      plistexist_var = 0;
-      plistexist_thresh = 0;
+      ctx->plistexist_var = 0;
+      ctx->plistexist_thresh = 0;
     }
 
   return;
@@ -805,73 +2926,228 @@ void plistinit(void *conv, void *var)
 /************************** clean an objliststruct ***************************/
 /*
 Fill a list with whether each object in the list survived the cleaning 
-(assumes that mthresh has already been calculated for all objects in the list)
+(assumes that mthresh has already been calculated for all objects in the list).
+Objects are indexed on a grid of cells so that each one is only tested
+against the later objects whose cleaning zone may overlap its own, which
+gives the same result as testing it against all of them. Objects whose zone
+is too large (or undefined) for the grid are tested against all the others.
 */
 
-void clean(objliststruct *objlist, double clean_param, int *survives)
+int clean(objliststruct *objlist, double clean_param, int *survives)
 {
-  objstruct     *obj1, *obj2;
-  int	        i,j;
-  double        amp,ampin,alpha,alphain, unitarea,unitareain,beta,val;
-  float	       	dx,dy,rlim;
+  objstruct	*obj;
+  double	r, asum, cell, xmin, xmax, ymin, ymax, v;
+  int		*range, *cellstart, *cellobj, *stamp, *cand, *wide;
+  int		i, j, k, cx, cy, n, nfin, nwide, nx, ny, ncand, status;
 
-  beta = clean_param;
+  status = RETURN_OK;
+  range = cellstart = cellobj = stamp = cand = wide = NULL;
+  n = objlist->nobj;
 
   /* initialize to all surviving */
-  for (i=0; i<objlist->nobj; i++)
+  for (i=0; i<n; i++)
     survives[i] = 1;
 
-  obj1 = objlist->obj;
-  for (i=0; i<objlist->nobj; i++, obj1++)
+  /* short lists are tested directly */
+  if (n < CLEAN_GRID_MINOBJ)
     {
-      if (!survives[i])
-	continue;
+      for (i=0; i<n; i++)
+	if (survives[i])
+	  cleanobj(objlist, i, clean_param, survives, NULL, 0);
+      return status;
+    }
+
+  QMALLOC(range, int, 4*n, status);
+  QCALLOC(stamp, int, n, status);
+  QMALLOC(cand, int, n, status);
+  QMALLOC(wide, int, n, status);
 
-      /* parameters for test object */
-      unitareain = PI*obj1->a*obj1->b;
-      ampin = obj1->fdflux/(2*unitareain*obj1->abcor);
-      alphain = (pow(ampin/obj1->thresh, 1.0/beta)-1)*unitareain/obj1->fdnpix;
+  /* extent of the object centres, and mean size of the cleaning zones */
+  nfin = 0;
+  asum = xmin = xmax = ymin = ymax = 0.0;
+  for (i=0, obj=objlist->obj; i<n; i++, obj++)
+    {
+      range[4*i] = -1;
+      if (!(fabs(obj->mx) < BIG && fabs(obj->my) < BIG &&
+	    CLEAN_ZONE*obj->a < BIG))
+	continue;
+      if (!nfin || obj->mx < xmin)
+	xmin = obj->mx;
+      if (!nfin || obj->mx > xmax)
+	xmax = obj->mx;
+      if (!nfin || obj->my < ymin)
+	ymin = obj->my;
+      if (!nfin || obj->my > ymax)
+	ymax = obj->my;
+      asum += obj->a;
+      nfin++;
+      range[4*i] = 0;
+    }
 
-      /* loop over remaining objects in list*/
-      obj2 = obj1 + 1;
-      for (j=i+1; j<objlist->nobj; j++, obj2++)
+  /* cells about twice the mean zone radius, but no more than a few per
+   * object */
+  cell = nfin? 2.0*CLEAN_ZONE*asum/nfin: 1.0;
+  if (!(cell >= 1.0))
+    cell = 1.0;
+  for (;;)
+    {
+      v = (floor((xmax-xmin)/cell) + 1.0) * (floor((ymax-ymin)/cell) + 1.0);
+      if (v <= 4.0*n + 16.0)
+	break;
+      cell *= 2.0;
+    }
+  nx = (int)floor((xmax-xmin)/cell) + 1;
+  ny = (int)floor((ymax-ymin)/cell) + 1;
+  QCALLOC(cellstart, int, nx*ny+1, status);
+
+  /* range of cells covered by the box around the zone of each object, with
+   * a margin for the rounding of the test in cleanobj(). Two zones can only
+   * meet if their boxes share a cell (cell indices are clamped to the grid,
+   * which keeps this true for boxes reaching beyond it). */
+  nwide = 0;
+  for (i=0, obj=objlist->obj; i<n; i++, obj++)
+    {
+      if (range[4*i] == 0)
 	{
-	  if (!survives[j])
-	    continue;
+	  r = CLEAN_ZONE*obj->a;
+	  r += 1.0 + 1e-6*(fabs(obj->mx) + fabs(obj->my) + r);
+	  range[4*i] = CLEAN_CELL(obj->mx - r, xmin, cell, nx);
+	  range[4*i+1] = CLEAN_CELL(obj->mx + r, xmin, cell, nx);
+	  range[4*i+2] = CLEAN_CELL(obj->my - r, ymin, cell, ny);
+	  range[4*i+3] = CLEAN_CELL(obj->my + r, ymin, cell, ny);
+	  if ((range[4*i+1]-range[4*i]+1)*(range[4*i+3]-range[4*i+2]+1) >
+	      CLEAN_GRID_MAXCELL)
+	    range[4*i] = -1;
+	}
+      if (range[4*i] < 0)
+	{
+	  wide[nwide++] = i;
+	  continue;
+	}
+      for (cy=range[4*i+2]; cy<=range[4*i+3]; cy++)
+	for (cx=range[4*i]; cx<=range[4*i+1]; cx++)
+	  cellstart[cy*nx+cx+1]++;
+    }
 
-	  dx = obj1->mx - obj2->mx;
-	  dy = obj1->my - obj2->my;
-	  rlim = obj1->a + obj2->a;
-	  rlim *= rlim;
-	  if (dx*dx + dy*dy > rlim*CLEAN_ZONE*CLEAN_ZONE)
-	    continue;
+  /* fill the cells */
+  for (k=0; k<nx*ny; k++)
+    cellstart[k+1] += cellstart[k];
+  QMALLOC(cellobj, int, cellstart[nx*ny] + 1, status);
+  for (i=0; i<n; i++)
+    {
+      if (range[4*i] < 0)
+	continue;
+      for (cy=range[4*i+2]; cy<=range[4*i+3]; cy++)
+	for (cx=range[4*i]; cx<=range[4*i+1]; cx++)
+	  cellobj[cellstart[cy*nx+cx]++] = i;
+    }
+  for (k=nx*ny; k>0; k--)
+    cellstart[k] = cellstart[k-1];
+  cellstart[0] = 0;
 
-	  /* if obj1 is bigger, see if it eats obj2 */
-	  if (obj2->fdflux < obj1->fdflux)
+  /* test each surviving object against the later objects sharing a cell
+   * with it, and the later wide objects */
+  for (i=0; i<n; i++)
+    {
+      if (!survives[i])
+	continue;
+      if (range[4*i] < 0)
+	{
+	  cleanobj(objlist, i, clean_param, survives, NULL, 0);
+	  continue;
+	}
+      ncand = 0;
+      for (cy=range[4*i+2]; cy<=range[4*i+3]; cy++)
+	for (cx=range[4*i]; cx<=range[4*i+1]; cx++)
+	  for (k=cellstart[cy*nx+cx]; k<cellstart[cy*nx+cx+1]; k++)
 	    {
-	      val = 1 + alphain*(obj1->cxx*dx*dx + obj1->cyy*dy*dy +
-				 obj1->cxy*dx*dy);
-	      if (val>1.0 && ((float)(val<1e10?ampin*pow(val,-beta):0.0) >
-			      obj2->mthresh))
-		  survives[j] = 0; /* the test object eats this one */
+	      j = cellobj[k];
+	      if (j > i && stamp[j] != i+1)
+		{
+		  stamp[j] = i+1;
+		  cand[ncand++] = j;
+		}
 	    }
+      for (k=0; k<nwide; k++)
+	if (wide[k] > i)
+	  cand[ncand++] = wide[k];
+      cleanobj(objlist, i, clean_param, survives, cand, ncand);
+    }
 
-	  /* if obj2 is bigger, see if it eats obj1 */
-	  else
-	    {
-	      unitarea = PI*obj2->a*obj2->b;
-	      amp = obj2->fdflux/(2*unitarea*obj2->abcor);
-	      alpha = (pow(amp/obj2->thresh, 1.0/beta) - 1) *
-		unitarea/obj2->fdnpix;
-	      val = 1 + alpha*(obj2->cxx*dx*dx + obj2->cyy*dy*dy +
-			       obj2->cxy*dx*dy);
-	      if (val>1.0 && ((float)(val<1e10?amp*pow(val,-beta):0.0) >
-			      obj1->mthresh))
-		survives[i] = 0;  /* this object eats the test object */
-	    }
+ exit:
+  free(range);
+  free(cellstart);
+  free(cellobj);
+  free(stamp);
+  free(cand);
+  free(wide);
+  return status;
+}
+
+/*
+Test surviving object i of a list against the later surviving objects,
+marking whichever is eaten in each pair: the `ncand` objects listed in
+`cand` if it is not NULL, else all of them. The result does not depend on
+the order of the candidates.
+*/
+void cleanobj(objliststruct *objlist, int i, double clean_param,
+	      int *survives, int *cand, int ncand)
+{
+  objstruct     *obj1, *obj2;
+  int	        j, k;
+  double        amp,ampin,alpha,alphain, unitarea,unitareain,beta,val;
+  float	       	dx,dy,rlim;
+
+  beta = clean_param;
+  obj1 = objlist->obj + i;
+
+  /* parameters for test object */
+  unitareain = PI*obj1->a*obj1->b;
+  ampin = obj1->fdflux/(2*unitareain*obj1->abcor);
+  alphain = (pow(ampin/obj1->thresh, 1.0/beta)-1)*unitareain/obj1->fdnpix;
+
+  /* loop over remaining objects in list*/
+  if (!cand)
+    ncand = objlist->nobj - i - 1;
+  for (k=0; k<ncand; k++)
+    {
+      j = cand? cand[k]: i+1+k;
+      if (!survives[j])
+	continue;
+      obj2 = objlist->obj + j;
+
+      dx = obj1->mx - obj2->mx;
+      dy = obj1->my - obj2->my;
+      rlim = obj1->a + obj2->a;
+      rlim *= rlim;
+      if (dx*dx + dy*dy > rlim*CLEAN_ZONE*CLEAN_ZONE)
+	continue;
+
+      /* if obj1 is bigger, see if it eats obj2 */
+      if (obj2->fdflux < obj1->fdflux)
+	{
+	  val = 1 + alphain*(obj1->cxx*dx*dx + obj1->cyy*dy*dy +
+			     obj1->cxy*dx*dy);
+	  if (val>1.0 && ((float)(val<1e10?ampin*pow(val,-beta):0.0) >
+			  obj2->mthresh))
+	      survives[j] = 0; /* the test object eats this one */
+	}
+
+      /* if obj2 is bigger, see if it eats obj1 */
+      else
+	{
+	  unitarea = PI*obj2->a*obj2->b;
+	  amp = obj2->fdflux/(2*unitarea*obj2->abcor);
+	  alpha = (pow(amp/obj2->thresh, 1.0/beta) - 1) *
+	    unitarea/obj2->fdnpix;
+	  val = 1 + alpha*(obj2->cxx*dx*dx + obj2->cyy*dy*dy +
+			   obj2->cxy*dx*dy);
+	  if (val>1.0 && ((float)(val<1e10?amp*pow(val,-beta):0.0) >
+			  obj1->mthresh))
+	    survives[i] = 0;  /* this object eats the test object */
+	}
 
-	} /* inner loop over objlist (obj2) */
-    } /* outer loop of objlist (obj1) */
+    } /* inner loop over objlist (obj2) */
 }
 
 
@@ -941,3 +3217,154 @@ void sep_freeobjarray(sepobj *objects, int nobj)
     free(objects[--nobj].pix);
   free(objects);
 }
+
+/*****************************************************************************/
+/*
+Convert the objects of the list that survive cleaning (all of them if
+`survives` is NULL), `nobj` in all, to the columns of a catalog.
+*/
+
+int convertcatalog(objliststruct *objlist, int *survives, int nobj, int w,
+		   sepcatalog **catalog)
+{
+  int i, j, k, npix, status = RETURN_OK;
+  objstruct *obj;
+  pliststruct *pixt, *pixel;
+  sepcatalog *cat;
+
+  pixel = objlist->plist;
+  cat = NULL;
+  *catalog = NULL;
+  QCALLOC(cat, sepcatalog, 1, status);
+  cat->nobj = nobj;
+
+  QMALLOC(cat->thresh, float, nobj, status);
+  QMALLOC(cat->npix, int, nobj, status);
+  QMALLOC(cat->tnpix, int, nobj, status);
+  QMALLOC(cat->xmin, int, nobj, status);
+  QMALLOC(cat->xmax, int, nobj, status);
+  QMALLOC(cat->ymin, int, nobj, status);
+  QMALLOC(cat->ymax, int, nobj, status);
+  QMALLOC(cat->x, double, nobj, status);
+  QMALLOC(cat->y, double, nobj, status);
+  QMALLOC(cat->x2, double, nobj, status);
+  QMALLOC(cat->y2, double, nobj, status);
+  QMALLOC(cat->xy, double, nobj, status);
+  QMALLOC(cat->a, float, nobj, status);
+  QMALLOC(cat->b, float, nobj, status);
+  QMALLOC(cat->theta, float, nobj, status);
+  QMALLOC(cat->cxx, float, nobj, status);
+  QMALLOC(cat->cyy, float, nobj, status);
+  QMALLOC(cat->cxy, float, nobj, status);
+  QMALLOC(cat->cflux, float, nobj, status);
+  QMALLOC(cat->flux, float, nobj, status);
+  QMALLOC(cat->cpeak, float, nobj, status);
+  QMALLOC(cat->peak, float, nobj, status);
+  QMALLOC(cat->xcpeak, int, nobj, status);
+  QMALLOC(cat->ycpeak, int, nobj, status);
+  QMALLOC(cat->xpeak, int, nobj, status);
+  QMALLOC(cat->ypeak, int, nobj, status);
+  QMALLOC(cat->flag, short, nobj, status);
+  QMALLOC(cat->pixoff, int, nobj+1, status);
+
+  /* pixel offsets of the objects, then one array for all pixel lists */
+  npix = 0;
+  for (i=0, j=0; i<objlist->nobj; i++)
+    if (!survives || survives[i])
+      {
+	cat->pixoff[j++] = npix;
+	npix += objlist->obj[i].fdnpix;
+      }
+  cat->pixoff[nobj] = npix;
+  QMALLOC(cat->pix, int, npix, status);
+
+  for (i=0, j=0; i<objlist->nobj; i++)
+    {
+      if (survives && !survives[i])
+	continue;
+      obj = objlist->obj + i;
+
+      cat->thresh[j] = obj->thresh;
+      cat->npix[j] = obj->fdnpix;
+      cat->tnpix[j] = obj->dnpix;
+
+      cat->xmin[j] = obj->xmin;
+      cat->xmax[j] = obj->xmax;
+      cat->ymin[j] = obj->ymin;
+      cat->ymax[j] = obj->ymax;
+      cat->x[j] = obj->mx;
+      cat->y[j] = obj->my;
+      cat->x2[j] = obj->mx2;
+      cat->y2[j] = obj->my2;
+      cat->xy[j] = obj->mxy;
+
+      cat->a[j] = obj->a;
+      cat->b[j] = obj->b;
+      cat->theta[j] = obj->theta;
+
+      cat->cxx[j] = obj->cxx;
+      cat->cyy[j] = obj->cyy;
+      cat->cxy[j] = obj->cxy;
+
+      cat->cflux[j] = obj->fdflux; /* these change names */
+      cat->flux[j] = obj->dflux;
+      cat->cpeak[j] = obj->fdpeak;
+      cat->peak[j] = obj->dpeak;
+
+      cat->xpeak[j] = obj->xpeak;
+      cat->ypeak[j] = obj->ypeak;
+      cat->xcpeak[j] = obj->xcpeak;
+      cat->ycpeak[j] = obj->ycpeak;
+
+      cat->flag[j] = obj->flag;
+
+      for (pixt=pixel+obj->firstpix, k=cat->pixoff[j]; pixt>=pixel;
+	   pixt=pixel+PLIST(pixt,nextpix), k++)
+	cat->pix[k] = PLIST(pixt,x) + w*PLIST(pixt,y);
+      j++;
+    }
+
+  *catalog = cat;
+
+ exit:
+  if (status != RETURN_OK)
+    sep_freecatalog(cat);
+  return status;
+}
+
+void sep_freecatalog(sepcatalog *catalog)
+/* free memory associated with a catalog, including its columns */
+{
+  if (!catalog)
+    return;
+  free(catalog->thresh);
+  free(catalog->npix);
+  free(catalog->tnpix);
+  free(catalog->xmin);
+  free(catalog->xmax);
+  free(catalog->ymin);
+  free(catalog->ymax);
+  free(catalog->x);
+  free(catalog->y);
+  free(catalog->x2);
+  free(catalog->y2);
+  free(catalog->xy);
+  free(catalog->a);
+  free(catalog->b);
+  free(catalog->theta);
+  free(catalog->cxx);
+  free(catalog->cyy);
+  free(catalog->cxy);
+  free(catalog->cflux);
+  free(catalog->flux);
+  free(catalog->cpeak);
+  free(catalog->peak);
+  free(catalog->xcpeak);
+  free(catalog->ycpeak);
+  free(catalog->xpeak);
+  free(catalog->ypeak);
+  free(catalog->flag);
+  free(catalog->pixoff);
+  free(catalog->pix);
+  free(catalog);
+}
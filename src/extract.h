@@ -22,6 +22,8 @@
 
 #define	UNKNOWN	        -1    /* flag for LUTZ */
 #define	CLEAN_ZONE      10.0  /* zone (in sigma) to consider for processing */
+#define	CLEAN_GRID_MINOBJ  64 /* min. objects for cleaning on a grid */
+#define	CLEAN_GRID_MAXCELL 64 /* max. grid cells covered by an object */
 #define CLEAN_STACKSIZE 3000  /* replaces prefs.clean_stacksize  */
                               /* (MEMORY_OBJSTACK in sextractor inputs) */
 #define CLEAN_MARGIN    0  /* replaces prefs.cleanmargin which was set based */
@@ -30,12 +32,27 @@
 #define	MARGIN_OFFSET  4.0 /* Margin offset (pixels) */ 
 #define	MAXDEBAREA     3   /* max. area for deblending (must be >= 1)*/
 #define	MAXPICSIZE     1048576 /* max. image size in any dimension */
+#define	PIXSTACK_INIT  16384   /* initial size of the pixel stack (pixels) */
+#define	DEBLEND_QUEUE_NPIX 1048576 /* pixels queued before deblending them */
 
-/* plist-related macros */
+/* cell of the cleaning grid, of size `cell` from `origin`, containing
+ * coordinate x, clamped to the n cells of the grid */
+#define	CLEAN_CELL(x, origin, cell, n)					\
+  ((x) < (origin)? 0: ((x) - (origin))/(cell) >= (n)? (n)-1:		\
+   (int)(((x) - (origin))/(cell)))
+
+/* plist-related macros. The pixel list layout is stored in the extraction
+ * context, so PLISTEXIST and PLISTPIX expect a `sep_extract_ctx *ctx` in
+ * scope. */
 #define	PLIST(ptr, elem)	(((pbliststruct *)(ptr))->elem)
-#define	PLISTEXIST(elem)	(plistexist_##elem)
-#define	PLISTPIX(ptr, elem)	(*((PIXTYPE *)((ptr)+plistoff_##elem)))
-#define	PLISTFLAG(ptr, elem)	(*((FLAGTYPE *)((ptr)+plistoff_##elem)))
+#define	PLISTEXIST(elem)	(ctx->plistexist_##elem)
+#define	PLISTPIX(ptr, elem)	(*((PIXTYPE *)((ptr)+ctx->plistoff_##elem)))
+#define	PLISTFLAG(ptr, elem)	(*((FLAGTYPE *)((ptr)+ctx->plistoff_##elem)))
+
+#define SEP_RAND_MAX   32767  /* max value returned by ctxrand() */
+
+#define OBJ_SEAM       0x4000 /* internal flag: detection touches a seam */
+                              /* between strips in parallel extraction */
 
 /* Extraction status */
 typedef	enum {COMPLETE, INCOMPLETE, NONOBJECT, OBJECT} pixstatus;
@@ -64,6 +81,8 @@ typedef struct
   BYTE *dptr;         /* pointer to original data, can be any supported type */
   int dtype;          /* data type of original data */
   int dw, dh;         /* original data width, height */
+  size_t dstride;     /* bytes between lines of original data (0 if all */
+                      /* lines are read from dptr in turn) */
   PIXTYPE *bptr;      /* buffer pointer (self-managed memory) */
   int bw, bh;         /* buffer width, height (bufw can be larger than w due */
                       /* to padding). */
@@ -75,11 +94,6 @@ typedef struct
 } arraybuffer;
 
 
-/* globals */
-extern int plistexist_cdvalue, plistexist_thresh, plistexist_var;
-extern int plistoff_value, plistoff_cdvalue, plistoff_thresh, plistoff_var;
-extern int plistsize;
-
 typedef struct
 {
   /* thresholds */
@@ -119,6 +133,10 @@ typedef struct
   /* accessing individual pixels in plist*/
   int	   firstpix;			     /* ptr to first pixel */
   int	   lastpix;			     /* ptr to last pixel */
+
+  /* scan position where the parent detection was completed; gives the
+     order of objects in the catalog */
+  int	   closey, closex;
 } objstruct;
 
 typedef struct
@@ -130,32 +148,160 @@ typedef struct
   PIXTYPE       thresh;   /* detection threshold */
 } objliststruct;
 
+/* Buffers used by the main scan of sep_extract_with_ctx() */
+typedef struct
+{
+  int         stacksize;  /* allocated length of each buffer */
+  infostruct  *info, *store;
+  char        *marker;
+  pixstatus   *psstack;
+  int         *start, *end;
+  PIXTYPE     *dumscan, *cdscan, *sigscan;
+  PIXTYPE     *workscan;  /* filtering work space (3*stacksize elements) */
+} scanbuffers;
 
-int analysemthresh(int objnb, objliststruct *objlist, int minarea,
-		   PIXTYPE thresh);
-void preanalyse(int, objliststruct *);
-void analyse(int, objliststruct *, int);
+/* Pixel stack holding the pixels of all objects being detected */
+typedef struct
+{
+  pliststruct *pixel;
+  int         size;       /* allocated size in bytes */
+  int         plistsize;  /* plistsize used to link the free list */
+  int         hwm;        /* end of the part used since last linked */
+} pixstackbuffer;
 
-int  lutzalloc(int, int);
-void lutzfree(void);
-int  lutz(pliststruct *plistin,
+/* Buffers used by lutz() */
+typedef struct
+{
+  int         stacksize;  /* allocated length of each buffer */
+  infostruct  *info, *store;
+  char        *marker;
+  pixstatus   *psstack;
+  int         *start, *end, *discan;
+  int         xmin, ymin, xmax, ymax;
+} lutzbuffers;
+
+/* Buffers used by deblend() */
+typedef struct
+{
+  int           nthresh;  /* number of thresholds allocated for */
+  objliststruct *objlist;
+  short         *son, *ok;
+  pliststruct   *plist;   /* pixels of the detection deblended, compacted */
+  size_t        plistbytes; /* allocated size of plist in bytes */
+} deblendbuffers;
+
+/* Detection set aside during the scan to be deblended later (see
+ * queuedetection()) */
+typedef struct
+{
+  size_t      off;        /* offset of its pixels in the queue's plist */
+  infostruct  info;       /* its pixels (relative to off) and flags */
+  PIXTYPE     thresh;     /* threshold when it was completed */
+  int         y, x;       /* where it was completed */
+} deblendjob;
+
+/* Detections waiting to be deblended concurrently, and the contexts of the
+ * threads other than the scanning one */
+typedef struct
+{
+  deblendjob      *job;
+  int             njob, size;   /* jobs queued, allocated length of job */
+  pliststruct     *plist;       /* pixels of all jobs */
+  size_t          used, plistbytes; /* bytes of plist used, allocated */
+  sep_extract_ctx **workers;
+  int             nworkers;
+} deblendqueue;
+
+/* Extraction context: all state used during a single extraction. Each
+ * thread running an extraction must use its own context. Buffers are kept
+ * between extractions and only reallocated when they need to grow. */
+struct sep_extract_ctx
+{
+  /* pixel list layout (set by plistinit()) */
+  int plistexist_cdvalue, plistexist_thresh, plistexist_var;
+  int plistoff_value, plistoff_cdvalue, plistoff_thresh, plistoff_var;
+  int plistsize;
+
+  scanbuffers    scan;
+  pixstackbuffer pixstack;
+  lutzbuffers    lutz;
+  deblendbuffers deblend;
+  deblendqueue   queue;
+
+  unsigned int   randstate;  /* state of random number generator */
+  int            nthreads;   /* threads deblending (<= 1: in the scan) */
+  size_t         imstride, nstride;  /* bytes between lines (0: contiguous) */
+};
+
+
+int analysemthresh(sep_extract_ctx *ctx, int objnb, objliststruct *objlist,
+		   int minarea, PIXTYPE thresh);
+void preanalyse(sep_extract_ctx *, int, objliststruct *);
+void analyse(sep_extract_ctx *, int, objliststruct *, int);
+
+int  lutzalloc(sep_extract_ctx *, int, int);
+void lutzfree(sep_extract_ctx *);
+int  lutz(sep_extract_ctx *ctx, pliststruct *plistin,
 	  int *objrootsubmap, int subx, int suby, int subw,
 	  objstruct *objparent, objliststruct *objlist, int minarea);
 
 void update(infostruct *, infostruct *, pliststruct *);
 
-int  allocdeblend(int);
-void freedeblend(void);
-int  deblend(objliststruct *, int, objliststruct *, int, double, int);
+int  *createsubmap(objliststruct *, int, int *, int *, int *, int *);
+int  allocdeblend(sep_extract_ctx *, int);
+void freedeblend(sep_extract_ctx *);
+int  deblend(sep_extract_ctx *, objliststruct *, int, objliststruct *, int,
+	     double, int);
 
 /*int addobjshallow(objstruct *, objliststruct *);
 int rmobjshallow(int, objliststruct *);
 void mergeobjshallow(objstruct *, objstruct *);
 */
-int addobjdeep(int, objliststruct *, objliststruct *);
+int addobjdeep(sep_extract_ctx *, int, objliststruct *, objliststruct *);
+
+/* Kernel prepared for filtering image lines with FFTs (see convolve.c) */
+typedef struct
+{
+  int     n;          /* transform length (0 if not filtering with FFTs) */
+  int     seglen;     /* output pixels per segment of a line */
+  int     nseg;       /* number of segments in a line */
+  float   *conv;      /* kernel (not owned) */
+  int     convw, convh;
+  float   conv2max;   /* largest squared kernel value */
+  double  *twiddle;   /* n/2 complex twiddle factors */
+  double  *kern;      /* transforms of the kernel rows (n complex each) */
+  double  *kernmf;    /* matched filter transforms (2 per kernel row) */
+} fftkernel;
+
+/* Transforms of the last input lines being filtered with FFTs */
+typedef struct
+{
+  double  *lines;     /* line y in slot y%convh (n complex per block) */
+  int     *bad;       /* if the line can't be filtered with FFTs */
+  double  *scale;     /* largest 1/noise^2 of the line (matched filter) */
+  int     ynext;      /* next line to transform */
+  double  *acc;       /* transform of the output line */
+} fftlines;
 
+int separable_kernel(float *conv, int convw, int convh,
+		     float *convx, float *convy);
 int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh,
              PIXTYPE *out);
+int convolve_sep(arraybuffer *buf, int y, float *convx, float *convy,
+		 int convw, int convh, PIXTYPE *work, PIXTYPE *out);
 int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
                    float *conv, int convw, int convh,
                    PIXTYPE *outnum, PIXTYPE *outdenom);
+int matched_filter_sep(arraybuffer *imbuf, arraybuffer *nbuf, int y,
+		       float *convx, float *convy, int convw, int convh,
+		       PIXTYPE *work, PIXTYPE *out);
+int  fftkernel_init(fftkernel *fk, float *conv, int convw, int convh, int w,
+		    int matched);
+void fftkernel_free(fftkernel *fk);
+int  fftlines_init(fftlines *fl, fftkernel *fk);
+void fftlines_free(fftlines *fl);
+int convolve_fft(arraybuffer *buf, int y, fftkernel *fk, fftlines *fl,
+		 PIXTYPE *out);
+int matched_filter_fft(arraybuffer *imbuf, arraybuffer *nbuf, int y,
+		       fftkernel *fk, fftlines *fl, PIXTYPE *work,
+		       PIXTYPE *out);
@@ -32,45 +32,43 @@
 
 #define	NOBJ 256  /* starting number of obj. */
 
-void lutzsort(infostruct *, objliststruct *);
-
-/*------------------------- Static buffers for lutz() -----------------------*/
-
-static infostruct  *info=NULL, *store=NULL;
-static char	   *marker=NULL;
-static pixstatus   *psstack=NULL;
-static int         *start=NULL, *end=NULL, *discan=NULL;
-static int         xmin, ymin, xmax, ymax;
-
+void lutzsort(sep_extract_ctx *, infostruct *, objliststruct *);
 
 /******************************* lutzalloc ***********************************/
 /*
-Allocate once for all memory space for buffers used by lutz().
+Allocate once for all memory space for buffers used by lutz(). Buffers
+already in the context are kept if they are large enough for `width`.
 */
-int lutzalloc(int width, int height)
+int lutzalloc(sep_extract_ctx *ctx, int width, int height)
 {
+  lutzbuffers *lb = &ctx->lutz;
   int *discant;
   int stacksize, i, status=RETURN_OK;
 
   stacksize = width+1;
-  xmin = ymin = 0;
-  xmax = width-1;
-  ymax = height-1;
-  QMALLOC(info, infostruct, stacksize, status);
-  QMALLOC(store, infostruct, stacksize, status);
-  QMALLOC(marker, char, stacksize, status);
-  QMALLOC(psstack, pixstatus, stacksize, status);
-  QMALLOC(start, int, stacksize, status);
-  QMALLOC(end, int, stacksize, status);
-  QMALLOC(discan, int, stacksize, status);
-  discant = discan;
+  lb->xmin = lb->ymin = 0;
+  lb->xmax = width-1;
+  lb->ymax = height-1;
+  if (stacksize <= lb->stacksize)
+    return status;
+
+  lutzfree(ctx);
+  QMALLOC(lb->info, infostruct, stacksize, status);
+  QMALLOC(lb->store, infostruct, stacksize, status);
+  QMALLOC(lb->marker, char, stacksize, status);
+  QMALLOC(lb->psstack, pixstatus, stacksize, status);
+  QMALLOC(lb->start, int, stacksize, status);
+  QMALLOC(lb->end, int, stacksize, status);
+  QMALLOC(lb->discan, int, stacksize, status);
+  discant = lb->discan;
   for (i=stacksize; i--;)
     *(discant++) = -1;
+  lb->stacksize = stacksize;
 
   return status;
 
  exit:
-  lutzfree();
+  lutzfree(ctx);
 
   return status;
 }
@@ -79,22 +77,25 @@ int lutzalloc(int width, int height)
 /*
 Free once for all memory space for buffers used by lutz().
 */
-void lutzfree()
+void lutzfree(sep_extract_ctx *ctx)
 {
-  free(discan);
-  discan = NULL;
-  free(info);
-  info = NULL;
-  free(store);
-  store = NULL;
-  free(marker);
-  marker = NULL;
-  free(psstack);
-  psstack = NULL;
-  free(start);
-  start = NULL;
-  free(end);
-  end = NULL;
+  lutzbuffers *lb = &ctx->lutz;
+
+  free(lb->discan);
+  lb->discan = NULL;
+  free(lb->info);
+  lb->info = NULL;
+  free(lb->store);
+  lb->store = NULL;
+  free(lb->marker);
+  lb->marker = NULL;
+  free(lb->psstack);
+  lb->psstack = NULL;
+  free(lb->start);
+  lb->start = NULL;
+  free(lb->end);
+  lb->end = NULL;
+  lb->stacksize = 0;
   return;
 }
 
@@ -104,11 +105,16 @@ void lutzfree()
 C implementation of R.K LUTZ' algorithm for the extraction of 8-connected pi-
 xels in an image
 */
-int lutz(pliststruct *plistin,
+int lutz(sep_extract_ctx *ctx, pliststruct *plistin,
 	 int *objrootsubmap, int subx, int suby, int subw,
 	 objstruct *objparent, objliststruct *objlist, int minarea)
 {
-  static infostruct	curpixinfo,initinfo;
+  infostruct		curpixinfo,initinfo;
+  infostruct		*info = ctx->lutz.info, *store = ctx->lutz.store;
+  char			*marker = ctx->lutz.marker;
+  pixstatus		*psstack = ctx->lutz.psstack;
+  int			*start = ctx->lutz.start, *end = ctx->lutz.end;
+  int			xmax = ctx->lutz.xmax, ymax = ctx->lutz.ymax;
   objstruct		*obj;
   pliststruct		*plist,*pixel, *plistint;
   
@@ -154,7 +160,7 @@ int lutz(pliststruct *plistin,
   /*------Allocate memory for the pixel list */
   free(objlist->plist);
   if (!(objlist->plist
-	= (pliststruct *)malloc((eny-sty)*(enx-stx)*plistsize)))
+	= (pliststruct *)malloc((eny-sty)*(enx-stx)*ctx->plistsize)))
     {
       out = MEMORY_ALLOC_ERROR;
       plist = NULL;			/* To avoid gcc -Wall warnings */
@@ -169,6 +175,7 @@ int lutz(pliststruct *plistin,
 
   objlist->nobj = 0;
   co = pstop = 0;
+  curpixinfo = initinfo;
   curpixinfo.pixnb = 1;
 
   for (yl=sty; yl<=eny; yl++, iscan += step)
@@ -177,7 +184,7 @@ int lutz(pliststruct *plistin,
       cs = NONOBJECT;
       trunflag = (yl==0 || yl==ymax) ? SEP_OBJ_TRUNC : 0;
       if (yl==eny)
-	iscan = discan;
+	iscan = ctx->lutz.discan;
 
       for (xl=stx; xl<=enx; xl++)
 	{
@@ -195,11 +202,11 @@ int lutz(pliststruct *plistin,
 	    {
 	      if (xl==0 || xl==xmax)
 		curpixinfo.flag |= SEP_OBJ_TRUNC;
-	      memcpy(pixel, plistint, (size_t)plistsize);
+	      memcpy(pixel, plistint, (size_t)ctx->plistsize);
 	      PLIST(pixel, nextpix) = -1;
 	      curpixinfo.lastpix = curpixinfo.firstpix = cn;
-	      cn += plistsize;
-	      pixel += plistsize;
+	      cn += ctx->plistsize;
+	      pixel += ctx->plistsize;
 
 	      /*----------------- Start Segment -----------------------------*/
 	      if (cs != OBJECT)
@@ -275,7 +282,7 @@ int lutz(pliststruct *plistin,
 				    out = MEMORY_ALLOC_ERROR;
 				    goto exit_lutz;
 				  }
-			      lutzsort(&info[co], objlist);
+			      lutzsort(ctx, &info[co], objlist);
 			    }
 			}
 		      else
@@ -347,7 +354,7 @@ int lutz(pliststruct *plistin,
 /*
 Add an object to the object list based on info (pixel info)
 */
-void  lutzsort(infostruct *info, objliststruct *objlist)
+void  lutzsort(sep_extract_ctx *ctx, infostruct *info, objliststruct *objlist)
 {
   objstruct *obj = objlist->obj+objlist->nobj;
 
@@ -357,7 +364,7 @@ void  lutzsort(infostruct *info, objliststruct *objlist)
   obj->flag = info->flag;
   objlist->npix += info->pixnb;
   
-  preanalyse(objlist->nobj, objlist);
+  preanalyse(ctx, objlist->nobj, objlist);
   
   objlist->nobj++;
   
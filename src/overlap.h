@@ -168,407 +168,142 @@ double circoverlap_new(double dx, double dy, double r)
 */
 
 /*****************************************************************************/
-/* ellipse overlap functions */
+/* ellipse overlap functions
+ *
+ * Exact overlap of pixels with an ellipse, by integration along the pixel
+ * edges.
+ *
+ * Along x, the ellipse cxx*x^2 + cyy*y^2 + cxy*x*y <= r^2 spans
+ * |y + s*x| <= k*sqrt(X^2 - x^2), so that the overlap of the pixel
+ * [xmin, xmax] x [ymin, ymax] is the integral over x of
+ * clip(ymax + s*x) - clip(ymin + s*x), where clip() limits a value to the
+ * half-height of the ellipse. Primitives of clip(c + s*x) take a closed form
+ * once the abscissae where the line crosses the ellipse are known; these
+ * only depend on the row of the pixel (edgeline_init), leaving a few
+ * operations per pixel (shearoverlap). */
 
 typedef struct
 {
-  double x, y;
-} point;
-
+  double s, k, X;       /* shear, vertical scale and half-width of ellipse */
+  double q;             /* area of a quarter of ellipse */
+  double x, a0;         /* last pixel edge evaluated with shear_a0() */
+} shearellipse;
 
+/* the line y = c, i.e. y + s*x = c + s*x in the sheared frame */
 typedef struct
 {
-  point p1, p2;
-} intersections;
-
-static inline void swap(double *a, double *b)
-{
-  double temp;
-  temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-static inline void swap_point(point *a, point *b)
+  double c;
+  double u1, u2;        /* abscissae where the line crosses the ellipse */
+  double sig1, sig2;    /* side of the ellipse (1: above, -1: below) of the
+			   line left of u1 and right of u2 */
+  double p1, p2, a2;    /* primitive at u1 and u2, shear_a0() at u2 */
+  int    cross;         /* does the line cross the ellipse at all? */
+} edgeline;
+
+/* ellipse of semi-axes a*r, b*r and position angle theta. Its parameters
+ * are derived from a, b and theta rather than from the coefficients cxx,
+ * cyy and cxy, which lose precision for thin ellipses. */
+static void shearellipse_init(double a, double b, double theta, double r,
+			      shearellipse *e)
 {
-  point temp;
-  temp = *a;
-  *a = *b;
-  *b = temp;
-}
+  double costheta, sintheta, cyy, cxy;
 
-/* rotate values to the left: a=b, b=c, c=a */
-static inline void rotate(double *a, double *b, double *c)
-{
-  double temp;
-  temp = *a;
-  *a = *b;
-  *b = *c;
-  *c = temp;
+  e->x = HUGE_VAL;
+  e->a0 = 0.;
+  if (!(r > 0. && a > 0. && b > 0.))
+    {
+      e->s = e->k = e->X = e->q = 0.;
+      return;
+    }
+  costheta = cos(theta);
+  sintheta = sin(theta);
+  cyy = sintheta*sintheta/(a*a) + costheta*costheta/(b*b);
+  cxy = 2.*costheta*sintheta * (1./(a*a) - 1./(b*b));
+  e->s = cxy / (2.*cyy);
+  e->k = 1. / (a*b*cyy);
+  e->X = r * a*b * sqrt(cyy);
+  e->q = 0.25 * PI * e->k * e->X * e->X;
 }
 
-/* Check if a point (x,y) is inside a triangle */
-static int in_triangle(double x, double y, double x1, double y1,
-		       double x2, double y2, double x3, double y3)
+/* integral of the half-height of the ellipse from 0 to u (|u| <= X) */
+static inline double shear_a0(const shearellipse *e, double u)
 {
-  int c;
+  double t;
 
-  c = 0;
-  c += ((y1 > y) != (y2 > y)) && (x < (x2-x1) * (y-y1) / (y2-y1) + x1);
-  c += ((y2 > y) != (y3 > y)) && (x < (x3-x2) * (y-y2) / (y3-y2) + x2);
-  c += ((y3 > y) != (y1 > y)) && (x < (x1-x3) * (y-y3) / (y1-y3) + x3);
-
-  return c % 2 == 1;
+  t = sqrt((e->X - u)*(e->X + u));
+  return 0.5 * e->k * (u*t + e->X*e->X*atan2(u, t));
 }
 
-
-/* Intersection of a line defined by two points with a unit circle */
-static intersections circle_line(double x1, double y1, double x2, double y2)
+/* crossings of the line y = c with the ellipse, and the primitive there */
+static void edgeline_init(const shearellipse *e, double c, edgeline *l)
 {
-  double a, b, delta, dx, dy;
-  double tol = 1.e-10;
-  intersections inter;
-
-  dx = x2 - x1;
-  dy = y2 - y1;
+  double q, disc, sq, s = e->s, X = e->X;
 
-  if (fabs(dx) < tol && fabs(dy) < tol)
+  l->c = c;
+  disc = (s*s + e->k*e->k)*X*X - c*c;
+  l->cross = (disc > 0. && X > 0.);
+  if (!l->cross)
     {
-      inter.p1.x = 2.;
-      inter.p1.y = 2.;
-      inter.p2.x = 2.;
-      inter.p2.y = 2.;
+      l->sig1 = (c > 0.)? 1.: -1.;
+      return;
     }
-  else if (fabs(dx) > fabs(dy))
-    {
-      /* Find the slope and intercept of the line */
-      a = dy / dx;
-      b = y1 - a * x1;
-
-      /* Find the determinant of the quadratic equation */
-      delta = 1. + a*a - b*b;
-      if (delta > 0.)  /* solutions exist */
-	{
-	  delta = sqrt(delta);
-
-	  inter.p1.x = (-a*b - delta) / (1. + a*a);
-	  inter.p1.y = a * inter.p1.x + b;
-	  inter.p2.x = (-a*b + delta) / (1. + a*a);
-	  inter.p2.y = a * inter.p2.x + b;
-	}
-      else  /* no solution, return values > 1 */
-	{
-	  inter.p1.x = 2.;
-	  inter.p1.y = 2.;
-	  inter.p2.x = 2.;
-	  inter.p2.y = 2.;
-	}
-    }
-  else
-    {
-      /* Find the slope and intercept of the line */
-      a = dx / dy;
-      b = x1 - a * y1;
-
-      /* Find the determinant of the quadratic equation */
-      delta = 1. + a*a - b*b;
-      if (delta > 0.)  /* solutions exist */
-	{
-	  delta = sqrt(delta);
-	  inter.p1.y = (-a*b - delta) / (1. + a*a);
-	  inter.p1.x = a * inter.p1.y + b;
-	  inter.p2.y = (-a*b + delta) / (1. + a*a);
-	  inter.p2.x = a * inter.p2.y + b;
-	}
-      else  /* no solution, return values > 1 */
-	{
-	  inter.p1.x = 2.;
-	  inter.p1.y = 2.;
-	  inter.p2.x = 2.;
-	  inter.p2.y = 2.;
-	}
-    }
-
-  return inter;
+  l->sig1 = (c - s*X > 0.)? 1.: -1.;
+  q = s*s + e->k*e->k;
+  sq = e->k * sqrt(disc);
+  l->u1 = (-c*s - sq) / q;
+  l->u2 = (-c*s + sq) / q;
+  if (l->u1 < -X)
+    l->u1 = -X;
+  if (l->u2 > X)
+    l->u2 = X;
+  l->sig2 = (c + s*X > 0.)? 1.: -1.;
+  l->p1 = l->sig1 * (shear_a0(e, l->u1) + e->q);
+  l->a2 = shear_a0(e, l->u2);
+  l->p2 = l->p1 + (l->u2 - l->u1)*(c + 0.5*s*(l->u2 + l->u1));
 }
 
-/* The intersection of a line with the unit circle. The intersection the
- * closest to (x2, y2) is chosen. */
-static point circle_segment_single2(double x1, double y1, double x2, double y2)
+/* is the line outside the ellipse at x? */
+static inline int edgeline_outside(const edgeline *l, double x)
 {
-  double dx1, dy1, dx2, dy2;
-  intersections inter;
-  point pt1, pt2, pt;
-
-  inter = circle_line(x1, y1, x2, y2);
-  pt1 = inter.p1;
-  pt2 = inter.p2;
-
-  /*Can be optimized, but just checking for correctness right now */
-  dx1 = fabs(pt1.x - x2);
-  dy1 = fabs(pt1.y - y2);
-  dx2 = fabs(pt2.x - x2);
-  dy2 = fabs(pt2.y - y2);
-
-  if (dx1 > dy1)  /* compare based on x-axis */
-    pt = (dx1 > dx2) ? pt2 : pt1;
-  else
-    pt = (dy1 > dy2) ? pt2 : pt1;
-     
-  return pt;
+  return !l->cross || x <= l->u1 || x >= l->u2;
 }
 
-/* Intersection(s) of a segment with the unit circle. Discard any
-   solution not on the segment. */
-intersections circle_segment(double x1, double y1, double x2, double y2)
+/* integral of clip(c + s*u) from -X to x (|x| <= X), given
+ * a0 = shear_a0(e, x) where the line is outside the ellipse */
+static inline double edgeline_prim(const shearellipse *e, const edgeline *l,
+				   double x, double a0)
 {
-  intersections inter, inter_new;
-  point pt1, pt2;
-
-  inter = circle_line(x1, y1, x2, y2);
-  pt1 = inter.p1;
-  pt2 = inter.p2;
-
-  if ((pt1.x > x1 && pt1.x > x2) || (pt1.x < x1 && pt1.x < x2) ||
-      (pt1.y > y1 && pt1.y > y2) || (pt1.y < y1 && pt1.y < y2))
-    {
-      pt1.x = 2.;
-      pt1.y = 2.;
-    }
-  if ((pt2.x > x1 && pt2.x > x2) || (pt2.x < x1 && pt2.x < x2) ||
-      (pt2.y > y1 && pt2.y > y2) || (pt2.y < y1 && pt2.y < y2))
-    {
-      pt2.x = 2.;
-      pt2.y = 2.;
-    }
-
-  if (pt1.x > 1. && pt2.x < 2.)
-    {
-      inter_new.p1 = pt1;
-      inter_new.p2 = pt2;
-    }
-  else
-    {
-      inter_new.p1 = pt2;
-      inter_new.p2 = pt1;
-    }
-  return inter_new;
+  if (!l->cross || x <= l->u1)
+    return l->sig1 * (a0 + e->q);
+  if (x < l->u2)
+    return l->p1 + (x - l->u1)*(l->c + 0.5*e->s*(x + l->u1));
+  return l->p2 + l->sig2 * (a0 - l->a2);
 }
 
-
-/* Given a triangle defined by three points (x1, y1), (x2, y2), and
-   (x3, y3), find the area of overlap with the unit circle. */
-static double triangle_unitcircle_overlap(double x1, double y1,
-					  double x2, double y2,
-					  double x3, double y3)
+/* exact overlap of the ellipse with the pixel [xmin, xmax] x [ymin, ymax],
+ * the lines y = ymin and y = ymax being `lo` and `hi` */
+static double shearoverlap(shearellipse *e, const edgeline *lo,
+			   const edgeline *hi, double xmin, double xmax)
 {
-  double d1, d2, d3, area, xp, yp;
-  int in1, in2, in3, on1, on2, on3;
-  int intersect13, intersect23;
-  intersections inter;
-  point pt1, pt2, pt3, pt4, pt5, pt6;
-
-  /* Find distance of all vertices to circle center */
-  d1 = x1*x1 + y1*y1;
-  d2 = x2*x2 + y2*y2;
-  d3 = x3*x3 + y3*y3;
-
-  /* Order vertices by distance from origin */
-  if (d1 < d2)
-    {
-      if (d2 < d3)
-	{}
-      else if (d1 < d3)
-	{
-	  swap(&x2, &x3);
-	  swap(&y2, &y3);
-	  swap(&d2, &d3);
-	}
-      else
-	{
-	  rotate(&x1, &x3, &x2);
-	  rotate(&y1, &y3, &y2);
-	  rotate(&d1, &d3, &d2);
-	}
-    }
-  else
-    {
-      if (d1 < d3)
-	{
-	  swap(&x1, &x2);
-	  swap(&y1, &y2);
-	  swap(&d1, &d2);
-	}
-      else if (d2 < d3)
-	{
-	  rotate(&x1, &x2, &x3);
-	  rotate(&y1, &y2, &y3);
-	  rotate(&d1, &d2, &d3);
-	}
-      else
-	{
-	  swap(&x1, &x3);
-	  swap(&y1, &y3);
-	  swap(&d1, &d3);
-	}
-    }
-     
-  /* Determine number of vertices inside circle */
-  in1 = d1 < 1.;
-  in2 = d2 < 1.;
-  in3 = d3 < 1.;
+  double a0min, a0max;
 
-  /* Determine which vertices are on the circle */
-  on1 = fabs(d1 - 1.) < 1.e-10;
-  on2 = fabs(d2 - 1.) < 1.e-10;
-  on3 = fabs(d3 - 1.) < 1.e-10;
-
-  if (on3 || in3) /* triangle completely within circle */
-    area = area_triangle(x1, y1, x2, y2, x3, y3);
-
-  else if (in2 || on2)
-    {
-      /* If vertex 1 or 2 are on the edge of the circle, then we use
-       * the dot product to vertex 3 to determine whether an
-       * intersection takes place. */
-      intersect13 = !on1 || (x1*(x3-x1) + y1*(y3-y1) < 0.);
-      intersect23 = !on2 || (x2*(x3-x2) + y2*(y3-y2) < 0.);
-      if (intersect13 && intersect23)
-	{
-	  pt1 = circle_segment_single2(x1, y1, x3, y3);
-	  pt2 = circle_segment_single2(x2, y2, x3, y3);
-	  area = (area_triangle(x1, y1, x2, y2, pt1.x, pt1.y) +
-		  area_triangle(x2, y2, pt1.x, pt1.y, pt2.x, pt2.y) +
-		  area_arc(pt1.x, pt1.y, pt2.x, pt2.y, 1.));
-	}
-      else if (intersect13)
-	{
-	  pt1 = circle_segment_single2(x1, y1, x3, y3);
-	  area = (area_triangle(x1, y1, x2, y2, pt1.x, pt1.y) +
-		  area_arc(x2, y2, pt1.x, pt1.y, 1.));
-	}
-      else if (intersect23)
-	{
-	  pt2 = circle_segment_single2(x2, y2, x3, y3);
-	  area = (area_triangle(x1, y1, x2, y2, pt2.x, pt2.y) +
-		  area_arc(x1, y1, pt2.x, pt2.y, 1.));
-	}
-      else
-	area = area_arc(x1, y1, x2, y2, 1.);
-    }
-  else if (in1)
-    {
-      /* Check for intersections of far side with circle */
-      inter = circle_segment(x2, y2, x3, y3);
-      pt1 = inter.p1;
-      pt2 = inter.p2;
-      pt3 = circle_segment_single2(x1, y1, x2, y2);
-      pt4 = circle_segment_single2(x1, y1, x3, y3);
-
-      if (pt1.x > 1.)  /* indicates no intersection */
-	{
-	  /* check if the pixel vertex (x1, y2) and the origin are on
-	   * different sides of the circle segment. If they are, the
-	   * circle segment spans more than pi radians.
-	   * We use the formula (y-y1) * (x2-x1) > (y2-y1) * (x-x1)
-	   * to determine if (x, y) is on the left of the directed
-	   * line segment from (x1, y1) to (x2, y2) */
-	  if (((0.-pt3.y) * (pt4.x-pt3.x) > (pt4.y-pt3.y) * (0.-pt3.x)) !=
-	      ((y1-pt3.y) * (pt4.x-pt3.x) > (pt4.y-pt3.y) * (x1-pt3.x)))
-	    {
-	      area = (area_triangle(x1, y1, pt3.x, pt3.y, pt4.x, pt4.y) +
-		      PI - area_arc(pt3.x, pt3.y, pt4.x, pt4.y, 1.));
-	    }
-	  else
-	    {
-	      area = (area_triangle(x1, y1, pt3.x, pt3.y, pt4.x, pt4.y) +
-		      area_arc(pt3.x, pt3.y, pt4.x, pt4.y, 1.));
-	    }
-	}
-      else
-	{
-	  /* ensure that pt1 is the point closest to (x2, y2) */
-	  if (((pt2.x-x2)*(pt2.x-x2) + (pt2.y-y2)*(pt2.y-y2)) <
-	      ((pt1.x-x2)*(pt1.x-x2) + (pt1.y-y2)*(pt1.y-y2)))
-	    swap_point(&pt1, &pt2);
-
-	  area = (area_triangle(x1, y1, pt3.x, pt3.y, pt1.x, pt1.y) +
-		  area_triangle(x1, y1, pt1.x, pt1.y, pt2.x, pt2.y) +
-		  area_triangle(x1, y1, pt2.x, pt2.y, pt4.x, pt4.y) +
-		  area_arc(pt1.x, pt1.y, pt3.x, pt3.y, 1.) +
-		  area_arc(pt2.x, pt2.y, pt4.x, pt4.y, 1.));
-	}
-    }
-  else
+  if (xmax <= -e->X || xmin >= e->X)
+    return 0.;
+  if (xmin < -e->X)
+    xmin = -e->X;
+  if (xmax > e->X)
+    xmax = e->X;
+  a0min = a0max = 0.;
+  if (edgeline_outside(lo, xmin) || edgeline_outside(hi, xmin))
+    a0min = (xmin == e->x)? e->a0: shear_a0(e, xmin);
+  if (edgeline_outside(lo, xmax) || edgeline_outside(hi, xmax))
     {
-      inter = circle_segment(x1, y1, x2, y2);
-      pt1 = inter.p1;
-      pt2 = inter.p2;
-      inter = circle_segment(x2, y2, x3, y3);
-      pt3 = inter.p1;
-      pt4 = inter.p2;
-      inter = circle_segment(x3, y3, x1, y1);
-      pt5 = inter.p1;
-      pt6 = inter.p2;
-      if (pt1.x <= 1.)
-	{
-	  xp = 0.5 * (pt1.x + pt2.x);
-	  yp = 0.5 * (pt1.y + pt2.y);
-	  area = (triangle_unitcircle_overlap(x1, y1, x3, y3, xp, yp) +
-		  triangle_unitcircle_overlap(x2, y2, x3, y3, xp, yp));
-	}
-      else if (pt3.x <= 1.)
-	{
-	  xp = 0.5 * (pt3.x + pt4.x);
-	  yp = 0.5 * (pt3.y + pt4.y);
-	  area = (triangle_unitcircle_overlap(x3, y3, x1, y1, xp, yp) +
-		  triangle_unitcircle_overlap(x2, y2, x1, y1, xp, yp));
-	}
-      else if (pt5.x <= 1.)
-	{
-	  xp = 0.5 * (pt5.x + pt6.x);
-	  yp = 0.5 * (pt5.y + pt6.y);
-	  area = (triangle_unitcircle_overlap(x1, y1, x2, y2, xp, yp) +
-		  triangle_unitcircle_overlap(x3, y3, x2, y2, xp, yp));
-	}
-      else  /* no intersections */
-	{
-	  if (in_triangle(0., 0., x1, y1, x2, y2, x3, y3))
-	    return PI;
-	  else
-	    return 0.;
-	}
+      a0max = shear_a0(e, xmax);
+      e->x = xmax;
+      e->a0 = a0max;
     }
-  return area;
-}
-
-/* exact overlap between a rectangle defined by (xmin, ymin, xmax,
-   ymax) and an ellipse with major and minor axes rx and ry
-   respectively and position angle theta. */
-static double ellipoverlap(double xmin, double ymin, double xmax, double ymax,
-			   double a, double b, double theta)
-{
-  double cos_m_theta, sin_m_theta, scale;
-  double x1, y1, x2, y2, x3, y3, x4, y4;
-
-  cos_m_theta = cos(-theta);
-  sin_m_theta = sin(-theta);
-
-  /* scale by which the areas will be shrunk */
-  scale = a * b;
-
-  /* Reproject rectangle to a frame in which ellipse is a unit circle */
-  x1 = (xmin * cos_m_theta - ymin * sin_m_theta) / a;
-  y1 = (xmin * sin_m_theta + ymin * cos_m_theta) / b;
-  x2 = (xmax * cos_m_theta - ymin * sin_m_theta) / a;
-  y2 = (xmax * sin_m_theta + ymin * cos_m_theta) / b;
-  x3 = (xmax * cos_m_theta - ymax * sin_m_theta) / a;
-  y3 = (xmax * sin_m_theta + ymax * cos_m_theta) / b;
-  x4 = (xmin * cos_m_theta - ymax * sin_m_theta) / a;
-  y4 = (xmin * sin_m_theta + ymax * cos_m_theta) / b;
-
-  /* Divide resulting quadrilateral into two triangles and find
-     intersection with unit circle */
-  return scale * (triangle_unitcircle_overlap(x1, y1, x2, y2, x3, y3) +
-		  triangle_unitcircle_overlap(x1, y1, x4, y4, x3, y3));
+  return ((edgeline_prim(e, hi, xmax, a0max) -
+	   edgeline_prim(e, hi, xmin, a0min)) -
+	  (edgeline_prim(e, lo, xmax, a0max) -
+	   edgeline_prim(e, lo, xmin, a0min)));
 }
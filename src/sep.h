@@ -22,6 +22,8 @@
 
 /* datatype codes */
 #define SEP_TBYTE        11  /* 8-bit unsigned byte */
+#define SEP_TUSHORT      20  /* 16-bit unsigned integer */
+#define SEP_TSHORT       21  /* 16-bit signed integer */
 #define SEP_TINT         31  /* native int type */
 #define SEP_TFLOAT       42
 #define SEP_TDOUBLE      82
@@ -35,14 +37,27 @@
 #define SEP_APER_HASMASKED   0x0020
 #define SEP_APER_ALLMASKED   0x0040
 #define SEP_APER_NONPOSITIVE 0x0080
+#define SEP_APER_CIRCLE      0x0100  /* Kron flux measured in a circle */
 
 /* input flags for aperture photometry */
 #define SEP_ERROR_IS_VAR     0x0001
 #define SEP_ERROR_IS_ARRAY   0x0002
 #define SEP_MASK_IGNORE      0x0004
+#define SEP_APER_CACHE       0x0008  /* batches: reuse weights of apertures */
 
 /*--------------------- global background estimation ------------------------*/
 
+typedef int (*sep_readline_func)(void *userdata, int y,
+				 void *line, void *noiseline);
+/* Callback supplying an image line by line to sep_makeback_stream() and
+ * sep_extract_stream(): copy line `y` of the image (w elements of type
+ * dtype) to `line` and, if there is a mask (sep_makeback_stream()) or noise
+ * (sep_extract_stream()) array, line `y` of it (w elements of type mdtype
+ * or ndtype) to `noiseline` (NULL otherwise). Lines are requested once
+ * each, in increasing order. Return 0 on success, or any other value to
+ * abort. */
+
+
 typedef struct
 {
   int w, h;          /* original image width, height */
@@ -82,6 +97,62 @@ int sep_makeback(void *im,            /* image data                          */
  * - fthresh = 0.0
  */
 
+int sep_makeback_parallel(void *im, void *mask, int dtype, int mdtype,
+			  int w, int h, int bw, int bh, float mthresh,
+			  int fw, int fh, float fthresh,
+			  int nthreads,        /* number of threads             */
+			  sepbackmap **bkmap);
+/* Same as sep_makeback(), but computing the statistics of the rows of
+ * background tiles concurrently on `nthreads` threads. The result is
+ * identical to that of sep_makeback(). If `nthreads` is 0 or less, the
+ * OpenMP default number of threads is used. Without OpenMP support, this
+ * is equivalent to sep_makeback().
+ */
+
+int sep_makeback_strided(void *im, void *mask, int dtype, int mdtype,
+			 size_t imstride,     /* bytes between image lines   */
+			 size_t mstride,      /* bytes between mask lines    */
+			 int w, int h, int bw, int bh, float mthresh,
+			 int fw, int fh, float fthresh, int nthreads,
+			 sepbackmap **bkmap);
+/* Same as sep_makeback_parallel(), for image and mask arrays whose lines
+ * are `imstride` and `mstride` bytes apart (such as views of larger
+ * arrays), read in place. A stride of 0 means contiguous lines. Returns
+ * ILLEGAL_STRIDE if a stride is shorter than a line.
+ */
+
+typedef struct sep_backbuilder sep_backbuilder;
+/* State of a background estimation from an image supplied one row of
+ * background tiles at a time. Only one row of tiles is held at a time, so
+ * that images that do not fit in memory can be processed. */
+
+int sep_backbuilder_new(int dtype, int mdtype,
+			int w, int h, int bw, int bh, float mthresh,
+			int fw, int fh, float fthresh,
+			int hasmask,          /* will rows come with a mask?   */
+			sep_backbuilder **bb);
+int sep_backbuilder_addrow(sep_backbuilder *bb,
+			   void *im,          /* next row of tiles             */
+			   void *mask);       /* its mask (NULL if no mask)    */
+int sep_backbuilder_finish(sep_backbuilder *bb, sepbackmap **bkmap);
+void sep_backbuilder_free(sep_backbuilder *bb);
+/* Create a builder for the background of a w x h image, with the
+ * parameters of sep_makeback(), then add each row of tiles, from the top:
+ * `im` (and `mask`) hold lines j*bh to (j+1)*bh-1 of the image (the last
+ * row may be shorter), contiguously. Once all rows are added, finish
+ * returns the background map, identical to that of sep_makeback().
+ * The builder must then still be freed with sep_backbuilder_free(). */
+
+int sep_makeback_stream(sep_readline_func readline, /* supplies the lines */
+			void *userdata,       /* passed to readline            */
+			int dtype, int mdtype,
+			int w, int h, int bw, int bh, float mthresh,
+			int fw, int fh, float fthresh,
+			int hasmask,          /* read a mask with each line?   */
+			sepbackmap **bkmap);
+/* Same as sep_makeback(), but reading the image (and mask) line by line
+ * through `readline`, holding only one row of tiles in memory. */
+
 float sep_globalback(sepbackmap *bkmap);
 float sep_globalrms(sepbackmap *bkmap);
 /* Get the estimate of the global background "mean" or standard deviation */
@@ -106,6 +177,49 @@ int sep_backrmsarray(sepbackmap *bkmap, void *arr, int dtype);
  * The second function subtracts the background from the input array.
  * Arr must be an array of the same size as original image. */
 
+int sep_backarrays_parallel(sepbackmap *bkmap,
+			    void *back,       /* background output (or NULL)   */
+			    void *rms,        /* RMS output (or NULL)          */
+			    int dtype,        /* datatype of back and rms      */
+			    void *sub,        /* array to subtract from (or NULL) */
+			    int sdtype,       /* datatype of sub               */
+			    int nthreads);    /* number of threads             */
+/* Evaluate the background and RMS for the entire image in a single pass
+ * over its lines, writing the background to `back`, the RMS to `rms` and
+ * subtracting the background from `sub` (any of which can be NULL), on
+ * `nthreads` threads. The results are identical to those of the functions
+ * above. If `nthreads` is 0 or less, the OpenMP default number of threads
+ * is used. Without OpenMP support, lines are evaluated one at a time.
+ */
+
+int sep_backwindow(sepbackmap *bkmap,
+		   int xmin, int xmax,   /* pixels xmin <= x < xmax          */
+		   int ymin, int ymax,   /* and ymin <= y < ymax             */
+		   void *back,           /* background output (or NULL)      */
+		   void *rms,            /* RMS output (or NULL)             */
+		   int dtype);           /* datatype of back and rms         */
+/* Evaluate the background and RMS of a window of the image, into arrays of
+ * (xmax-xmin) x (ymax-ymin) elements, with the values of the same pixels
+ * of sep_backarray() and sep_backrmsarray(). The window must be within the
+ * image. */
+
+size_t sep_backmap_size(const sepbackmap *bkmap);
+int sep_backmap_write(const sepbackmap *bkmap, void *buf, size_t size);
+int sep_backmap_read(const void *buf, size_t size, sepbackmap **bkmap);
+int sep_backmap_view(const void *buf, size_t size, sepbackmap *bkmap);
+/* Serialize a background map: its size, the tile grid, the global values
+ * and the nodes of the background and RMS splines, into
+ * sep_backmap_size() bytes of buf (as for writing to a file). The nodes
+ * are stored as they are, so a map read back evaluates exactly as the
+ * original.
+ *
+ * sep_backmap_read() creates a new map (to be freed with sep_freeback())
+ * from a serialized one, written on a machine of either byte order.
+ * sep_backmap_view() instead sets the node arrays of bkmap to point into
+ * buf, such as a memory-mapped file, which must then outlive bkmap and
+ * not be changed; bkmap must not be passed to sep_freeback(). This needs
+ * buf to be aligned for floats and in the byte order of this machine. */
+
 void sep_freeback(sepbackmap *bkmap);
 /* Free memory associated with bkmap */
 
@@ -163,13 +277,254 @@ int sep_extract(void *image,          /* image array                         */
  * 
  */
 
-/* set and get the size of the pixel stack used in extract() */
+typedef struct sep_extract_ctx sep_extract_ctx;
+/* Opaque extraction context holding all working state for one extraction
+ * (pixel-list layout, scan, pixel stack, Lutz and deblending buffers, random
+ * number state). A context may be used by one thread at a time; use one
+ * context per thread to run extractions concurrently.
+ *
+ * Buffers are kept in the context between calls and only reallocated when
+ * the image width, `deblend_nthresh` or the pixel stack size requires it,
+ * so reusing one context for many images avoids most per-call setup. */
+
+int sep_extract_ctx_new(sep_extract_ctx **ctx);
+void sep_extract_ctx_free(sep_extract_ctx *ctx);
+/* Allocate and free an extraction context. */
+
+void sep_extract_ctx_set_nthreads(sep_extract_ctx *ctx, int nthreads);
+/* Deblend the detections found by extractions with this context across
+ * `nthreads` threads (the OpenMP default if 0 or less) rather than one by
+ * one as the scan completes them (the default, nthreads = 1). Detections
+ * are queued during the scan and deblended in batches, largest first; the
+ * objects found are identical and in the same order. With an object
+ * callback, the batches are those completed on each line. Only has an
+ * effect if SEP is built with OpenMP support. */
+
+void sep_extract_ctx_set_strides(sep_extract_ctx *ctx,
+				 size_t imstride, size_t nstride);
+/* Read the lines of the image and noise arrays of later extractions with
+ * this context `imstride` and `nstride` bytes apart rather than
+ * contiguously, for instance to extract from a view of a larger array
+ * without copying it. A stride of 0 (the default) means contiguous lines.
+ * Extractions return ILLEGAL_STRIDE if a stride is shorter than a line;
+ * measurements in sep_extract_measure() need contiguous lines. Has no effect
+ * on sep_extract_stream(). */
+
+int sep_extract_with_ctx(sep_extract_ctx *ctx,
+			 void *image, void *noise, int dtype, int ndtype,
+			 int w, int h, float thresh, int minarea,
+			 float *conv, int convw, int convh,
+			 int deblend_nthresh, double deblend_cont,
+			 int clean_flag, double clean_param,
+			 int use_matched_filter,
+			 sepobj **objects, int *nobj);
+/* Same as sep_extract(), but using the given context for all working state.
+ * `sep_extract()` is equivalent to calling this with a temporary context. */
+
+typedef int (*sep_object_func)(void *userdata, const sepobj *obj);
+/* Callback receiving the objects found by sep_extract_stream(), in the
+ * order sep_extract() would return them. `obj` and its pixel list are only
+ * valid during the call. Return 0 on success, or any other value to abort
+ * the extraction. */
+
+int sep_extract_stream(sep_extract_ctx *ctx,
+		       sep_readline_func readline, /* supplies the lines  */
+		       void *userdata,       /* passed to readline            */
+		       int dtype, int ndtype, int w, int h,
+		       float thresh, int minarea,
+		       float *conv, int convw, int convh,
+		       int deblend_nthresh, double deblend_cont,
+		       int clean_flag, double clean_param,
+		       int use_matched_filter,
+		       sep_object_func emit, /* receives the objects (or NULL) */
+		       void *emitdata,       /* passed to emit                */
+		       sepobj **objects,     /* OUTPUT: object array          */
+		       int *nobj);           /* OUTPUT: number of objects     */
+/* Same as sep_extract_with_ctx(), but reading the image (and noise) line by
+ * line through `readline` instead of from arrays, so that the image need
+ * not be in memory: only as many lines as the filter is high are kept.
+ * Set `ndtype` to 0 if there is no noise array. If `readline` fails, the
+ * extraction stops with status LINE_READ_ERROR (9).
+ *
+ * If `emit` is not NULL, objects are not gathered in an array: each object
+ * is passed to `emit` as soon as it is final, `*objects` is set to NULL and
+ * `*nobj` to the number of objects passed. Without cleaning, objects are
+ * passed as soon as they are complete. With cleaning, an object is held
+ * until the scan is far enough below it that no later object as large as
+ * the largest found so far could clean it, and is only cleaned against the
+ * objects found by then. This gives the same objects as sep_extract()
+ * unless an object larger than all the previous ones cleans an object
+ * passed earlier. If `emit` fails, the extraction stops with status
+ * OBJECT_EMIT_ERROR (10). */
+
+int sep_extract_parallel(void *image, void *noise, int dtype, int ndtype,
+			 int w, int h, float thresh, int minarea,
+			 float *conv, int convw, int convh,
+			 int deblend_nthresh, double deblend_cont,
+			 int clean_flag, double clean_param,
+			 int use_matched_filter,
+			 int nthreads,        /* number of strips/threads        */
+			 sepobj **objects, int *nobj);
+/* Same as sep_extract(), but splitting the image into `nthreads` horizontal
+ * strips that are extracted concurrently. Detections crossing strip
+ * boundaries are joined afterwards; the result is identical to that of
+ * sep_extract(). If `nthreads` is 0 or less, the OpenMP default number of
+ * threads is used. Strips only run concurrently if SEP is built with OpenMP
+ * support.
+ *
+ * Each strip uses its own pixel stack of up to sep_get_extract_pixstack()
+ * pixels. */
+
+#define SEP_MEAS_MAXAPER 16   /* circular apertures of a measurement plan */
+
+#define SEP_MEAS_KRON     0x0001  /* Kron radius & flux                  */
+#define SEP_MEAS_APER     0x0002  /* fluxes in circular apertures        */
+#define SEP_MEAS_FLUXRAD  0x0004  /* radius enclosing a fraction of flux */
+#define SEP_MEAS_WIN      0x0008  /* windowed position                   */
+
+typedef struct
+{
+  int    flags;          /* measurements to make (SEP_MEAS_*)               */
+  double err;            /* error of each pixel if there is no noise array */
+  double gain;           /* counts per data unit (0: no poisson noise)  [0] */
+  int    subpix;         /* subpixel sampling of apertures              [5] */
+  double kron_r;         /* ellipse of the Kron radius (in a, b)        [6] */
+  double kron_fac;       /* ellipse of the Kron flux (in Kron radii)  [2.5] */
+  double kron_rmin;      /* smallest radius of the Kron flux circle  [1.75] */
+  int    naper;          /* number of circular apertures                    */
+  double aper_r[SEP_MEAS_MAXAPER]; /* their radii                           */
+  double fluxfrac;       /* fraction of flux of the flux radius       [0.5] */
+  double win_sig;        /* sigma of the window, or <= 0 for 2/2.35 times
+			    the radius enclosing half the flux          [0] */
+} sepmeasplan;
+
+typedef struct
+{
+  double kronrad;        /* Kron radius (in a, b)                           */
+  short  kronflag;
+  double kronflux, kronfluxerr;  /* flux in Kron ellipse (or circle)        */
+  short  kronfluxflag;   /* aperture flags, or'ed with SEP_APER_CIRCLE     */
+  double flux_aper[SEP_MEAS_MAXAPER], fluxerr_aper[SEP_MEAS_MAXAPER];
+  short  flag_aper[SEP_MEAS_MAXAPER];
+  double fluxrad;        /* radius enclosing fluxfrac of the Kron flux      */
+  short  fluxradflag;
+  double xwin, ywin;     /* windowed position                               */
+  int    winniter;
+  short  winflag;
+} sepmeas;
+
+int sep_extract_measure(sep_extract_ctx *ctx,
+			void *image, void *noise, int dtype, int ndtype,
+			int w, int h, float thresh, int minarea,
+			float *conv, int convw, int convh,
+			int deblend_nthresh, double deblend_cont,
+			int clean_flag, double clean_param,
+			int use_matched_filter,
+			const sepmeasplan *plan, /* measurements to make   */
+			sepobj **objects,     /* OUTPUT: object array          */
+			sepmeas **meas,       /* OUTPUT: their measurements    */
+			int *nobj);           /* OUTPUT: number of objects     */
+/* Same as sep_extract_with_ctx(), also measuring each object right after
+ * it is final, while the image rows it covers were just scanned. The
+ * measurements of objects[i] go to meas[i] (free with free()). They are
+ * those of the aperture functions on `image`, with `noise` (if not NULL)
+ * as the error array and no mask:
+ *
+ * SEP_MEAS_KRON    - sep_kron_radius() within ellipse kron_r of the object
+ *                    and sep_sum_ellipse() within kron_fac times the Kron
+ *                    radius or, if the Kron radius times sqrt(a*b) is below
+ *                    kron_rmin, sep_sum_circle() of radius kron_rmin (with
+ *                    SEP_APER_CIRCLE in kronfluxflag).
+ * SEP_MEAS_APER    - sep_sum_circle() for each radius of aper_r.
+ * SEP_MEAS_FLUXRAD - sep_flux_radius() within kron_r * a of the object,
+ *                    relative to its Kron flux with SEP_MEAS_KRON.
+ * SEP_MEAS_WIN     - sep_windowed() with sigma win_sig, or 2/2.35 times
+ *                    the radius enclosing half the flux as above.
+ *
+ * The objects are those sep_extract() returns. Without cleaning they are
+ * measured as they are found, as by sep_extract_stream() with an object
+ * callback; with cleaning, once the whole image is cleaned. */
+
+void sep_measplan_init(sepmeasplan *plan);
+/* Set all fields of a measurement plan to their defaults in [ ] above, with
+ * no measurements, apertures or pixel error. */
+
+typedef struct
+{
+  int      nobj;                 /* number of objects (length of columns)    */
+  float    *thresh;              /* columns of the fields of sepobj          */
+  int      *npix, *tnpix;
+  int      *xmin, *xmax, *ymin, *ymax;
+  double   *x, *y;
+  double   *x2, *y2, *xy;
+  float    *a, *b, *theta;
+  float    *cxx, *cyy, *cxy;
+  float    *cflux, *flux;
+  float    *cpeak, *peak;
+  int      *xcpeak, *ycpeak;
+  int      *xpeak, *ypeak;
+  short    *flag;
+  int      *pixoff;              /* pixels of object i are pix[pixoff[i]] to
+				    pix[pixoff[i+1]-1] (length nobj+1)       */
+  int      *pix;                 /* pixel indices of all objects             */
+} sepcatalog;
+
+int sep_extract_catalog(sep_extract_ctx *ctx,
+			void *image, void *noise, int dtype, int ndtype,
+			int w, int h, float thresh, int minarea,
+			float *conv, int convw, int convh,
+			int deblend_nthresh, double deblend_cont,
+			int clean_flag, double clean_param,
+			int use_matched_filter,
+			sepcatalog **catalog); /* OUTPUT: catalog of objects */
+/* Same as sep_extract_with_ctx(), but returning the objects as a catalog of
+ * one contiguous array per field (objects in the same order), with the
+ * pixel lists of all objects in one array indexed by `pixoff`. The catalog
+ * must be freed with sep_freecatalog(). */
+
+typedef struct
+{
+  int xmin, xmax;        /* pixels xmin <= x < xmax */
+  int ymin, ymax;        /* and ymin <= y < ymax */
+} sepwindow;
+
+int sep_extract_windows(sep_extract_ctx *ctx,
+			void *image, void *noise, int dtype, int ndtype,
+			int w, int h,
+			size_t imstride,      /* bytes between image lines     */
+			size_t nstride,       /* bytes between noise lines     */
+			const sepwindow *windows, /* regions to extract from   */
+			int nwin,             /* number of windows             */
+			float thresh, int minarea,
+			float *conv, int convw, int convh,
+			int deblend_nthresh, double deblend_cont,
+			int clean_flag, double clean_param,
+			int use_matched_filter,
+			sepobj **objects,     /* OUTPUT: object array          */
+			int *winoff,          /* OUTPUT: window offsets
+						 (length nwin+1)               */
+			int *nobj);           /* OUTPUT: number of objects     */
+/* Extract sources from each window of a w x h image in turn, as
+ * sep_extract_with_ctx() would from a copy of the window, reading it in
+ * place (with lines `imstride` and `nstride` bytes apart, or contiguous if
+ * 0) and reusing the buffers of `ctx` from one window to the next.
+ * Windows are clipped to the image. The objects of window k are
+ * objects[winoff[k]] to objects[winoff[k+1]-1], with their positions and
+ * pixel indices in the image; SEP_OBJ_TRUNC flags objects touching the
+ * edges of their window. The strides set on `ctx` are not used. */
+
+/* set and get the maximum size in pixels of the pixel stack used in
+ * extract(). The stack starts small and grows as needed up to this size;
+ * extraction fails with PIXSTACK_FULL beyond it. */
 void sep_set_extract_pixstack(size_t val);
 size_t sep_get_extract_pixstack(void);
 
 void sep_freeobjarray(sepobj *objects, int nobj);
 /* free memory associated with an sepobj array, including pixel lists */
 
+void sep_freecatalog(sepcatalog *catalog);
+/* free memory associated with a catalog, including its columns */
+
 /*-------------------------- aperture photometry ----------------------------*/
 
 int sep_sum_circle(void *data,        /* data array */
@@ -227,6 +582,89 @@ int sep_sum_ellipann(void *data, void *error, void *mask,
 		     double rin, double rout, int subpix,
 		     double *sum, double *sumerr, double *area, short *flag);
 
+int sep_sum_circle_batch(void *data, void *error, void *mask,
+			 int dtype, int edtype, int mdtype, int w, int h,
+			 double maskthresh, double gain, short inflag,
+			 int n, const double *x, const double *y,
+			 const double *r, int nr, int subpix, int nthreads,
+			 double *sum, double *sumerr, double *area,
+			 short *flag);
+
+int sep_sum_ellipse_batch(void *data, void *error, void *mask,
+			  int dtype, int edtype, int mdtype, int w, int h,
+			  double maskthresh, double gain, short inflag,
+			  int n, const double *x, const double *y,
+			  const double *a, const double *b, const double *theta,
+			  const double *r, int nr, int subpix, int nthreads,
+			  double *sum, double *sumerr, double *area,
+			  short *flag);
+
+int sep_sum_circann_batch(void *data, void *error, void *mask,
+			  int dtype, int edtype, int mdtype, int w, int h,
+			  double maskthresh, double gain, short inflag,
+			  int n, const double *x, const double *y,
+			  const double *rin, const double *rout, int nr,
+			  int subpix, int nthreads,
+			  double *sum, double *sumerr, double *area,
+			  short *flag);
+
+int sep_sum_ellipann_batch(void *data, void *error, void *mask,
+			   int dtype, int edtype, int mdtype, int w, int h,
+			   double maskthresh, double gain, short inflag,
+			   int n, const double *x, const double *y,
+			   const double *a, const double *b, const double *theta,
+			   const double *rin, const double *rout, int nr,
+			   int subpix, int nthreads,
+			   double *sum, double *sumerr, double *area,
+			   short *flag);
+/* Same as the functions above for n sources centred on (x[i], y[i]), each
+ * with nr apertures: radii r[i*nr+k] (or rin[i*nr+k], rout[i*nr+k]) and,
+ * for ellipses, shape a[i], b[i], theta[i]. Results for aperture k of
+ * source i go to sum[i*nr+k], sumerr[i*nr+k], area[i*nr+k] (area can be
+ * NULL) and flag[i*nr+k].
+ *
+ * Array converters are looked up once for the batch and sources are summed
+ * in order of position, using `nthreads` threads when built with OpenMP
+ * (all available threads if `nthreads` <= 0). Results do not depend on the
+ * number of threads. If some apertures have invalid parameters, all others
+ * are still summed and the status of the first failing one is returned.
+ *
+ * With SEP_APER_CACHE in `inflag`, centres are rounded to the nearest 1/16
+ * pixel and the pixel weights of each aperture shape and centre offset
+ * within the pixel are computed once and reused, which is much faster when
+ * many sources share a few radii (or shapes). Results are then exactly
+ * those of the functions above at the rounded centres. Moving an aperture
+ * by at most 1/32 pixel along each axis changes its sum by at most
+ * 0.045 * P * max|pixel value| along its edge, where P is the perimeter
+ * (2*pi*r for circles; that of both edges for annuli). */
+
+int sep_sum_ellipse_multi(void *data, void *error, void *mask,
+			  int dtype, int edtype, int mdtype, int w, int h,
+			  double maskthresh, double gain, short inflag,
+			  int n, const double *x, const double *y,
+			  const double *a, const double *b, const double *theta,
+			  const double *r, int nr,
+			  const double *rin, const double *rout, int nann,
+			  const double *rkron, int subpix, int nthreads,
+			  double *sum, double *sumerr, double *area, short *flag,
+			  double *kronrad, short *kronflag);
+/* Sum nr concentric ellipses and nann concentric elliptical annuli of each
+ * of n sources, and optionally their Kron radius, in a single pass over
+ * the pixels they cover. Source i has shape a[i], b[i], theta[i], radii
+ * r[i*nr+k] and annuli rin[i*nann+k], rout[i*nann+k] (each in units of a
+ * and b, as in sep_sum_ellipse). With m = nr + nann, results for source i
+ * go to sum[i*m+k], sumerr[i*m+k], area[i*m+k] (area can be NULL) and
+ * flag[i*m+k], with the ellipses first (k < nr) and the annuli next.
+ * Each is exactly the result of sep_sum_ellipse() or sep_sum_ellipann().
+ * Circles are ellipses with a = b = 1 and theta = 0 (in exact mode, they
+ * then differ from sep_sum_circle() only by rounding).
+ *
+ * If rkron is not NULL, kronrad[i] and kronflag[i] are also set to the
+ * results of sep_kron_radius() within ellipse rkron[i] of source i.
+ *
+ * Sources are processed as in the batch functions above (but without
+ * SEP_APER_CACHE). */
+
 
 int sep_sum_circann_multi(void *data, void *error, void *mask,
 			  int dtype, int edtype, int mdtype, int w, int h,
@@ -309,6 +747,23 @@ int sep_windowed(void *data, void *error, void *mask,
  * niter      : number of iterations used.
  */
 
+int sep_windowed_batch(void *data, void *error, void *mask,
+		       int dtype, int edtype, int mdtype, int w, int h,
+		       double maskthresh, double gain, short inflag,
+		       int n, const double *x, const double *y,
+		       const double *sig, int subpix, int nthreads,
+		       double *xout, double *yout, int *niter, short *flag);
+/* Same as sep_windowed() for n sources starting at (x[i], y[i]) with sigma
+ * sig[i], results going to xout[i], yout[i], niter[i] and flag[i].
+ *
+ * Sources are iterated in order of position, using `nthreads` threads when
+ * built with OpenMP (all available threads if `nthreads` <= 0); the pixels
+ * around a source are read once for all its iterations. Results are the
+ * same as those of sep_windowed(). If a source has invalid parameters, the
+ * status of the first such source is returned and its outputs are left
+ * unset; all others are still computed.
+ */
+
 
 void sep_set_ellipse(unsigned char *arr, int w, int h,
 		     double x, double y, double cxx, double cyy, double cxy,
@@ -336,3 +791,43 @@ void sep_get_errmsg(int status, char *errtext);
 void sep_get_errdetail(char *errtext);
 /* Return a longer error message with more specifics about the problem.
    The message may be up to 512 characters */
+
+/*-------------------------- timing & counters ------------------------------*/
+
+typedef struct
+{
+  /* wall time in seconds spent in each stage, summed over threads; the time
+   * of a stage includes that of the stages listed under it */
+  double t_extract;      /* extraction                                      */
+  double t_filter;       /*   filtering the image lines                     */
+  double t_deblend;      /*   deblending detections                         */
+  double t_lutz;         /*     sub-scans of the detections                 */
+  double t_analyse;      /*   analysing final objects                       */
+  double t_clean;        /*   cleaning                                      */
+  double t_convert;      /*   converting objects to the output              */
+  double t_back;         /* background estimation                           */
+  double t_backstat;     /*   clipped statistics of the tiles               */
+  double t_backhisto;    /*   histograms of the tiles                       */
+  double t_backguess;    /*   background & rms of the tiles                 */
+  double t_backfilter;   /*   median filtering of the map                   */
+  double t_backspline;   /*   spline coefficients of the map                */
+  double t_backeval;     /* evaluating and subtracting the background       */
+  double t_aper;         /* aperture sums                                   */
+
+  /* counters */
+  size_t npix;           /* image pixels scanned in extractions             */
+  size_t ndetect;        /* detections (before deblending)                  */
+  size_t nlutz;          /* sub-scans in deblending                         */
+  size_t pixstack_max;   /* most pixels used in the pixel stack at once     */
+  size_t nobj;           /* objects found (before cleaning)                 */
+  size_t ncleaned;       /* objects removed by cleaning                     */
+  size_t nbacktile;      /* background tiles                                */
+  size_t naper;          /* apertures summed                                */
+} sepstats;
+
+int sep_get_stats(sepstats *stats);
+void sep_reset_stats(void);
+/* Get and reset the time spent in each stage and the counters of all calls
+ * since the last reset, in all threads. They are only kept if SEP is built
+ * with SEP_STATS defined: sep_get_stats() returns 1 if so, and otherwise
+ * 0 with all of `stats` set to zero. */
@@ -29,6 +29,12 @@
 #define ILLEGAL_APER_PARAMS 6
 #define DEBLEND_OVERFLOW    7
 #define LINE_NOT_IN_BUF     8
+#define LINE_READ_ERROR     9
+#define OBJECT_EMIT_ERROR   10
+#define ILLEGAL_BACK_ROW    11
+#define ILLEGAL_STRIDE      12
+#define ILLEGAL_BACKMAP     13
+#define ILLEGAL_WINDOW      14
 
 #define	BIG 1e+30  /* a huge number (< biggest value a float can store) */
 #define	PI  3.1415926535898
@@ -38,6 +44,51 @@ typedef	int	      LONG;
 typedef	unsigned int  ULONG;
 typedef	unsigned char BYTE;    /* a byte */
 
+/* thread-local storage qualifier */
+#if defined(_MSC_VER)
+#define SEP_TLS __declspec(thread)
+#else
+#define SEP_TLS __thread
+#endif
+
+/* index of the calling thread in an OpenMP parallel region */
+#ifdef _OPENMP
+#include <omp.h>
+#define SEP_THREAD_NUM() omp_get_thread_num()
+#else
+#define SEP_THREAD_NUM() 0
+#endif
+
+/* timers and counters of sep_get_stats(), only kept with SEP_STATS:
+ * STATS_DECL(t) declares timer t (last of the declarations of a block),
+ * STATS_START(t) starts it and STATS_TIME(field, t) adds the time since to
+ * a field. Updates are atomic, so that they can be made by any thread. */
+#ifdef SEP_STATS
+#ifdef _OPENMP
+#define STATS_ATOMIC _Pragma("omp atomic")
+#define STATS_CRITICAL _Pragma("omp critical (sep_stats)")
+#else
+#define STATS_ATOMIC
+#define STATS_CRITICAL
+#endif
+#define STATS_DECL(t)        double t = 0.0
+#define STATS_START(t)       ((t) = stats_now())
+#define STATS_TIME(field, t)					\
+  do { double dt_ = stats_now() - (t);				\
+    STATS_ATOMIC stats_sum.field += dt_; } while (0)
+#define STATS_ADD(field, n)					\
+  do { size_t n_ = (n); STATS_ATOMIC stats_sum.field += n_; } while (0)
+#define STATS_MAX(field, n)					\
+  do { size_t n_ = (n); STATS_CRITICAL				\
+    { if (n_ > stats_sum.field) stats_sum.field = n_; } } while (0)
+#else
+#define STATS_DECL(t)
+#define STATS_START(t)       do {} while (0)
+#define STATS_TIME(field, t) do {} while (0)
+#define STATS_ADD(field, n)  do {} while (0)
+#define STATS_MAX(field, n)  do {} while (0)
+#endif
+
 /* keep these synchronized */
 typedef float         PIXTYPE;    /* type used inside of functions */
 #define PIXDTYPE      SEP_TFLOAT  /* dtype code corresponding to PIXTYPE */
@@ -77,6 +128,11 @@ typedef void (*array_writer)(float *ptr, int n, void *target);
 float fqmedian(float *ra, int n);
 void put_errdetail(char *errtext);
 
+#ifdef SEP_STATS
+extern sepstats stats_sum;
+double stats_now(void);
+#endif
+
 int get_converter(int dtype, converter *f, int *size);
 int get_array_converter(int dtype, array_converter *f, int *size);
 int get_array_writer(int dtype, array_writer *f, int *size);
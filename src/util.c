@@ -19,13 +19,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef SEP_STATS
+#include <time.h>
+#endif
 #include "sep.h"
 #include "sepcore.h"
 
 #define DETAILSIZE 512
 
 char *sep_version_string = "0.5.0";
-static char _errdetail_buffer[DETAILSIZE] = "";
+static SEP_TLS char _errdetail_buffer[DETAILSIZE] = "";
 
 /****************************************************************************/
 /* data type conversion mechanics for runtime type conversion */
@@ -45,6 +48,21 @@ PIXTYPE convert_int(void *ptr)
   return *(int *)ptr;
 }
 
+PIXTYPE convert_byt(void *ptr)
+{
+  return *(BYTE *)ptr;
+}
+
+PIXTYPE convert_sht(void *ptr)
+{
+  return *(short *)ptr;
+}
+
+PIXTYPE convert_ush(void *ptr)
+{
+  return *(unsigned short *)ptr;
+}
+
 /* return the correct converter depending on the datatype code */
 int get_converter(int dtype, converter *f, int *size)
 {
@@ -55,6 +73,11 @@ int get_converter(int dtype, converter *f, int *size)
       *f = convert_flt;
       *size = sizeof(float);
     }
+  else if (dtype == SEP_TBYTE)
+    {
+      *f = convert_byt;
+      *size = sizeof(BYTE);
+    }
   else if (dtype == SEP_TINT)
     {
       *f = convert_int;
@@ -65,6 +88,16 @@ int get_converter(int dtype, converter *f, int *size)
       *f = convert_dbl;
       *size = sizeof(double);
     }
+  else if (dtype == SEP_TSHORT)
+    {
+      *f = convert_sht;
+      *size = sizeof(short);
+    }
+  else if (dtype == SEP_TUSHORT)
+    {
+      *f = convert_ush;
+      *size = sizeof(unsigned short);
+    }
   else
     {
       *f = NULL;
@@ -107,6 +140,22 @@ void convert_array_byt(void *ptr, int n, PIXTYPE *target)
     target[i] = *source;
 }
 
+void convert_array_sht(void *ptr, int n, PIXTYPE *target)
+{
+  short *source = (short *)ptr;
+  int i;
+  for (i=0; i<n; i++, source++)
+    target[i] = *source;
+}
+
+void convert_array_ush(void *ptr, int n, PIXTYPE *target)
+{
+  unsigned short *source = (unsigned short *)ptr;
+  int i;
+  for (i=0; i<n; i++, source++)
+    target[i] = *source;
+}
+
 int get_array_converter(int dtype, array_converter *f, int *size)
 {
   int status = RETURN_OK;
@@ -131,6 +180,16 @@ int get_array_converter(int dtype, array_converter *f, int *size)
       *f = convert_array_dbl;
       *size = sizeof(double);
     }
+  else if (dtype == SEP_TSHORT)
+    {
+      *f = convert_array_sht;
+      *size = sizeof(short);
+    }
+  else if (dtype == SEP_TUSHORT)
+    {
+      *f = convert_array_ush;
+      *size = sizeof(unsigned short);
+    }
   else
     {
       *f = NULL;
@@ -280,6 +339,24 @@ void sep_get_errmsg(int status, char *errtext)
     case LINE_NOT_IN_BUF:
       strcpy(errtext, "array line out of buffer");
       break;
+    case LINE_READ_ERROR:
+      strcpy(errtext, "error reading image line");
+      break;
+    case OBJECT_EMIT_ERROR:
+      strcpy(errtext, "error passing on object");
+      break;
+    case ILLEGAL_BACK_ROW:
+      strcpy(errtext, "background box rows missing or in excess");
+      break;
+    case ILLEGAL_STRIDE:
+      strcpy(errtext, "line stride shorter than a line of the array");
+      break;
+    case ILLEGAL_BACKMAP:
+      strcpy(errtext, "invalid or truncated serialized background map");
+      break;
+    case ILLEGAL_WINDOW:
+      strcpy(errtext, "window not within the image");
+      break;
     default:
        strcpy(errtext, "unknown error status");
        break;
@@ -298,6 +375,51 @@ void put_errdetail(char *errtext)
 
 }
 
+/*****************************************************************************/
+/* Timing & counters */
+
+#ifdef SEP_STATS
+sepstats stats_sum;
+
+/* wall clock time in seconds */
+double stats_now(void)
+{
+#if defined(_OPENMP)
+  return omp_get_wtime();
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+#endif
+
+int sep_get_stats(sepstats *stats)
+{
+#ifdef SEP_STATS
+#ifdef _OPENMP
+#pragma omp critical (sep_stats)
+#endif
+  *stats = stats_sum;
+  return 1;
+#else
+  memset(stats, 0, sizeof(sepstats));
+  return 0;
+#endif
+}
+
+void sep_reset_stats(void)
+{
+#ifdef SEP_STATS
+#ifdef _OPENMP
+#pragma omp critical (sep_stats)
+#endif
+  memset(&stats_sum, 0, sizeof(sepstats));
+#endif
+}
+
 /*****************************************************************************/
 /* Array median */
 
@@ -3,6 +3,7 @@ from __future__ import print_function, division
 # unicode_literals doesn't play well with numpy dtype field names
 
 import os
+import warnings
 import pytest
 import numpy as np
 from numpy.testing import assert_allclose, assert_equal, assert_approx_equal
@@ -35,7 +36,8 @@ IMAGECAT_DTYPE = [('number', np.int64),
                   ('fluxerr_auto', np.float64),
                   ('flux_radius', np.float64, (3,)),
                   ('flags', np.int64)]
-SUPPORTED_IMAGE_DTYPES = [np.float64, np.float32, np.int32]
+SUPPORTED_IMAGE_DTYPES = [np.float64, np.float32, np.int32, np.int16,
+                          np.uint16]
 
 def assert_allclose_structured(x, y):
     """Assert that two structured arrays are close.
@@ -172,6 +174,59 @@ def test_masked_background():
     assert_allclose(sky.back(), 0.1 * np.ones((6, 6)))
 
 
+def test_background_16bit_view():
+    """Background of a 16-bit integer view of a larger array is the same as
+    that of a float copy."""
+
+    rng = np.random.RandomState(0)
+    parent = rng.poisson(100., (130, 150)).astype(np.uint16)
+    view = parent[5:125, 10:140]
+    assert not view.flags["C_CONTIGUOUS"]
+
+    ref = sep.Background(view.astype(np.float32), bw=32, bh=32)
+    for dt in (np.uint16, np.int16):
+        bkg = sep.Background(view.astype(dt), bw=32, bh=32)
+        assert_equal(bkg.back(), ref.back())
+    bkg = sep.Background(view, bw=32, bh=32)
+    assert bkg.back().dtype == np.float32
+    assert_equal(bkg.back(), ref.back())
+    assert_equal(bkg.rms(), ref.rms())
+
+    # columns must be adjacent
+    with pytest.raises(ValueError):
+        sep.Background(parent[:, ::2])
+
+
+def test_background_serialize():
+    """A background map loaded from its serialized form, or a window of it,
+    evaluates as the original."""
+
+    import pickle
+
+    data = np.random.RandomState(0).normal(100., 5., (130, 150))
+    bkg = sep.Background(data, bw=32, bh=24)
+    buf = bkg.tobytes()
+    assert len(buf) < data.nbytes // 100
+
+    bkg2 = sep.Background.frombytes(buf, dtype=np.float64)
+    assert bkg2.globalback == bkg.globalback
+    assert bkg2.globalrms == bkg.globalrms
+    assert_equal(bkg2.back(), bkg.back())
+    assert_equal(bkg2.rms(), bkg.rms())
+
+    bkg3 = pickle.loads(pickle.dumps(bkg))
+    assert_equal(bkg3.back(), bkg.back())
+
+    back, rms = bkg2.window(40, 97, 10, 31)
+    assert_equal(back, bkg.back()[10:31, 40:97])
+    assert_equal(rms, bkg.rms()[10:31, 40:97])
+
+    with pytest.raises(ValueError):
+        bkg2.window(0, 151, 0, 10)
+    with pytest.raises(Exception):
+        sep.Background.frombytes(buf[:-1])
+
+
 # -----------------------------------------------------------------------------
 # Extract
 
@@ -199,6 +254,44 @@ def test_extract_with_noise_array():
     objects2 = sep.extract(data, 1.5, err=noise, conv=None)
     assert_equal(objects, objects2)
 
+def test_extract_view():
+    """Extraction from a view of a larger array matches that from a copy."""
+
+    image = np.zeros((40, 50), dtype=np.int16)
+    image[10:13, 10:13] = 10
+    image[25:28, 30:33] = 20
+    image[:, 45:] = 100  # outside of the view
+
+    view = image[:, :40]
+    objects = sep.extract(view, 5.)
+    objects2 = sep.extract(np.ascontiguousarray(view), 5.)
+    assert len(objects) == 2
+    assert_equal(objects, objects2)
+
+def test_nthreads():
+    """Results do not depend on the number of threads."""
+
+    data = np.random.RandomState(0).normal(size=(100, 120))
+    data[20:25, 30:35] += 20.
+    data[60:70, 80:85] += 40.
+
+    bkg = sep.Background(data, bw=32, bh=32)
+    bkg4 = sep.Background(data, bw=32, bh=32, nthreads=4)
+    assert_equal(bkg.back(), bkg4.back(nthreads=4))
+    assert_equal(bkg.rms(), bkg4.rms(nthreads=4))
+
+    objects = sep.extract(data, 3.)
+    objects4 = sep.extract(data, 3., nthreads=4)
+    assert_equal(objects, objects4)
+
+    x, y = objects['x'], objects['y']
+    assert_equal(sep.sum_circle(data, x, y, 3.),
+                 sep.sum_circle(data, x, y, 3., nthreads=4))
+    assert_equal(sep.sum_ellipann(data, x, y, 1., 1., 0., 3., 5.),
+                 sep.sum_ellipann(data, x, y, 1., 1., 0., 3., 5., nthreads=4))
+    assert_equal(sep.winpos(data, x, y, 1.),
+                 sep.winpos(data, x, y, 1., nthreads=4))
+
 def test_extract_with_noise_convolution():
     """Test extraction when there is both noise and convolution.
 
@@ -273,6 +366,20 @@ def test_apertures_small_ellipse_exact():
     flux, fluxerr, flag = sep.sum_ellipse(data, x, x, r, r, 0., subpix=0)
     assert_allclose(flux, np.pi*r**2, rtol=rtol)
 
+def test_apertures_small_centered_exact():
+    """Regression test for small apertures centered on a pixel being
+    counted as covering the whole pixel."""
+
+    data = np.ones(data_shape)
+    xc = np.array([10., 20.])
+    for r in [0.05, 0.3, 0.7]:
+        rtol = 1.e-10
+        flux, fluxerr, flag = sep.sum_circle(data, xc, xc, r, subpix=0)
+        assert_allclose(flux, np.pi*r**2, rtol=rtol)
+        flux, fluxerr, flag = sep.sum_ellipse(data, xc, xc, 1., 0.5, 0.3,
+                                              r=r, subpix=0)
+        assert_allclose(flux, np.pi*0.5*r**2, rtol=rtol)
+
 def test_apertures_all():
     """Test that aperture subpixel sampling works"""
 
@@ -297,6 +404,95 @@ def test_apertures_all():
         assert_allclose(flux, flux_ref, rtol=rtol)
 
 
+def test_apertures_broadcast():
+    """Test that apertures summed in one call (several radii per source)
+    match apertures summed one at a time."""
+
+    data = np.random.rand(*data_shape)
+    r = np.array([1.5, 3., 4.5])
+
+    flux, fluxerr, flag = sep.sum_circle(data, x[:, None], y[:, None], r,
+                                         err=1.0, bkgann=(6., 8.))
+    assert flux.shape == (naper, len(r))
+    for i in range(naper):
+        for j in range(len(r)):
+            f, fe, fl = sep.sum_circle(data, x[i], y[i], r[j], err=1.0,
+                                       bkgann=(6., 8.))
+            assert f == flux[i, j] and fe == fluxerr[i, j]
+            assert fl == flag[i, j]
+
+    flux, fluxerr, flag = sep.sum_ellipse(data, x[:, None], y[:, None],
+                                          2., 1., 0.5, r)
+    f, fe, fl = sep.sum_ellipse(data, x[3], y[3], 2., 1., 0.5, r[2])
+    assert f == flux[3, 2] and fe == fluxerr[3, 2]
+
+    flux, fluxerr, flag = sep.sum_circle(data, [], [], 3.)
+    assert flux.shape == (0,)
+
+
+def test_apertures_readonly():
+    """Test that read-only coordinate and radius arrays are accepted, and
+    give the same results as writable ones without warnings."""
+
+    data = np.random.rand(*data_shape)
+    mask = np.zeros(data_shape, dtype=np.bool_)
+    xr, yr = x.copy(), y.copy()
+    r = 3. * np.ones(naper)
+    a = 2. * np.ones(naper)
+    b = np.ones(naper)
+    theta = 0.5 * np.ones(naper)
+    for arr in (xr, yr, r, a, b, theta):
+        arr.flags.writeable = False
+
+    with warnings.catch_warnings():
+        warnings.simplefilter("error")
+        flux1 = sep.sum_circle(data, xr, yr, r, bkgann=(6., 8.))
+        flux2 = sep.sum_circle(data, x, y, 3., bkgann=(6., 8.))
+        assert_equal(flux1, flux2)
+        flux1 = sep.sum_circann(data, xr, yr, r, 2.*r)
+        flux2 = sep.sum_circann(data, x, y, 3., 6.)
+        assert_equal(flux1, flux2)
+        flux1 = sep.sum_ellipse(data, xr, yr, a, b, theta, r,
+                                bkgann=(4., 6.))
+        flux2 = sep.sum_ellipse(data, x, y, 2., 1., 0.5, 3., bkgann=(4., 6.))
+        assert_equal(flux1, flux2)
+        flux1 = sep.sum_ellipann(data, xr, yr, a, b, theta, r, 2.*r)
+        flux2 = sep.sum_ellipann(data, x, y, 2., 1., 0.5, 3., 6.)
+        assert_equal(flux1, flux2)
+        kr1 = sep.kron_radius(data, xr, yr, a, b, theta, r)
+        kr2 = sep.kron_radius(data, x, y, 2., 1., 0.5, 3.)
+        assert_equal(kr1, kr2)
+        pos1 = sep.winpos(data, xr, yr, b)
+        pos2 = sep.winpos(data, x, y, 1.)
+        assert_equal(pos1, pos2)
+        sep.mask_ellipse(mask, xr, yr, a, b, theta, r)
+        assert mask.any()
+
+        # broadcast against a read-only array of another shape
+        flux1 = sep.sum_circle(data, xr[:, None], yr[:, None],
+                               r[:, None] * [1., 2.])
+        flux2 = sep.sum_circle(data, x[:, None], y[:, None], [3., 6.])
+        assert_equal(flux1, flux2)
+
+
+def test_apertures_bool_mask():
+    """Test that a boolean mask gives the same sums as a float mask."""
+
+    data = np.random.rand(*data_shape).astype(np.float32)
+    mask = np.zeros(data_shape, dtype=np.bool_)
+    mask[::7, ::5] = True
+
+    for dt in (np.float32, np.float64):
+        d = data.astype(dt)
+        flux1, fluxerr1, flag1 = sep.sum_circle(d, x, y, 3., err=1.0,
+                                                mask=mask)
+        flux2, fluxerr2, flag2 = sep.sum_circle(d, x, y, 3., err=1.0,
+                                                mask=mask.astype(dt))
+        assert_equal(flux1, flux2)
+        assert_equal(fluxerr1, fluxerr2)
+        assert_equal(flag1, flag2)
+
+
 
 def test_apertures_exact():
     """Test area as measured by exact aperture modes on array of ones"""
@@ -413,3 +609,17 @@ def test_set_pixstack():
     sep.set_extract_pixstack(new)
     assert new == sep.get_extract_pixstack()
     sep.set_extract_pixstack(old)
+
+
+def test_stats():
+    """Stage timings & counters are either disabled or count extractions."""
+    sep.reset_stats()
+    data = np.ones((20, 20), dtype=np.float64)
+    data[8:12, 8:12] = 10.
+    objects = sep.extract(data, 5.)
+    stats = sep.get_stats()
+    if stats is not None:
+        assert stats['npix'] == data.size
+        assert stats['nobj'] >= len(objects) > 0
+        sep.reset_stats()
+        assert sep.get_stats()['npix'] == 0